@@ -2,11 +2,142 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>   // getopt()
 
-#include <unistd.h>   // sleep()
+#include <vector>
 
-int main()
+// time-lapse contact sheet: every interval one frame is scaled straight into
+// its tile of a single preallocated sheet, a full sheet is written as JPEG
+// and the next one starts over the same buffer
+
+static volatile sig_atomic_t g_quit = 0;
+
+static void on_signal(int)
+{
+    g_quit = 1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [-c cols] [-r rows] [-i interval_ms] [-t WxH] [-q quality] [-n sheets] [-o dir]\n", name);
+    fprintf(stderr, "\t-c, -r : grid size, default 3x3\n");
+    fprintf(stderr, "\t-i : time between frames in ms, default 1000\n");
+    fprintf(stderr, "\t-t : tile size, default the capture size 320x240\n");
+    fprintf(stderr, "\t-q : JPEG quality, default 90\n");
+    fprintf(stderr, "\t-n : stop after this many sheets, default 0 = run until killed\n");
+    fprintf(stderr, "\t-o : output directory, sheets are written as sheet_<date>_<time>_<n>.jpg, default .\n");
+}
+
+static void timespec_add_ms(struct timespec* ts, long ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// encode, then rename so a reader never sees half a file; seq keeps sheets
+// finished within the same second from replacing each other
+static int write_sheet(const cv::Mat& sheet, const char* dir, int quality, int seq)
+{
+    std::vector<unsigned char> jpeg;
+    std::vector<int> params;
+    params.push_back(cv::IMWRITE_JPEG_QUALITY);
+    params.push_back(quality);
+    if (!cv::imencode(".jpg", sheet, jpeg, params))
+    {
+        fprintf(stderr, "jpeg encode failed\n");
+        return -1;
+    }
+
+    char stamp[32];
+    char path[256];
+    char tmp[272];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &tm);
+    snprintf(path, sizeof(path), "%s/sheet_%s_%04d.jpg", dir, stamp, seq);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "open %s failed: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    size_t written = fwrite(jpeg.data(), 1, jpeg.size(), fp);
+    fclose(fp);
+    if (written != jpeg.size() || rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "write %s failed: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    fprintf(stderr, "%s: %zu bytes\n", path, jpeg.size());
+    return 0;
+}
+
+int main(int argc, char** argv)
 {
+    int cols = 3;
+    int rows = 3;
+    long interval_ms = 1000;
+    int tw = 0;
+    int th = 0;
+    int quality = 90;
+    int max_sheets = 0;
+    const char* dir = ".";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:i:t:q:n:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            cols = atoi(optarg);
+            break;
+        case 'r':
+            rows = atoi(optarg);
+            break;
+        case 'i':
+            interval_ms = atol(optarg);
+            break;
+        case 't':
+            if (sscanf(optarg, "%dx%d", &tw, &th) != 2)
+                tw = th = 0;
+            break;
+        case 'q':
+            quality = atoi(optarg);
+            break;
+        case 'n':
+            max_sheets = atoi(optarg);
+            break;
+        case 'o':
+            dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 0;
+        }
+    }
+    if (cols < 1 || rows < 1 || interval_ms < 0)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
     cv::VideoCapture cap;
     cap.set(cv::CAP_PROP_FRAME_WIDTH, 320);
     cap.set(cv::CAP_PROP_FRAME_HEIGHT, 240);
@@ -14,33 +145,72 @@ int main()
 
     const int w = cap.get(cv::CAP_PROP_FRAME_WIDTH);
     const int h = cap.get(cv::CAP_PROP_FRAME_HEIGHT);
-    fprintf(stderr, "%d x %d\n", w, h);
-
-    cv::Mat bgr[9];
-    for (int i = 0; i < 9; i++)
+    if (tw <= 0 || th <= 0)
     {
-        cap >> bgr[i];
-
-        sleep(1);
+        tw = w;
+        th = h;
     }
+    fprintf(stderr, "%d x %d -> %dx%d tiles of %d x %d every %ld ms\n", w, h, cols, rows, tw, th, interval_ms);
 
-    cap.release();
+    // the only image memory besides the capture buffer
+    cv::Mat sheet(th * rows, tw * cols, CV_8UC3, cv::Scalar(0, 0, 0));
+    cv::Mat frame;
 
-    // combine into big image
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    int tile = 0;
+    int sheets = 0;
+    while (!g_quit)
     {
-        cv::Mat out(h * 3, w * 3, CV_8UC3);
-        bgr[0].copyTo(out(cv::Rect(0, 0, w, h)));
-        bgr[1].copyTo(out(cv::Rect(w, 0, w, h)));
-        bgr[2].copyTo(out(cv::Rect(w * 2, 0, w, h)));
-        bgr[3].copyTo(out(cv::Rect(0, h, w, h)));
-        bgr[4].copyTo(out(cv::Rect(w, h, w, h)));
-        bgr[5].copyTo(out(cv::Rect(w * 2, h, w, h)));
-        bgr[6].copyTo(out(cv::Rect(0, h * 2, w, h)));
-        bgr[7].copyTo(out(cv::Rect(w, h * 2, w, h)));
-        bgr[8].copyTo(out(cv::Rect(w * 2, h * 2, w, h)));
+        cap >> frame;
+        if (frame.empty())
+        {
+            fprintf(stderr, "capture failed\n");
+            break;
+        }
+
+        // resize writes into the ROI header, no intermediate frame
+        cv::Mat roi = sheet(cv::Rect((tile % cols) * tw, (tile / cols) * th, tw, th));
+        if (frame.cols == tw && frame.rows == th)
+            frame.copyTo(roi);
+        else
+            cv::resize(frame, roi, roi.size(), 0, 0, cv::INTER_AREA);
+
+        char stamp[16];
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+        cv::putText(roi, stamp, cv::Point(4, th - 6), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 255, 255), 1);
 
-        cv::imwrite("out.jpg", out);
+        if (++tile == cols * rows)
+        {
+            write_sheet(sheet, dir, quality, sheets++);
+            tile = 0;
+            if (max_sheets > 0 && sheets >= max_sheets)
+                break;
+        }
+
+        // absolute deadlines, capture and encode time don't add up to drift;
+        // after a stall start from now instead of catching up in a burst
+        struct timespec mono;
+        timespec_add_ms(&next, interval_ms);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        if (mono.tv_sec > next.tv_sec + interval_ms / 1000 + 1)
+            next = mono;
+        while (!g_quit && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+            ;
     }
 
+    // a partly filled sheet is still worth keeping, without the previous sheet's tiles
+    if (tile > 0)
+    {
+        for (int i = tile; i < cols * rows; i++)
+            sheet(cv::Rect((i % cols) * tw, (i / cols) * th, tw, th)).setTo(cv::Scalar(0, 0, 0));
+        write_sheet(sheet, dir, quality, sheets);
+    }
+
+    cap.release();
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,45 @@
+#ifndef __AUDIO_STREAM_H
+#define __AUDIO_STREAM_H
+
+#include "rk_mpi_ai.h"
+#include "rk_mpi_aenc.h"
+#include "rtsp_demo.h"
+
+#define AUDIO_TX_FRAME_BYTES 1024	// encoded frame limit, G.711 at 160 samples is 160
+
+/*
+ * AI -> AENC (G.711) -> rtsp_tx_audio on the same session as the video.
+ * AI timestamps come from CLOCK_MONOTONIC like the VI/VENC PTS, so audio
+ * and video share one clock once both tracks are synced with
+ * rtsp_sync_audio_ts / rtsp_sync_video_ts at the same reference.
+ * librtsp is not thread safe: the audio thread only fetches from AENC and
+ * queues the frames in a single-producer ring, the stream thread sends
+ * them when audio_tx_fd() is readable, next to rtsp_tx_video/do_event.
+ * Every buffer between the microphone and the network is bounded by the
+ * depths below; a late audio thread drops audio, it never holds video.
+ */
+typedef struct {
+	const char *card_name;		// ALSA card, "hw:0,0"
+	RK_U32 sample_rate;			// G.711 is defined for 8000Hz
+	RK_U32 channels;			// channels on the sound card, encoded as mono
+	RK_U32 samples_per_frame;	// 160 = 20ms at 8kHz
+	RK_U32 ai_frame_num;		// driver ring depth
+	RK_U32 ai_usr_depth;		// frames queued for GetFrame/bind
+	RK_U32 aenc_buf_count;		// encoded frames queued before GetStream
+	RK_U32 tx_depth;			// encoded frames waiting for the stream thread, power of 2
+	int rtsp_codec;				// RTSP_CODEC_ID_AUDIO_G711A / G711U
+} audio_cfg_t;
+
+void audio_cfg_default(audio_cfg_t *cfg);
+int audio_init(const audio_cfg_t *cfg, rtsp_session_handle session);
+/* Thread body: fetch encoded frames and queue them for the stream thread, runs until audio_stop(). */
+void *audio_stream_thread(void *arg);
+/* Readable (eventfd) while frames are queued; -1 before audio_init(). */
+int audio_tx_fd();
+/* Stream thread only: sends every queued frame with rtsp_tx_audio. */
+void audio_tx_drain();
+void audio_stop();
+void audio_deinit();
+void audio_dump_stats();
+
+#endif
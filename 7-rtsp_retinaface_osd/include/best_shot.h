@@ -0,0 +1,124 @@
+#ifndef __BEST_SHOT_H
+#define __BEST_SHOT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "tracker.h"
+
+#define BEST_SHOT_MAX_SLOTS 32
+#define BEST_SHOT_LANDMARKS 5
+
+/*
+ * Best-shot face capture: every detection pass each confirmed track's
+ * face is scored on size, pose (from the five landmarks) and sharpness.
+ * Sharpness is measured on the face in the native resolution NV12 frame,
+ * so a small face is not scored on its upsampled blur. Only the best view
+ * per track is kept, as a square NV12 chip cut from that frame, in a pool
+ * of slots allocated at init; when the track ends its chip is encoded to
+ * JPEG once. A full pool evicts its weakest chip, and a token bucket caps
+ * the JPEG rate, so memory and output stay bounded however many people
+ * walk by.
+ *
+ * The tracker ends tracks on the detection thread, so the end only hands
+ * the slot to a low priority thread (RT_STAGE_BEST_SHOT) that encodes and
+ * writes it, then gives the slot back; until then nothing is offered to
+ * it. cfg.cb runs on that thread.
+ */
+typedef struct {
+	RK_U32 track_id;
+	RK_U64 pts;
+	float score;				// combined quality, 0..1
+	float size, pose, sharpness;
+	int jpeg_size;
+	const uint8_t *jpeg;
+} best_shot_t;
+
+typedef void (*best_shot_cb)(const best_shot_t *shot, void *arg);
+
+/* NV12 frame the faces are scored on and cut from, and its scale relative to the box coordinates */
+typedef struct {
+	const uint8_t *y;
+	const uint8_t *uv;			// interleaved, half resolution, same stride as y
+	RK_U32 width;
+	RK_U32 height;
+	RK_U32 stride;				// bytes per row
+	float sx, sy;				// image pixels per box pixel
+} best_shot_image_t;
+
+typedef struct {
+	RK_U32 chip;				// chip side, multiple of 16
+	RK_U32 slots;				// tracks held at once
+	RK_U32 min_face;			// box pixels, smaller faces are not scored
+	RK_U32 ideal_face;			// size score saturates here
+	float margin;				// around the box, per side
+	float min_score;			// never emitted below this
+	RK_U32 max_per_min;			// JPEG token bucket
+	RK_U32 burst;
+	int venc_chn;				// MJPEG channel, -1: software encoder only
+	RK_U32 qfactor;
+	const char *dir;			// best_<track>_<pts>.jpg, NULL: callback only
+	best_shot_cb cb;
+	void *cb_arg;
+} best_shot_cfg_t;
+
+typedef struct {
+	RK_U32 track_id;			// 0: free
+	RK_U64 pts;
+	float score, size, pose, sharpness;
+	uint8_t *nv12;
+	MB_BLK blk;					// backing of nv12 when encoding on the VENC
+	bool queued;				// with the encoder thread
+} best_shot_slot_t;
+
+typedef struct {
+	best_shot_cfg_t cfg;
+	best_shot_slot_t slots[BEST_SHOT_MAX_SLOTS];
+	MB_POOL pool;
+	bool venc_ready;
+	RK_U16 *xs, *ys;			// sampling tables, chip -> image
+	uint8_t *jpeg;				// encoder thread only
+	int jpeg_cap;
+	float tokens;
+	RK_U64 refill_us;
+
+	// slot indices to the encoder thread and back, under lock
+	pthread_t thread;
+	bool thread_running;
+	bool quit;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t todo[BEST_SHOT_MAX_SLOTS];
+	RK_U32 todo_head;
+	RK_U32 todo_count;
+	uint8_t done[BEST_SHOT_MAX_SLOTS];
+	RK_U32 done_count;
+
+	RK_U64 cost_us;
+	RK_U32 runs;
+	RK_U32 scored;
+	RK_U32 improved;
+	RK_U32 evicted;				// weaker chip dropped for a new track
+	RK_U32 rejected;			// pool full of better chips
+	RK_U32 emitted;
+	RK_U32 limited;				// track ended with no token left
+	RK_U32 encode_errors;
+	RK_U64 encode_us;			// on the encoder thread, write included
+} best_shot_ctx_t;
+
+void best_shot_cfg_default(best_shot_cfg_t *cfg);
+int best_shot_init(best_shot_ctx_t *bs, const best_shot_cfg_t *cfg);
+/* One face of a confirmed track, box and landmarks in box coordinates (landmarks may be NULL) */
+void best_shot_offer(best_shot_ctx_t *bs, const track_t *track, const best_shot_image_t *image,
+                     const POINT_S *landmarks);
+/* Tracker on_end: queue the track's chip for encoding, if it has one; never waits for the encoder */
+void best_shot_track_end(const track_t *track, void *arg);
+/* 0..1 from the five RetinaFace landmarks: eyes, nose, mouth corners */
+float best_shot_pose_score(const POINT_S *landmarks);
+/* Mean absolute gradient of a luma crop */
+RK_U32 best_shot_sharpness(const uint8_t *y, RK_U32 width, RK_U32 height, RK_U32 stride);
+void best_shot_dump_stats(best_shot_ctx_t *bs);
+/* Queued chips are encoded first. */
+void best_shot_deinit(best_shot_ctx_t *bs);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef __CAM_HEALTH_H
+#define __CAM_HEALTH_H
+
+#include <stdint.h>
+
+#include "rk_comm_video.h"
+
+/*
+ * Low-rate camera diagnostics on a decimated luma plane: focus, exposure,
+ * noise and occlusion. Conditions are debounced and reported once when
+ * they start and once when they clear. Compression artefacts are not
+ * checked: the frames here come from the sensor, never from the encoder.
+ */
+typedef enum {
+	CAM_HEALTH_DEFOCUS = 0,
+	CAM_HEALTH_OCCLUDED,
+	CAM_HEALTH_OVEREXPOSED,
+	CAM_HEALTH_UNDEREXPOSED,
+	CAM_HEALTH_NOISY,
+	CAM_HEALTH_EVENT_NUM
+} cam_health_event_e;
+
+typedef struct {
+	float focus;			// variance of the Laplacian
+	float focus_baseline;	// slow average while the camera is healthy
+	float mean;
+	float stddev;
+	float dark_ratio;		// pixels <= dark_level
+	float bright_ratio;		// pixels >= bright_level
+	float noise_sigma;		// Immerkaer estimate, grey levels
+	float frame_diff;		// mean abs difference to the previous plane
+	RK_U32 cost_us;
+	RK_U32 hist[256];
+} cam_health_metrics_t;
+
+typedef void (*cam_health_event_cb)(cam_health_event_e event, bool active, const cam_health_metrics_t *m,
+                                    void *arg);
+
+typedef struct {
+	RK_U32 width;			// size of the frames handed to cam_health_process()
+	RK_U32 height;
+	RK_U32 step;			// luma decimation, 8 on the VI frame
+	RK_U32 debounce;		// consecutive runs before a condition changes state
+	float defocus_ratio;	// focus below baseline * ratio
+	float clip_ratio;		// dark/bright pixel share for under/over exposure
+	RK_U32 dark_level;
+	RK_U32 bright_level;
+	float noise_sigma;
+	float occlusion_stddev;	// flat image ...
+	float occlusion_diff;	// ... reached by a sudden change
+	cam_health_event_cb cb;
+	void *cb_arg;
+} cam_health_cfg_t;
+
+typedef struct {
+	cam_health_cfg_t cfg;
+	RK_U32 dw, dh;
+	uint8_t *plane;
+	uint8_t *prev;
+	bool have_prev;
+	bool have_baseline;
+	bool flat_after_change;
+	cam_health_metrics_t metrics;
+	bool active[CAM_HEALTH_EVENT_NUM];
+	RK_U32 streak[CAM_HEALTH_EVENT_NUM];
+	RK_U32 runs;
+	RK_U32 events;
+} cam_health_t;
+
+void cam_health_cfg_default(cam_health_cfg_t *cfg, RK_U32 width, RK_U32 height, RK_U32 step);
+int cam_health_init(cam_health_t *health, const cam_health_cfg_t *cfg);
+/* frame must be NV12 of the configured size. */
+int cam_health_process(cam_health_t *health, const VIDEO_FRAME_INFO_S *frame);
+/* Same analysis on a luma buffer, used by the frame path and for offline checks. */
+int cam_health_process_luma(cam_health_t *health, const uint8_t *y_plane, RK_U32 stride);
+const char *cam_health_event_name(cam_health_event_e event);
+void cam_health_dump_stats(cam_health_t *health);
+void cam_health_deinit(cam_health_t *health);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __CROP_MOSAIC_H
+#define __CROP_MOSAIC_H
+
+#include <stdint.h>
+
+#include "rk_type.h"
+#include "rk_common.h"
+#include "rk_comm_video.h"
+#include "retinaface.h"
+
+#define CROP_MOSAIC_MAX_TILES 16
+
+/*
+ * Crop mosaic: several regions of interest are cut from the frame, each
+ * scaled so its longer side is about one tile, and packed onto a single
+ * model-size canvas with a shelf packer (first fit, tallest first). One
+ * inference then covers all of them instead of paying the NPU dispatch
+ * cost once per region. Detections are mapped back to the region they
+ * fall in; one that reaches the band along a cut tile edge is a partial
+ * face and is dropped. If the regions do not fit, the tile side shrinks
+ * down to min_tile, and what still does not fit is left for a next pass.
+ */
+typedef enum {
+	CROP_MOSAIC_BGR888 = 0,
+	CROP_MOSAIC_NV12,
+} crop_mosaic_format_e;
+
+/* Frame the tiles are cut from, and its scale relative to the ROI coordinates */
+typedef struct {
+	const uint8_t *data;
+	const uint8_t *uv;			// NV12 only: interleaved chroma plane
+	crop_mosaic_format_e format;
+	RK_U32 width;
+	RK_U32 height;
+	RK_U32 stride;				// bytes per row, of the luma plane for NV12
+	float sx, sy;				// image pixels per ROI pixel
+} crop_mosaic_image_t;
+
+typedef struct {
+	RECT_S roi;					// clipped to the frame, ROI coordinates
+	int tag;					// caller's, e.g. a track id
+	bool placed;
+	RK_S32 x, y;				// on the canvas
+	RK_U32 w, h;
+	RK_U32 cut_edges;			// CROP_MOSAIC_EDGE_* the ROI does not share with the frame
+} crop_mosaic_tile_t;
+
+#define CROP_MOSAIC_EDGE_LEFT   (1 << 0)
+#define CROP_MOSAIC_EDGE_TOP    (1 << 1)
+#define CROP_MOSAIC_EDGE_RIGHT  (1 << 2)
+#define CROP_MOSAIC_EDGE_BOTTOM (1 << 3)
+
+typedef struct {
+	RK_U32 canvas_w;			// model input size
+	RK_U32 canvas_h;
+	RK_U32 tile;				// longer side a ROI is scaled to
+	RK_U32 min_tile;			// smallest tile side before ROIs are left out
+	float max_scale;			// upsampling cap, tiny ROIs stay small
+	RK_U32 gap;					// blank canvas pixels between tiles
+	RK_U32 border;				// detections reaching this close to a cut edge are dropped
+} crop_mosaic_cfg_t;
+
+/* One detection of the mosaic, in the ROI coordinates of its tile */
+typedef struct {
+	int tile;
+	int tag;
+	object_detect_result det;
+} crop_mosaic_det_t;
+
+typedef struct {
+	crop_mosaic_cfg_t cfg;
+	crop_mosaic_tile_t tiles[CROP_MOSAIC_MAX_TILES];
+	int count;
+	int placed;
+	RK_U32 side;				// tile side of the last layout
+	RK_U16 *xs, *ys;			// sampling tables, tile -> image
+
+	RK_U32 packs;
+	RK_U32 rois;
+	RK_U32 spilled;				// did not fit, left for a next pass
+	RK_U32 dets;
+	RK_U32 straddling;			// dropped on a tile edge
+	RK_U32 stray;				// centre in a gap
+	RK_U64 render_us;
+	RK_U32 renders;
+} crop_mosaic_t;
+
+void crop_mosaic_cfg_default(crop_mosaic_cfg_t *cfg, RK_U32 canvas_w, RK_U32 canvas_h);
+int crop_mosaic_init(crop_mosaic_t *m, const crop_mosaic_cfg_t *cfg);
+/*
+ * Lays the ROIs out on the canvas; frame_w x frame_h bounds them in ROI
+ * coordinates. Returns the number placed, tiles[i].placed tells which.
+ */
+int crop_mosaic_pack(crop_mosaic_t *m, const RECT_S *rois, const int *tags, int count, RK_U32 frame_w,
+                     RK_U32 frame_h);
+/* Samples every placed tile from image into the packed BGR canvas, blank elsewhere */
+void crop_mosaic_render(crop_mosaic_t *m, const crop_mosaic_image_t *image, uint8_t *canvas);
+/* Canvas detections -> per-tile ones in ROI coordinates. Returns the number written to out. */
+int crop_mosaic_split(crop_mosaic_t *m, const object_detect_result_list *canvas_dets, crop_mosaic_det_t *out,
+                      int max);
+/*
+ * One mosaic inference against one inference per ROI (each rendered alone
+ * at its mosaic scale) on the same frame; prints the time of both. Leaves
+ * the model input and results of the last per-ROI run behind.
+ */
+void crop_mosaic_bench(crop_mosaic_t *m, rknn_app_context_t *app_ctx, const retinaface_thresh_t *thresh,
+                       const crop_mosaic_image_t *image, const RECT_S *rois, int count, RK_U32 frame_w,
+                       RK_U32 frame_h);
+void crop_mosaic_dump_stats(crop_mosaic_t *m);
+void crop_mosaic_deinit(crop_mosaic_t *m);
+
+#endif
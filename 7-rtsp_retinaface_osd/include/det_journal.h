@@ -0,0 +1,105 @@
+#ifndef __DET_JOURNAL_H
+#define __DET_JOURNAL_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "tracker.h"
+#include "zone_analytics.h"
+
+#define DET_JOURNAL_MAGIC 0x4e524a44	// "DJRN"
+#define DET_JOURNAL_VERSION 1
+
+/*
+ * Persistent detection journal: fixed-size records in a ring file that
+ * is preallocated and mapped once, so an append is a 32 byte store into
+ * memory and never a syscall. Every index_stride records the time of the
+ * first one goes into a sparse index; a time range query binary searches
+ * the index and then scans one stride of records. Times are wall clock,
+ * kept non-decreasing across the ring so the search stays valid after a
+ * reboot or a clock step. Dirty pages reach the card from
+ * det_journal_sync(), called off the pipeline thread.
+ */
+typedef struct {
+	RK_U64 time_us;			// CLOCK_REALTIME
+	RK_U32 seq;				// low bits of the record number, tells a live slot from a stale one
+	RK_U32 track_id;
+	int16_t x, y;
+	uint16_t w, h;
+	uint16_t score;			// * 65535
+	uint8_t cls;
+	uint8_t zones;			// zone mask at this time
+	RK_U32 reserved;
+} det_journal_record_t;
+
+typedef struct {
+	RK_U64 time_us;			// of record number seq
+	RK_U64 seq;
+} det_journal_index_t;
+
+/* First page of the file, followed by the index ring and the record ring */
+typedef struct {
+	RK_U32 magic;
+	RK_U32 version;
+	RK_U32 record_size;
+	RK_U32 index_stride;
+	RK_U64 capacity;		// records
+	RK_U64 index_capacity;	// capacity / index_stride
+	RK_U64 head;			// records ever appended, published after the record
+	RK_U64 last_time_us;
+} det_journal_header_t;
+
+typedef struct {
+	RK_U64 capacity;		// records in the ring, the file is ~32 bytes each
+	RK_U32 index_stride;	// power of two
+	RK_U32 sync_ahead;		// bytes of ring paged in ahead of the writer on each sync
+} det_journal_cfg_t;
+
+typedef struct {
+	det_journal_cfg_t cfg;
+	int fd;
+	void *map;
+	size_t map_size;
+	det_journal_header_t *hdr;
+	det_journal_index_t *index;
+	det_journal_record_t *records;
+	bool read_only;
+	std::atomic<RK_S64> realtime_offset_us;	// CLOCK_REALTIME - CLOCK_MONOTONIC, refreshed on sync
+
+	RK_U64 cost_us;
+	RK_U32 appends;
+	RK_U64 synced_head;
+	RK_U64 sync_us;
+} det_journal_t;
+
+typedef void (*det_journal_cb)(const det_journal_record_t *record, void *arg);
+
+void det_journal_cfg_default(det_journal_cfg_t *cfg);
+/* Opens (or creates and preallocates) the ring file. A file of another geometry is started afresh. */
+int det_journal_open(det_journal_t *journal, const char *path, const det_journal_cfg_t *cfg);
+/*
+ * Maps an existing ring file read only, for queries while (or after) the
+ * pipeline writes it. Never creates, truncates or rewrites the file; one
+ * of another geometry or size is refused. Only query, dump_stats and close.
+ */
+int det_journal_open_ro(det_journal_t *journal, const char *path, const det_journal_cfg_t *cfg);
+/* Pipeline thread only. pts is CLOCK_MONOTONIC in us, as stamped by VI. */
+void det_journal_append(det_journal_t *journal, RK_U64 pts, const track_t *track, uint8_t zones);
+/* Every confirmed track matched in this pass, after zone_process() if zones is set */
+void det_journal_append_tracks(det_journal_t *journal, const tracker_t *tracker, const zone_analytics_t *zones);
+/*
+ * Records with from_us <= time_us < to_us, oldest first, and any of the
+ * zones in zone_mask (0: all). Any thread. Returns the number of records
+ * passed to cb.
+ */
+int det_journal_query(det_journal_t *journal, RK_U64 from_us, RK_U64 to_us, uint8_t zone_mask,
+                      det_journal_cb cb, void *arg);
+/* msync the pages written since the last call and page in the next ones. Not from the pipeline thread. */
+int det_journal_sync(det_journal_t *journal);
+/* Right after mlockall(): the ring must not be pinned in RAM with the rest of the process */
+void det_journal_unlock(det_journal_t *journal);
+RK_U64 det_journal_now_us(void);
+void det_journal_dump_stats(det_journal_t *journal);
+void det_journal_close(det_journal_t *journal);
+
+#endif
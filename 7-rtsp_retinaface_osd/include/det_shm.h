@@ -0,0 +1,39 @@
+#ifndef __DET_SHM_H
+#define __DET_SHM_H
+
+#include "retinaface.h"
+#include "tracker.h"
+#include "det_shm_client.h"
+
+/*
+ * Publishes every detection pass into a POSIX shared memory segment for
+ * other processes on the device (layout and reader in det_shm_client.h).
+ * An update is a seqlocked copy of the faces plus one FUTEX_WAKE, done on
+ * the pipeline thread; readers only ever read the segment, so nothing
+ * they do can delay it. The segment outlives the writer, a restarted
+ * pipeline continues its seq and readers keep their mapping.
+ */
+typedef struct {
+	int fd;
+	det_shm_t *shm;
+	RK_U32 width;
+	RK_U32 height;
+
+	RK_U32 publishes;
+	RK_U64 cost_us;
+	RK_U64 cost_worst_us;
+} det_shm_writer_t;
+
+/* width x height: the coordinate space of the published boxes */
+int det_shm_open(det_shm_writer_t *writer, const char *name, RK_U32 width, RK_U32 height);
+/*
+ * One detection pass, after tracker_update(). Model coordinates are scaled
+ * by sx, sy into the published space; faces matched to a confirmed track
+ * carry its id.
+ */
+void det_shm_publish(det_shm_writer_t *writer, RK_U64 pts, const object_detect_result_list *results,
+                     float sx, float sy, const tracker_t *tracker);
+void det_shm_dump_stats(det_shm_writer_t *writer);
+void det_shm_close(det_shm_writer_t *writer);
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef __DET_SHM_CLIENT_H
+#define __DET_SHM_CLIENT_H
+
+/*
+ * Shared memory layout of the latest detection pass and a header-only C
+ * reader. Plain C, no Rockit headers: copy this file into the consumer's
+ * build (link with -lrt on older glibc).
+ *
+ * One writer updates the segment under a seqlock: seq is odd while an
+ * update is in progress and even once it is complete. A reader copies the
+ * result out and retries if seq moved meanwhile, so it never sees a torn
+ * result and never makes the writer wait. After each update the writer
+ * does a FUTEX_WAKE on seq; det_shm_client_wait() sleeps on it, so
+ * readers wake within microseconds of a pass instead of polling. The
+ * mapping is read-only on the reader side.
+ *
+ *	det_shm_client_t c;
+ *	det_shm_result_t r;
+ *	det_shm_client_open(&c, DET_SHM_DEFAULT_NAME);
+ *	while (det_shm_client_wait(&c, 1000) >= 0) {
+ *		if (det_shm_client_read(&c, &r) == 0)
+ *			... r.count faces in r.dets, tracked ones with track_id != 0 ...
+ *	}
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define DET_SHM_DEFAULT_NAME "/rtsp_retinaface_det"
+#define DET_SHM_MAGIC 0x4d485344	// "DSHM"
+#define DET_SHM_VERSION 1
+#define DET_SHM_MAX_DETS 128
+#define DET_SHM_LANDMARKS 5
+
+typedef struct {
+	int32_t left;				// display pixels, width x height below
+	int32_t top;
+	int32_t right;
+	int32_t bottom;
+	float score;
+	uint32_t track_id;			// 0: not (yet) a confirmed track
+	int32_t landmarks[DET_SHM_LANDMARKS][2];
+} det_shm_det_t;
+
+typedef struct {
+	uint64_t pts;				// CLOCK_MONOTONIC us of the frame
+	uint64_t publish_us;		// CLOCK_MONOTONIC us of the update, tells a stalled writer
+	uint32_t pass;				// detection passes so far
+	uint32_t count;
+	uint32_t width;
+	uint32_t height;
+	det_shm_det_t dets[DET_SHM_MAX_DETS];
+} det_shm_result_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;				// sizeof(det_shm_t)
+	uint32_t writer_pid;
+	uint32_t seq;				// seqlock and futex word
+	uint32_t reserved[11];		// result starts on its own cache line
+	det_shm_result_t result;
+} det_shm_t;
+
+typedef struct {
+	int fd;
+	const det_shm_t *shm;
+	uint32_t seen;				// seq of the last result read or waited for
+} det_shm_client_t;
+
+static inline int det_shm_client_open(det_shm_client_t *c, const char *name) {
+	void *map;
+
+	c->shm = NULL;
+	c->seen = 0;
+	c->fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (c->fd < 0)
+		return -1;
+	map = mmap(NULL, sizeof(det_shm_t), PROT_READ, MAP_SHARED, c->fd, 0);
+	if (map == MAP_FAILED) {
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	c->shm = (const det_shm_t *)map;
+	if (c->shm->magic != DET_SHM_MAGIC || c->shm->version != DET_SHM_VERSION ||
+	    c->shm->size != sizeof(det_shm_t)) {
+		munmap(map, sizeof(det_shm_t));
+		close(c->fd);
+		c->fd = -1;
+		c->shm = NULL;
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+/* Copy of the latest result. Returns -1 (errno EAGAIN) before the first one. */
+static inline int det_shm_client_read(det_shm_client_t *c, det_shm_result_t *out) {
+	const det_shm_result_t *src = &c->shm->result;
+	uint32_t begin, end, count;
+
+	for (;;) {
+		begin = __atomic_load_n(&c->shm->seq, __ATOMIC_ACQUIRE);
+		if (begin == 0) {
+			errno = EAGAIN;
+			return -1;
+		}
+		if (begin & 1) {
+			sched_yield();		// the writer is mid-update, a few us at most
+			continue;
+		}
+		memcpy(out, src, offsetof(det_shm_result_t, dets));
+		// count may be torn until seq is checked, never trust it for the copy size
+		count = out->count < DET_SHM_MAX_DETS ? out->count : DET_SHM_MAX_DETS;
+		memcpy(out->dets, src->dets, count * sizeof(det_shm_det_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		end = __atomic_load_n(&c->shm->seq, __ATOMIC_RELAXED);
+		if (begin == end)
+			break;
+	}
+	c->seen = begin;
+	return 0;
+}
+
+/*
+ * Sleeps until a result newer than the last one read arrives, or
+ * timeout_ms (-1: forever). Returns 1 for a new result, 0 on timeout.
+ */
+static inline int det_shm_client_wait(det_shm_client_t *c, int timeout_ms) {
+	struct timespec ts;
+	uint32_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&c->shm->seq, __ATOMIC_ACQUIRE);
+		if (seq != c->seen && !(seq & 1))
+			return 1;
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		// returns at once if seq already moved on, no wake-up is lost
+		if (syscall(SYS_futex, &c->shm->seq, FUTEX_WAIT, seq, timeout_ms < 0 ? NULL : &ts, NULL, 0) != 0 &&
+		    errno == ETIMEDOUT)
+			return 0;
+	}
+}
+
+static inline void det_shm_client_close(det_shm_client_t *c) {
+	if (c->shm)
+		munmap((void *)c->shm, sizeof(det_shm_t));
+	if (c->fd >= 0)
+		close(c->fd);
+	c->shm = NULL;
+	c->fd = -1;
+}
+
+#endif
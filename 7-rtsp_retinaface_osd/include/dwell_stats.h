@@ -0,0 +1,76 @@
+#ifndef __DWELL_STATS_H
+#define __DWELL_STATS_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "tracker.h"
+#include "zone_analytics.h"
+
+#define DWELL_MAX_CLASSES 2
+#define DWELL_MAX_SCOPES (ZONE_MAX_ZONES + 1)	// 0: whole frame, 1..: zones
+#define DWELL_HIST_BINS 12						// <1s, 1-2s, 2-4s ... >=1024s
+#define DWELL_MAX_BUCKETS 1440
+
+/*
+ * Rolling per-class, per-zone counts and dwell-time histograms.
+ * Time is cut into fixed buckets kept in a ring allocated once, so
+ * memory is the same after a minute or after months. A query sums the
+ * buckets covering the requested window. Each bucket has a sequence
+ * counter: the pipeline never waits for a reader, a reader that raced
+ * an update simply copies the bucket again.
+ */
+typedef struct {
+	RK_U32 entries[DWELL_MAX_CLASSES][DWELL_MAX_SCOPES];
+	RK_U32 exits[DWELL_MAX_CLASSES][DWELL_MAX_SCOPES];
+	RK_U32 hist[DWELL_MAX_CLASSES][DWELL_MAX_SCOPES][DWELL_HIST_BINS];
+	RK_U64 dwell_ms[DWELL_MAX_CLASSES][DWELL_MAX_SCOPES];	// sum, for the mean
+} dwell_counts_t;
+
+typedef struct {
+	std::atomic<RK_U32> seq;	// odd while the pipeline writes
+	RK_U64 index;				// absolute bucket number, pts / bucket length
+	dwell_counts_t counts;
+} dwell_bucket_t;
+
+typedef struct {
+	RK_U32 window_sec;			// actually covered, may be less than asked right after start
+	dwell_counts_t counts;
+	RK_U32 occupancy[DWELL_MAX_CLASSES][DWELL_MAX_SCOPES];	// right now
+} dwell_summary_t;
+
+typedef struct {
+	RK_U32 bucket_sec;
+	RK_U32 bucket_count;		// history = bucket_sec * bucket_count
+} dwell_cfg_t;
+
+typedef struct {
+	RK_U32 track_id;
+	int cls;
+	uint16_t inside;			// scope mask, bit 0 whole frame
+	RK_U64 enter_pts[DWELL_MAX_SCOPES];
+	RK_U64 last_pts;
+} dwell_track_t;
+
+typedef struct {
+	dwell_cfg_t cfg;
+	dwell_bucket_t *buckets;
+	std::atomic<RK_U64> head;	// absolute index of the newest bucket
+	bool started;
+	dwell_track_t tracks[TRACKER_MAX_TRACKS];	// by tracker slot
+	std::atomic<RK_U32> occupancy[DWELL_MAX_CLASSES][DWELL_MAX_SCOPES];
+} dwell_stats_t;
+
+void dwell_cfg_default(dwell_cfg_t *cfg);
+int dwell_init(dwell_stats_t *ds, const dwell_cfg_t *cfg);
+/* After tracker_update() (and zone_process() if zones is set), from the pipeline thread. */
+void dwell_update(dwell_stats_t *ds, const tracker_t *tracker, const zone_analytics_t *zones);
+/* Any thread, any time. */
+void dwell_query(dwell_stats_t *ds, RK_U32 window_sec, dwell_summary_t *out);
+/* Histogram bin of a dwell time, and the lower edge of a bin in seconds */
+int dwell_hist_bin(RK_U64 dwell_ms);
+RK_U32 dwell_bin_floor_sec(int bin);
+void dwell_dump_stats(dwell_stats_t *ds, const zone_analytics_t *zones, RK_U32 window_sec);
+void dwell_deinit(dwell_stats_t *ds);
+
+#endif
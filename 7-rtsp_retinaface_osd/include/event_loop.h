@@ -0,0 +1,43 @@
+#ifndef __EVENT_LOOP_H
+#define __EVENT_LOOP_H
+
+#include "rk_type.h"
+
+#define EVENT_LOOP_MAX_FDS 16
+
+/*
+ * Small epoll loop for the streaming thread.
+ * MPI channels expose a pollable fd (RK_MPI_VENC_GetFd, RK_MPI_VPSS_GetChnFd, ...),
+ * so the thread sleeps until a buffer is ready instead of polling with usleep().
+ * The tick callback runs at least every tick_ms; it is where rtsp_do_event()
+ * services the RTSP sockets, which librtsp does not expose.
+ */
+typedef void (*event_loop_cb)(int fd, RK_U32 events, void *arg);
+typedef void (*event_loop_tick_cb)(void *arg);
+
+typedef struct {
+	int fd;
+	event_loop_cb cb;
+	void *arg;
+} event_loop_handler_t;
+
+typedef struct {
+	int epfd;
+	int wakefd;						// eventfd used by event_loop_stop()
+	int tick_ms;
+	event_loop_tick_cb tick_cb;
+	void *tick_arg;
+	RK_U64 last_tick_us;
+	volatile bool running;
+	event_loop_handler_t handlers[EVENT_LOOP_MAX_FDS];
+} event_loop_t;
+
+int event_loop_init(event_loop_t *loop, int tick_ms, event_loop_tick_cb tick_cb, void *tick_arg);
+int event_loop_add(event_loop_t *loop, int fd, event_loop_cb cb, void *arg);
+int event_loop_del(event_loop_t *loop, int fd);
+/* Runs until event_loop_stop() is called from any thread. */
+int event_loop_run(event_loop_t *loop);
+void event_loop_stop(event_loop_t *loop);
+void event_loop_deinit(event_loop_t *loop);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __FACE_AE_H
+#define __FACE_AE_H
+
+#include <stdint.h>
+
+#include "rk_type.h"
+#include "rk_common.h"
+
+#define FACE_AE_GRID 15
+#define FACE_AE_CELLS (FACE_AE_GRID * FACE_AE_GRID)
+#define FACE_AE_MAX_FACES 16
+
+/*
+ * Face-priority metering: face boxes -> 15x15 AE grid weights.
+ * The ISP is only reached through face_ae_ops_t, so the control loop can
+ * run against a stub; face_ae_ops_rkaiq() binds it to the rkaiq uAPI2.
+ */
+typedef struct {
+	void *ctx;
+	int (*get_weights)(void *ctx, uint8_t *weights);		// FACE_AE_CELLS entries, row major
+	int (*set_weights)(void *ctx, const uint8_t *weights);
+} face_ae_ops_t;
+
+typedef struct {
+	RK_U32 min_interval_ms;	// at most one push per interval
+	RK_U32 hold_ms;			// keep face metering after the last face was seen
+	RK_U32 smooth_q8;		// step toward the target per push, 256 = jump
+	RK_U32 margin_percent;	// grow each box so hair and neck are metered too
+	uint8_t face_weight;
+	uint8_t bg_divisor;		// default weight / bg_divisor outside faces
+} face_ae_cfg_t;
+
+typedef struct {
+	face_ae_cfg_t cfg;
+	face_ae_ops_t ops;
+	RK_U32 width;			// coordinate space of the boxes
+	RK_U32 height;
+
+	uint8_t defaults[FACE_AE_CELLS];	// tuning weights read at init, restored without faces
+	uint8_t target[FACE_AE_CELLS];
+	uint16_t cur_q8[FACE_AE_CELLS];
+	uint8_t applied[FACE_AE_CELLS];
+	RK_U64 last_push_us;
+	RK_U64 last_face_us;
+	bool face_mode;
+
+	RK_U32 pushes;
+	RK_U32 push_errors;
+} face_ae_t;
+
+void face_ae_cfg_default(face_ae_cfg_t *cfg);
+int face_ae_init(face_ae_t *ae, const face_ae_cfg_t *cfg, const face_ae_ops_t *ops, RK_U32 width,
+                 RK_U32 height);
+/* Call once per detection pass, with or without faces.
+ * Returns 1 if new weights were pushed, 0 if not, -1 on ISP error. */
+int face_ae_update(face_ae_t *ae, const RECT_S *faces, int count, RK_U64 now_us);
+/* Put the tuning weights back, e.g. on exit. */
+int face_ae_restore(face_ae_t *ae);
+
+/* aiq_ctx is a rk_aiq_sys_ctx_t*, see isp_get_ctx(). */
+void face_ae_ops_rkaiq(face_ae_ops_t *ops, void *aiq_ctx);
+
+#endif
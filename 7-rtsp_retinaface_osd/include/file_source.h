@@ -0,0 +1,78 @@
+#ifndef __FILE_SOURCE_H
+#define __FILE_SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rk_type.h"
+#include "rk_common.h"
+#include "rk_comm_video.h"
+
+/*
+ * Recorded footage as a frame source: an H.264/H.265 Annex-B elementary
+ * stream is split into access units and decoded into NV12
+ * VIDEO_FRAME_INFO_S, the same MB-backed frames VI and VPSS hand out.
+ * The decoder is only reached through file_source_dec_ops_t, so the
+ * demux/pacing path can run against a software stand-in;
+ * file_source_dec_ops_vdec() binds it to a VDEC channel.
+ */
+typedef struct {
+	void *ctx;
+	/* one access unit; returns RK_SUCCESS, or an error if the decoder is full after timeout_ms */
+	RK_S32 (*send)(void *ctx, const uint8_t *data, size_t len, RK_U64 pts, bool eos, RK_S32 timeout_ms);
+	RK_S32 (*get)(void *ctx, VIDEO_FRAME_INFO_S *frame, RK_S32 timeout_ms);
+	RK_S32 (*release)(void *ctx, const VIDEO_FRAME_INFO_S *frame);
+	void (*close)(void *ctx);
+} file_source_dec_ops_t;
+
+typedef enum {
+	FILE_SOURCE_MAX_SPEED = 0,	// feed the decoder as fast as the consumer takes frames
+	FILE_SOURCE_REALTIME,		// pace access units at cfg.fps
+} file_source_pace_e;
+
+typedef struct {
+	RK_CODEC_ID_E codec;	// RK_VIDEO_ID_Unused: guess from the stream, then the extension
+	RK_U32 max_width;		// decoder picture size limit
+	RK_U32 max_height;
+	RK_U32 fps;				// elementary streams carry no timing: PTS step and realtime pace
+	file_source_pace_e pace;
+	bool loop;				// rewind at end of file
+	RK_U32 frame_buf_cnt;	// VDEC output buffers
+} file_source_cfg_t;
+
+/* Called for every decoded frame; the frame is released when it returns.
+ * Return < 0 to stop. */
+typedef int (*file_source_frame_cb)(const VIDEO_FRAME_INFO_S *frame, void *arg);
+
+typedef struct {
+	file_source_cfg_t cfg;
+	file_source_dec_ops_t dec;
+	const uint8_t *data;	// whole file, mmap'ed
+	size_t size;
+	size_t pos;				// next start code
+	int fd;
+
+	RK_U64 aus;
+	RK_U64 frames;
+	RK_U64 bytes;
+	RK_U64 start_us;
+	RK_U64 cb_us;			// time spent in the consumer
+	RK_U32 send_retries;
+} file_source_t;
+
+void file_source_cfg_default(file_source_cfg_t *cfg);
+int file_source_open(file_source_t *src, const char *path, const file_source_cfg_t *cfg);
+/* Takes ownership of dec: it is closed by file_source_close(). */
+void file_source_set_decoder(file_source_t *src, const file_source_dec_ops_t *dec);
+/* Next access unit (all NALs of one picture plus its parameter sets).
+ * Returns its length, 0 at end of file. Points into the mapped file. */
+size_t file_source_next_au(file_source_t *src, const uint8_t **au);
+/* Decode until end of file (or forever with cfg.loop), *quit or cb < 0. */
+int file_source_run(file_source_t *src, file_source_frame_cb cb, void *arg, volatile bool *quit);
+void file_source_dump_stats(file_source_t *src);
+void file_source_close(file_source_t *src);
+
+/* VDEC channel sized for cfg; frames come out as NV12. */
+int file_source_dec_ops_vdec(file_source_dec_ops_t *ops, int vdec_chn, const file_source_cfg_t *cfg);
+
+#endif
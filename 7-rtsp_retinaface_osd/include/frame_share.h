@@ -0,0 +1,107 @@
+#ifndef __FRAME_SHARE_H
+#define __FRAME_SHARE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rk_type.h"
+#include "event_loop.h"
+#include "frame_share_client.h"
+
+#define FRAME_SHARE_MAX_CLIENTS 8
+#define FRAME_SHARE_MAX_SLOTS 8
+#define FRAME_SHARE_PRIV_BYTES 256
+
+/*
+ * Local frame sharing: NV12 frames go to other processes as DMA-buf fds
+ * over a Unix socket (protocol in frame_share_client.h), so a consumer
+ * maps the pipeline's own buffer read-only instead of pulling RTSP and
+ * decoding it. A published frame sits in a refcounted slot until every
+ * client it was sent to has released it; only then is the source buffer
+ * given back. Slots are fewer than the source pool, and slow clients are
+ * skipped rather than waited for, so the producer never runs dry.
+ *
+ * The source is abstract (fd + release callback), the server runs its
+ * own epoll thread and touches no MPI call itself.
+ */
+typedef struct {
+	int fd;						// DMA-buf, or any mappable fd; stays open while the server runs
+	RK_U64 pts;
+	RK_U32 width;
+	RK_U32 height;
+	RK_U32 hor_stride;
+	RK_U32 ver_stride;
+	RK_U32 size;
+} frame_share_frame_t;
+
+struct frame_share_s;
+/* Source fd readable: fetch a frame and frame_share_publish() it */
+typedef void (*frame_share_source_cb)(struct frame_share_s *share, void *arg);
+/* Every client is done with the frame, priv is what was passed to frame_share_publish() */
+typedef void (*frame_share_release_cb)(void *priv, void *arg);
+
+typedef struct {
+	const char *path;			// socket path, replaced if it exists
+	RK_U32 max_slots;			// frames held at once, keep below the source pool size
+	RK_U32 max_inflight;		// per client
+	RK_U32 lease_ms;			// a client holding a frame longer is disconnected
+	int source_fd;				// pollable, -1: frames are published from another thread's call
+	frame_share_source_cb source;
+	frame_share_release_cb release;
+	void *cb_arg;
+} frame_share_cfg_t;
+
+typedef struct {
+	int fd;
+	RK_U32 known;				// buffers whose fd this client already has
+	RK_U32 held;				// slots it has not released
+	RK_U32 sent;
+	RK_U32 skipped;
+} frame_share_client_state_t;
+
+typedef struct {
+	bool in_use;
+	RK_U32 seq;
+	RK_U32 buffer;
+	RK_U32 refs;
+	RK_U64 publish_us;
+	uint8_t priv[FRAME_SHARE_PRIV_BYTES];
+} frame_share_slot_t;
+
+typedef struct frame_share_s {
+	frame_share_cfg_t cfg;
+	int listen_fd;
+	event_loop_t loop;
+	pthread_t thread;
+	bool thread_running;
+	int buffers[FRAME_SHARE_MAX_BUFFERS];	// fd per buffer index, -1: unused
+	frame_share_client_state_t clients[FRAME_SHARE_MAX_CLIENTS];
+	frame_share_slot_t slots[FRAME_SHARE_MAX_SLOTS];
+	RK_U32 seq;
+
+	RK_U32 published;
+	RK_U32 unwatched;			// no client took it, released at once
+	RK_U32 no_slot;				// all slots held, released at once
+	RK_U32 lease_expired;
+	RK_U32 connects;
+	RK_U64 hold_us;				// publish -> last release
+	RK_U32 holds;
+} frame_share_t;
+
+void frame_share_cfg_default(frame_share_cfg_t *cfg);
+/* Binds the socket and starts the server thread */
+int frame_share_start(frame_share_t *share, const frame_share_cfg_t *cfg);
+/*
+ * Server thread only (from the source callback). Sends the frame to every
+ * client with room for it; the release callback runs once the last of
+ * them hands it back, possibly before this returns. Returns the number
+ * of clients the frame went to.
+ */
+int frame_share_publish(frame_share_t *share, const frame_share_frame_t *frame, const void *priv, size_t priv_size);
+int frame_share_clients(const frame_share_t *share);
+void frame_share_dump_stats(frame_share_t *share);
+/* Disconnects every client and releases every held frame */
+void frame_share_stop(frame_share_t *share);
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef __FRAME_SHARE_CLIENT_H
+#define __FRAME_SHARE_CLIENT_H
+
+/*
+ * Wire protocol of the frame sharing socket and a header-only C client.
+ * Plain C, no Rockit headers: copy this file into the consumer's build.
+ *
+ * The server sends one FRAME message per frame on a SOCK_SEQPACKET
+ * socket. The first time a client sees a buffer index the buffer's
+ * DMA-buf fd is attached (SCM_RIGHTS); the client maps it once and keeps
+ * the mapping, later frames in that buffer carry no fd. Every frame must
+ * be handed back with a RELEASE message carrying its seq within lease_ms,
+ * or the server drops the connection. A client holding max_inflight
+ * frames is skipped until it releases one.
+ *
+ *	frame_share_client_t c;
+ *	frame_share_msg_t msg;
+ *	frame_share_client_open(&c, FRAME_SHARE_DEFAULT_PATH);
+ *	for (;;) {
+ *		const uint8_t *nv12 = frame_share_client_recv(&c, &msg, -1);
+ *		... Y at nv12, UV at nv12 + msg.hor_stride * msg.ver_stride ...
+ *		frame_share_client_release(&c, &msg);
+ *	}
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/dma-buf.h>
+
+#define FRAME_SHARE_DEFAULT_PATH "/tmp/frame_share.sock"
+#define FRAME_SHARE_MAGIC 0x52485346	// "FSHR"
+#define FRAME_SHARE_VERSION 1
+#define FRAME_SHARE_MAX_BUFFERS 32
+
+#define FRAME_SHARE_MSG_FRAME 1		// server -> client
+#define FRAME_SHARE_MSG_RELEASE 2	// client -> server, seq of the frame handed back
+
+#define FRAME_SHARE_FLAG_FD 0x1		// a DMA-buf fd for this buffer index is attached
+
+#define FRAME_SHARE_FMT_NV12 0x3231564e	// "NV12"
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;
+	uint32_t seq;				// frame number
+	uint32_t buffer;			// index of the buffer the frame is in, < FRAME_SHARE_MAX_BUFFERS
+	uint64_t pts;				// CLOCK_MONOTONIC us, as stamped by VI
+	uint32_t width;
+	uint32_t height;
+	uint32_t hor_stride;		// bytes per luma row
+	uint32_t ver_stride;		// luma rows before the chroma plane
+	uint32_t format;
+	uint32_t size;				// bytes to map
+	uint32_t lease_ms;
+	uint32_t max_inflight;
+	uint32_t flags;
+	uint32_t reserved;
+} frame_share_msg_t;
+
+typedef struct {
+	int sock;
+	void *addr[FRAME_SHARE_MAX_BUFFERS];
+	size_t size[FRAME_SHARE_MAX_BUFFERS];
+	int fd[FRAME_SHARE_MAX_BUFFERS];
+} frame_share_client_t;
+
+static inline int frame_share_client_open(frame_share_client_t *c, const char *path) {
+	struct sockaddr_un addr;
+	int i;
+
+	for (i = 0; i < FRAME_SHARE_MAX_BUFFERS; i++) {
+		c->addr[i] = NULL;
+		c->size[i] = 0;
+		c->fd[i] = -1;
+	}
+	c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (c->sock < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(c->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(c->sock);
+		c->sock = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static inline void frame_share_client_sync(int fd, uint64_t flags) {
+	struct dma_buf_sync sync;
+	sync.flags = flags;
+	// not a DMA-buf (e.g. memfd): nothing to sync
+	(void)ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+/*
+ * Waits up to timeout_ms (-1: forever) for the next frame. Returns its
+ * read-only mapping, or NULL on timeout (errno ETIMEDOUT) or when the
+ * server went away.
+ */
+static inline const uint8_t *frame_share_client_recv(frame_share_client_t *c, frame_share_msg_t *msg,
+                                                     int timeout_ms) {
+	struct pollfd pfd;
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	int fd = -1;
+	ssize_t n;
+
+	pfd.fd = c->sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeout_ms) <= 0) {
+		errno = ETIMEDOUT;
+		return NULL;
+	}
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = msg;
+	iov.iov_len = sizeof(*msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control.buf;
+	mh.msg_controllen = sizeof(control.buf);
+	n = recvmsg(c->sock, &mh, MSG_CMSG_CLOEXEC);
+	if (n != (ssize_t)sizeof(*msg))
+		return NULL;
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+	}
+	if (msg->magic != FRAME_SHARE_MAGIC || msg->type != FRAME_SHARE_MSG_FRAME ||
+	    msg->buffer >= FRAME_SHARE_MAX_BUFFERS) {
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	uint32_t b = msg->buffer;
+	if (fd >= 0) {
+		// a new buffer behind this index, drop the old mapping
+		if (c->addr[b])
+			munmap(c->addr[b], c->size[b]);
+		if (c->fd[b] >= 0)
+			close(c->fd[b]);
+		c->addr[b] = mmap(NULL, msg->size, PROT_READ, MAP_SHARED, fd, 0);
+		if (c->addr[b] == MAP_FAILED)
+			c->addr[b] = NULL;
+		c->size[b] = msg->size;
+		c->fd[b] = fd;
+	}
+	if (!c->addr[b])
+		return NULL;
+	frame_share_client_sync(c->fd[b], DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+	return (const uint8_t *)c->addr[b];
+}
+
+static inline int frame_share_client_release(frame_share_client_t *c, const frame_share_msg_t *frame) {
+	frame_share_msg_t msg;
+
+	if (frame->buffer < FRAME_SHARE_MAX_BUFFERS && c->fd[frame->buffer] >= 0)
+		frame_share_client_sync(c->fd[frame->buffer], DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = FRAME_SHARE_MAGIC;
+	msg.version = FRAME_SHARE_VERSION;
+	msg.type = FRAME_SHARE_MSG_RELEASE;
+	msg.seq = frame->seq;
+	msg.buffer = frame->buffer;
+	return send(c->sock, &msg, sizeof(msg), MSG_NOSIGNAL) == (ssize_t)sizeof(msg) ? 0 : -1;
+}
+
+static inline void frame_share_client_close(frame_share_client_t *c) {
+	int i;
+
+	for (i = 0; i < FRAME_SHARE_MAX_BUFFERS; i++) {
+		if (c->addr[i])
+			munmap(c->addr[i], c->size[i]);
+		if (c->fd[i] >= 0)
+			close(c->fd[i]);
+		c->addr[i] = NULL;
+		c->fd[i] = -1;
+	}
+	if (c->sock >= 0)
+		close(c->sock);
+	c->sock = -1;
+}
+
+#endif
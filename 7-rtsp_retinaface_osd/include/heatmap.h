@@ -0,0 +1,72 @@
+#ifndef __HEATMAP_H
+#define __HEATMAP_H
+
+#include <stdint.h>
+
+#include "tracker.h"
+
+/*
+ * Occupancy heatmap: track footprints are added into a coarse uint16
+ * grid every detection pass and the whole grid decays by
+ * v -= ceil(v / 2^shift) at a fixed interval, so old activity fades
+ * exponentially without any float math and reaches 0 instead of
+ * settling at 2^shift - 1. Intervals missed while the pipeline was gated
+ * or stalled are caught up in one pass. All buffers are allocated at init;
+ * accumulation and decay are saturating NEON adds/shifts on ARM. Files
+ * are written from a snapshot, off the detection thread.
+ */
+typedef struct {
+	RK_U32 width;				// coordinate space of the track boxes
+	RK_U32 height;
+	RK_U32 cell;				// pixels per grid cell
+	RK_U32 weight;				// added per cell per detection pass
+	RK_U32 decay_shift;			// v -= ceil(v / 2^decay_shift) ...
+	RK_U32 decay_interval_ms;	// ... this often; half-life ~ 0.69 * 2^shift intervals
+	bool footprint_bottom;		// only the lower third of the box, where a person stands
+	RK_U32 osd_scale;			// OSD pixels per cell
+} heatmap_cfg_t;
+
+typedef struct {
+	heatmap_cfg_t cfg;
+	uint16_t *grid;
+	RK_U32 gw, gh;
+	RK_U64 last_decay_us;
+	RK_U32 zero_steps;			// decays that take any cell to 0
+	uint32_t lut[256];			// false colour, ARGB8888
+	uint16_t *snap;				// grid copy for export, owned by the writer while snap_ready
+	bool snap_ready;			// __atomic: set by heatmap_snapshot(), cleared once written
+
+	// OSD
+	int rgn_handle;				// -1: not attached
+	int venc_chn;
+	RK_U32 osd_w, osd_h;
+
+	RK_U64 cost_us;
+	RK_U32 runs;
+	RK_U64 decays;
+} heatmap_t;
+
+void heatmap_cfg_default(heatmap_cfg_t *cfg, RK_U32 width, RK_U32 height);
+int heatmap_init(heatmap_t *hm, const heatmap_cfg_t *cfg);
+/* Add one rectangle in frame coordinates */
+void heatmap_splat(heatmap_t *hm, const RECT_S *box, RK_U32 weight);
+/* Decay if due, then splat every confirmed track matched in this pass. */
+void heatmap_update(heatmap_t *hm, const tracker_t *tracker, RK_U64 now_us);
+uint16_t heatmap_max(const heatmap_t *hm);
+/* gw x gh false colour PNG, upscaled by cfg.osd_scale */
+int heatmap_export_png(heatmap_t *hm, const char *path);
+/* gw x gh little endian uint16, row major */
+int heatmap_export_raw(heatmap_t *hm, const char *path);
+/* Detection thread: copy the grid for heatmap_export_snapshot(), unless the last copy is not written yet */
+void heatmap_snapshot(heatmap_t *hm);
+/* Any other thread: heatmap.png and heatmap_<gw>x<gh>.raw in dir from the
+ * pending snapshot. Returns 1 if written, 0 if none was pending, -1 on error. */
+int heatmap_export_snapshot(heatmap_t *hm, const char *dir);
+/* Translucent thumbnail on a VENC channel at (x, y); redrawn by heatmap_osd_update() */
+int heatmap_osd_attach(heatmap_t *hm, int rgn_handle, int venc_chn, RK_S32 x, RK_S32 y);
+int heatmap_osd_update(heatmap_t *hm);
+void heatmap_osd_detach(heatmap_t *hm);
+void heatmap_dump_stats(heatmap_t *hm);
+void heatmap_deinit(heatmap_t *hm);
+
+#endif
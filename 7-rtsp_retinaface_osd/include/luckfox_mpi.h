@@ -30,9 +30,26 @@ RK_U64 TEST_COMM_GetNowUs();
 RK_S32 test_rgn_overlay_line_process(int sX ,int sY,int type, int group);
 RK_S32 rgn_overlay_release(int group);
 
+int isp_init(int cam_id, rk_aiq_working_mode_t hdr_mode, const char *iq_dir);
+int isp_run();
+int isp_stop();
+rk_aiq_sys_ctx_t *isp_get_ctx();
+
 int vi_dev_init();
 int vi_chn_init(int channelId, int width, int height);
-int vpss_init(int VpssChn, int width, int height);
+/* wrap_line > 0: line ring buffer, only for a channel bound to a VENC with the same wrap_line */
+int vi_chn_init_ex(int channelId, int width, int height, int buf_cnt, int depth, int wrap_line);
+/* dst_fps > 0: the channel delivers only that many of the sensor's 30 frames per second */
+int vi_chn_init_fps(int channelId, int width, int height, int buf_cnt, int depth, int dst_fps);
 int venc_init(int chnId, int width, int height, RK_CODEC_ID_E enType);
+int venc_init_ex(int chnId, int width, int height, RK_CODEC_ID_E enType, int stream_buf_cnt,
+                 int buf_size, int wrap_line, bool ref_share);
+int venc_set_low_latency(int chnId, int width, int height, int slices);
+int venc_enable_svc(int chnId, int layers);
+/* CBR target in kbps, changed on the running channel */
+int venc_set_bitrate(int chnId, int kbps);
+/* Unbound MJPEG channel for stills: venc_encode_frame() sends one frame and copies its JPEG out */
+int venc_jpeg_init(int chnId, int width, int height, int qfactor);
+int venc_encode_frame(int chnId, const VIDEO_FRAME_INFO_S *frame, void *out, int out_size, int timeout_ms);
 
 #endif
\ No newline at end of file
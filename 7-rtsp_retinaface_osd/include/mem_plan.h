@@ -0,0 +1,86 @@
+#ifndef __MEM_PLAN_H
+#define __MEM_PLAN_H
+
+#include <stdint.h>
+
+#include "rk_type.h"
+#include "rk_common.h"
+
+#define MEM_PLAN_MAX_VI_CHN 3
+#define MEM_PLAN_MAX_ENTRIES 16
+
+/*
+ * DMA/CMA budget of the pipeline.
+ * mem_plan_compute() only does arithmetic (no MPI calls) and picks the
+ * buffer knobs; main.cpp passes them to vi_chn_init_ex()/venc_init_ex().
+ * Later allocations (VPSS pools, NPU) are added with mem_plan_add() and
+ * the sum is checked against the CmaFree drop seen at runtime.
+ */
+typedef enum {
+	MEM_PLAN_VI_VENC = 0,	// bound to the encoder only, can use a wrap buffer
+	MEM_PLAN_VI_BIND,		// bound to VPSS or another module
+	MEM_PLAN_VI_USER,		// read with RK_MPI_VI_GetChnFrame
+} mem_plan_vi_role_e;
+
+typedef struct {
+	RK_U32 width;
+	RK_U32 height;
+	RK_U32 fps;
+	RK_U32 bitrate_kbps;
+	RK_CODEC_ID_E codec;
+	int vi_chn_count;
+	mem_plan_vi_role_e vi_role[MEM_PLAN_MAX_VI_CHN];
+	bool save;				// apply wrap, ref sharing and minimal depths
+	RK_U32 budget_kb;		// 0: no budget check
+} mem_plan_cfg_t;
+
+typedef struct {
+	int buf_cnt;
+	int depth;
+	int wrap_line;
+} mem_plan_vi_chn_t;
+
+typedef struct {
+	int stream_buf_cnt;
+	int buf_size;
+	int wrap_line;
+	bool ref_share;
+} mem_plan_venc_t;
+
+typedef struct {
+	const char *name;
+	RK_U64 bytes;
+} mem_plan_entry_t;
+
+typedef struct {
+	mem_plan_cfg_t cfg;
+	mem_plan_vi_chn_t vi[MEM_PLAN_MAX_VI_CHN];
+	mem_plan_venc_t venc;
+	int entry_count;
+	mem_plan_entry_t entries[MEM_PLAN_MAX_ENTRIES];
+	RK_U64 total_bytes;
+	long cma_free_start_kb;	// -1 if the kernel does not report CMA
+} mem_plan_t;
+
+void mem_plan_cfg_default(mem_plan_cfg_t *cfg, RK_U32 width, RK_U32 height);
+/* MEM_BUDGET_KB=<n> sets the budget. */
+void mem_plan_cfg_from_env(mem_plan_cfg_t *cfg);
+void mem_plan_compute(const mem_plan_cfg_t *cfg, mem_plan_t *plan);
+void mem_plan_add(mem_plan_t *plan, const char *name, RK_U64 bytes);
+
+RK_U64 mem_plan_frame_bytes(RK_U32 width, RK_U32 height, RK_U32 align);
+RK_U64 mem_plan_venc_ref_bytes(RK_U32 width, RK_U32 height, RK_CODEC_ID_E codec, bool ref_share);
+RK_U32 mem_plan_venc_buf_size(RK_U32 width, RK_U32 height, RK_U32 fps, RK_U32 bitrate_kbps);
+
+/* CmaFree from /proc/meminfo in kB, -1 if not available. */
+long mem_plan_cma_free_kb();
+/* Call before the first allocation. */
+void mem_plan_mark_start(mem_plan_t *plan);
+void mem_plan_report(const mem_plan_t *plan);
+/* Compare the plan with the CMA actually taken since mem_plan_mark_start().
+ * Returns -1 if the budget is exceeded. */
+int mem_plan_verify(const mem_plan_t *plan);
+/* mem_plan_verify() against a CmaFree reading now_kb, -1 if not available. */
+int mem_plan_check(const mem_plan_t *plan, long now_kb);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef __MOTION_GATE_H
+#define __MOTION_GATE_H
+
+#include <stdint.h>
+
+#include "rk_mpi_ivs.h"
+
+#define MOTION_GATE_MAX_ROIS 4
+#define MOTION_GATE_MAX_CELLS (64 * 64)
+
+/*
+ * Cheap "did anything change" check in front of the NPU.
+ * Uses the IVS hardware block (motion + occlusion) when a channel can be
+ * created and falls back to a NEON SAD motion map on the decimated luma
+ * otherwise. Both backends fill the same result.
+ */
+typedef enum {
+	MOTION_GATE_IVS = 0,
+	MOTION_GATE_SOFT,
+} motion_gate_backend_e;
+
+typedef struct {
+	RK_U32 width;			// size of the frames handed to motion_gate_process()
+	RK_U32 height;
+	RK_U32 min_cells;		// moving cells (8x8 at gate scale) needed to trigger
+	RK_U32 hold_frames;		// keep the detector running after motion stops
+	RK_U32 force_interval;	// run anyway every N frames so static faces are refreshed
+	RK_U32 sad_thresh;		// software backend: mean abs diff per pixel of a moving cell
+	RK_U32 ivs_sensibility;	// IVS backend: 1 low, 2 mid, 3 high
+	bool try_ivs;
+	bool rois;				// collect the moving regions, only -G has a use for them
+} motion_gate_cfg_t;
+
+typedef struct {
+	bool run_detector;
+	bool occluded;
+	RK_U32 motion_cells;
+	int roi_count;			// 0 unless cfg.rois
+	RECT_S rois[MOTION_GATE_MAX_ROIS];	// in frame coordinates, -G hints them to roi_sched
+} motion_gate_result_t;
+
+typedef struct {
+	motion_gate_cfg_t cfg;
+	motion_gate_backend_e backend;
+	int ivs_chn;
+
+	// software backend
+	RK_U32 step;			// luma decimation factor
+	RK_U32 dw, dh;			// decimated size, multiples of 8
+	uint8_t *prev;
+	uint8_t *cur;
+	bool have_prev;
+
+	RK_U32 frames;
+	RK_U32 idle_frames;		// frames since the last trigger
+	RK_U32 triggered;
+} motion_gate_t;
+
+void motion_gate_cfg_default(motion_gate_cfg_t *cfg, RK_U32 width, RK_U32 height);
+int motion_gate_init(motion_gate_t *gate, const motion_gate_cfg_t *cfg);
+/* frame must be NV12; only the Y plane is read by the software backend */
+int motion_gate_process(motion_gate_t *gate, const VIDEO_FRAME_INFO_S *frame, motion_gate_result_t *res);
+void motion_gate_deinit(motion_gate_t *gate);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __PARAM_STORE_H
+#define __PARAM_STORE_H
+
+#include <atomic>
+
+#include "rk_type.h"
+#include "retinaface.h"
+
+#define PARAM_STORE_SLOTS 4
+#define PARAM_STORE_MAX_READERS 4
+#define PARAMS_INFER_INTERVAL_MS 500	// detection pass period by default, with or without a file
+
+/*
+ * Runtime tunables without a rebuild or a stream restart. The current
+ * values are an immutable snapshot behind one atomic pointer: a hot-path
+ * reader pays a single load and sees either the old or the new set, never
+ * a mix. An update fills a free slot, derives the values the pipeline
+ * would otherwise recompute per frame (e.g. the quantized score
+ * threshold), then swaps the pointer. Slots are recycled RCU style: each
+ * registered reader reports a quiescent state once per loop, and a
+ * retired snapshot is reused only after every reader has passed one.
+ *
+ * Updates come from a key = value file, watched with inotify and polled
+ * from the main loop, or from param_store_update().
+ */
+typedef struct {
+	RK_U32 version;
+	retinaface_thresh_t det;	// score_thresh_q is derived
+	RK_U32 bitrate_kbps;
+	RK_U32 infer_interval_ms;	// minimum time between detection passes, 0: every frame
+} params_t;
+
+/* Fill the derived fields of a new snapshot, on the updating thread */
+typedef void (*param_store_derive_cb)(params_t *params, void *arg);
+/* Act on a change that is not read per frame, e.g. the encoder bitrate */
+typedef void (*param_store_apply_cb)(const params_t *old_params, const params_t *new_params, void *arg);
+
+typedef struct {
+	const char *path;			// NULL: updates only through param_store_update()
+	param_store_derive_cb derive;
+	param_store_apply_cb apply;
+	void *cb_arg;
+	RK_U32 grace_ms;			// longest wait for readers before an update is refused, plus the infer interval
+} param_store_cfg_t;
+
+typedef struct {
+	param_store_cfg_t cfg;
+	std::atomic<const params_t *> current;
+	params_t slots[PARAM_STORE_SLOTS];
+	RK_U32 retired[PARAM_STORE_SLOTS];		// version that replaced the slot, 0: never published
+	std::atomic<RK_U32> reader_seen[PARAM_STORE_MAX_READERS];
+	std::atomic<RK_U32> readers;
+	int inotify_fd;
+	char file_name[64];
+
+	RK_U32 updates;
+	RK_U32 rejected;
+} param_store_t;
+
+void params_default(params_t *params);
+void param_store_cfg_default(param_store_cfg_t *cfg);
+/* Publishes initial, then the file's values on top of it if the file exists */
+int param_store_init(param_store_t *store, const param_store_cfg_t *cfg, const params_t *initial);
+/* Returns the reader id for param_store_quiescent() */
+int param_store_register_reader(param_store_t *store);
+
+/* The snapshot is valid until the reader's next param_store_quiescent() */
+static inline const params_t *param_store_get(param_store_t *store) {
+	return store->current.load(std::memory_order_acquire);
+}
+
+/* Reader holds no snapshot pointer at this point, e.g. the top of its loop */
+static inline void param_store_quiescent(param_store_t *store, int reader) {
+	store->reader_seen[reader].store(param_store_get(store)->version, std::memory_order_release);
+}
+
+/* One updating thread. Returns 0, or -1 if the values are out of range or readers are stuck. */
+int param_store_update(param_store_t *store, const params_t *next);
+/* Parse the file over the current values and publish. */
+int param_store_reload(param_store_t *store);
+/* Non-blocking: reloads if the file was written since the last call. Returns 1 on an update. */
+int param_store_poll(param_store_t *store);
+void param_store_dump(param_store_t *store);
+void param_store_deinit(param_store_t *store);
+
+#endif
@@ -60,8 +60,9 @@ typedef struct {
 
 typedef struct {
     rknn_context rknn_ctx;
-    rknn_tensor_mem* max_mem;
-    rknn_tensor_mem* net_mem;
+    rknn_tensor_mem* max_mem;       // internal (activation) memory, may be shared between models
+    rknn_tensor_mem* net_mem;       // weights
+    bool own_max_mem;
     rknn_input_output_num io_num;
     rknn_tensor_attr* input_attrs;
     rknn_tensor_attr* output_attrs;
@@ -76,10 +77,22 @@ typedef struct {
 
 
 
+typedef struct {
+    float score_thresh;         // faces scoring below are dropped
+    float nms_iou;              // overlap above which the weaker box is suppressed
+    int score_thresh_q;         // score_thresh in the raw int8 score domain, retinaface_quantize_score()
+} retinaface_thresh_t;
+
 //retinaface
 int init_retinaface_model(const char* model_path, rknn_app_context_t* app_ctx);
 int release_retinaface_model(rknn_app_context_t* app_ctx);
+/* 0.5 score, 0.2 NMS IoU */
 int inference_retinaface_model(rknn_app_context_t* app_ctx,object_detect_result_list* od_results);
+int inference_retinaface_model_ex(rknn_app_context_t* app_ctx, object_detect_result_list* od_results,
+                                  const retinaface_thresh_t* thresh);
+void retinaface_thresh_default(const rknn_app_context_t* app_ctx, retinaface_thresh_t* thresh);
+/* score as a raw int8 bound, a prior passes when its raw score is above it; -129 passes all */
+int retinaface_quantize_score(const rknn_app_context_t* app_ctx, float score);
 
 
 
@@ -0,0 +1,121 @@
+#ifndef __ROI_SCHED_H
+#define __ROI_SCHED_H
+
+#include <stdint.h>
+
+#include "tracker.h"
+#include "crop_mosaic.h"
+
+#define ROI_SCHED_MAX_ROIS CROP_MOSAIC_MAX_TILES
+#define ROI_SCHED_VI_BUF_CNT 2
+#define ROI_SCHED_MAX_HINTS 4
+
+/*
+ * Track-guided re-detection: between full-frame passes the detector only
+ * looks at a window around each track's predicted box. The windows are
+ * cut from a higher resolution frame than the full-frame model input and
+ * packed into one inference with the crop mosaic, so small faces get
+ * more pixels and the NPU runs once for all tracks. Full-frame passes
+ * still find new faces: every full_every passes, at least every
+ * full_max_ms, and right after a pass that lost a track or could not fit
+ * every window. The defaults are tuned for the paced infer loop, one pass
+ * per PARAMS_INFER_INTERVAL_MS: full_every applies there, full_max_ms
+ * only caps the gap when the interval is set longer.
+ *
+ * Motion outside every track window (from the motion gate) rides along
+ * in the next ROI pass as untagged windows, so a face walking in between
+ * two full passes is picked up there; such a window finding nothing is
+ * not a lost track and forces nothing.
+ *
+ * Per-track motion is indexed by tracker slot and checked by track id.
+ */
+typedef enum {
+	ROI_SCHED_FULL = 0,
+	ROI_SCHED_ROI,
+} roi_sched_pass_e;
+
+typedef struct {
+	RK_U32 full_every;			// passes, 1: full frame every time
+	RK_U32 full_max_ms;
+	float window;				// window side as a multiple of the box side
+	RK_U32 min_window;			// ROI pixels, small faces still get some context
+	float velocity_alpha;		// smoothing of the per-track velocity, 1: last step only
+	float dedup_iou;			// detections of one face in two overlapping windows
+	int vi_chn;					// higher resolution NV12 source
+	RK_U32 width;
+	RK_U32 height;
+	RK_U32 fps;					// source rate limit, 0: sensor rate
+} roi_sched_cfg_t;
+
+typedef struct {
+	RK_U32 id;					// track the motion belongs to, 0: none
+	float cx, cy;				// last matched box centre
+	float vx, vy;				// ROI pixels per second
+	RK_U64 pts;
+} roi_sched_motion_t;
+
+typedef struct {
+	roi_sched_cfg_t cfg;
+	roi_sched_motion_t motion[TRACKER_MAX_TRACKS];
+	RK_U32 since_full;			// ROI passes since the last full one
+	RK_U64 last_full_pts;
+	bool force_full;
+	RECT_S hints[ROI_SCHED_MAX_HINTS];	// for the next plan only
+	int hint_count;
+
+	RK_U32 full_passes;
+	RK_U32 roi_passes;
+	RK_U32 windows;
+	RK_U32 refound;
+	RK_U32 lost;				// windows with no face, a full pass follows
+	RK_U32 spilled;
+	RK_U32 hinted;				// motion windows looked at
+	RK_U32 hint_found;			// ... with a face in them
+	RK_U64 full_us;
+	RK_U64 roi_us;
+} roi_sched_t;
+
+/* Accuracy of a policy against a full-frame pass on every pass, for -F replays */
+typedef struct {
+	float iou;					// a reference face counts as found above this
+	RK_U32 interval_ms;			// pts between passes, as the live loop paces them; 0: every frame
+	RK_U64 next_pts;
+	RK_U64 frames;
+	RK_U64 ref_faces;
+	RK_U64 matched;
+	RK_U64 extra;				// found by the policy only, e.g. small faces in a window
+	RK_U64 ref_us;				// time of the reference passes, all full frame
+} roi_sched_replay_t;
+
+void roi_sched_cfg_default(roi_sched_cfg_t *cfg);
+/* ROI_FULL_EVERY, ROI_FULL_MAX_MS, ROI_WINDOW, ROI_VI_CHN, ROI_SIZE=WxH, ROI_FPS */
+void roi_sched_cfg_from_env(roi_sched_cfg_t *cfg);
+RK_U64 roi_sched_source_bytes(const roi_sched_cfg_t *cfg);
+void roi_sched_init(roi_sched_t *sched, const roi_sched_cfg_t *cfg);
+/* Moving regions in a frame sx, sy times smaller than the plan's, checked by the next ROI pass. */
+void roi_sched_hint(roi_sched_t *sched, const RECT_S *rois, int count, float sx, float sy);
+/*
+ * What the next pass should be. For ROI_SCHED_ROI, rois and tags (track
+ * ids) get one window per track, then the hinted motion no track window
+ * covers, tagged 0. Windows entirely outside frame_w x frame_h are dropped,
+ * the rest are left for crop_mosaic_pack() to clip.
+ */
+roi_sched_pass_e roi_sched_plan(roi_sched_t *sched, const tracker_t *tracker, RK_U64 pts, RK_U32 frame_w,
+                                RK_U32 frame_h, RECT_S *rois, int *tags, int *count);
+/* Keeps the best of the detections one face left in overlapping windows. Returns the new count. */
+int roi_sched_dedup(roi_sched_t *sched, crop_mosaic_det_t *dets, int count);
+/* A finished pass; mosaic and dets only for ROI passes. */
+void roi_sched_done(roi_sched_t *sched, roi_sched_pass_e pass, RK_U64 pts, const crop_mosaic_t *mosaic,
+                    const crop_mosaic_det_t *dets, int count, RK_U64 cost_us);
+/* After tracker_update(): velocities of the tracks matched in this pass */
+void roi_sched_observe(roi_sched_t *sched, const tracker_t *tracker);
+void roi_sched_dump_stats(roi_sched_t *sched);
+
+void roi_sched_replay_init(roi_sched_replay_t *replay);
+/* true if the frame at pts gets a pass; frames in between are skipped like the live loop does */
+bool roi_sched_replay_due(roi_sched_replay_t *replay, RK_U64 pts);
+void roi_sched_replay_frame(roi_sched_replay_t *replay, const object_detect_result *ref, int ref_count,
+                            const object_detect_result *got, int got_count);
+void roi_sched_replay_report(const roi_sched_replay_t *replay, const roi_sched_t *sched);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __RT_SCHED_H
+#define __RT_SCHED_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "rk_type.h"
+
+/*
+ * Pipeline stages that get their own scheduling class.
+ * On the single-core RV1106 the stream stage (VENC fetch + RTSP send) must
+ * preempt inference, and logging must never delay either of them.
+ */
+typedef enum {
+	RT_STAGE_STREAM = 0,	// VENC stream fetch + rtsp_tx_video
+	RT_STAGE_AUDIO,			// AENC stream fetch + rtsp_tx_audio
+	RT_STAGE_INFER,			// VI frame -> rknn -> OSD
+	RT_STAGE_LOG,			// main thread, statistics
+	RT_STAGE_STORAGE,		// SD card writer, below everything else
+	RT_STAGE_SNAPSHOT,		// full resolution stills, waits on VI/VENC only
+	RT_STAGE_SHARE,			// frame export socket to local processes
+	RT_STAGE_BEST_SHOT,		// face chip JPEG encode and write
+	RT_STAGE_NUM
+} rt_stage_e;
+
+typedef struct {
+	const char *name;
+	int priority;			// SCHED_FIFO priority 1..99, 0 = SCHED_OTHER
+	int nice;				// SCHED_OTHER only, also lowers the I/O priority
+	RK_U32 deadline_us;		// per-iteration budget, 0 = not checked
+	size_t stack_size;		// bytes, also the amount that is prefaulted
+} rt_stage_cfg_t;
+
+typedef struct {
+	rt_stage_cfg_t stage[RT_STAGE_NUM];
+	bool lock_memory;		// mlockall() once the pipeline has warmed up
+} rt_sched_profile_t;
+
+/* Default profile: stream 60, audio 55, infer 30, log SCHED_OTHER,
+ * storage SCHED_OTHER nice 10, snapshot SCHED_OTHER nice 5,
+ * share SCHED_OTHER, best shot SCHED_OTHER nice 5. */
+void rt_sched_profile_default(rt_sched_profile_t *profile);
+/* Override priorities/deadlines from RT_PRIO_<STAGE> / RT_DEADLINE_US_<STAGE>
+ * and disable memory locking with RT_MLOCK=0. */
+void rt_sched_profile_from_env(rt_sched_profile_t *profile);
+
+int rt_sched_init(const rt_sched_profile_t *profile);
+/* pthread_create() with the stage's policy, priority and prefaulted stack.
+ * Falls back to SCHED_OTHER if the process lacks CAP_SYS_NICE. */
+int rt_sched_thread_create(pthread_t *tid, rt_stage_e stage, void *(*fn)(void *), void *arg);
+/* Apply the stage's policy to the calling thread (used for the main thread). */
+int rt_sched_apply_current(rt_stage_e stage);
+/* Lock current and future mappings; call after model load and the first frames. */
+int rt_sched_lock_memory();
+
+/* Deadline accounting around one iteration of a stage loop. */
+RK_U64 rt_sched_stage_begin(rt_stage_e stage);
+void rt_sched_stage_end(rt_stage_e stage, RK_U64 begin_us);
+RK_U64 rt_sched_stage_runs(rt_stage_e stage);
+void rt_sched_dump_stats();
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "rk_type.h"
+
+#define SNAPSHOT_QUEUE 8
+
+/*
+ * Full resolution stills next to the 720x480 stream. A separate VI
+ * channel at sensor size is opened on the first request and closed again
+ * after idle_ms, or kept open at standby_fps. Its frame goes from the VI
+ * DMA buffer straight into an MJPEG VENC channel, never through the CPU.
+ * Requests only queue an entry and return; a low priority thread takes
+ * the first frame captured after the request, encodes it and hands the
+ * JPEG to the callback, so the stream and the detector never wait on it.
+ */
+typedef struct {
+	RK_U32 id;
+	RK_U64 request_us;			// CLOCK_MONOTONIC, when snapshot_request() was called
+	RK_U64 pts;					// of the frame that was encoded
+	RK_U32 width;
+	RK_U32 height;
+	int jpeg_size;				// -1: failed, jpeg is NULL
+	const uint8_t *jpeg;		// valid during the callback only
+	const char *path;			// file written, NULL if none
+} snapshot_t;
+
+typedef void (*snapshot_cb)(const snapshot_t *shot, void *arg);
+
+typedef struct {
+	int vi_chn;
+	int venc_chn;
+	RK_U32 width;				// sensor size
+	RK_U32 height;
+	RK_U32 qfactor;
+	RK_U32 standby_fps;			// 0: open per request, >0: keep the channel open at this rate
+	RK_U32 idle_ms;				// close an on-demand channel after this long without requests
+	RK_U32 timeout_ms;
+	const char *dir;			// snap_<id>_<pts>.jpg, NULL: callback only
+	snapshot_cb cb;
+	void *cb_arg;
+} snapshot_cfg_t;
+
+typedef struct {
+	RK_U32 id;
+	RK_U64 request_us;
+	snapshot_cb cb;
+	void *cb_arg;
+} snapshot_request_t;
+
+typedef struct {
+	snapshot_cfg_t cfg;
+	pthread_t thread;
+	bool thread_running;
+	volatile bool quit;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	snapshot_request_t queue[SNAPSHOT_QUEUE];
+	RK_U32 queue_head;
+	RK_U32 queue_count;
+	RK_U32 next_id;
+
+	bool vi_open;
+	bool venc_open;
+	RK_U64 last_use_us;
+	uint8_t *jpeg;
+	int jpeg_cap;
+
+	RK_U32 requests;
+	RK_U32 dropped;				// queue full
+	RK_U32 taken;
+	RK_U32 failed;
+	RK_U32 opens;
+	RK_U32 stale;				// frames older than their request, skipped
+	RK_U64 latency_us;			// request -> JPEG
+	RK_U64 latency_worst_us;
+	RK_U64 encode_us;
+	RK_U64 bytes;
+} snapshot_ctx_t;
+
+void snapshot_cfg_default(snapshot_cfg_t *cfg);
+/* SNAPSHOT_SIZE=WxH, SNAPSHOT_VI_CHN=n, SNAPSHOT_STANDBY_FPS=n, SNAPSHOT_QUALITY=1..99 */
+void snapshot_cfg_from_env(snapshot_cfg_t *cfg);
+int snapshot_start(snapshot_ctx_t *snap, const snapshot_cfg_t *cfg);
+/*
+ * Any thread, never waits for a frame or the encoder. cb NULL uses the one
+ * in cfg. Returns the snapshot id, or -1 if SNAPSHOT_QUEUE requests are
+ * already pending.
+ */
+int snapshot_request(snapshot_ctx_t *snap, snapshot_cb cb, void *cb_arg);
+/* CMA held while the channel is open: VI buffers and the JPEG stream buffer */
+RK_U64 snapshot_open_bytes(const snapshot_cfg_t *cfg);
+void snapshot_dump_stats(snapshot_ctx_t *snap);
+/* Pending requests are completed first. */
+void snapshot_stop(snapshot_ctx_t *snap);
+
+#endif
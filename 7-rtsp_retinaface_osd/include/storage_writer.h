@@ -0,0 +1,89 @@
+#ifndef __STORAGE_WRITER_H
+#define __STORAGE_WRITER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <atomic>
+
+#include "rk_type.h"
+
+#define STORAGE_WRITER_MAX_SEGMENTS 64
+#define STORAGE_WRITER_SYNC_POINT 0x1	// a new segment may start here, e.g. an IDR
+
+/*
+ * SD card write path. Producers copy data into a lock-free single
+ * producer / single consumer ring and return at once, or drop it if the
+ * ring is full; they never wait for the card. A low priority thread
+ * drains the ring into aligned blocks written with O_DIRECT into
+ * segment files preallocated with fallocate, so page cache writeback
+ * never stalls the pipeline, and batches fdatasync. The same thread runs
+ * a periodic idle job, e.g. flushing the detection journal.
+ */
+typedef void (*storage_idle_cb)(void *arg);
+
+typedef struct {
+	const char *dir;			// NULL: no segment files, only the idle job
+	const char *prefix;			// <dir>/<prefix>_YYYYmmdd_HHMMSS_<n><suffix>
+	const char *suffix;
+	RK_U64 segment_bytes;		// preallocated per file
+	RK_U32 block_bytes;			// write unit, multiple of 4096
+	RK_U32 queue_bytes;			// ring size, power of two
+	RK_U32 sync_blocks;			// fdatasync after this many blocks ...
+	RK_U32 sync_ms;				// ... or this long after the first unsynced one
+	RK_U32 max_segments;		// oldest deleted beyond this, 0: keep all
+	storage_idle_cb idle;
+	void *idle_arg;
+	RK_U32 idle_ms;
+} storage_writer_cfg_t;
+
+typedef struct {
+	storage_writer_cfg_t cfg;
+
+	// ring, head written by the producer, tail by the writer thread
+	uint8_t *queue;
+	std::atomic<RK_U32> head;
+	std::atomic<RK_U32> tail;
+
+	// writer thread
+	pthread_t thread;
+	bool thread_running;
+	volatile bool quit;
+	uint8_t *block;				// aligned staging buffer
+	RK_U32 block_fill;
+	int fd;
+	bool direct;
+	RK_U64 seg_written;			// bytes written to the current segment, excluding block_fill
+	RK_U32 seg_index;
+	char seg_names[STORAGE_WRITER_MAX_SEGMENTS][256];
+	RK_U32 unsynced_blocks;
+	RK_U64 unsynced_since_us;
+	RK_U64 next_idle_us;
+
+	// producer stats
+	std::atomic<RK_U32> queue_max;
+	std::atomic<RK_U32> dropped;
+	std::atomic<RK_U64> dropped_bytes;
+	// writer stats
+	RK_U64 bytes;
+	RK_U32 blocks;
+	RK_U64 write_us;
+	RK_U64 write_worst_us;
+	RK_U32 syncs;
+	RK_U64 sync_us;
+	RK_U64 sync_worst_us;
+	RK_U32 segments;
+	RK_U32 errors;
+} storage_writer_t;
+
+void storage_writer_cfg_default(storage_writer_cfg_t *cfg);
+int storage_writer_start(storage_writer_t *writer, const storage_writer_cfg_t *cfg);
+/* One producer thread only. Never blocks; returns -1 and counts a drop if the ring is full. */
+int storage_writer_pushv(storage_writer_t *writer, const struct iovec *iov, int count, RK_U32 flags);
+int storage_writer_push(storage_writer_t *writer, const void *data, RK_U32 len, RK_U32 flags);
+RK_U32 storage_writer_queue_depth(storage_writer_t *writer);
+void storage_writer_dump_stats(storage_writer_t *writer);
+/* Drains the ring, closes the segment at its real length and joins the thread. */
+void storage_writer_stop(storage_writer_t *writer);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __SVC_STREAM_H
+#define __SVC_STREAM_H
+
+#include <stdint.h>
+
+#include "rtsp_demo.h"
+#include "venc_stream.h"
+
+#define SVC_MAX_LAYERS 4
+#define SVC_MAX_CLIENTS (SVC_MAX_LAYERS + 1)
+
+/*
+ * Temporal SVC fan-out: one TSVC encode, several RTSP sessions that each
+ * forward only the layers up to their cap. librtsp has no per-client hook,
+ * so a "client" here is a session path:
+ *   <base>/t0 ... <base>/t<n-2>   fixed caps (base layer, base + 1, ...)
+ *   <base>/auto                   cap adapted from how long sends take
+ * The full-rate stream stays on <base> through the normal rtsp sink.
+ */
+typedef struct {
+	char path[64];
+	rtsp_session_handle session;
+	int max_layer;			// forward frames with temporal id <= max_layer
+	bool adaptive;
+
+	// adaptive cap
+	RK_U32 window_frames;
+	RK_U32 window_slow;
+	RK_U32 good_windows;
+
+	RK_U32 sent;
+	RK_U32 dropped;
+} svc_client_t;
+
+typedef struct {
+	int layers;
+	bool hevc;
+	int client_count;
+	svc_client_t clients[SVC_MAX_CLIENTS];
+
+	// per frame state, a frame may arrive as several slice AUs
+	RK_U64 cur_pts;
+	int cur_layer;
+	RK_U32 gop_pos;			// frames since the last IDR, for the pattern fallback
+	RK_U32 parsed_frames;	// layer id found in the bitstream
+	RK_U32 pattern_frames;	// layer id derived from the TSVC pattern
+	RK_U32 layer_frames[SVC_MAX_LAYERS];
+} svc_stream_t;
+
+int svc_stream_init(svc_stream_t *svc, rtsp_demo_handle demo, const char *base_path, int layers,
+                    RK_CODEC_ID_E codec);
+void svc_stream_sync_ts(svc_stream_t *svc, uint64_t ts, uint64_t ntptime);
+/* venc_sink_cb, register with venc_stream_add_sink(reader, svc_stream_sink, svc). */
+void svc_stream_sink(const venc_au_t *au, void *arg);
+/* Temporal id of one Annex-B buffer, -1 if it carries no layer information. */
+int svc_temporal_id(const uint8_t *data, RK_U32 len, bool hevc, bool *idr);
+void svc_stream_dump_stats(svc_stream_t *svc);
+void svc_stream_deinit(svc_stream_t *svc);
+
+#endif
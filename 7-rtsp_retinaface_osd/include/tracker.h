@@ -0,0 +1,67 @@
+#ifndef __TRACKER_H
+#define __TRACKER_H
+
+#include <stdint.h>
+
+#include "rk_type.h"
+#include "rk_common.h"
+#include "rk_comm_video.h"
+
+#define TRACKER_MAX_TRACKS 32
+
+/*
+ * Greedy IoU tracker: each detection pass, the best overlapping
+ * detection/track pairs are matched, unmatched detections open new
+ * tracks and tracks missed for max_misses passes end. Slots are fixed,
+ * so per-track state elsewhere can be indexed by slot and checked by id.
+ */
+typedef struct {
+	RECT_S box;
+	float score;
+	int cls;
+	int index;				// caller's index, e.g. into the retinaface result list
+} tracker_det_t;
+
+typedef struct {
+	RK_U32 id;				// 0: slot free
+	int cls;
+	RECT_S box;
+	float score;
+	int det_index;			// detection matched in the last update, -1 if coasting
+	RK_U32 hits;
+	RK_U32 misses;			// consecutive passes without a match
+	RK_U64 first_pts;
+	RK_U64 last_pts;		// last matched detection
+	bool confirmed;			// hits >= min_hits, reported to analytics
+} track_t;
+
+typedef void (*tracker_end_cb)(const track_t *track, void *arg);
+
+typedef struct {
+	float iou_min;
+	RK_U32 min_hits;
+	RK_U32 max_misses;
+	tracker_end_cb on_end;	// called for confirmed tracks before their slot is freed
+	void *cb_arg;
+} tracker_cfg_t;
+
+typedef struct {
+	tracker_cfg_t cfg;
+	track_t tracks[TRACKER_MAX_TRACKS];
+	RK_U32 next_id;
+	RK_U64 pts;				// of the last update
+	RK_U32 created;
+	RK_U32 ended;
+	RK_U32 dropped;			// detections without a free slot
+} tracker_t;
+
+void tracker_cfg_default(tracker_cfg_t *cfg);
+void tracker_init(tracker_t *tracker, const tracker_cfg_t *cfg);
+/* One detection pass. Returns the number of active tracks. */
+int tracker_update(tracker_t *tracker, const tracker_det_t *dets, int count, RK_U64 pts);
+/* End every track, e.g. at shutdown, so on_end sees them. */
+void tracker_flush(tracker_t *tracker);
+/* Box centre, or bottom centre (where a person stands) */
+POINT_S tracker_anchor(const RECT_S *box, bool bottom);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __VENC_STREAM_H
+#define __VENC_STREAM_H
+
+#include <stdint.h>
+
+#include "rk_mpi_venc.h"
+
+#define VENC_STREAM_MAX_PACKS 8
+#define VENC_STREAM_MAX_SINKS 4
+
+typedef struct {
+	const uint8_t *data;
+	RK_U32 len;
+} venc_nal_t;
+
+/*
+ * One encoded frame as a scatter-gather list.
+ * The pack pointers reference the VENC buffers directly and are only valid
+ * inside the sink callback; the stream is released after all sinks returned.
+ */
+typedef struct {
+	int chn;
+	RK_U32 seq;
+	RK_U64 pts;				// pts of the first pack, shared by all packs
+	RK_U32 pack_count;
+	RK_U32 total_len;
+	bool frame_end;			// false while slices of a frame are still pending
+	bool after_drop;		// frames before this one were dropped, it may reference them
+	venc_nal_t packs[VENC_STREAM_MAX_PACKS];
+} venc_au_t;
+
+typedef void (*venc_sink_cb)(const venc_au_t *au, void *arg);
+
+typedef struct {
+	venc_sink_cb cb;
+	void *arg;
+} venc_sink_t;
+
+typedef struct {
+	int chn;
+	VENC_STREAM_S stream;
+	VENC_PACK_S packs[VENC_STREAM_MAX_PACKS];	// reused for every GetStream
+	venc_au_t au;
+	int sink_count;
+	venc_sink_t sinks[VENC_STREAM_MAX_SINKS];
+	bool dropping;				// the rest of an overflowed frame is skipped too
+	RK_U64 drop_pts;
+	bool resync;				// the next AU out is the first after a drop
+
+	// read by the stats thread, 32-bit so the loads cannot tear
+	RK_U32 frames;
+	RK_U32 multi_pack_frames;
+	RK_U32 overflow_frames;		// more packs than VENC_STREAM_MAX_PACKS, dropped and an IDR requested
+	RK_U32 dropped_streams;
+} venc_stream_reader_t;
+
+int venc_stream_reader_init(venc_stream_reader_t *reader, int chn);
+int venc_stream_add_sink(venc_stream_reader_t *reader, venc_sink_cb cb, void *arg);
+/* Fetch one stream, hand it to every sink and release it. A frame with more
+ * packs than VENC_STREAM_MAX_PACKS never reaches the sinks in part: it is
+ * dropped, slices and all, and an IDR requested.
+ * Returns RK_SUCCESS if a stream was fetched. */
+RK_S32 venc_stream_read(venc_stream_reader_t *reader, RK_S32 timeout_ms);
+void venc_stream_dump_stats(venc_stream_reader_t *reader);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __VPSS_NODE_H
+#define __VPSS_NODE_H
+
+#include "rk_mpi_mb.h"
+#include "rk_mpi_sys.h"
+#include "rk_mpi_vpss.h"
+
+#define VPSS_NODE_MAX_OUTPUTS VPSS_MAX_CHN_NUM
+
+/*
+ * One VPSS group fed by a VI channel, fanning out into several hardware
+ * scaled outputs (encoder size, model input, thumbnail ...).
+ * Replaces the cvtColor + cv::resize done on the CPU for every frame.
+ */
+typedef struct {
+	const char *name;
+	RK_U32 width;
+	RK_U32 height;
+	PIXEL_FORMAT_E format;		// RK_FMT_YUV420SP, RK_FMT_RGB888, RK_FMT_BGR888
+	RECT_S crop;				// in source coordinates, width == 0: no crop
+	ROTATION_E rotation;
+	RK_U32 depth;				// frames queued for GetChnFrame, 0 for bind-only outputs
+	RK_U32 pool_blk_cnt;		// > 0: private MB pool with that many blocks
+} vpss_output_cfg_t;
+
+typedef struct {
+	int grp;
+	RK_U32 in_width;
+	RK_U32 in_height;
+	int output_count;
+	vpss_output_cfg_t outputs[VPSS_NODE_MAX_OUTPUTS];
+	MB_POOL pools[VPSS_NODE_MAX_OUTPUTS];
+	int fds[VPSS_NODE_MAX_OUTPUTS];
+	bool bound;
+	MPP_CHN_S src_chn;
+} vpss_node_t;
+
+RK_U32 vpss_node_frame_size(RK_U32 width, RK_U32 height, PIXEL_FORMAT_E format);
+/* DMA taken by the private pools of all outputs. */
+RK_U64 vpss_node_pool_bytes(const vpss_node_t *node);
+int vpss_node_create(vpss_node_t *node, int grp, RK_U32 in_width, RK_U32 in_height,
+                     const vpss_output_cfg_t *outputs, int output_count);
+int vpss_node_bind_vi(vpss_node_t *node, int vi_dev, int vi_chn);
+/* Unbound input, e.g. decoded frames; the frame stays owned by the caller. */
+RK_S32 vpss_node_send_frame(vpss_node_t *node, const VIDEO_FRAME_INFO_S *frame, RK_S32 timeout_ms);
+/* Pollable fd of an output, for event_loop_add(). */
+int vpss_node_get_fd(vpss_node_t *node, int output);
+RK_S32 vpss_node_get_frame(vpss_node_t *node, int output, VIDEO_FRAME_INFO_S *frame, RK_S32 timeout_ms);
+RK_S32 vpss_node_release_frame(vpss_node_t *node, int output, VIDEO_FRAME_INFO_S *frame);
+void vpss_node_destroy(vpss_node_t *node);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __ZONE_ANALYTICS_H
+#define __ZONE_ANALYTICS_H
+
+#include <stdint.h>
+
+#include "tracker.h"
+
+#define ZONE_MAX_ZONES 8		// one bit per zone in a grid cell
+#define ZONE_MAX_POINTS 16
+#define ZONE_MAX_WIRES 8
+#define ZONE_NAME_LEN 16
+
+/*
+ * Zone intrusion and line crossing on tracker output.
+ * Polygons are rasterized once into a coarse grid holding a zone bitmask
+ * per cell, so "which zones is this track in" is one lookup. Tripwires
+ * are tested as intersection of the track's last and current anchor
+ * segment with the wire. Enter/exit need a few consecutive frames and a
+ * cross must stay on the new side, so box jitter on a border is quiet.
+ */
+typedef enum {
+	ZONE_EVENT_ENTER = 0,
+	ZONE_EVENT_EXIT,
+	ZONE_EVENT_CROSS,
+	ZONE_EVENT_COUNT,
+} zone_event_e;
+
+typedef struct {
+	zone_event_e type;
+	int rule;				// zone index for enter/exit, wire index for cross
+	const char *name;
+	RK_U32 track_id;
+	int cls;
+	int direction;			// cross only: side of a->b reached, +1 where cross(b - a, p - a) > 0
+	RK_U64 pts;				// frame where the change happened, not where it was confirmed
+} zone_event_t;
+
+typedef void (*zone_event_cb)(const zone_event_t *event, void *arg);
+
+typedef struct {
+	char name[ZONE_NAME_LEN];
+	int count;
+	POINT_S points[ZONE_MAX_POINTS];
+} zone_polygon_t;
+
+typedef struct {
+	char name[ZONE_NAME_LEN];
+	POINT_S a;
+	POINT_S b;
+} zone_tripwire_t;
+
+typedef struct {
+	RK_U32 width;			// coordinate space of the track boxes
+	RK_U32 height;
+	RK_U32 cell;			// grid cell size in pixels
+	RK_U32 enter_frames;	// consecutive frames inside before ENTER
+	RK_U32 exit_frames;		// consecutive frames outside before EXIT
+	RK_U32 cross_frames;	// frames on the new side before CROSS
+	bool anchor_bottom;		// test the box bottom centre instead of the centre
+	zone_event_cb cb;
+	void *cb_arg;
+} zone_cfg_t;
+
+typedef struct {
+	RK_U32 track_id;		// 0: slot unused
+	int cls;
+	RK_U64 last_pts;		// last pass the track was matched in, its exits when it ends
+	uint8_t inside;			// debounced zone mask
+	uint8_t streak[ZONE_MAX_ZONES];
+	RK_U64 streak_pts[ZONE_MAX_ZONES];
+	POINT_S last;
+	bool have_last;
+	int8_t side[ZONE_MAX_WIRES];		// confirmed side per wire, 0 unknown
+	int8_t pending[ZONE_MAX_WIRES];		// side just crossed to, 0 none
+	uint8_t pending_frames[ZONE_MAX_WIRES];
+	RK_U64 pending_pts[ZONE_MAX_WIRES];
+} zone_track_state_t;
+
+typedef struct {
+	zone_cfg_t cfg;
+	zone_polygon_t zones[ZONE_MAX_ZONES];
+	int zone_count;
+	zone_tripwire_t wires[ZONE_MAX_WIRES];
+	int wire_count;
+
+	uint8_t *grid;			// zone mask per cell
+	RK_U32 gw, gh;
+	zone_track_state_t state[TRACKER_MAX_TRACKS];	// by tracker slot
+
+	RK_U32 events[ZONE_EVENT_COUNT];
+	RK_U64 cost_us;
+	RK_U32 runs;
+} zone_analytics_t;
+
+void zone_cfg_default(zone_cfg_t *cfg, RK_U32 width, RK_U32 height);
+int zone_init(zone_analytics_t *za, const zone_cfg_t *cfg);
+int zone_add_polygon(zone_analytics_t *za, const char *name, const POINT_S *points, int count);
+int zone_add_tripwire(zone_analytics_t *za, const char *name, POINT_S a, POINT_S b);
+/* Text rules, one per line:
+ *   zone <name> x,y x,y x,y ...
+ *   wire <name> x,y x,y
+ * Returns the number of rules loaded, -1 if the file can't be read. */
+int zone_load_file(zone_analytics_t *za, const char *path);
+/* Zone mask at a point, 0 outside all zones */
+uint8_t zone_mask_at(const zone_analytics_t *za, RK_S32 x, RK_S32 y);
+/* Evaluate all confirmed tracks after tracker_update(); events go to cfg.cb.
+ * A track that ended exits its zones with its class at the last pass it was seen. */
+void zone_process(zone_analytics_t *za, const tracker_t *tracker);
+void zone_dump_stats(zone_analytics_t *za);
+void zone_deinit(zone_analytics_t *za);
+
+#endif
@@ -11,11 +11,36 @@
 #include <sys/poll.h>
 #include <time.h>
 #include <unistd.h>
+#include <atomic>
 #include <vector>
 
 #include "rtsp_demo.h"
 #include "luckfox_mpi.h"
 #include "retinaface.h"
+#include "rt_sched.h"
+#include "event_loop.h"
+#include "venc_stream.h"
+#include "audio_stream.h"
+#include "vpss_node.h"
+#include "motion_gate.h"
+#include "svc_stream.h"
+#include "mem_plan.h"
+#include "face_ae.h"
+#include "cam_health.h"
+#include "file_source.h"
+#include "tracker.h"
+#include "zone_analytics.h"
+#include "dwell_stats.h"
+#include "heatmap.h"
+#include "best_shot.h"
+#include "det_journal.h"
+#include "storage_writer.h"
+#include "snapshot.h"
+#include "frame_share.h"
+#include "det_shm.h"
+#include "param_store.h"
+#include "crop_mosaic.h"
+#include "roi_sched.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
@@ -33,37 +58,333 @@ object_detect_result_list od_results;
 rtsp_demo_handle g_rtsplive = NULL;
 rtsp_session_handle g_rtsp_session;
 
+static volatile bool g_quit = false;
+static bool g_legacy_poll = false;	// -P: old GetStream + 10ms sleep, for latency comparison
+static int g_low_latency_slices = 0;	// -L n: slice-split encoding, each slice sent when ready
+static bool g_audio_enable = false;	// -a: G.711 audio track from the on-board mic
+static bool g_cpu_scale = false;	// -C: cvtColor + cv::resize on the CPU instead of VPSS
+static bool g_gate_enable = true;	// -M disables: run the detector on every frame
+static int g_svc_layers = 0;		// -T n: temporal SVC, extra sessions with fewer layers
+static bool g_mem_save = false;		// -m: VI/VENC wrap, ref buffer sharing, minimal depths
+static bool g_face_ae_enable = false;	// -E: meter exposure on detected faces
+static face_ae_t g_face_ae;
+static bool g_face_ae_ready = false;
+static bool g_health_enable = true;	// -H disables: no defocus/occlusion/exposure/noise checks
+static cam_health_t g_health;
+static bool g_health_ready = false;
+#define HEALTH_INTERVAL_US 1000000
+static const char *g_ingest_path = NULL;	// -F file: detect on a recorded H.264/H.265 stream, no camera
+static bool g_ingest_realtime = false;		// -r: decode at the stream frame rate instead of max speed
+static const char *g_zone_path = NULL;		// -Z file: zone/tripwire rules evaluated on face tracks
+static tracker_t g_tracker;
+static zone_analytics_t g_zones;
+static bool g_zones_ready = false;
+static dwell_stats_t g_dwell;
+static bool g_dwell_ready = false;
+#define DWELL_REPORT_SEC 300
+static bool g_heatmap_osd = false;	// -O: heatmap thumbnail on the stream
+static heatmap_t g_heatmap;
+static bool g_heatmap_ready = false;
+static const char *g_heatmap_dir = NULL;	// HEATMAP_DIR: periodic PNG + raw export
+#define HEATMAP_RGN_HANDLE 8		// face boxes use 0..3
+#define HEATMAP_OSD_INTERVAL_US 1000000
+#define HEATMAP_EXPORT_INTERVAL_US (60 * 1000000ULL)
+static const char *g_best_shot_dir = NULL;	// -B dir: one JPEG per face track, the best view it had
+static best_shot_ctx_t g_best_shot;
+static bool g_best_shot_ready = false;
+#define BEST_SHOT_VENC_CHN 1
+static const char *g_journal_path = NULL;	// -J file: persistent ring of every tracked detection
+static const char *g_journal_query = NULL;	// -Q from,to[,zones]: print journal records and exit
+static det_journal_t g_journal;
+static bool g_journal_ready = false;
+#define JOURNAL_SYNC_SEC 5
+static const char *g_record_dir = NULL;		// -R dir: H.264 segments on the SD card
+static storage_writer_t g_storage;
+static bool g_storage_ready = false;
+static bool g_record_started = false;		// from the first IDR on
+static RK_U64 g_record_last_pts = 0;
+static const char *g_snapshot_dir = NULL;	// -S dir: full resolution stills on SIGUSR1 and zone events
+static snapshot_ctx_t g_snapshot;
+static bool g_snapshot_ready = false;
+static const char *g_share_path = NULL;	// -X socket: NV12 frames to local processes as DMA-buf fds
+static frame_share_t g_share;
+static bool g_share_ready = false;
+static const char *g_det_shm_name = NULL;	// -D name: latest detections in POSIX shared memory
+static det_shm_writer_t g_det_shm;
+static bool g_det_shm_ready = false;
+static const char *g_params_path = NULL;	// -p file: thresholds, bitrate and rates, reloaded on write or SIGHUP
+static param_store_t g_params;
+static bool g_params_ready = false;
+static bool g_mosaic_bench = false;		// -K: time one mosaic pass over the tracked faces against one run per face
+static crop_mosaic_t g_mosaic;
+static bool g_mosaic_ready = false;
+#define MOSAIC_BENCH_INTERVAL_US (10 * 1000000ULL)
+static bool g_roi_enable = false;		// -G: between full-frame passes, re-detect only around the tracks
+static roi_sched_t g_roi;
+static bool g_roi_ready = false;
+
+#define VPSS_GRP_ANALYTICS 0
+#define VPSS_OUT_MODEL     0
+#define VPSS_OUT_GATE      1
+#define VPSS_OUT_SHARE     2
+#define SHARE_POOL_BLK_CNT 6	// frame share holds at most 4, two stay with VPSS
+#define GATE_WIDTH  360
+#define GATE_HEIGHT 240
+static vpss_node_t g_vpss;
+static bool g_vpss_ready = false;
+static event_loop_t g_stream_loop;
+static motion_gate_t g_gate;
+static bool g_gate_ready = false;
+static std::atomic<RK_U32> g_gate_skipped(0);
+static std::atomic<RK_U32> g_gate_occluded(0);
+
+// capture -> fetch latency of VENC packets, reported by the main thread
+static std::atomic<RK_U64> g_fetch_latency_us(0);
+static std::atomic<RK_U64> g_first_slice_latency_us(0);
+static std::atomic<RK_U64> g_fetch_count(0);
+static RK_U64 g_last_au_pts = 0;
+
+static venc_stream_reader_t g_venc_reader;
+static svc_stream_t g_svc;
+static bool g_svc_ready = false;
+
+// rtsp sink: every pack goes out with the frame pts, no concatenation copy
+static void RtspVideoSink(const venc_au_t *au, void *arg) {
+	(void)arg;
+	RK_U64 stage_begin = rt_sched_stage_begin(RT_STAGE_STREAM);
+
+	// VI stamps frames with CLOCK_MONOTONIC, the same clock as TEST_COMM_GetNowUs()
+	if (stage_begin >= au->pts) {
+		if (au->pts != g_last_au_pts)
+			g_first_slice_latency_us.fetch_add(stage_begin - au->pts, std::memory_order_relaxed);
+		if (au->frame_end) {
+			g_fetch_latency_us.fetch_add(stage_begin - au->pts, std::memory_order_relaxed);
+			g_fetch_count.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	g_last_au_pts = au->pts;
+
+	if (g_rtsplive && g_rtsp_session) {
+		for (RK_U32 i = 0; i < au->pack_count; i++)
+			rtsp_tx_video(g_rtsp_session, au->packs[i].data, au->packs[i].len, au->pts);
+	}
+	rt_sched_stage_end(RT_STAGE_STREAM, stage_begin);
+}
+
+// stream thread: copied into the storage ring, never waits for the card
+static void RecordVideoSink(const venc_au_t *au, void *arg) {
+	storage_writer_t *writer = (storage_writer_t *)arg;
+	struct iovec iov[VENC_STREAM_MAX_PACKS];
+	bool idr = false;
+
+	for (RK_U32 i = 0; i < au->pack_count; i++) {
+		svc_temporal_id(au->packs[i].data, au->packs[i].len, false, &idr);
+		iov[i].iov_base = (void *)au->packs[i].data;
+		iov[i].iov_len = au->packs[i].len;
+	}
+	// only the first slice of a frame may start a segment
+	bool sync_point = idr && au->pts != g_record_last_pts;
+	g_record_last_pts = au->pts;
+	if (au->after_drop)
+		g_record_started = false;
+	if (!g_record_started && !sync_point)
+		return;
+	int ret = storage_writer_pushv(writer, iov, au->pack_count, sync_point ? STORAGE_WRITER_SYNC_POINT : 0);
+	// after a drop the following frames reference one the file never got: wait for the next IDR
+	g_record_started = ret == 0;
+}
+
+static void JournalSyncJob(void *arg) {
+	det_journal_sync((det_journal_t *)arg);
+}
+
+static void VencStreamReady(int fd, RK_U32 events, void *arg) {
+	(void)fd;
+	(void)events;
+	venc_stream_reader_t *reader = (venc_stream_reader_t *)arg;
+
+	// drain everything the encoder finished since the last wakeup
+	while (venc_stream_read(reader, 0) == RK_SUCCESS) {
+	}
+	if (g_rtsplive)
+		rtsp_do_event(g_rtsplive);
+}
+
+// audio frames queued by the audio thread, sent here because librtsp is only used from this thread
+static void AudioTxReady(int fd, RK_U32 events, void *arg) {
+	(void)fd;
+	(void)events;
+	(void)arg;
+	audio_tx_drain();
+}
+
+static void RtspTick(void *arg) {
+	(void)arg;
+	if (g_rtsplive)
+		rtsp_do_event(g_rtsplive);
+}
+
 static void *GetMediaBuffer(void *arg) {
 	(void)arg;
 	printf("========%s========\n", __func__);
-	void *pData = RK_NULL;
-	int s32Ret;
-
-	VENC_STREAM_S stFrame;
-	stFrame.pstPack = (VENC_PACK_S *)malloc(sizeof(VENC_PACK_S));
-
-	while (1) {
-		s32Ret = RK_MPI_VENC_GetStream(0, &stFrame, -1);
-		if (s32Ret == RK_SUCCESS) {
-			if (g_rtsplive && g_rtsp_session) {
-				pData = RK_MPI_MB_Handle2VirAddr(stFrame.pstPack->pMbBlk);
-				rtsp_tx_video(g_rtsp_session, (uint8_t *)pData, stFrame.pstPack->u32Len,
-				              stFrame.pstPack->u64PTS);
-				rtsp_do_event(g_rtsplive);
-			}
+	venc_stream_reader_t *reader = &g_venc_reader;
 
-			s32Ret = RK_MPI_VENC_ReleaseStream(0, &stFrame);
-			if (s32Ret != RK_SUCCESS) {
-				RK_LOGE("RK_MPI_VENC_ReleaseStream fail %x", s32Ret);
+	if (g_legacy_poll) {
+		while (!g_quit) {
+			if (venc_stream_read(reader, -1) == RK_SUCCESS) {
+				if (g_rtsplive)
+					rtsp_do_event(g_rtsplive);
 			}
+			if (g_audio_enable)
+				audio_tx_drain();
+			usleep(10 * 1000);
+		}
+	} else {
+		// wait on the VENC fd, tick every 10ms to serve RTSP requests
+		int venc_fd = RK_MPI_VENC_GetFd(0);
+		if (event_loop_init(&g_stream_loop, 10, RtspTick, NULL) == 0) {
+			if (g_audio_enable)
+				event_loop_add(&g_stream_loop, audio_tx_fd(), AudioTxReady, NULL);
+			if (event_loop_add(&g_stream_loop, venc_fd, VencStreamReady, reader) == 0)
+				event_loop_run(&g_stream_loop);
+			event_loop_deinit(&g_stream_loop);
 		}
-		usleep(10 * 1000);
+		RK_MPI_VENC_CloseFd(0);
 	}
+
 	printf("\n======exit %s=======\n", __func__);
-	free(stFrame.pstPack);
 	return NULL;
 }
 
+static void OnCamHealthEvent(cam_health_event_e event, bool active, const cam_health_metrics_t *m, void *arg) {
+	(void)arg;
+	printf("cam health: %s %s (focus %.0f/%.0f, mean %.0f, sd %.1f, noise %.1f)\n",
+	       cam_health_event_name(event), active ? "on" : "off", m->focus, m->focus_baseline, m->mean,
+	       m->stddev, m->noise_sigma);
+}
+
+// VPSS output in model size BGR888 -> rknn input memory, honour the row stride
+static void LoadModelInputBgr(const VIDEO_FRAME_INFO_S *frame, void *data) {
+	int model_width = rknn_app_ctx.model_width;
+	int model_height = rknn_app_ctx.model_height;
+	RK_MPI_SYS_MmzFlushCache(frame->stVFrame.pMbBlk, RK_TRUE);
+	uint8_t *dst = (uint8_t *)rknn_app_ctx.input_mems[0]->virt_addr;
+	uint8_t *src = (uint8_t *)data;
+	RK_U32 src_stride = frame->stVFrame.u32VirWidth * 3;
+	if (src_stride == (RK_U32)model_width * 3) {
+		memcpy(dst, src, model_width * model_height * 3);
+	} else {
+		for (int y = 0; y < model_height; y++)
+			memcpy(dst + y * model_width * 3, src + y * src_stride, model_width * 3);
+	}
+}
+
+// -G: the pass is planned on a frame of the high resolution VI channel. If it is an ROI pass, windows around
+// the tracks are cut from that frame into one mosaic inference, and the faces replace od_results in model
+// coordinates, so everything downstream works as after a full pass. *pts is then that frame's.
+// Returns -1 when a full pass is due (or the ROI frame is late), the model path frame is only taken then.
+static int RoiPass(const retinaface_thresh_t *thresh, RK_U64 *pts) {
+	static object_detect_result_list mosaic_results;
+	static crop_mosaic_det_t dets[128];
+	VIDEO_FRAME_INFO_S frame;
+	crop_mosaic_image_t image;
+	RECT_S rois[ROI_SCHED_MAX_ROIS];
+	int tags[ROI_SCHED_MAX_ROIS];
+	int count;
+	float scale_x = (float)DISP_WIDTH / rknn_app_ctx.model_width;
+	float scale_y = (float)DISP_HEIGHT / rknn_app_ctx.model_height;
+	RK_U64 begin = TEST_COMM_GetNowUs();
+
+	if (RK_MPI_VI_GetChnFrame(0, g_roi.cfg.vi_chn, &frame, 100) != RK_SUCCESS)
+		return -1;
+	const uint8_t *data = (const uint8_t *)RK_MPI_MB_Handle2VirAddr(frame.stVFrame.pMbBlk);
+	if (!data || roi_sched_plan(&g_roi, &g_tracker, frame.stVFrame.u64PTS, DISP_WIDTH, DISP_HEIGHT, rois, tags,
+	                            &count) == ROI_SCHED_FULL) {
+		RK_MPI_VI_ReleaseChnFrame(0, g_roi.cfg.vi_chn, &frame);
+		return -1;
+	}
+	*pts = frame.stVFrame.u64PTS;
+	RK_MPI_SYS_MmzFlushCache(frame.stVFrame.pMbBlk, RK_TRUE);
+	memset(&image, 0, sizeof(image));
+	image.data = data;
+	image.uv = data + frame.stVFrame.u32VirWidth * frame.stVFrame.u32VirHeight;
+	image.format = CROP_MOSAIC_NV12;
+	image.width = frame.stVFrame.u32Width;
+	image.height = frame.stVFrame.u32Height;
+	image.stride = frame.stVFrame.u32VirWidth;
+	image.sx = (float)image.width / DISP_WIDTH;
+	image.sy = (float)image.height / DISP_HEIGHT;
+	crop_mosaic_pack(&g_mosaic, rois, tags, count, DISP_WIDTH, DISP_HEIGHT);
+	crop_mosaic_render(&g_mosaic, &image, (uint8_t *)rknn_app_ctx.input_mems[0]->virt_addr);
+	RK_MPI_VI_ReleaseChnFrame(0, g_roi.cfg.vi_chn, &frame);
+
+	inference_retinaface_model_ex(&rknn_app_ctx, &mosaic_results, thresh);
+	int n = crop_mosaic_split(&g_mosaic, &mosaic_results, dets, 128);
+	n = roi_sched_dedup(&g_roi, dets, n);
+	roi_sched_done(&g_roi, ROI_SCHED_ROI, *pts, &g_mosaic, dets, n, TEST_COMM_GetNowUs() - begin);
+
+	od_results.count = n;
+	for (int i = 0; i < n; i++) {
+		object_detect_result *res = &od_results.results[i];
+		const object_detect_result *det = &dets[i].det;
+		res->prop = det->prop;
+		res->box.left = (int)(det->box.left / scale_x);
+		res->box.top = (int)(det->box.top / scale_y);
+		res->box.right = (int)(det->box.right / scale_x);
+		res->box.bottom = (int)(det->box.bottom / scale_y);
+		for (int k = 0; k < 5; k++) {
+			res->point[k].x = (int)(det->point[k].x / scale_x);
+			res->point[k].y = (int)(det->point[k].y / scale_y);
+		}
+	}
+	return 0;
+}
+
+static void OnZoneEvent(const zone_event_t *event, void *arg) {
+	static const char *names[ZONE_EVENT_COUNT] = {"enter", "exit", "cross"};
+	(void)arg;
+	printf("zone: track %u %s %s", event->track_id, names[event->type], event->name);
+	if (event->type == ZONE_EVENT_CROSS)
+		printf(" (%s)", event->direction > 0 ? "+" : "-");
+	printf(" pts %llu", (unsigned long long)event->pts);
+	// only queued here, the still is taken and encoded on the snapshot thread
+	if (g_snapshot_ready && event->type != ZONE_EVENT_EXIT)
+		printf(" snapshot %d", snapshot_request(&g_snapshot, NULL, NULL));
+	printf("\n");
+}
+
+// share thread: the VPSS frame stays out of its pool until every client released it
+static void ShareFrameReady(frame_share_t *share, void *arg) {
+	VIDEO_FRAME_INFO_S frame;
+	frame_share_frame_t shared;
+	(void)arg;
+
+	if (vpss_node_get_frame(&g_vpss, VPSS_OUT_SHARE, &frame, 0) != RK_SUCCESS)
+		return;
+	shared.fd = RK_MPI_MB_Handle2Fd(frame.stVFrame.pMbBlk);
+	shared.pts = frame.stVFrame.u64PTS;
+	shared.width = frame.stVFrame.u32Width;
+	shared.height = frame.stVFrame.u32Height;
+	shared.hor_stride = frame.stVFrame.u32VirWidth;
+	shared.ver_stride = frame.stVFrame.u32VirHeight;
+	shared.size = RK_MPI_MB_GetSize(frame.stVFrame.pMbBlk);
+	frame_share_publish(share, &shared, &frame, sizeof(frame));
+}
+
+static void ShareFrameRelease(void *priv, void *arg) {
+	(void)arg;
+	vpss_node_release_frame(&g_vpss, VPSS_OUT_SHARE, (VIDEO_FRAME_INFO_S *)priv);
+}
+
+static void OnSnapshot(const snapshot_t *shot, void *arg) {
+	(void)arg;
+	if (shot->jpeg_size < 0)
+		return;
+	printf("snapshot %u: %ux%u %dKB %s, captured %llu ms after the request\n", shot->id, shot->width, shot->height,
+	       shot->jpeg_size / 1024, shot->path ? shot->path : "",
+	       (unsigned long long)((shot->pts > shot->request_us ? shot->pts - shot->request_us : 0) / 1000));
+}
+
 static void *RetinaProcessBuffer(void *arg) {
 	(void)arg;
 	printf("========%s========\n", __func__);
@@ -81,25 +402,205 @@ static void *RetinaProcessBuffer(void *arg) {
 	int s32Ret;
 	int group_count = 0;
 	VIDEO_FRAME_INFO_S stViFrame;
+	RK_U64 next_health_us = 0;
+	RK_U64 next_infer_us = 0;
+	RK_U64 next_mosaic_bench_us = 0;
+	retinaface_thresh_t default_thresh;
+	retinaface_thresh_default(&rknn_app_ctx, &default_thresh);
+	int params_reader = g_params_ready ? param_store_register_reader(&g_params) : -1;
+	RK_U64 next_heatmap_osd_us = 0;
+	RK_U64 next_heatmap_export_us = TEST_COMM_GetNowUs() + HEATMAP_EXPORT_INTERVAL_US;
 
-	while(1)
+	while(!g_quit)
 	{
-		s32Ret = RK_MPI_VI_GetChnFrame(0, 1, &stViFrame, -1);
+		// no snapshot pointer is held across this point, older ones may be recycled
+		const params_t *params = NULL;
+		if (params_reader >= 0) {
+			param_store_quiescent(&g_params, params_reader);
+			params = param_store_get(&g_params);
+		}
+		// the only pacing of the loop: one pass per interval, measured start to start
+		RK_U32 interval_ms = params ? params->infer_interval_ms : PARAMS_INFER_INTERVAL_MS;
+		if (interval_ms) {
+			RK_U64 now = TEST_COMM_GetNowUs();
+			if (now < next_infer_us)
+				usleep(next_infer_us - now);
+			next_infer_us = TEST_COMM_GetNowUs() + (RK_U64)interval_ms * 1000;
+		}
+
+		// motion gate and camera health: small NV12 from VPSS, or the VI frame itself on the CPU path
+		motion_gate_result_t gate_res;
+		bool have_vi_frame = false;
+		bool health_due = g_health_ready && TEST_COMM_GetNowUs() >= next_health_us;
+		gate_res.run_detector = true;
+		gate_res.roi_count = 0;
+		if (g_gate_ready || health_due) {
+			VIDEO_FRAME_INFO_S stGateFrame;
+			if (g_vpss_ready) {
+				s32Ret = vpss_node_get_frame(&g_vpss, VPSS_OUT_GATE, &stGateFrame, -1);
+				if (s32Ret == RK_SUCCESS) {
+					if (g_gate_ready)
+						motion_gate_process(&g_gate, &stGateFrame, &gate_res);
+					if (health_due)
+						cam_health_process(&g_health, &stGateFrame);
+					vpss_node_release_frame(&g_vpss, VPSS_OUT_GATE, &stGateFrame);
+				}
+			} else {
+				s32Ret = RK_MPI_VI_GetChnFrame(0, 1, &stViFrame, -1);
+				if (s32Ret == RK_SUCCESS) {
+					if (g_gate_ready)
+						motion_gate_process(&g_gate, &stViFrame, &gate_res);
+					if (health_due)
+						cam_health_process(&g_health, &stViFrame);
+					have_vi_frame = true;
+				}
+			}
+			if (health_due)
+				next_health_us = TEST_COMM_GetNowUs() + HEALTH_INTERVAL_US;
+			if (s32Ret == RK_SUCCESS && !gate_res.run_detector) {
+				if (have_vi_frame)
+					RK_MPI_VI_ReleaseChnFrame(0, 1, &stViFrame);
+				g_gate_skipped.fetch_add(1, std::memory_order_relaxed);
+				if (gate_res.occluded)
+					g_gate_occluded.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+		}
+		// -G: what moved outside the tracks is looked at in the next ROI pass
+		if (g_roi_ready && gate_res.roi_count > 0)
+			roi_sched_hint(&g_roi, gate_res.rois, gate_res.roi_count, (float)disp_width / g_gate.cfg.width,
+			               (float)disp_height / g_gate.cfg.height);
+
+		const retinaface_thresh_t *thresh = params ? &params->det : &default_thresh;
+		RK_U64 stage_begin = rt_sched_stage_begin(RT_STAGE_INFER);
+		RK_U64 pts = 0;
+		// -G: most passes only look around the tracks in a frame of the ROI channel; the model path frame is
+		// then not taken at all and the pass carries the ROI frame's pts
+		bool full_pass = !g_roi_ready || RoiPass(thresh, &pts) != 0;
+		if (!full_pass) {
+			if (have_vi_frame)
+				RK_MPI_VI_ReleaseChnFrame(0, 1, &stViFrame);
+			s32Ret = RK_SUCCESS;
+		} else if (g_vpss_ready)
+			s32Ret = vpss_node_get_frame(&g_vpss, VPSS_OUT_MODEL, &stViFrame, -1);
+		else if (!have_vi_frame)
+			s32Ret = RK_MPI_VI_GetChnFrame(0, 1, &stViFrame, -1);
 		if(s32Ret == RK_SUCCESS)
 		{
-			void *vi_data = RK_MPI_MB_Handle2VirAddr(stViFrame.stVFrame.pMbBlk);
-			if(vi_data != RK_NULL)
+			void *vi_data = full_pass ? RK_MPI_MB_Handle2VirAddr(stViFrame.stVFrame.pMbBlk) : NULL;
+			if(vi_data != RK_NULL || !full_pass)
 			{
-				cv::Mat yuv420sp(disp_height + disp_height / 2, disp_width, CV_8UC1, vi_data);
-				cv::Mat bgr(disp_height, disp_width, CV_8UC3);			
-				cv::Mat model_bgr(model_height, model_width, CV_8UC3);			
+				if (full_pass) {
+					pts = stViFrame.stVFrame.u64PTS;
+					RK_U64 full_begin = TEST_COMM_GetNowUs();
+					if (g_vpss_ready) {
+						// VPSS already scaled to model size in BGR888
+						LoadModelInputBgr(&stViFrame, vi_data);
+					} else {
+						cv::Mat yuv420sp(disp_height + disp_height / 2, disp_width, CV_8UC1, vi_data);
+						cv::Mat bgr(disp_height, disp_width, CV_8UC3);			
+						cv::Mat model_bgr(model_height, model_width, CV_8UC3);			
+
+						cv::cvtColor(yuv420sp, bgr, cv::COLOR_YUV420sp2BGR);
+
+						cv::resize(bgr, model_bgr, cv::Size(model_width ,model_height), 0, 0, cv::INTER_LINEAR);	
+						memcpy(rknn_app_ctx.input_mems[0]->virt_addr, model_bgr.data, model_width * model_height * 3);
+					}
+					inference_retinaface_model_ex(&rknn_app_ctx, &od_results, thresh);
+					if (g_roi_ready)
+						roi_sched_done(&g_roi, ROI_SCHED_FULL, pts, NULL, NULL, 0, TEST_COMM_GetNowUs() - full_begin);
+				}
+
+				tracker_det_t dets[TRACKER_MAX_TRACKS];
+				int det_count = 0;
+				for (int i = 0; i < od_results.count && det_count < TRACKER_MAX_TRACKS; i++) {
+					image_rect_t *box = &od_results.results[i].box;
+					dets[det_count].box.s32X = (RK_S32)(box->left * scale_x);
+					dets[det_count].box.s32Y = (RK_S32)(box->top * scale_y);
+					dets[det_count].box.u32Width = (RK_U32)((box->right - box->left) * scale_x);
+					dets[det_count].box.u32Height = (RK_U32)((box->bottom - box->top) * scale_y);
+					dets[det_count].score = od_results.results[i].prop;
+					dets[det_count].cls = 0;
+					dets[det_count].index = i;
+					det_count++;
+				}
+				tracker_update(&g_tracker, dets, det_count, pts);
+				if (g_roi_ready)
+					roi_sched_observe(&g_roi, &g_tracker);
+				if (g_zones_ready)
+					zone_process(&g_zones, &g_tracker);
+				if (g_dwell_ready)
+					dwell_update(&g_dwell, &g_tracker, g_zones_ready ? &g_zones : NULL);
+				if (g_journal_ready)
+					det_journal_append_tracks(&g_journal, &g_tracker, g_zones_ready ? &g_zones : NULL);
+				if (g_det_shm_ready)
+					det_shm_publish(&g_det_shm, pts, &od_results, scale_x, scale_y, &g_tracker);
+				if (g_heatmap_ready) {
+					RK_U64 now = TEST_COMM_GetNowUs();
+					heatmap_update(&g_heatmap, &g_tracker, now);
+					if (g_heatmap.rgn_handle >= 0 && now >= next_heatmap_osd_us) {
+						heatmap_osd_update(&g_heatmap);
+						next_heatmap_osd_us = now + HEATMAP_OSD_INTERVAL_US;
+					}
+					// only a copy here, the main thread writes the files
+					if (g_heatmap_dir && now >= next_heatmap_export_us) {
+						heatmap_snapshot(&g_heatmap);
+						next_heatmap_export_us = now + HEATMAP_EXPORT_INTERVAL_US;
+					}
+				}
 
-				cv::cvtColor(yuv420sp, bgr, cv::COLOR_YUV420sp2BGR);
+				// after a full pass the tracks' boxes belong to this frame; faces are scored at vi1 resolution
+				if (g_best_shot_ready && full_pass) {
+					VIDEO_FRAME_INFO_S stFaceFrame;
+					const VIDEO_FRAME_INFO_S *face_frame = NULL;
+					if (!g_vpss_ready)
+						face_frame = &stViFrame;
+					else if (RK_MPI_VI_GetChnFrame(0, 1, &stFaceFrame, 0) == RK_SUCCESS)
+						face_frame = &stFaceFrame;	// vi1 keeps a frame for us while bound, see vi_role
+					void *face_data = face_frame ? RK_MPI_MB_Handle2VirAddr(face_frame->stVFrame.pMbBlk) : NULL;
+					if (face_data) {
+						best_shot_image_t image;
+						RK_MPI_SYS_MmzFlushCache(face_frame->stVFrame.pMbBlk, RK_TRUE);
+						image.y = (const uint8_t *)face_data;
+						image.uv = image.y + face_frame->stVFrame.u32VirWidth * face_frame->stVFrame.u32VirHeight;
+						image.width = face_frame->stVFrame.u32Width;
+						image.height = face_frame->stVFrame.u32Height;
+						image.stride = face_frame->stVFrame.u32VirWidth;
+						image.sx = (float)image.width / disp_width;
+						image.sy = (float)image.height / disp_height;
+						for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+							const track_t *trk = &g_tracker.tracks[t];
+							if (!trk->id || !trk->confirmed || trk->det_index < 0)
+								continue;
+							POINT_S landmarks[BEST_SHOT_LANDMARKS];
+							const point_t *point = od_results.results[trk->det_index].point;
+							for (int k = 0; k < BEST_SHOT_LANDMARKS; k++) {
+								landmarks[k].s32X = (RK_S32)(point[k].x * scale_x);
+								landmarks[k].s32Y = (RK_S32)(point[k].y * scale_y);
+							}
+							best_shot_offer(&g_best_shot, trk, &image, landmarks);
+						}
+					}
+					if (face_frame == &stFaceFrame)
+						RK_MPI_VI_ReleaseChnFrame(0, 1, &stFaceFrame);
+				}
 
-				cv::resize(bgr, model_bgr, cv::Size(model_width ,model_height), 0, 0, cv::INTER_LINEAR);	
-				memcpy(rknn_app_ctx.input_mems[0]->virt_addr, model_bgr.data, model_width * model_height * 3);
-				inference_retinaface_model(&rknn_app_ctx, &od_results);
+				if (g_face_ae_ready) {
+					RECT_S faces[FACE_AE_MAX_FACES];
+					int face_count = 0;
+					// confirmed tracks matched in this pass, so a one-off false positive never moves the metering
+					for (int t = 0; t < TRACKER_MAX_TRACKS && face_count < FACE_AE_MAX_FACES; t++) {
+						const track_t *trk = &g_tracker.tracks[t];
+						if (trk->id && trk->confirmed && trk->det_index >= 0)
+							faces[face_count++] = trk->box;
+					}
+					face_ae_update(&g_face_ae, faces, face_count, TEST_COMM_GetNowUs());
+				}
 
+				// the last pass's boxes stay on the stream until this pass has new ones
+				for (int i = 0; i < group_count; i++)
+					rgn_overlay_release(i);
+				group_count = 0;
 				for(int i = 0; i < od_results.count; i++)
 				{					
 					object_detect_result *det_result = &(od_results.results[i]);
@@ -129,32 +630,501 @@ static void *RetinaProcessBuffer(void *arg) {
 
 				}		
 
+				// last: the bench overwrites the model input and results of this pass, and needs its frame
+				if (g_mosaic_ready && full_pass && TEST_COMM_GetNowUs() >= next_mosaic_bench_us) {
+					RECT_S rois[CROP_MOSAIC_MAX_TILES];
+					int roi_count = 0;
+					for (int t = 0; t < TRACKER_MAX_TRACKS && roi_count < CROP_MOSAIC_MAX_TILES; t++) {
+						const track_t *trk = &g_tracker.tracks[t];
+						if (!trk->id || !trk->confirmed)
+							continue;
+						// twice the face, so the detector sees it whole
+						rois[roi_count].s32X = trk->box.s32X - (RK_S32)trk->box.u32Width / 2;
+						rois[roi_count].s32Y = trk->box.s32Y - (RK_S32)trk->box.u32Height / 2;
+						rois[roi_count].u32Width = trk->box.u32Width * 2;
+						rois[roi_count].u32Height = trk->box.u32Height * 2;
+						roi_count++;
+					}
+					if (roi_count > 0) {
+						crop_mosaic_image_t image;
+						memset(&image, 0, sizeof(image));
+						image.data = (const uint8_t *)vi_data;
+						if (g_vpss_ready) {
+							image.format = CROP_MOSAIC_BGR888;
+							image.width = model_width;
+							image.height = model_height;
+							image.stride = stViFrame.stVFrame.u32VirWidth * 3;
+							image.sx = 1.0f / scale_x;
+							image.sy = 1.0f / scale_y;
+						} else {
+							image.format = CROP_MOSAIC_NV12;
+							image.width = disp_width;
+							image.height = disp_height;
+							image.stride = stViFrame.stVFrame.u32VirWidth;
+							image.uv = image.data + image.stride * stViFrame.stVFrame.u32VirHeight;
+							image.sx = 1.0f;
+							image.sy = 1.0f;
+						}
+						crop_mosaic_bench(&g_mosaic, &rknn_app_ctx, thresh, &image, rois, roi_count, disp_width,
+						                  disp_height);
+						next_mosaic_bench_us = TEST_COMM_GetNowUs() + MOSAIC_BENCH_INTERVAL_US;
+					}
+				}
 			}
-			s32Ret = RK_MPI_VI_ReleaseChnFrame(0, 1, &stViFrame);
+			if (!full_pass)
+				s32Ret = RK_SUCCESS;
+			else if (g_vpss_ready)
+				s32Ret = vpss_node_release_frame(&g_vpss, VPSS_OUT_MODEL, &stViFrame);
+			else
+				s32Ret = RK_MPI_VI_ReleaseChnFrame(0, 1, &stViFrame);
 			if (s32Ret != RK_SUCCESS) {
-				RK_LOGE("RK_MPI_VI_ReleaseChnFrame fail %x", s32Ret);
+				RK_LOGE("ReleaseChnFrame fail %x", s32Ret);
 			}
+			rt_sched_stage_end(RT_STAGE_INFER, stage_begin);
 		}
 		else{
 			printf("Get viframe error %d !\n", s32Ret);
 			continue;
 		}
-
-		usleep(500000);		
-		for(int i = 0;i < group_count; i++)
-			rgn_overlay_release(i);
-		group_count = 0;
-	}			
+	}
+	for (int i = 0; i < group_count; i++)
+		rgn_overlay_release(i);
 	return NULL;
 }
 
 
+typedef struct {
+	vpss_node_t *vpss;
+	RK_U64 frames;
+	RK_U64 faces;
+	RK_U64 infer_us;
+	RK_U64 skipped;				// decoded between two replay passes
+	roi_sched_replay_t *replay;	// -F with -G: score the re-detection policy against the full-frame pass
+} ingest_ctx_t;
+
+// -F with -G: the policy runs on the decoded picture next to a full-frame pass on every pass.
+// ref is the full-frame pass (picture coordinates) and what a full policy pass would have returned.
+static void ReplayRoiPolicy(ingest_ctx_t *ingest, const VIDEO_FRAME_INFO_S *frame,
+                            const object_detect_result *ref, int ref_count, RK_U64 full_us) {
+	static object_detect_result_list mosaic_results;
+	static crop_mosaic_det_t dets[128];
+	static object_detect_result got[128];
+	RK_U32 width = frame->stVFrame.u32Width;
+	RK_U32 height = frame->stVFrame.u32Height;
+	RK_U64 pts = frame->stVFrame.u64PTS;
+	RECT_S rois[ROI_SCHED_MAX_ROIS];
+	int tags[ROI_SCHED_MAX_ROIS];
+	int roi_count;
+	int got_count = 0;
+
+	ingest->replay->ref_us += full_us;
+	const uint8_t *data = (const uint8_t *)RK_MPI_MB_Handle2VirAddr(frame->stVFrame.pMbBlk);
+	if (data && roi_sched_plan(&g_roi, &g_tracker, pts, width, height, rois, tags, &roi_count) == ROI_SCHED_ROI) {
+		retinaface_thresh_t thresh;
+		crop_mosaic_image_t image;
+		RK_U64 begin = TEST_COMM_GetNowUs();
+		retinaface_thresh_default(&rknn_app_ctx, &thresh);
+		RK_MPI_SYS_MmzFlushCache(frame->stVFrame.pMbBlk, RK_TRUE);
+		memset(&image, 0, sizeof(image));
+		image.data = data;
+		image.uv = data + frame->stVFrame.u32VirWidth * frame->stVFrame.u32VirHeight;
+		image.format = CROP_MOSAIC_NV12;
+		image.width = width;
+		image.height = height;
+		image.stride = frame->stVFrame.u32VirWidth;
+		image.sx = 1.0f;
+		image.sy = 1.0f;
+		crop_mosaic_pack(&g_mosaic, rois, tags, roi_count, width, height);
+		crop_mosaic_render(&g_mosaic, &image, (uint8_t *)rknn_app_ctx.input_mems[0]->virt_addr);
+		inference_retinaface_model_ex(&rknn_app_ctx, &mosaic_results, &thresh);
+		got_count = crop_mosaic_split(&g_mosaic, &mosaic_results, dets, 128);
+		got_count = roi_sched_dedup(&g_roi, dets, got_count);
+		roi_sched_done(&g_roi, ROI_SCHED_ROI, pts, &g_mosaic, dets, got_count, TEST_COMM_GetNowUs() - begin);
+		for (int i = 0; i < got_count; i++)
+			got[i] = dets[i].det;
+	} else {
+		roi_sched_done(&g_roi, ROI_SCHED_FULL, pts, NULL, NULL, 0, full_us);
+		got_count = ref_count;
+		memcpy(got, ref, ref_count * sizeof(object_detect_result));
+	}
+
+	tracker_det_t track_dets[TRACKER_MAX_TRACKS];
+	int det_count = 0;
+	for (int i = 0; i < got_count && det_count < TRACKER_MAX_TRACKS; i++) {
+		track_dets[det_count].box.s32X = got[i].box.left;
+		track_dets[det_count].box.s32Y = got[i].box.top;
+		track_dets[det_count].box.u32Width = got[i].box.right - got[i].box.left;
+		track_dets[det_count].box.u32Height = got[i].box.bottom - got[i].box.top;
+		track_dets[det_count].score = got[i].prop;
+		track_dets[det_count].cls = 0;
+		track_dets[det_count].index = i;
+		det_count++;
+	}
+	tracker_update(&g_tracker, track_dets, det_count, pts);
+	roi_sched_observe(&g_roi, &g_tracker);
+	roi_sched_replay_frame(ingest->replay, ref, ref_count, got, got_count);
+}
+
+// decoded NV12 -> VPSS model output -> retinaface, boxes in decoded picture coordinates
+static int OnIngestFrame(const VIDEO_FRAME_INFO_S *frame, void *arg) {
+	ingest_ctx_t *ingest = (ingest_ctx_t *)arg;
+	VIDEO_FRAME_INFO_S stModelFrame;
+
+	// the replay passes at the live loop's rate, not the file's frame rate
+	if (ingest->replay && !roi_sched_replay_due(ingest->replay, frame->stVFrame.u64PTS)) {
+		ingest->skipped++;
+		return 0;
+	}
+	if (vpss_node_send_frame(ingest->vpss, frame, -1) != RK_SUCCESS)
+		return 0;
+	if (vpss_node_get_frame(ingest->vpss, VPSS_OUT_MODEL, &stModelFrame, 1000) != RK_SUCCESS)
+		return 0;
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	void *data = RK_MPI_MB_Handle2VirAddr(stModelFrame.stVFrame.pMbBlk);
+	if (data) {
+		LoadModelInputBgr(&stModelFrame, data);
+		inference_retinaface_model(&rknn_app_ctx, &od_results);
+		RK_U64 full_us = TEST_COMM_GetNowUs() - begin;
+		ingest->infer_us += full_us;
+		float scale_x = (float)frame->stVFrame.u32Width / rknn_app_ctx.model_width;
+		float scale_y = (float)frame->stVFrame.u32Height / rknn_app_ctx.model_height;
+		static object_detect_result ref[128];
+		for (int i = 0; i < od_results.count; i++) {
+			const object_detect_result *res = &od_results.results[i];
+			ref[i] = *res;
+			ref[i].box.left = (int)(res->box.left * scale_x);
+			ref[i].box.top = (int)(res->box.top * scale_y);
+			ref[i].box.right = (int)(res->box.right * scale_x);
+			ref[i].box.bottom = (int)(res->box.bottom * scale_y);
+			for (int k = 0; k < 5; k++) {
+				ref[i].point[k].x = (int)(res->point[k].x * scale_x);
+				ref[i].point[k].y = (int)(res->point[k].y * scale_y);
+			}
+			printf("frame %llu pts %llu: face %d %d %d %d %.2f\n", (unsigned long long)ingest->frames,
+			       (unsigned long long)frame->stVFrame.u64PTS, ref[i].box.left, ref[i].box.top, ref[i].box.right,
+			       ref[i].box.bottom, res->prop);
+		}
+		ingest->faces += od_results.count;
+		if (ingest->replay)
+			ReplayRoiPolicy(ingest, frame, ref, od_results.count, full_us);
+	}
+	ingest->frames++;
+	vpss_node_release_frame(ingest->vpss, VPSS_OUT_MODEL, &stModelFrame);
+	return 0;
+}
+
+static void OnIngestSignal(int sig) {
+	(void)sig;
+	g_quit = true;
+}
+
+// -F: batch analytics on a recorded stream instead of the camera
+static int RunFileIngest(const char *path) {
+	file_source_cfg_t src_cfg;
+	file_source_t src;
+	file_source_dec_ops_t dec;
+	vpss_output_cfg_t vpss_out;
+	vpss_node_t vpss;
+	ingest_ctx_t ingest;
+	roi_sched_replay_t replay;
+	int ret = -1;
+
+	signal(SIGINT, OnIngestSignal);
+	signal(SIGTERM, OnIngestSignal);
+	if (RK_MPI_SYS_Init() != RK_SUCCESS) {
+		RK_LOGE("rk mpi sys init fail!");
+		return -1;
+	}
+	file_source_cfg_default(&src_cfg);
+	src_cfg.pace = g_ingest_realtime ? FILE_SOURCE_REALTIME : FILE_SOURCE_MAX_SPEED;
+	if (file_source_open(&src, path, &src_cfg) != 0)
+		goto out_sys;
+	if (file_source_dec_ops_vdec(&dec, 0, &src.cfg) != 0)
+		goto out_src;
+	file_source_set_decoder(&src, &dec);
+
+	memset(&vpss_out, 0, sizeof(vpss_out));
+	vpss_out.name = "model";
+	vpss_out.width = rknn_app_ctx.model_width;
+	vpss_out.height = rknn_app_ctx.model_height;
+	vpss_out.format = RK_FMT_BGR888;
+	vpss_out.rotation = ROTATION_0;
+	vpss_out.depth = 1;
+	vpss_out.pool_blk_cnt = 2;
+	if (vpss_node_create(&vpss, VPSS_GRP_ANALYTICS, src.cfg.max_width, src.cfg.max_height, &vpss_out, 1) != 0)
+		goto out_src;
+
+	memset(&ingest, 0, sizeof(ingest));
+	ingest.vpss = &vpss;
+	if (g_roi_enable) {
+		roi_sched_cfg_t roi_cfg;
+		crop_mosaic_cfg_t mosaic_cfg;
+		tracker_cfg_t tracker_cfg;
+		roi_sched_cfg_default(&roi_cfg);
+		roi_sched_cfg_from_env(&roi_cfg);
+		roi_sched_init(&g_roi, &roi_cfg);
+		tracker_cfg_default(&tracker_cfg);
+		tracker_init(&g_tracker, &tracker_cfg);
+		crop_mosaic_cfg_default(&mosaic_cfg, rknn_app_ctx.model_width, rknn_app_ctx.model_height);
+		if (crop_mosaic_init(&g_mosaic, &mosaic_cfg) == 0) {
+			const char *interval = getenv("ROI_REPLAY_INTERVAL_MS");
+			roi_sched_replay_init(&replay);
+			replay.interval_ms = interval ? atoi(interval) : PARAMS_INFER_INTERVAL_MS;
+			ingest.replay = &replay;
+		}
+	}
+	ret = file_source_run(&src, OnIngestFrame, &ingest, &g_quit);
+	file_source_dump_stats(&src);
+	if (ingest.frames)
+		printf("ingest: %llu frames, %llu faces, inference %llu us/frame\n", (unsigned long long)ingest.frames,
+		       (unsigned long long)ingest.faces, (unsigned long long)(ingest.infer_us / ingest.frames));
+	if (ingest.skipped)
+		printf("ingest: %llu frames skipped between replay passes\n", (unsigned long long)ingest.skipped);
+	if (ingest.replay) {
+		roi_sched_replay_report(&replay, &g_roi);
+		crop_mosaic_deinit(&g_mosaic);
+	}
+	vpss_node_destroy(&vpss);
+out_src:
+	file_source_close(&src);
+out_sys:
+	RK_MPI_SYS_Exit();
+	release_retinaface_model(&rknn_app_ctx);
+	return ret;
+}
+
+static void OnJournalRecord(const det_journal_record_t *record, void *arg) {
+	(void)arg;
+	printf("%llu.%06llu track %u cls %u score %.2f box %d,%d %ux%u zones %#x\n",
+	       (unsigned long long)(record->time_us / 1000000), (unsigned long long)(record->time_us % 1000000),
+	       record->track_id, record->cls, record->score / 65535.0f, record->x, record->y, record->w, record->h,
+	       record->zones);
+}
+
+// -Q: search the journal, times in unix seconds
+static int RunJournalQuery(const char *path, const char *spec) {
+	det_journal_cfg_t cfg;
+	unsigned long long from = 0, to = 0;
+	unsigned int zones = 0;
+
+	if (sscanf(spec, "%llu,%llu,%i", &from, &to, &zones) < 2) {
+		printf("journal: query wants from,to[,zone mask], got %s\n", spec);
+		return -1;
+	}
+	det_journal_cfg_default(&cfg);
+	if (det_journal_open_ro(&g_journal, path, &cfg) != 0)
+		return -1;
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	int count = det_journal_query(&g_journal, from * 1000000, to * 1000000, (uint8_t)zones, OnJournalRecord, NULL);
+	printf("journal: %d records in %llu us\n", count, (unsigned long long)(TEST_COMM_GetNowUs() - begin));
+	det_journal_close(&g_journal);
+	return 0;
+}
+
+// once per update, the infer loop compares raw int8 scores against it
+static void DeriveParams(params_t *params, void *arg) {
+	(void)arg;
+	params->det.score_thresh_q = retinaface_quantize_score(&rknn_app_ctx, params->det.score_thresh);
+}
+
+static void ApplyParams(const params_t *old_params, const params_t *new_params, void *arg) {
+	(void)arg;
+	if (new_params->bitrate_kbps != old_params->bitrate_kbps)
+		venc_set_bitrate(0, new_params->bitrate_kbps);
+}
+
+static void usage(const char *name) {
+	printf("Usage: %s [-P] [-L slices] [-a] [-C] [-M] [-T layers] [-m] [-E] [-H] [-F file [-r]] [-Z rules] [-O] [-B dir] [-J file [-Q from,to]] [-R dir] [-S dir] [-X socket] [-D shm] [-p file] [-K] [-G]\n", name);
+	printf("\t-P : fetch VENC stream by 10ms polling instead of the event loop\n");
+	printf("\t-L : low latency mode, split each frame into n slices and send them as they finish\n");
+	printf("\t-a : capture audio and send it as a G.711A track in the same session\n");
+	printf("\t-C : scale the model input with OpenCV on the CPU instead of VPSS\n");
+	printf("\t-M : no motion gate, run the detector on every frame\n");
+	printf("\t-T : 2-4 temporal SVC layers, lower frame rates on /live/0/t<n> and /live/0/auto\n");
+	printf("\t-m : memory saving plan: VI->VENC wrap buffer, shared VENC refs, minimal VI depths\n");
+	printf("\t-E : face-priority exposure, AE grid weights follow the detected faces\n");
+	printf("\t-H : no camera health checks (defocus, occlusion, exposure, noise)\n");
+	printf("\t-F : run detection on an H.264/H.265 Annex-B file through VDEC instead of the camera\n");
+	printf("\t-r : with -F, decode at 30fps instead of as fast as the NPU allows\n");
+	printf("\t-Z : zone/tripwire rules file, enter/exit/cross events for tracked faces\n");
+	printf("\t-O : overlay the occupancy heatmap on the stream (HEATMAP_DIR=dir also exports it)\n");
+	printf("\t-B : save the best face crop of every track to dir as JPEG when the track ends\n");
+	printf("\t-J : keep every tracked detection in a preallocated ring file (128MB, ~a week)\n");
+	printf("\t-Q : with -J, print the records between two unix times (optionally in zone mask) and exit\n");
+	printf("\t-R : record the H.264 stream to dir in 64MB segments, written behind with O_DIRECT\n");
+	printf("\t-S : full sensor resolution JPEG to dir on SIGUSR1 and zone enter/cross (SNAPSHOT_* env)\n");
+	printf("\t-X : share 720x480 NV12 frames with local processes as DMA-buf fds on this Unix socket\n");
+	printf("\t-D : publish every detection pass to shared memory, e.g. %s (det_shm_client.h)\n",
+	       DET_SHM_DEFAULT_NAME);
+	printf("\t-p : key = value file of score_thresh, nms_iou, bitrate_kbps, infer_interval_ms, reloaded on write\n");
+	printf("\t-K : every 10s, time one crop mosaic inference over the tracked faces against one per face\n");
+	printf("\t-G : between full-frame passes only re-detect around the tracks, on a 1080p VI channel (ROI_* env);\n"
+	       "\t     with -F, score that policy against a full-frame pass on every frame\n");
+}
+
+static void DumpStats() {
+	RK_U64 count = g_fetch_count.exchange(0, std::memory_order_relaxed);
+	RK_U64 latency = g_fetch_latency_us.exchange(0, std::memory_order_relaxed);
+	RK_U64 first_slice = g_first_slice_latency_us.exchange(0, std::memory_order_relaxed);
+	if (count)
+		printf("venc fetch (%s): %llu frames, avg capture->fetch %llu us, capture->first slice %llu us\n",
+		       g_legacy_poll ? "poll" : "epoll", (unsigned long long)count,
+		       (unsigned long long)(latency / count), (unsigned long long)(first_slice / count));
+	venc_stream_dump_stats(&g_venc_reader);
+	if (g_audio_enable)
+		audio_dump_stats();
+	if (g_svc_ready)
+		svc_stream_dump_stats(&g_svc);
+	if (g_face_ae_ready)
+		printf("face ae: %s, %u pushes, %u errors\n", g_face_ae.face_mode ? "faces" : "default",
+		       g_face_ae.pushes, g_face_ae.push_errors);
+	if (g_health_ready)
+		cam_health_dump_stats(&g_health);
+	printf("tracker: %u created, %u ended, %u dropped\n", g_tracker.created, g_tracker.ended,
+	       g_tracker.dropped);
+	if (g_zones_ready)
+		zone_dump_stats(&g_zones);
+	if (g_heatmap_ready)
+		heatmap_dump_stats(&g_heatmap);
+	if (g_best_shot_ready)
+		best_shot_dump_stats(&g_best_shot);
+	if (g_journal_ready)
+		det_journal_dump_stats(&g_journal);
+	if (g_storage_ready)
+		storage_writer_dump_stats(&g_storage);
+	if (g_snapshot_ready)
+		snapshot_dump_stats(&g_snapshot);
+	if (g_share_ready)
+		frame_share_dump_stats(&g_share);
+	if (g_det_shm_ready)
+		det_shm_dump_stats(&g_det_shm);
+	if (g_params_ready)
+		param_store_dump(&g_params);
+	if (g_mosaic_ready)
+		crop_mosaic_dump_stats(&g_mosaic);
+	if (g_roi_ready)
+		roi_sched_dump_stats(&g_roi);
+	if (g_dwell_ready)
+		dwell_dump_stats(&g_dwell, g_zones_ready ? &g_zones : NULL, DWELL_REPORT_SEC);
+	if (g_gate_ready)
+		printf("motion gate (%s): %u triggers, %u skipped, %u occluded\n",
+		       g_gate.backend == MOTION_GATE_IVS ? "ivs" : "soft", g_gate.triggered,
+		       g_gate_skipped.exchange(0, std::memory_order_relaxed),
+		       g_gate_occluded.exchange(0, std::memory_order_relaxed));
+	rt_sched_dump_stats();
+}
+
+// vi/venc buffers from the config, plus what is allocated already: the NPU and the VPSS pools if there is a VPSS
+static void PlanMemory(const mem_plan_cfg_t *cfg, RK_U64 npu_bytes, mem_plan_t *plan) {
+	mem_plan_compute(cfg, plan);
+	mem_plan_add(plan, "npu", npu_bytes);
+	if (g_vpss_ready)
+		mem_plan_add(plan, "vpss pools", vpss_node_pool_bytes(&g_vpss));
+}
+
 int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "PL:aCMT:mEHF:rZ:OB:J:Q:R:S:X:D:p:KGh")) != -1) {
+		switch (opt) {
+		case 'P':
+			g_legacy_poll = true;
+			break;
+		case 'L':
+			g_low_latency_slices = atoi(optarg);
+			// more slices than the reader holds would drop every frame
+			if (g_low_latency_slices < 0 || g_low_latency_slices > VENC_STREAM_MAX_PACKS) {
+				printf("-L %s: slices must be 0..%d\n", optarg, VENC_STREAM_MAX_PACKS);
+				return -1;
+			}
+			break;
+		case 'a':
+			g_audio_enable = true;
+			break;
+		case 'C':
+			g_cpu_scale = true;
+			break;
+		case 'M':
+			g_gate_enable = false;
+			break;
+		case 'T':
+			g_svc_layers = atoi(optarg);
+			break;
+		case 'm':
+			g_mem_save = true;
+			break;
+		case 'E':
+			g_face_ae_enable = true;
+			break;
+		case 'H':
+			g_health_enable = false;
+			break;
+		case 'F':
+			g_ingest_path = optarg;
+			break;
+		case 'r':
+			g_ingest_realtime = true;
+			break;
+		case 'Z':
+			g_zone_path = optarg;
+			break;
+		case 'O':
+			g_heatmap_osd = true;
+			break;
+		case 'B':
+			g_best_shot_dir = optarg;
+			break;
+		case 'J':
+			g_journal_path = optarg;
+			break;
+		case 'Q':
+			g_journal_query = optarg;
+			break;
+		case 'R':
+			g_record_dir = optarg;
+			break;
+		case 'S':
+			g_snapshot_dir = optarg;
+			break;
+		case 'X':
+			g_share_path = optarg;
+			break;
+		case 'D':
+			g_det_shm_name = optarg;
+			break;
+		case 'p':
+			g_params_path = optarg;
+			break;
+		case 'K':
+			g_mosaic_bench = true;
+			break;
+		case 'G':
+			g_roi_enable = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	if (g_journal_path && g_journal_query)
+		return RunJournalQuery(g_journal_path, g_journal_query);
+
   system("RkLunch-stop.sh");
 	RK_S32 s32Ret = 0; 
 
 	int width    = DISP_WIDTH;
     int height   = DISP_HEIGHT;
+
+	// realtime profile: stream > infer > log
+	rt_sched_profile_t rt_profile;
+	rt_sched_profile_default(&rt_profile);
+	rt_sched_profile_from_env(&rt_profile);
+	rt_sched_init(&rt_profile);
+	rt_sched_apply_current(RT_STAGE_LOG);
+
+	// everything from here on is counted against the memory plan
+	mem_plan_t mem_plan;
+	mem_plan_mark_start(&mem_plan);
 	
 	// Rknn model
 	const char *model_path = "./model/retinaface.rknn";
@@ -164,14 +1134,26 @@ int main(int argc, char *argv[]) {
 		RK_LOGE("rknn model init fail!");
 		return -1;
 	}
+	rknn_mem_size npu_mem;
+	memset(&npu_mem, 0, sizeof(npu_mem));
+	rknn_query(rknn_app_ctx.rknn_ctx, RKNN_QUERY_MEM_SIZE, &npu_mem, sizeof(npu_mem));
+	if (g_ingest_path)
+		return RunFileIngest(g_ingest_path);
 
 	// rkaiq init 
-	RK_BOOL multi_sensor = RK_FALSE;	
 	const char *iq_dir = "/etc/iqfiles";
 	rk_aiq_working_mode_t hdr_mode = RK_AIQ_WORKING_MODE_NORMAL;
 	//hdr_mode = RK_AIQ_WORKING_MODE_ISP_HDR2;
-	SAMPLE_COMM_ISP_Init(0, hdr_mode, multi_sensor, iq_dir);
-	SAMPLE_COMM_ISP_Run(0);
+	isp_init(0, hdr_mode, iq_dir);
+	isp_run();
+
+	if (g_face_ae_enable && isp_get_ctx()) {
+		face_ae_cfg_t face_ae_cfg;
+		face_ae_ops_t face_ae_ops;
+		face_ae_cfg_default(&face_ae_cfg);
+		face_ae_ops_rkaiq(&face_ae_ops, isp_get_ctx());
+		g_face_ae_ready = face_ae_init(&g_face_ae, &face_ae_cfg, &face_ae_ops, width, height) == 0;
+	}
 
 	// rkmpi init
 	if (RK_MPI_SYS_Init() != RK_SUCCESS) {
@@ -183,16 +1165,226 @@ int main(int argc, char *argv[]) {
 	g_rtsplive = create_rtsp_demo(554);
 	g_rtsp_session = rtsp_new_session(g_rtsplive, "/live/0");
 	rtsp_set_video(g_rtsp_session, RTSP_CODEC_ID_VIDEO_H264, NULL, 0);
-	rtsp_sync_video_ts(g_rtsp_session, rtsp_get_reltime(), rtsp_get_ntptime());
+	if (g_audio_enable) {
+		audio_cfg_t audio_cfg;
+		audio_cfg_default(&audio_cfg);
+		if (audio_init(&audio_cfg, g_rtsp_session) != 0) {
+			RK_LOGE("audio init fail, streaming video only");
+			audio_deinit();
+			g_audio_enable = false;
+		}
+	}
+	// one reference for both tracks, VI and AI both stamp with CLOCK_MONOTONIC
+	uint64_t sync_ts = rtsp_get_reltime();
+	uint64_t sync_ntp = rtsp_get_ntptime();
+	rtsp_sync_video_ts(g_rtsp_session, sync_ts, sync_ntp);
+	if (g_svc_layers > 0) {
+		g_svc_ready = svc_stream_init(&g_svc, g_rtsplive, "/live/0", g_svc_layers, RK_VIDEO_ID_AVC) == 0;
+		if (g_svc_ready)
+			svc_stream_sync_ts(&g_svc, sync_ts, sync_ntp);
+		else
+			svc_stream_deinit(&g_svc);
+	}
+	if (g_audio_enable)
+		rtsp_sync_audio_ts(g_rtsp_session, sync_ts, sync_ntp);
+
+	// vpss: vi1 -> model input, scaled and converted in hardware
+	if (!g_cpu_scale) {
+		vpss_output_cfg_t vpss_out[3];
+		memset(vpss_out, 0, sizeof(vpss_out));
+		vpss_out[VPSS_OUT_MODEL].name = "model";
+		vpss_out[VPSS_OUT_MODEL].width = rknn_app_ctx.model_width;
+		vpss_out[VPSS_OUT_MODEL].height = rknn_app_ctx.model_height;
+		vpss_out[VPSS_OUT_MODEL].format = RK_FMT_BGR888;
+		vpss_out[VPSS_OUT_MODEL].rotation = ROTATION_0;
+		vpss_out[VPSS_OUT_MODEL].depth = 1;
+		vpss_out[VPSS_OUT_MODEL].pool_blk_cnt = 2;
+		vpss_out[VPSS_OUT_GATE].name = "gate";
+		vpss_out[VPSS_OUT_GATE].width = GATE_WIDTH;
+		vpss_out[VPSS_OUT_GATE].height = GATE_HEIGHT;
+		vpss_out[VPSS_OUT_GATE].format = RK_FMT_YUV420SP;
+		vpss_out[VPSS_OUT_GATE].rotation = ROTATION_0;
+		vpss_out[VPSS_OUT_GATE].depth = 1;
+		vpss_out[VPSS_OUT_GATE].pool_blk_cnt = 2;
+		vpss_out[VPSS_OUT_SHARE].name = "share";
+		vpss_out[VPSS_OUT_SHARE].width = width;
+		vpss_out[VPSS_OUT_SHARE].height = height;
+		vpss_out[VPSS_OUT_SHARE].format = RK_FMT_YUV420SP;
+		vpss_out[VPSS_OUT_SHARE].rotation = ROTATION_0;
+		vpss_out[VPSS_OUT_SHARE].depth = 1;
+		vpss_out[VPSS_OUT_SHARE].pool_blk_cnt = SHARE_POOL_BLK_CNT;
+		g_vpss_ready = vpss_node_create(&g_vpss, VPSS_GRP_ANALYTICS, width, height, vpss_out,
+		                                g_share_path ? 3 : 2) == 0;
+	}
+
+	// memory plan: vi0 feeds venc only, vi1 feeds vpss or is read directly
+	RK_CODEC_ID_E enCodecType = RK_VIDEO_ID_AVC;
+	mem_plan_cfg_t mem_cfg;
+	mem_plan_cfg_default(&mem_cfg, width, height);
+	mem_plan_cfg_from_env(&mem_cfg);
+	mem_cfg.codec = enCodecType;
+	// -B reads vi1 next to the VPSS bind, for faces at full resolution
+	mem_cfg.vi_role[1] = g_vpss_ready && !g_best_shot_dir ? MEM_PLAN_VI_BIND : MEM_PLAN_VI_USER;
+	mem_cfg.save = g_mem_save;
+	PlanMemory(&mem_cfg, npu_mem.total_dma_allocated_size, &mem_plan);
 
 	// vi init
 	vi_dev_init();
-	vi_chn_init(0, width, height);
-	vi_chn_init(1, width, height);
+	vi_chn_init_ex(0, width, height, mem_plan.vi[0].buf_cnt, mem_plan.vi[0].depth, mem_plan.vi[0].wrap_line);
+	vi_chn_init_ex(1, width, height, mem_plan.vi[1].buf_cnt, mem_plan.vi[1].depth, mem_plan.vi[1].wrap_line);
+
+	if (g_vpss_ready && vpss_node_bind_vi(&g_vpss, 0, 1) != 0) {
+		// vi1 was sized for a bound consumer and the VPSS pools are gone: plan it for direct reads and reopen it
+		vpss_node_destroy(&g_vpss);
+		g_vpss_ready = false;
+		RK_MPI_VI_DisableChn(0, 1);
+		mem_cfg.vi_role[1] = MEM_PLAN_VI_USER;
+		PlanMemory(&mem_cfg, npu_mem.total_dma_allocated_size, &mem_plan);
+		vi_chn_init_ex(1, width, height, mem_plan.vi[1].buf_cnt, mem_plan.vi[1].depth, mem_plan.vi[1].wrap_line);
+	}
+	if (!g_cpu_scale && !g_vpss_ready)
+		printf("vpss unavailable, scaling on the CPU\n");
+
+	// frame export: clients map the VPSS share output buffers, nothing is copied
+	if (g_share_path && g_vpss_ready) {
+		frame_share_cfg_t share_cfg;
+		frame_share_cfg_default(&share_cfg);
+		share_cfg.path = g_share_path;
+		share_cfg.max_slots = SHARE_POOL_BLK_CNT - 2;
+		share_cfg.source_fd = vpss_node_get_fd(&g_vpss, VPSS_OUT_SHARE);
+		share_cfg.source = ShareFrameReady;
+		share_cfg.release = ShareFrameRelease;
+		g_share_ready = frame_share_start(&g_share, &share_cfg) == 0;
+	} else if (g_share_path) {
+		printf("frame share needs vpss, disabled\n");
+	}
+
+	// motion gate in front of the NPU, IVS if possible
+	if (g_gate_enable) {
+		motion_gate_cfg_t gate_cfg;
+		if (g_vpss_ready)
+			motion_gate_cfg_default(&gate_cfg, GATE_WIDTH, GATE_HEIGHT);
+		else
+			motion_gate_cfg_default(&gate_cfg, width, height);
+		gate_cfg.rois = g_roi_enable;
+		g_gate_ready = motion_gate_init(&g_gate, &gate_cfg) == 0;
+	}
+
+	// camera health once a second on the gate-sized frame, decimated to 90x60
+	if (g_health_enable) {
+		cam_health_cfg_t health_cfg;
+		if (g_vpss_ready)
+			cam_health_cfg_default(&health_cfg, GATE_WIDTH, GATE_HEIGHT, 4);
+		else
+			cam_health_cfg_default(&health_cfg, width, height, 8);
+		health_cfg.cb = OnCamHealthEvent;
+		g_health_ready = cam_health_init(&g_health, &health_cfg) == 0;
+	}
+
+	// face tracks in display coordinates, zone rules on top
+	tracker_cfg_t tracker_cfg;
+	tracker_cfg_default(&tracker_cfg);
+	if (g_best_shot_dir) {
+		best_shot_cfg_t best_shot_cfg;
+		best_shot_cfg_default(&best_shot_cfg);
+		best_shot_cfg.venc_chn = BEST_SHOT_VENC_CHN;
+		best_shot_cfg.dir = g_best_shot_dir;
+		g_best_shot_ready = best_shot_init(&g_best_shot, &best_shot_cfg) == 0;
+		if (g_best_shot_ready) {
+			tracker_cfg.on_end = best_shot_track_end;
+			tracker_cfg.cb_arg = &g_best_shot;
+		}
+	}
+	tracker_init(&g_tracker, &tracker_cfg);
+	if (g_mosaic_bench || g_roi_enable) {
+		crop_mosaic_cfg_t mosaic_cfg;
+		crop_mosaic_cfg_default(&mosaic_cfg, rknn_app_ctx.model_width, rknn_app_ctx.model_height);
+		g_mosaic_ready = crop_mosaic_init(&g_mosaic, &mosaic_cfg) == 0;
+	}
+	if (g_zone_path) {
+		zone_cfg_t zone_cfg;
+		zone_cfg_default(&zone_cfg, width, height);
+		zone_cfg.cb = OnZoneEvent;
+		if (zone_init(&g_zones, &zone_cfg) == 0 && zone_load_file(&g_zones, g_zone_path) > 0)
+			g_zones_ready = true;
+		else
+			zone_deinit(&g_zones);
+	}
+	dwell_cfg_t dwell_cfg;
+	dwell_cfg_default(&dwell_cfg);
+	g_dwell_ready = dwell_init(&g_dwell, &dwell_cfg) == 0;
+	heatmap_cfg_t heatmap_cfg;
+	heatmap_cfg_default(&heatmap_cfg, width, height);
+	g_heatmap_ready = heatmap_init(&g_heatmap, &heatmap_cfg) == 0;
+	g_heatmap_dir = getenv("HEATMAP_DIR");
+	if (g_journal_path) {
+		det_journal_cfg_t journal_cfg;
+		det_journal_cfg_default(&journal_cfg);
+		g_journal_ready = det_journal_open(&g_journal, g_journal_path, &journal_cfg) == 0;
+	}
+	if (g_det_shm_name)
+		g_det_shm_ready = det_shm_open(&g_det_shm, g_det_shm_name, width, height) == 0;
+	// recorder segments and journal flushes share one low priority writer thread
+	if (g_record_dir || g_journal_ready) {
+		storage_writer_cfg_t storage_cfg;
+		storage_writer_cfg_default(&storage_cfg);
+		storage_cfg.dir = g_record_dir;
+		if (g_journal_ready) {
+			storage_cfg.idle = JournalSyncJob;
+			storage_cfg.idle_arg = &g_journal;
+			storage_cfg.idle_ms = JOURNAL_SYNC_SEC * 1000;
+		}
+		g_storage_ready = storage_writer_start(&g_storage, &storage_cfg) == 0;
+	}
+	// stills on their own VI/VENC channels, opened by the first request
+	if (g_snapshot_dir) {
+		snapshot_cfg_t snapshot_cfg;
+		snapshot_cfg_default(&snapshot_cfg);
+		snapshot_cfg_from_env(&snapshot_cfg);
+		snapshot_cfg.dir = g_snapshot_dir;
+		snapshot_cfg.cb = OnSnapshot;
+		g_snapshot_ready = snapshot_start(&g_snapshot, &snapshot_cfg) == 0;
+		if (g_snapshot_ready && snapshot_cfg.standby_fps > 0)
+			mem_plan_add(&mem_plan, "snapshot", snapshot_open_bytes(&snapshot_cfg));
+	}
+	// re-detection windows come from their own VI channel, well above the 720x480 of vi1
+	if (g_roi_enable && g_mosaic_ready) {
+		roi_sched_cfg_t roi_cfg;
+		roi_sched_cfg_default(&roi_cfg);
+		roi_sched_cfg_from_env(&roi_cfg);
+		if (g_snapshot_ready && g_snapshot.cfg.vi_chn == roi_cfg.vi_chn) {
+			printf("roi: vi%d already takes snapshots, set ROI_VI_CHN or SNAPSHOT_VI_CHN\n", roi_cfg.vi_chn);
+		} else if (vi_chn_init_fps(roi_cfg.vi_chn, roi_cfg.width, roi_cfg.height, ROI_SCHED_VI_BUF_CNT, 1,
+		                           roi_cfg.fps) == 0) {
+			roi_sched_init(&g_roi, &roi_cfg);
+			mem_plan_add(&mem_plan, "roi vi", roi_sched_source_bytes(&roi_cfg));
+			g_roi_ready = true;
+		} else {
+			RK_MPI_VI_DisableChn(0, roi_cfg.vi_chn);
+		}
+	}
 	
 	// venc init
-	RK_CODEC_ID_E enCodecType = RK_VIDEO_ID_AVC;
-	venc_init(0, width, height, enCodecType);
+	venc_init_ex(0, width, height, enCodecType, mem_plan.venc.stream_buf_cnt, mem_plan.venc.buf_size,
+	             mem_plan.venc.wrap_line, mem_plan.venc.ref_share);
+	if (g_low_latency_slices > 0)
+		venc_set_low_latency(0, width, height, g_low_latency_slices);
+	// after -L: TSVC is P-only as well, and replaces its NORMALP gop
+	if (g_svc_ready && venc_enable_svc(0, g_svc_layers) != 0) {
+		svc_stream_deinit(&g_svc);
+		g_svc_ready = false;
+	}
+	// after the encoder exists: a bitrate in the file is applied right away
+	if (g_params_path) {
+		param_store_cfg_t params_cfg;
+		params_t params;
+		param_store_cfg_default(&params_cfg);
+		params_cfg.path = g_params_path;
+		params_cfg.derive = DeriveParams;
+		params_cfg.apply = ApplyParams;
+		params_default(&params);
+		g_params_ready = param_store_init(&g_params, &params_cfg, &params) == 0;
+	}
 
 	// bind vi to venc	
 	stSrcChn.enModId = RK_ID_VI;
@@ -209,34 +1401,135 @@ int main(int argc, char *argv[]) {
 		return -1;
 	}
 			
+	// heatmap thumbnail in the top right corner of the stream
+	if (g_heatmap_osd && g_heatmap_ready)
+		heatmap_osd_attach(&g_heatmap, HEATMAP_RGN_HANDLE, 0,
+		                   width - g_heatmap.gw * heatmap_cfg.osd_scale - 16, 16);
+
+	venc_stream_reader_init(&g_venc_reader, 0);
+	venc_stream_add_sink(&g_venc_reader, RtspVideoSink, NULL);
+	if (g_svc_ready)
+		venc_stream_add_sink(&g_venc_reader, svc_stream_sink, &g_svc);
+	if (g_storage_ready && g_record_dir)
+		venc_stream_add_sink(&g_venc_reader, RecordVideoSink, &g_storage);
+
 	printf("init success\n");	
+	mem_plan_report(&mem_plan);
+	mem_plan_verify(&mem_plan);
+
+	// SIGINT/SIGTERM/SIGUSR1/SIGHUP are only taken by the main thread via sigtimedwait()
+	sigset_t quit_set;
+	sigemptyset(&quit_set);
+	sigaddset(&quit_set, SIGINT);
+	sigaddset(&quit_set, SIGTERM);
+	sigaddset(&quit_set, SIGUSR1);
+	sigaddset(&quit_set, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &quit_set, NULL);
 	
 	pthread_t main_thread;
-	pthread_create(&main_thread, NULL, GetMediaBuffer, NULL);
+	rt_sched_thread_create(&main_thread, RT_STAGE_STREAM, GetMediaBuffer, NULL);
 	pthread_t retina_thread;
-	pthread_create(&retina_thread, NULL, RetinaProcessBuffer, NULL);
+	rt_sched_thread_create(&retina_thread, RT_STAGE_INFER, RetinaProcessBuffer, NULL);
+	pthread_t audio_thread;
+	if (g_audio_enable)
+		rt_sched_thread_create(&audio_thread, RT_STAGE_AUDIO, audio_stream_thread, NULL);
 	
-	
-	while (1) {		
-		usleep(50000);
+	bool mem_locked = false;
+	int tick = 0;
+	struct timespec wait_ts = {1, 0};
+	int sig;
+	while ((sig = sigtimedwait(&quit_set, NULL, &wait_ts)) != SIGINT && sig != SIGTERM) {
+		if (sig == SIGUSR1) {
+			if (g_snapshot_ready)
+				printf("snapshot %d requested\n", snapshot_request(&g_snapshot, NULL, NULL));
+			continue;
+		}
+		if (sig == SIGHUP) {
+			if (g_params_ready)
+				param_store_reload(&g_params);
+			continue;
+		}
+		// warm-up done once the first inference has run, lock everything in RAM
+		if (!mem_locked && rt_sched_stage_runs(RT_STAGE_INFER) > 0) {
+			rt_sched_lock_memory();
+			if (g_journal_ready)
+				det_journal_unlock(&g_journal);
+			mem_locked = true;
+		}
+		++tick;
+		if (g_params_ready)
+			param_store_poll(&g_params);
+		// journal pages go to the card from the writer thread, or from here, never from the pipeline
+		if (g_journal_ready && !g_storage_ready && tick % JOURNAL_SYNC_SEC == 0)
+			det_journal_sync(&g_journal);
+		if (g_heatmap_ready && g_heatmap_dir)
+			heatmap_export_snapshot(&g_heatmap, g_heatmap_dir);
+		if (tick % 10 == 0)
+			DumpStats();
 	}
+	printf("exit...\n");
 
+	g_quit = true;
+	if (!g_legacy_poll)
+		event_loop_stop(&g_stream_loop);
 	pthread_join(main_thread, NULL);
 	pthread_join(retina_thread, NULL);
+	if (g_audio_enable) {
+		audio_stop();
+		pthread_join(audio_thread, NULL);
+		audio_deinit();
+	}
 
 	RK_MPI_SYS_UnBind(&stSrcChn, &stvencChn);
+	if (g_gate_ready)
+		motion_gate_deinit(&g_gate);
+	if (g_health_ready)
+		cam_health_deinit(&g_health);
+	if (g_dwell_ready)
+		dwell_deinit(&g_dwell);
+	if (g_heatmap_ready)
+		heatmap_deinit(&g_heatmap);
+	if (g_best_shot_ready) {
+		// faces still in view get their shot too
+		tracker_flush(&g_tracker);
+		best_shot_deinit(&g_best_shot);
+	}
+	if (g_snapshot_ready)
+		snapshot_stop(&g_snapshot);
+	if (g_share_ready)
+		frame_share_stop(&g_share);
+	if (g_storage_ready)
+		storage_writer_stop(&g_storage);
+	if (g_journal_ready)
+		det_journal_close(&g_journal);
+	if (g_det_shm_ready)
+		det_shm_close(&g_det_shm);
+	if (g_params_ready)
+		param_store_deinit(&g_params);
+	if (g_mosaic_ready)
+		crop_mosaic_deinit(&g_mosaic);
+	if (g_zones_ready)
+		zone_deinit(&g_zones);
+	if (g_vpss_ready)
+		vpss_node_destroy(&g_vpss);
 	RK_MPI_VI_DisableChn(0, 0);
 	RK_MPI_VI_DisableChn(0, 1);
+	if (g_roi_ready)
+		RK_MPI_VI_DisableChn(0, g_roi.cfg.vi_chn);
 	
 	RK_MPI_VENC_StopRecvFrame(0);
 	RK_MPI_VENC_DestroyChn(0);
+	if (g_svc_ready)
+		svc_stream_deinit(&g_svc);
 	
 	RK_MPI_VI_DisableDev(0);
 
 	RK_MPI_SYS_Exit();
 
 	// Stop RKAIQ
-	SAMPLE_COMM_ISP_Stop(0);
+	if (g_face_ae_ready)
+		face_ae_restore(&g_face_ae);
+	isp_stop();
 
 	// Release rknn model
     release_retinaface_model(&rknn_app_ctx);	
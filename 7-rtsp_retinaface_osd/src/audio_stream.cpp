@@ -0,0 +1,260 @@
+/*****************************************************************************
+* | Function    :   Audio capture, G.711 encoding and RTSP audio track
+*
+******************************************************************************/
+
+#include <sys/eventfd.h>
+#include <atomic>
+
+#include "luckfox_mpi.h"
+#include "audio_stream.h"
+#include "rt_sched.h"
+
+#define AUDIO_DEV_ID 0
+#define AUDIO_AI_CHN 0
+#define AUDIO_AENC_CHN 0
+
+static audio_cfg_t g_audio_cfg;
+static rtsp_session_handle g_audio_session = NULL;
+static volatile bool g_audio_quit = false;
+static bool g_audio_bound = false;
+
+// audio thread -> stream thread, single producer / single consumer
+typedef struct {
+	RK_U64 pts;
+	RK_U32 len;
+	uint8_t data[AUDIO_TX_FRAME_BYTES];
+} audio_tx_frame_t;
+
+static audio_tx_frame_t *g_audio_tx = NULL;
+static RK_U32 g_audio_tx_mask = 0;
+static std::atomic<RK_U32> g_audio_tx_head(0);	// next slot the audio thread fills
+static std::atomic<RK_U32> g_audio_tx_tail(0);	// next slot the stream thread sends
+static int g_audio_tx_fd = -1;
+
+static RK_U32 g_audio_frames = 0;
+static RK_U32 g_audio_bytes = 0;
+static RK_U32 g_audio_late = 0;	// frames older than the ai ring when fetched
+static RK_U32 g_audio_dropped = 0;	// tx ring full or frame too big
+
+void audio_cfg_default(audio_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->card_name = "hw:0,0";
+	cfg->sample_rate = 8000;
+	cfg->channels = 2;
+	cfg->samples_per_frame = 160;
+	cfg->ai_frame_num = 4;
+	cfg->ai_usr_depth = 2;
+	cfg->aenc_buf_count = 4;
+	cfg->tx_depth = 8;
+	cfg->rtsp_codec = RTSP_CODEC_ID_AUDIO_G711A;
+}
+
+static int audio_ai_init(const audio_cfg_t *cfg) {
+	RK_S32 s32Ret;
+	AIO_ATTR_S aiAttr;
+	AI_CHN_PARAM_S aiParam;
+
+	memset(&aiAttr, 0, sizeof(aiAttr));
+	snprintf((char *)aiAttr.u8CardName, sizeof(aiAttr.u8CardName), "%s", cfg->card_name);
+	aiAttr.soundCard.channels = cfg->channels;
+	aiAttr.soundCard.sampleRate = cfg->sample_rate;
+	aiAttr.soundCard.bitWidth = AUDIO_BIT_WIDTH_16;
+	aiAttr.enBitwidth = AUDIO_BIT_WIDTH_16;
+	aiAttr.enSamplerate = (AUDIO_SAMPLE_RATE_E)cfg->sample_rate;
+	aiAttr.enSoundmode = AUDIO_SOUND_MODE_MONO;
+	aiAttr.u32FrmNum = cfg->ai_frame_num;
+	aiAttr.u32PtNumPerFrm = cfg->samples_per_frame;
+	aiAttr.u32EXFlag = 0;
+	aiAttr.u32ChnCnt = cfg->channels;
+
+	s32Ret = RK_MPI_AI_SetPubAttr(AUDIO_DEV_ID, &aiAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_AI_SetPubAttr fail %x", s32Ret);
+		return -1;
+	}
+	s32Ret = RK_MPI_AI_Enable(AUDIO_DEV_ID);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_AI_Enable fail %x", s32Ret);
+		return -1;
+	}
+
+	memset(&aiParam, 0, sizeof(aiParam));
+	aiParam.s32UsrFrmDepth = cfg->ai_usr_depth;
+	aiParam.enLoopbackMode = AUDIO_LOOPBACK_NONE;
+	s32Ret = RK_MPI_AI_SetChnParam(AUDIO_DEV_ID, AUDIO_AI_CHN, &aiParam);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_AI_SetChnParam fail %x", s32Ret);
+		return -1;
+	}
+	s32Ret = RK_MPI_AI_EnableChn(AUDIO_DEV_ID, AUDIO_AI_CHN);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_AI_EnableChn fail %x", s32Ret);
+		return -1;
+	}
+	return 0;
+}
+
+static int audio_aenc_init(const audio_cfg_t *cfg) {
+	RK_S32 s32Ret;
+	AENC_CHN_ATTR_S aencAttr;
+	RK_CODEC_ID_E enType = cfg->rtsp_codec == RTSP_CODEC_ID_AUDIO_G711U ?
+	                       RK_AUDIO_ID_PCM_MULAW : RK_AUDIO_ID_PCM_ALAW;
+
+	memset(&aencAttr, 0, sizeof(aencAttr));
+	aencAttr.enType = enType;
+	aencAttr.u32BufCount = cfg->aenc_buf_count;
+	aencAttr.u32Depth = cfg->aenc_buf_count;
+	aencAttr.stCodecAttr.enType = enType;
+	aencAttr.stCodecAttr.enBitwidth = AUDIO_BIT_WIDTH_16;
+	aencAttr.stCodecAttr.u32Channels = 1;
+	aencAttr.stCodecAttr.u32SampleRate = cfg->sample_rate;
+
+	s32Ret = RK_MPI_AENC_CreateChn(AUDIO_AENC_CHN, &aencAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_AENC_CreateChn fail %x", s32Ret);
+		return -1;
+	}
+	return 0;
+}
+
+int audio_init(const audio_cfg_t *cfg, rtsp_session_handle session) {
+	printf("========%s========\n", __func__);
+	MPP_CHN_S stAiChn, stAencChn;
+
+	g_audio_cfg = *cfg;
+	g_audio_session = session;
+	g_audio_quit = false;
+
+	// power of 2 so the free running indices wrap cleanly
+	RK_U32 depth = 1;
+	while (depth < cfg->tx_depth)
+		depth <<= 1;
+	g_audio_tx = (audio_tx_frame_t *)calloc(depth, sizeof(audio_tx_frame_t));
+	g_audio_tx_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!g_audio_tx || g_audio_tx_fd < 0) {
+		printf("audio: tx ring of %u frames fail %s\n", depth, strerror(errno));
+		return -1;
+	}
+	g_audio_tx_mask = depth - 1;
+	g_audio_tx_head.store(0, std::memory_order_relaxed);
+	g_audio_tx_tail.store(0, std::memory_order_relaxed);
+
+	if (audio_ai_init(cfg) != 0)
+		return -1;
+	if (audio_aenc_init(cfg) != 0)
+		return -1;
+
+	stAiChn.enModId = RK_ID_AI;
+	stAiChn.s32DevId = AUDIO_DEV_ID;
+	stAiChn.s32ChnId = AUDIO_AI_CHN;
+	stAencChn.enModId = RK_ID_AENC;
+	stAencChn.s32DevId = 0;
+	stAencChn.s32ChnId = AUDIO_AENC_CHN;
+	if (RK_MPI_SYS_Bind(&stAiChn, &stAencChn) != RK_SUCCESS) {
+		RK_LOGE("bind ai to aenc failed");
+		return -1;
+	}
+	g_audio_bound = true;
+
+	rtsp_set_audio(session, cfg->rtsp_codec, NULL, 0);
+	rtsp_set_audio_sample_rate(session, cfg->sample_rate);
+	rtsp_set_audio_channels(session, 1);
+	return 0;
+}
+
+void *audio_stream_thread(void *arg) {
+	(void)arg;
+	printf("========%s========\n", __func__);
+	AUDIO_STREAM_S stStream;
+	// anything older than the whole ai ring has already been replaced by newer audio
+	RK_U64 frame_us = (RK_U64)g_audio_cfg.samples_per_frame * 1000000 / g_audio_cfg.sample_rate;
+	RK_U64 max_age_us = frame_us * g_audio_cfg.ai_frame_num;
+
+	while (!g_audio_quit) {
+		if (RK_MPI_AENC_GetStream(AUDIO_AENC_CHN, &stStream, 100) != RK_SUCCESS)
+			continue;
+
+		RK_U64 stage_begin = rt_sched_stage_begin(RT_STAGE_AUDIO);
+		void *pData = RK_MPI_MB_Handle2VirAddr(stStream.pMbBlk);
+		if (pData != RK_NULL && stStream.u32Len > 0) {
+			if (stage_begin > stStream.u64TimeStamp + max_age_us)
+				g_audio_late++;
+			RK_U32 head = g_audio_tx_head.load(std::memory_order_relaxed);
+			// full: the stream thread is behind, this frame is dropped rather than waited for
+			if (head - g_audio_tx_tail.load(std::memory_order_acquire) > g_audio_tx_mask ||
+			    stStream.u32Len > AUDIO_TX_FRAME_BYTES) {
+				g_audio_dropped++;
+			} else {
+				audio_tx_frame_t *frame = &g_audio_tx[head & g_audio_tx_mask];
+				memcpy(frame->data, pData, stStream.u32Len);
+				frame->len = stStream.u32Len;
+				frame->pts = stStream.u64TimeStamp;
+				g_audio_tx_head.store(head + 1, std::memory_order_release);
+				uint64_t one = 1;
+				if (write(g_audio_tx_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+					printf("audio: wake fail %s\n", strerror(errno));
+			}
+		}
+		RK_MPI_AENC_ReleaseStream(AUDIO_AENC_CHN, &stStream);
+		rt_sched_stage_end(RT_STAGE_AUDIO, stage_begin);
+	}
+
+	printf("\n======exit %s=======\n", __func__);
+	return NULL;
+}
+
+int audio_tx_fd() {
+	return g_audio_tx_fd;
+}
+
+void audio_tx_drain() {
+	uint64_t val;
+
+	if (g_audio_tx_fd < 0)
+		return;
+	// reset before looking at head: a frame queued after the load wakes the loop again
+	while (read(g_audio_tx_fd, &val, sizeof(val)) > 0) {
+	}
+	RK_U32 tail = g_audio_tx_tail.load(std::memory_order_relaxed);
+	RK_U32 head = g_audio_tx_head.load(std::memory_order_acquire);
+	for (; tail != head; tail++) {
+		audio_tx_frame_t *frame = &g_audio_tx[tail & g_audio_tx_mask];
+		rtsp_tx_audio(g_audio_session, frame->data, frame->len, frame->pts);
+		g_audio_frames++;
+		g_audio_bytes += frame->len;
+		g_audio_tx_tail.store(tail + 1, std::memory_order_release);
+	}
+}
+
+void audio_stop() {
+	g_audio_quit = true;
+}
+
+void audio_deinit() {
+	MPP_CHN_S stAiChn, stAencChn;
+
+	if (g_audio_bound) {
+		stAiChn.enModId = RK_ID_AI;
+		stAiChn.s32DevId = AUDIO_DEV_ID;
+		stAiChn.s32ChnId = AUDIO_AI_CHN;
+		stAencChn.enModId = RK_ID_AENC;
+		stAencChn.s32DevId = 0;
+		stAencChn.s32ChnId = AUDIO_AENC_CHN;
+		RK_MPI_SYS_UnBind(&stAiChn, &stAencChn);
+		g_audio_bound = false;
+	}
+	RK_MPI_AENC_DestroyChn(AUDIO_AENC_CHN);
+	RK_MPI_AI_DisableChn(AUDIO_DEV_ID, AUDIO_AI_CHN);
+	RK_MPI_AI_Disable(AUDIO_DEV_ID);
+	if (g_audio_tx_fd >= 0)
+		close(g_audio_tx_fd);
+	g_audio_tx_fd = -1;
+	free(g_audio_tx);
+	g_audio_tx = NULL;
+}
+
+void audio_dump_stats() {
+	printf("audio: frames=%u bytes=%u late=%u dropped=%u\n", g_audio_frames, g_audio_bytes, g_audio_late,
+	       g_audio_dropped);
+}
@@ -0,0 +1,506 @@
+/*****************************************************************************
+* | Function    :   Best-shot face capture, one scored JPEG crop per track
+*
+******************************************************************************/
+
+#include <math.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "luckfox_mpi.h"
+#include "best_shot.h"
+#include "rt_sched.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define BEST_SHOT_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define BEST_SHOT_SHARP_FULL 12		// mean |gx|+|gy| of an in-focus face
+#define BEST_SHOT_ENCODE_TIMEOUT_MS 100
+
+void best_shot_cfg_default(best_shot_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->chip = 128;
+	cfg->slots = 8;
+	cfg->min_face = 40;
+	cfg->ideal_face = 96;
+	cfg->margin = 0.25f;
+	cfg->min_score = 0.3f;
+	cfg->max_per_min = 30;
+	cfg->burst = 5;
+	cfg->venc_chn = -1;
+	cfg->qfactor = 85;
+}
+
+static RK_U32 best_shot_nv12_size(const best_shot_cfg_t *cfg) {
+	return cfg->chip * cfg->chip * 3 / 2;
+}
+
+/* slot buffers from an MB pool, so the VENC can read them without a copy */
+static int best_shot_alloc_mb(best_shot_ctx_t *bs) {
+	MB_POOL_CONFIG_S stPoolCfg;
+	memset(&stPoolCfg, 0, sizeof(stPoolCfg));
+	stPoolCfg.u64MBSize = best_shot_nv12_size(&bs->cfg);
+	stPoolCfg.u32MBCnt = bs->cfg.slots;
+	stPoolCfg.enAllocType = MB_ALLOC_TYPE_DMA;
+	stPoolCfg.enRemapMode = MB_REMAP_MODE_CACHED;
+	stPoolCfg.bPreAlloc = RK_TRUE;
+	bs->pool = RK_MPI_MB_CreatePool(&stPoolCfg);
+	if (bs->pool == MB_INVALID_POOLID) {
+		RK_LOGE("best shot: RK_MPI_MB_CreatePool fail");
+		return -1;
+	}
+	for (RK_U32 i = 0; i < bs->cfg.slots; i++) {
+		best_shot_slot_t *slot = &bs->slots[i];
+		slot->blk = RK_MPI_MB_GetMB(bs->pool, stPoolCfg.u64MBSize, RK_TRUE);
+		slot->nv12 = slot->blk ? (uint8_t *)RK_MPI_MB_Handle2VirAddr(slot->blk) : NULL;
+		if (!slot->nv12) {
+			RK_LOGE("best shot: slot %u buffer fail", i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void best_shot_free_mb(best_shot_ctx_t *bs) {
+	for (RK_U32 i = 0; i < BEST_SHOT_MAX_SLOTS; i++) {
+		if (bs->slots[i].blk)
+			RK_MPI_MB_ReleaseMB(bs->slots[i].blk);
+		bs->slots[i].blk = NULL;
+		bs->slots[i].nv12 = NULL;
+	}
+	if (bs->pool != MB_INVALID_POOLID)
+		RK_MPI_MB_DestroyPool(bs->pool);
+	bs->pool = MB_INVALID_POOLID;
+}
+
+static void *best_shot_thread(void *arg);
+
+int best_shot_init(best_shot_ctx_t *bs, const best_shot_cfg_t *cfg) {
+	pthread_mutexattr_t mutex_attr;
+
+	memset(bs, 0, sizeof(*bs));
+	bs->cfg = *cfg;
+	bs->pool = MB_INVALID_POOLID;
+	bs->cfg.chip = (bs->cfg.chip + 15) & ~15u;
+	if (bs->cfg.chip == 0)
+		bs->cfg.chip = 128;
+	if (bs->cfg.slots < 1 || bs->cfg.slots > BEST_SHOT_MAX_SLOTS)
+		bs->cfg.slots = 8;
+	if (bs->cfg.ideal_face == 0)
+		bs->cfg.ideal_face = 96;
+	if (bs->cfg.burst == 0)
+		bs->cfg.burst = 1;
+
+	RK_U32 chip = bs->cfg.chip;
+	RK_U32 nv12_size = best_shot_nv12_size(&bs->cfg);
+	bs->jpeg_cap = nv12_size;
+	bs->xs = (RK_U16 *)malloc(chip * sizeof(RK_U16));
+	bs->ys = (RK_U16 *)malloc(chip * sizeof(RK_U16));
+	bs->jpeg = (uint8_t *)malloc(bs->jpeg_cap);
+	if (!bs->xs || !bs->ys || !bs->jpeg) {
+		printf("best shot: scratch alloc failed\n");
+		best_shot_deinit(bs);
+		return -1;
+	}
+
+	if (bs->cfg.venc_chn >= 0) {
+		if (best_shot_alloc_mb(bs) == 0 &&
+		    venc_jpeg_init(bs->cfg.venc_chn, chip, chip, bs->cfg.qfactor) == 0) {
+			bs->venc_ready = true;
+		} else {
+			printf("best shot: no MJPEG venc, encoding on the CPU\n");
+			best_shot_free_mb(bs);
+		}
+	}
+	if (!bs->venc_ready) {
+		for (RK_U32 i = 0; i < bs->cfg.slots; i++) {
+			bs->slots[i].nv12 = (uint8_t *)malloc(nv12_size);
+			if (!bs->slots[i].nv12) {
+				printf("best shot: slot alloc failed\n");
+				best_shot_deinit(bs);
+				return -1;
+			}
+		}
+	}
+	bs->tokens = bs->cfg.burst;
+	bs->refill_us = TEST_COMM_GetNowUs();
+
+	// the detection thread is SCHED_FIFO, the encoder SCHED_OTHER: no inversion on the lock
+	pthread_mutexattr_init(&mutex_attr);
+	pthread_mutexattr_setprotocol(&mutex_attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&bs->lock, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
+	pthread_cond_init(&bs->cond, NULL);
+	if (rt_sched_thread_create(&bs->thread, RT_STAGE_BEST_SHOT, best_shot_thread, bs) != 0) {
+		pthread_cond_destroy(&bs->cond);
+		pthread_mutex_destroy(&bs->lock);
+		best_shot_deinit(bs);
+		return -1;
+	}
+	bs->thread_running = true;
+	printf("best shot: %u slots of %ux%u, %u bytes, %s jpeg\n", bs->cfg.slots, chip, chip,
+	       bs->cfg.slots * nv12_size, bs->venc_ready ? "venc" : "cpu");
+	return 0;
+}
+
+float best_shot_pose_score(const POINT_S *lm) {
+	// 0, 1: eyes, 2: nose, 3, 4: mouth corners
+	float ex = lm[1].s32X - lm[0].s32X;
+	float ey = lm[1].s32Y - lm[0].s32Y;
+	float eye2 = ex * ex + ey * ey;
+	if (eye2 < 4.0f)
+		return 0.0f;
+
+	// roll: tilt of the eye line, zero at 45 degrees
+	float roll = 1.0f - fabsf(atan2f(ey, ex)) / (float)(M_PI / 4);
+
+	// yaw: the nose projected on the eye line sits half way when frontal
+	float t = ((lm[2].s32X - lm[0].s32X) * ex + (lm[2].s32Y - lm[0].s32Y) * ey) / eye2;
+	float yaw = 1.0f - fabsf(t - 0.5f) * 2.0f;
+
+	// pitch: the nose sits about half way between the eye and mouth lines
+	float eye_mid_y = (lm[0].s32Y + lm[1].s32Y) * 0.5f;
+	float mouth_mid_y = (lm[3].s32Y + lm[4].s32Y) * 0.5f;
+	float span = mouth_mid_y - eye_mid_y;
+	float pitch = 0.0f;
+	if (span > 1.0f)
+		pitch = 1.0f - fabsf((lm[2].s32Y - eye_mid_y) / span - 0.5f) * 2.0f;
+
+	if (roll < 0.0f || yaw < 0.0f)
+		return 0.0f;
+	if (pitch < 0.0f)
+		pitch = 0.0f;
+	return yaw * roll * (0.5f + 0.5f * pitch);
+}
+
+RK_U32 best_shot_sharpness(const uint8_t *y, RK_U32 width, RK_U32 height, RK_U32 stride) {
+	RK_U64 sum = 0;
+
+	if (width < 2 || height < 2)
+		return 0;
+	for (RK_U32 r = 0; r + 1 < height; r++) {
+		const uint8_t *row = y + r * stride;
+		const uint8_t *next = row + stride;
+		RK_U32 x = 0;
+#if defined(__ARM_NEON)
+		// |gx| + |gy| of 16 pixels per step, flushed before a u16 lane (+4*255 per step) can overflow
+		while (x + 17 <= width) {
+			uint16x8_t acc = vdupq_n_u16(0);
+			for (int n = 0; n < 64 && x + 17 <= width; n++, x += 16) {
+				uint8x16_t c = vld1q_u8(row + x);
+				acc = vpadalq_u8(acc, vabdq_u8(c, vld1q_u8(row + x + 1)));
+				acc = vpadalq_u8(acc, vabdq_u8(c, vld1q_u8(next + x)));
+			}
+			uint32x4_t acc32 = vpaddlq_u16(acc);
+			uint64x2_t acc64 = vpaddlq_u32(acc32);
+			sum += vgetq_lane_u64(acc64, 0) + vgetq_lane_u64(acc64, 1);
+		}
+#endif
+		for (; x + 1 < width; x++)
+			sum += abs(row[x] - row[x + 1]) + abs(row[x] - next[x]);
+	}
+	return (RK_U32)(sum / ((RK_U64)(width - 1) * (height - 1)));
+}
+
+/* the face itself at native resolution; upsampling a small face would blur it and cost it the score */
+static RK_U32 best_shot_face_sharpness(const best_shot_image_t *image, const RECT_S *box) {
+	int x0 = RK_MAX((int)(box->s32X * image->sx), 0);
+	int y0 = RK_MAX((int)(box->s32Y * image->sy), 0);
+	int x1 = BEST_SHOT_MIN((int)((box->s32X + (RK_S32)box->u32Width) * image->sx), (int)image->width);
+	int y1 = BEST_SHOT_MIN((int)((box->s32Y + (RK_S32)box->u32Height) * image->sy), (int)image->height);
+	if (x1 - x0 < 2 || y1 - y0 < 2)
+		return 0;
+	return best_shot_sharpness(image->y + y0 * image->stride + x0, x1 - x0, y1 - y0, image->stride);
+}
+
+/* square NV12 chip around the box, nearest neighbour, so a squeezed frame comes out undistorted */
+static void best_shot_sample(best_shot_ctx_t *bs, const best_shot_image_t *image, const RECT_S *box,
+                             uint8_t *nv12) {
+	RK_U32 chip = bs->cfg.chip;
+	float side = RK_MAX(box->u32Width, box->u32Height) * (1.0f + 2.0f * bs->cfg.margin);
+	float x0 = box->s32X + box->u32Width * 0.5f - side * 0.5f;
+	float y0 = box->s32Y + box->u32Height * 0.5f - side * 0.5f;
+	float step = side / chip;
+
+	for (RK_U32 i = 0; i < chip; i++) {
+		int x = (int)((x0 + (i + 0.5f) * step) * image->sx);
+		int y = (int)((y0 + (i + 0.5f) * step) * image->sy);
+		bs->xs[i] = x < 0 ? 0 : BEST_SHOT_MIN((RK_U32)x, image->width - 1);
+		bs->ys[i] = y < 0 ? 0 : BEST_SHOT_MIN((RK_U32)y, image->height - 1);
+	}
+	for (RK_U32 v = 0; v < chip; v++) {
+		const uint8_t *src = image->y + bs->ys[v] * image->stride;
+		uint8_t *dst = nv12 + v * chip;
+		for (RK_U32 u = 0; u < chip; u++)
+			dst[u] = src[bs->xs[u]];
+	}
+	// one chroma pair per 2x2, from the sample of its top left pixel
+	uint8_t *dst = nv12 + chip * chip;
+	for (RK_U32 v = 0; v < chip; v += 2) {
+		const uint8_t *src = image->uv + (bs->ys[v] >> 1) * image->stride;
+		for (RK_U32 u = 0; u < chip; u += 2) {
+			const uint8_t *p = src + (bs->xs[u] & ~1u);
+			*dst++ = p[0];
+			*dst++ = p[1];
+		}
+	}
+}
+
+static best_shot_slot_t *best_shot_find(best_shot_ctx_t *bs, RK_U32 track_id) {
+	for (RK_U32 i = 0; i < bs->cfg.slots; i++) {
+		if (bs->slots[i].track_id == track_id && !bs->slots[i].queued)
+			return &bs->slots[i];
+	}
+	return NULL;
+}
+
+static void best_shot_free_slot(best_shot_slot_t *slot) {
+	slot->track_id = 0;
+	slot->score = 0.0f;
+	slot->queued = false;
+}
+
+/* slots the encoder thread is done with are free again; only the detection thread frees them */
+static void best_shot_reclaim(best_shot_ctx_t *bs) {
+	uint8_t done[BEST_SHOT_MAX_SLOTS];
+	RK_U32 count;
+
+	pthread_mutex_lock(&bs->lock);
+	count = bs->done_count;
+	memcpy(done, bs->done, count);
+	bs->done_count = 0;
+	pthread_mutex_unlock(&bs->lock);
+	for (RK_U32 i = 0; i < count; i++)
+		best_shot_free_slot(&bs->slots[done[i]]);
+}
+
+void best_shot_offer(best_shot_ctx_t *bs, const track_t *track, const best_shot_image_t *image,
+                     const POINT_S *landmarks) {
+	const RECT_S *box = &track->box;
+	if (RK_MAX(box->u32Width, box->u32Height) < bs->cfg.min_face)
+		return;
+
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	best_shot_reclaim(bs);
+
+	float size = BEST_SHOT_MIN(box->u32Width, box->u32Height) / (float)bs->cfg.ideal_face;
+	float pose = landmarks ? best_shot_pose_score(landmarks) : 0.5f;
+	float sharpness = best_shot_face_sharpness(image, box) / (float)BEST_SHOT_SHARP_FULL;
+	size = BEST_SHOT_MIN(size, 1.0f);
+	sharpness = BEST_SHOT_MIN(sharpness, 1.0f);
+	float score = track->score * (0.3f * size + 0.35f * pose + 0.35f * sharpness);
+	bs->scored++;
+
+	best_shot_slot_t *slot = best_shot_find(bs, track->id);
+	if (slot && score <= slot->score)
+		goto out;
+	if (!slot) {
+		// a free slot, else the weakest chip if this one beats it
+		slot = best_shot_find(bs, 0);
+		if (!slot) {
+			best_shot_slot_t *weakest = NULL;
+			for (RK_U32 i = 0; i < bs->cfg.slots; i++) {
+				if (!bs->slots[i].queued && (!weakest || bs->slots[i].score < weakest->score))
+					weakest = &bs->slots[i];
+			}
+			if (!weakest || weakest->score >= score) {
+				bs->rejected++;
+				goto out;
+			}
+			slot = weakest;
+			bs->evicted++;
+		}
+	} else {
+		bs->improved++;
+	}
+	slot->track_id = track->id;
+	slot->pts = track->last_pts;
+	slot->score = score;
+	slot->size = size;
+	slot->pose = pose;
+	slot->sharpness = sharpness;
+	best_shot_sample(bs, image, box, slot->nv12);
+
+out:
+	bs->cost_us += TEST_COMM_GetNowUs() - begin;
+	bs->runs++;
+}
+
+static int best_shot_encode(best_shot_ctx_t *bs, best_shot_slot_t *slot) {
+	RK_U32 chip = bs->cfg.chip;
+
+	if (bs->venc_ready) {
+		VIDEO_FRAME_INFO_S stFrame;
+		memset(&stFrame, 0, sizeof(stFrame));
+		stFrame.stVFrame.pMbBlk = slot->blk;
+		stFrame.stVFrame.u32Width = chip;
+		stFrame.stVFrame.u32Height = chip;
+		stFrame.stVFrame.u32VirWidth = chip;
+		stFrame.stVFrame.u32VirHeight = chip;
+		stFrame.stVFrame.enPixelFormat = RK_FMT_YUV420SP;
+		stFrame.stVFrame.u64PTS = slot->pts;
+		RK_MPI_SYS_MmzFlushCache(slot->blk, RK_FALSE);
+		return venc_encode_frame(bs->cfg.venc_chn, &stFrame, bs->jpeg, bs->jpeg_cap,
+		                         BEST_SHOT_ENCODE_TIMEOUT_MS);
+	}
+
+	cv::Mat nv12(chip * 3 / 2, chip, CV_8UC1, slot->nv12);
+	cv::Mat bgr;
+	std::vector<uint8_t> out;
+	std::vector<int> params;
+	params.push_back(cv::IMWRITE_JPEG_QUALITY);
+	params.push_back(bs->cfg.qfactor);
+	cv::cvtColor(nv12, bgr, cv::COLOR_YUV2BGR_NV12);
+	if (!cv::imencode(".jpg", bgr, out, params) || (int)out.size() > bs->jpeg_cap)
+		return -1;
+	memcpy(bs->jpeg, out.data(), out.size());
+	return (int)out.size();
+}
+
+static bool best_shot_take_token(best_shot_ctx_t *bs) {
+	RK_U64 now = TEST_COMM_GetNowUs();
+	bs->tokens += (now - bs->refill_us) * bs->cfg.max_per_min / 60e6f;
+	bs->refill_us = now;
+	if (bs->tokens > bs->cfg.burst)
+		bs->tokens = bs->cfg.burst;
+	if (bs->tokens < 1.0f)
+		return false;
+	bs->tokens -= 1.0f;
+	return true;
+}
+
+static void best_shot_write(best_shot_ctx_t *bs, const best_shot_t *shot) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/best_%u_%llu.jpg", bs->cfg.dir, shot->track_id,
+	         (unsigned long long)shot->pts);
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		printf("best shot: open %s failed: %s\n", path, strerror(errno));
+		return;
+	}
+	if (fwrite(shot->jpeg, 1, shot->jpeg_size, fp) != (size_t)shot->jpeg_size)
+		printf("best shot: write %s failed: %s\n", path, strerror(errno));
+	fclose(fp);
+}
+
+/* encoder thread: the slot is not touched by the detection thread while queued */
+static void best_shot_emit(best_shot_ctx_t *bs, best_shot_slot_t *slot) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	int len = best_shot_encode(bs, slot);
+
+	if (len <= 0) {
+		bs->encode_errors++;
+		return;
+	}
+	best_shot_t shot;
+	shot.track_id = slot->track_id;
+	shot.pts = slot->pts;
+	shot.score = slot->score;
+	shot.size = slot->size;
+	shot.pose = slot->pose;
+	shot.sharpness = slot->sharpness;
+	shot.jpeg = bs->jpeg;
+	shot.jpeg_size = len;
+	if (bs->cfg.dir)
+		best_shot_write(bs, &shot);
+	if (bs->cfg.cb)
+		bs->cfg.cb(&shot, bs->cfg.cb_arg);
+	bs->emitted++;
+	bs->encode_us += TEST_COMM_GetNowUs() - begin;
+}
+
+static void *best_shot_thread(void *arg) {
+	best_shot_ctx_t *bs = (best_shot_ctx_t *)arg;
+
+	pthread_mutex_lock(&bs->lock);
+	for (;;) {
+		while (!bs->quit && bs->todo_count == 0)
+			pthread_cond_wait(&bs->cond, &bs->lock);
+		if (bs->todo_count == 0)
+			break;
+		RK_U32 index = bs->todo[bs->todo_head];
+		bs->todo_head = (bs->todo_head + 1) % BEST_SHOT_MAX_SLOTS;
+		bs->todo_count--;
+		pthread_mutex_unlock(&bs->lock);
+
+		best_shot_emit(bs, &bs->slots[index]);
+
+		pthread_mutex_lock(&bs->lock);
+		bs->done[bs->done_count++] = index;
+	}
+	pthread_mutex_unlock(&bs->lock);
+	return NULL;
+}
+
+void best_shot_track_end(const track_t *track, void *arg) {
+	best_shot_ctx_t *bs = (best_shot_ctx_t *)arg;
+
+	best_shot_reclaim(bs);
+	best_shot_slot_t *slot = best_shot_find(bs, track->id);
+	if (!slot)
+		return;
+	if (slot->score < bs->cfg.min_score) {
+		best_shot_free_slot(slot);
+		return;
+	}
+	if (!best_shot_take_token(bs)) {
+		bs->limited++;
+		best_shot_free_slot(slot);
+		return;
+	}
+	// a slot is queued at most once, so the queue cannot overflow
+	slot->queued = true;
+	pthread_mutex_lock(&bs->lock);
+	bs->todo[(bs->todo_head + bs->todo_count) % BEST_SHOT_MAX_SLOTS] = slot - bs->slots;
+	bs->todo_count++;
+	pthread_cond_signal(&bs->cond);
+	pthread_mutex_unlock(&bs->lock);
+}
+
+void best_shot_dump_stats(best_shot_ctx_t *bs) {
+	RK_U32 held = 0, queued = 0;
+	for (RK_U32 i = 0; i < bs->cfg.slots; i++) {
+		held += bs->slots[i].track_id != 0;
+		queued += bs->slots[i].queued;
+	}
+	printf("best shot: %u/%u held (%u encoding), %u scored, %u improved, %u evicted, %u rejected, %u emitted, "
+	       "%u rate limited, %u encode errors, %llu us/face, %llu ms/jpeg\n",
+	       held, bs->cfg.slots, queued, bs->scored, bs->improved, bs->evicted, bs->rejected, bs->emitted,
+	       bs->limited, bs->encode_errors, (unsigned long long)(bs->runs ? bs->cost_us / bs->runs : 0),
+	       (unsigned long long)(bs->emitted ? bs->encode_us / bs->emitted / 1000 : 0));
+	bs->cost_us = 0;
+	bs->runs = 0;
+}
+
+void best_shot_deinit(best_shot_ctx_t *bs) {
+	if (bs->thread_running) {
+		pthread_mutex_lock(&bs->lock);
+		bs->quit = true;
+		pthread_cond_signal(&bs->cond);
+		pthread_mutex_unlock(&bs->lock);
+		pthread_join(bs->thread, NULL);
+		bs->thread_running = false;
+		pthread_cond_destroy(&bs->cond);
+		pthread_mutex_destroy(&bs->lock);
+	}
+	if (bs->venc_ready) {
+		RK_MPI_VENC_StopRecvFrame(bs->cfg.venc_chn);
+		RK_MPI_VENC_DestroyChn(bs->cfg.venc_chn);
+		bs->venc_ready = false;
+		best_shot_free_mb(bs);
+	} else {
+		for (RK_U32 i = 0; i < BEST_SHOT_MAX_SLOTS; i++) {
+			free(bs->slots[i].nv12);
+			bs->slots[i].nv12 = NULL;
+		}
+	}
+	free(bs->xs);
+	free(bs->ys);
+	free(bs->jpeg);
+	bs->jpeg = NULL;
+	bs->xs = bs->ys = NULL;
+}
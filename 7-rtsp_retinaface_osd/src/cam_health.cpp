@@ -0,0 +1,252 @@
+/*****************************************************************************
+* | Function    :   Camera health diagnostics on a decimated luma plane
+*
+******************************************************************************/
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <math.h>
+
+#include "luckfox_mpi.h"
+#include "cam_health.h"
+
+#define CAM_HEALTH_BASELINE_ALPHA 0.05f
+#define CAM_HEALTH_EDGE_GRADIENT 64		// pixels above this are edges, not noise
+
+static const char *g_event_names[CAM_HEALTH_EVENT_NUM] = {
+	"defocus", "occluded", "overexposed", "underexposed", "noisy",
+};
+
+const char *cam_health_event_name(cam_health_event_e event) {
+	return event < CAM_HEALTH_EVENT_NUM ? g_event_names[event] : "unknown";
+}
+
+void cam_health_cfg_default(cam_health_cfg_t *cfg, RK_U32 width, RK_U32 height, RK_U32 step) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->width = width;
+	cfg->height = height;
+	cfg->step = step;
+	cfg->debounce = 3;
+	cfg->defocus_ratio = 0.35f;
+	cfg->clip_ratio = 0.25f;
+	cfg->dark_level = 8;
+	cfg->bright_level = 247;
+	cfg->noise_sigma = 12.0f;
+	cfg->occlusion_stddev = 6.0f;
+	cfg->occlusion_diff = 20.0f;
+}
+
+int cam_health_init(cam_health_t *health, const cam_health_cfg_t *cfg) {
+	memset(health, 0, sizeof(*health));
+	health->cfg = *cfg;
+	if (cfg->step < 1)
+		health->cfg.step = 1;
+	health->dw = cfg->width / health->cfg.step;
+	health->dh = cfg->height / health->cfg.step;
+	if (health->dw < 8 || health->dh < 3) {
+		printf("cam_health: %ux%u / %u too small\n", cfg->width, cfg->height, health->cfg.step);
+		return -1;
+	}
+	health->plane = (uint8_t *)malloc(health->dw * health->dh);
+	health->prev = (uint8_t *)malloc(health->dw * health->dh);
+	if (health->plane == NULL || health->prev == NULL) {
+		cam_health_deinit(health);
+		return -1;
+	}
+	printf("cam_health: %ux%u luma\n", health->dw, health->dh);
+	return 0;
+}
+
+/* variance of the 4-neighbour Laplacian */
+static float cam_health_focus(const uint8_t *p, RK_U32 w, RK_U32 h) {
+	RK_S64 sum = 0, sum_sq = 0;
+	RK_U32 n = 0;
+
+	for (RK_U32 y = 1; y + 1 < h; y++) {
+		const uint8_t *row = p + y * w;
+		const uint8_t *up = row - w;
+		const uint8_t *down = row + w;
+		RK_U32 x = 1;
+#if defined(__ARM_NEON)
+		int32x4_t vsum = vdupq_n_s32(0);
+		int32x4_t vsq = vdupq_n_s32(0);
+		for (; x + 8 < w; x += 8) {
+			int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x)));
+			int16x8_t l = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x - 1)));
+			int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x + 1)));
+			int16x8_t u = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + x)));
+			int16x8_t d = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + x)));
+			int16x8_t lap = vsubq_s16(vshlq_n_s16(c, 2), vaddq_s16(vaddq_s16(l, r), vaddq_s16(u, d)));
+			vsum = vpadalq_s16(vsum, lap);
+			vsq = vmlal_s16(vsq, vget_low_s16(lap), vget_low_s16(lap));
+			vsq = vmlal_s16(vsq, vget_high_s16(lap), vget_high_s16(lap));
+			n += 8;
+		}
+		// one row stays far below int32 overflow
+		sum += vgetq_lane_s32(vsum, 0) + vgetq_lane_s32(vsum, 1) + vgetq_lane_s32(vsum, 2) +
+		       vgetq_lane_s32(vsum, 3);
+		sum_sq += (RK_S64)vgetq_lane_s32(vsq, 0) + vgetq_lane_s32(vsq, 1) + vgetq_lane_s32(vsq, 2) +
+		          vgetq_lane_s32(vsq, 3);
+#endif
+		for (; x + 1 < w; x++) {
+			int lap = 4 * row[x] - row[x - 1] - row[x + 1] - up[x] - down[x];
+			sum += lap;
+			sum_sq += lap * lap;
+			n++;
+		}
+	}
+	if (n == 0)
+		return 0.0f;
+	float mean = (float)sum / n;
+	return (float)sum_sq / n - mean * mean;
+}
+
+/* Immerkaer: sigma = sqrt(pi/2) / 6 * mean |I * N|, over flat pixels only so edges are not counted as noise */
+static float cam_health_noise(const uint8_t *p, RK_U32 w, RK_U32 h) {
+	RK_U64 acc = 0;
+	RK_U32 n = 0;
+
+	for (RK_U32 y = 1; y + 1 < h; y++) {
+		const uint8_t *a = p + (y - 1) * w;
+		const uint8_t *b = p + y * w;
+		const uint8_t *c = p + (y + 1) * w;
+		for (RK_U32 x = 1; x + 1 < w; x++) {
+			if (abs(b[x + 1] - b[x - 1]) + abs(c[x] - a[x]) > CAM_HEALTH_EDGE_GRADIENT)
+				continue;
+			int v = a[x - 1] - 2 * a[x] + a[x + 1] - 2 * b[x - 1] + 4 * b[x] - 2 * b[x + 1] + c[x - 1] -
+			        2 * c[x] + c[x + 1];
+			acc += v < 0 ? -v : v;
+			n++;
+		}
+	}
+	return n ? sqrtf(M_PI / 2.0f) * acc / (6.0f * n) : 0.0f;
+}
+
+static float cam_health_frame_diff(const uint8_t *a, const uint8_t *b, RK_U32 n) {
+	RK_U64 acc = 0;
+	RK_U32 i = 0;
+#if defined(__ARM_NEON)
+	uint32x4_t vacc = vdupq_n_u32(0);
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+		vacc = vpadalq_u16(vacc, vpaddlq_u8(d));
+	}
+	acc = (RK_U64)vgetq_lane_u32(vacc, 0) + vgetq_lane_u32(vacc, 1) + vgetq_lane_u32(vacc, 2) +
+	      vgetq_lane_u32(vacc, 3);
+#endif
+	for (; i < n; i++)
+		acc += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+	return (float)acc / n;
+}
+
+static void cam_health_update(cam_health_t *health, cam_health_event_e event, bool condition) {
+	if (condition == health->active[event]) {
+		health->streak[event] = 0;
+		return;
+	}
+	if (++health->streak[event] < health->cfg.debounce)
+		return;
+	health->streak[event] = 0;
+	health->active[event] = condition;
+	health->events++;
+	if (health->cfg.cb)
+		health->cfg.cb(event, condition, &health->metrics, health->cfg.cb_arg);
+}
+
+int cam_health_process_luma(cam_health_t *health, const uint8_t *y_plane, RK_U32 stride) {
+	cam_health_metrics_t *m = &health->metrics;
+	const cam_health_cfg_t *cfg = &health->cfg;
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	RK_U32 n = health->dw * health->dh;
+
+	for (RK_U32 y = 0; y < health->dh; y++) {
+		const uint8_t *src = y_plane + y * cfg->step * stride;
+		uint8_t *dst = health->plane + y * health->dw;
+		for (RK_U32 x = 0; x < health->dw; x++)
+			dst[x] = src[x * cfg->step];
+	}
+
+	memset(m->hist, 0, sizeof(m->hist));
+	RK_U64 sum = 0, sum_sq = 0;
+	for (RK_U32 i = 0; i < n; i++) {
+		uint8_t v = health->plane[i];
+		m->hist[v]++;
+		sum += v;
+		sum_sq += v * v;
+	}
+	RK_U32 dark = 0, bright = 0;
+	for (RK_U32 i = 0; i <= cfg->dark_level && i < 256; i++)
+		dark += m->hist[i];
+	for (RK_U32 i = cfg->bright_level; i < 256; i++)
+		bright += m->hist[i];
+	m->mean = (float)sum / n;
+	m->stddev = sqrtf(fmaxf(0.0f, (float)sum_sq / n - m->mean * m->mean));
+	m->dark_ratio = (float)dark / n;
+	m->bright_ratio = (float)bright / n;
+
+	m->focus = cam_health_focus(health->plane, health->dw, health->dh);
+	m->noise_sigma = cam_health_noise(health->plane, health->dw, health->dh);
+	m->frame_diff = health->have_prev ? cam_health_frame_diff(health->plane, health->prev, n) : 0.0f;
+
+	// a flat image is only an occlusion if it appeared suddenly, not a dark static scene
+	if (m->stddev >= cfg->occlusion_stddev)
+		health->flat_after_change = false;
+	else if (m->frame_diff > cfg->occlusion_diff)
+		health->flat_after_change = true;
+	bool occluded = health->flat_after_change;
+	bool exposure_bad = m->dark_ratio > cfg->clip_ratio || m->bright_ratio > cfg->clip_ratio;
+	bool defocus = health->have_baseline && !occluded &&
+	               m->focus < m->focus_baseline * cfg->defocus_ratio;
+
+	// learn the sharpness of this scene only while nothing is wrong
+	if (!occluded && !exposure_bad && !health->active[CAM_HEALTH_DEFOCUS] && !defocus) {
+		if (!health->have_baseline) {
+			m->focus_baseline = m->focus;
+			health->have_baseline = true;
+		} else {
+			m->focus_baseline += (m->focus - m->focus_baseline) * CAM_HEALTH_BASELINE_ALPHA;
+		}
+	}
+
+	cam_health_update(health, CAM_HEALTH_OCCLUDED, occluded);
+	cam_health_update(health, CAM_HEALTH_DEFOCUS, defocus);
+	cam_health_update(health, CAM_HEALTH_OVEREXPOSED, m->bright_ratio > cfg->clip_ratio);
+	cam_health_update(health, CAM_HEALTH_UNDEREXPOSED, !occluded && m->dark_ratio > cfg->clip_ratio);
+	cam_health_update(health, CAM_HEALTH_NOISY, m->noise_sigma > cfg->noise_sigma);
+
+	uint8_t *tmp = health->prev;
+	health->prev = health->plane;
+	health->plane = tmp;
+	health->have_prev = true;
+	health->runs++;
+	m->cost_us = TEST_COMM_GetNowUs() - begin;
+	return 0;
+}
+
+int cam_health_process(cam_health_t *health, const VIDEO_FRAME_INFO_S *frame) {
+	const uint8_t *y_plane = (const uint8_t *)RK_MPI_MB_Handle2VirAddr(frame->stVFrame.pMbBlk);
+	if (y_plane == NULL)
+		return -1;
+	RK_U32 stride = frame->stVFrame.u32VirWidth ? frame->stVFrame.u32VirWidth : health->cfg.width;
+	RK_MPI_SYS_MmzFlushCache(frame->stVFrame.pMbBlk, RK_TRUE);
+	return cam_health_process_luma(health, y_plane, stride);
+}
+
+void cam_health_dump_stats(cam_health_t *health) {
+	cam_health_metrics_t *m = &health->metrics;
+	printf("cam health: focus %.0f (base %.0f), mean %.0f sd %.1f, dark %.2f bright %.2f, noise %.1f, "
+	       "diff %.1f, %u us\n",
+	       m->focus, m->focus_baseline, m->mean, m->stddev, m->dark_ratio, m->bright_ratio, m->noise_sigma,
+	       m->frame_diff, m->cost_us);
+	for (int i = 0; i < CAM_HEALTH_EVENT_NUM; i++)
+		if (health->active[i])
+			printf("  active: %s\n", g_event_names[i]);
+}
+
+void cam_health_deinit(cam_health_t *health) {
+	free(health->plane);
+	free(health->prev);
+	health->plane = NULL;
+	health->prev = NULL;
+}
@@ -0,0 +1,292 @@
+/*****************************************************************************
+* | Function    :   Crop mosaic, many small ROIs packed into one model input
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "crop_mosaic.h"
+
+#define CROP_MOSAIC_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define CROP_MOSAIC_SHRINK 0.8f		// tile side step when the ROIs do not fit
+
+void crop_mosaic_cfg_default(crop_mosaic_cfg_t *cfg, RK_U32 canvas_w, RK_U32 canvas_h) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->canvas_w = canvas_w;
+	cfg->canvas_h = canvas_h;
+	cfg->tile = 160;
+	cfg->min_tile = 64;
+	cfg->max_scale = 4.0f;
+	cfg->gap = 8;
+	cfg->border = 2;
+}
+
+int crop_mosaic_init(crop_mosaic_t *m, const crop_mosaic_cfg_t *cfg) {
+	memset(m, 0, sizeof(*m));
+	m->cfg = *cfg;
+	if (cfg->canvas_w == 0 || cfg->canvas_h == 0 || cfg->min_tile == 0 || cfg->tile < cfg->min_tile) {
+		printf("crop mosaic: bad canvas %ux%u or tile %u/%u\n", cfg->canvas_w, cfg->canvas_h, cfg->tile,
+		       cfg->min_tile);
+		return -1;
+	}
+	m->xs = (RK_U16 *)malloc(cfg->canvas_w * sizeof(RK_U16));
+	m->ys = (RK_U16 *)malloc(cfg->canvas_h * sizeof(RK_U16));
+	if (!m->xs || !m->ys) {
+		crop_mosaic_deinit(m);
+		return -1;
+	}
+	return 0;
+}
+
+/* Shelf packing at one tile side, tallest tiles first, each on the first shelf it fits */
+static int crop_mosaic_layout(crop_mosaic_t *m, RK_U32 side) {
+	RK_U32 canvas_w = m->cfg.canvas_w;
+	RK_U32 canvas_h = m->cfg.canvas_h;
+	RK_U32 gap = m->cfg.gap;
+	int order[CROP_MOSAIC_MAX_TILES];
+	RK_U32 shelf_y[CROP_MOSAIC_MAX_TILES], shelf_h[CROP_MOSAIC_MAX_TILES], shelf_x[CROP_MOSAIC_MAX_TILES];
+	int shelves = 0;
+	RK_U32 next_y = 0;
+	int placed = 0;
+
+	for (int i = 0; i < m->count; i++) {
+		crop_mosaic_tile_t *tile = &m->tiles[i];
+		RK_U32 longer = RK_MAX(tile->roi.u32Width, tile->roi.u32Height);
+		float scale = (float)side / longer;
+		if (scale > m->cfg.max_scale)
+			scale = m->cfg.max_scale;
+		tile->w = RK_MAX(1u, (RK_U32)(tile->roi.u32Width * scale + 0.5f));
+		tile->h = RK_MAX(1u, (RK_U32)(tile->roi.u32Height * scale + 0.5f));
+		tile->placed = false;
+		// insertion sort, a handful of tiles
+		int j = i;
+		for (; j > 0 && m->tiles[order[j - 1]].h < tile->h; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	for (int k = 0; k < m->count; k++) {
+		crop_mosaic_tile_t *tile = &m->tiles[order[k]];
+		int s = 0;
+		for (; s < shelves; s++) {
+			if (tile->h <= shelf_h[s] && shelf_x[s] + tile->w <= canvas_w)
+				break;
+		}
+		if (s == shelves) {
+			if (next_y + tile->h > canvas_h || tile->w > canvas_w)
+				continue;
+			shelf_y[s] = next_y;
+			shelf_h[s] = tile->h;
+			shelf_x[s] = 0;
+			shelves++;
+			next_y += tile->h + gap;
+		}
+		tile->x = shelf_x[s];
+		tile->y = shelf_y[s];
+		tile->placed = true;
+		shelf_x[s] += tile->w + gap;
+		placed++;
+	}
+	return placed;
+}
+
+int crop_mosaic_pack(crop_mosaic_t *m, const RECT_S *rois, const int *tags, int count, RK_U32 frame_w,
+                     RK_U32 frame_h) {
+	m->count = 0;
+	for (int i = 0; i < count && m->count < CROP_MOSAIC_MAX_TILES; i++) {
+		RK_S32 x0 = RK_MAX(rois[i].s32X, 0);
+		RK_S32 y0 = RK_MAX(rois[i].s32Y, 0);
+		RK_S32 x1 = CROP_MOSAIC_MIN(rois[i].s32X + (RK_S32)rois[i].u32Width, (RK_S32)frame_w);
+		RK_S32 y1 = CROP_MOSAIC_MIN(rois[i].s32Y + (RK_S32)rois[i].u32Height, (RK_S32)frame_h);
+		if (x1 <= x0 || y1 <= y0)
+			continue;
+		crop_mosaic_tile_t *tile = &m->tiles[m->count++];
+		tile->roi.s32X = x0;
+		tile->roi.s32Y = y0;
+		tile->roi.u32Width = x1 - x0;
+		tile->roi.u32Height = y1 - y0;
+		tile->tag = tags ? tags[i] : i;
+		tile->cut_edges = (x0 > 0 ? CROP_MOSAIC_EDGE_LEFT : 0) | (y0 > 0 ? CROP_MOSAIC_EDGE_TOP : 0) |
+		                  (x1 < (RK_S32)frame_w ? CROP_MOSAIC_EDGE_RIGHT : 0) |
+		                  (y1 < (RK_S32)frame_h ? CROP_MOSAIC_EDGE_BOTTOM : 0);
+	}
+
+	RK_U32 side = m->cfg.tile;
+	for (;;) {
+		m->placed = crop_mosaic_layout(m, side);
+		if (m->placed == m->count || side == m->cfg.min_tile)
+			break;
+		side = RK_MAX(m->cfg.min_tile, (RK_U32)(side * CROP_MOSAIC_SHRINK));
+	}
+	m->side = side;
+	m->packs++;
+	m->rois += m->count;
+	m->spilled += m->count - m->placed;
+	return m->placed;
+}
+
+static inline uint8_t crop_mosaic_clamp(int v) {
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* nearest neighbour, tile pixel centres -> image pixels */
+static void crop_mosaic_render_tile(crop_mosaic_t *m, const crop_mosaic_image_t *image,
+                                    const crop_mosaic_tile_t *tile, uint8_t *canvas) {
+	float step_x = (float)tile->roi.u32Width / tile->w;
+	float step_y = (float)tile->roi.u32Height / tile->h;
+	RK_U32 canvas_stride = m->cfg.canvas_w * 3;
+
+	for (RK_U32 u = 0; u < tile->w; u++) {
+		int x = (int)((tile->roi.s32X + (u + 0.5f) * step_x) * image->sx);
+		m->xs[u] = x < 0 ? 0 : CROP_MOSAIC_MIN((RK_U32)x, image->width - 1);
+	}
+	for (RK_U32 v = 0; v < tile->h; v++) {
+		int y = (int)((tile->roi.s32Y + (v + 0.5f) * step_y) * image->sy);
+		m->ys[v] = y < 0 ? 0 : CROP_MOSAIC_MIN((RK_U32)y, image->height - 1);
+	}
+
+	for (RK_U32 v = 0; v < tile->h; v++) {
+		uint8_t *dst = canvas + (tile->y + v) * canvas_stride + tile->x * 3;
+		const uint8_t *src = image->data + m->ys[v] * image->stride;
+		if (image->format == CROP_MOSAIC_BGR888) {
+			for (RK_U32 u = 0; u < tile->w; u++) {
+				const uint8_t *p = src + m->xs[u] * 3;
+				dst[0] = p[0];
+				dst[1] = p[1];
+				dst[2] = p[2];
+				dst += 3;
+			}
+			continue;
+		}
+		// NV12, BT.601 limited range like the VI output
+		const uint8_t *uv = image->uv + (m->ys[v] >> 1) * image->stride;
+		for (RK_U32 u = 0; u < tile->w; u++) {
+			int c = 298 * (src[m->xs[u]] - 16);
+			const uint8_t *p = uv + (m->xs[u] & ~1u);
+			int d = p[0] - 128;
+			int e = p[1] - 128;
+			dst[0] = crop_mosaic_clamp((c + 516 * d + 128) >> 8);
+			dst[1] = crop_mosaic_clamp((c - 100 * d - 208 * e + 128) >> 8);
+			dst[2] = crop_mosaic_clamp((c + 409 * e + 128) >> 8);
+			dst += 3;
+		}
+	}
+}
+
+void crop_mosaic_render(crop_mosaic_t *m, const crop_mosaic_image_t *image, uint8_t *canvas) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+
+	// gaps and unused shelves stay black, nothing for the detector there
+	memset(canvas, 0, m->cfg.canvas_w * m->cfg.canvas_h * 3);
+	for (int i = 0; i < m->count; i++) {
+		if (m->tiles[i].placed)
+			crop_mosaic_render_tile(m, image, &m->tiles[i], canvas);
+	}
+	m->render_us += TEST_COMM_GetNowUs() - begin;
+	m->renders++;
+}
+
+int crop_mosaic_split(crop_mosaic_t *m, const object_detect_result_list *canvas_dets, crop_mosaic_det_t *out,
+                      int max) {
+	int border = m->cfg.border;
+	int n = 0;
+
+	for (int i = 0; i < canvas_dets->count && n < max; i++) {
+		const object_detect_result *det = &canvas_dets->results[i];
+		int cx = (det->box.left + det->box.right) / 2;
+		int cy = (det->box.top + det->box.bottom) / 2;
+		int t = 0;
+		for (; t < m->count; t++) {
+			const crop_mosaic_tile_t *tile = &m->tiles[t];
+			if (tile->placed && cx >= tile->x && cx < tile->x + (int)tile->w && cy >= tile->y &&
+			    cy < tile->y + (int)tile->h)
+				break;
+		}
+		if (t == m->count) {
+			m->stray++;
+			continue;
+		}
+		const crop_mosaic_tile_t *tile = &m->tiles[t];
+		// a face cut by the ROI edge ends on (or past) the tile edge, its box is only part of it
+		if (((tile->cut_edges & CROP_MOSAIC_EDGE_LEFT) && det->box.left < tile->x + border) ||
+		    ((tile->cut_edges & CROP_MOSAIC_EDGE_TOP) && det->box.top < tile->y + border) ||
+		    ((tile->cut_edges & CROP_MOSAIC_EDGE_RIGHT) && det->box.right > tile->x + (int)tile->w - border) ||
+		    ((tile->cut_edges & CROP_MOSAIC_EDGE_BOTTOM) && det->box.bottom > tile->y + (int)tile->h - border)) {
+			m->straddling++;
+			continue;
+		}
+
+		float kx = (float)tile->roi.u32Width / tile->w;
+		float ky = (float)tile->roi.u32Height / tile->h;
+		crop_mosaic_det_t *o = &out[n++];
+		o->tile = t;
+		o->tag = tile->tag;
+		o->det.prop = det->prop;
+		o->det.box.left = tile->roi.s32X + (int)((det->box.left - tile->x) * kx);
+		o->det.box.top = tile->roi.s32Y + (int)((det->box.top - tile->y) * ky);
+		o->det.box.right = tile->roi.s32X + (int)((det->box.right - tile->x) * kx);
+		o->det.box.bottom = tile->roi.s32Y + (int)((det->box.bottom - tile->y) * ky);
+		for (int k = 0; k < 5; k++) {
+			o->det.point[k].x = tile->roi.s32X + (int)((det->point[k].x - tile->x) * kx);
+			o->det.point[k].y = tile->roi.s32Y + (int)((det->point[k].y - tile->y) * ky);
+		}
+	}
+	m->dets += n;
+	return n;
+}
+
+void crop_mosaic_bench(crop_mosaic_t *m, rknn_app_context_t *app_ctx, const retinaface_thresh_t *thresh,
+                       const crop_mosaic_image_t *image, const RECT_S *rois, int count, RK_U32 frame_w,
+                       RK_U32 frame_h) {
+	object_detect_result_list results;
+	crop_mosaic_det_t dets[128];
+	bool placed[CROP_MOSAIC_MAX_TILES];
+	uint8_t *canvas = (uint8_t *)app_ctx->input_mems[0]->virt_addr;
+
+	if (crop_mosaic_pack(m, rois, NULL, count, frame_w, frame_h) == 0)
+		return;
+
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	crop_mosaic_render(m, image, canvas);
+	inference_retinaface_model_ex(app_ctx, &results, thresh);
+	int mosaic_faces = crop_mosaic_split(m, &results, dets, 128);
+	RK_U64 mosaic_us = TEST_COMM_GetNowUs() - begin;
+
+	// same tiles at the same scale, one inference each
+	for (int i = 0; i < m->count; i++)
+		placed[i] = m->tiles[i].placed;
+	int single_faces = 0;
+	begin = TEST_COMM_GetNowUs();
+	for (int i = 0; i < m->count; i++) {
+		if (!placed[i])
+			continue;
+		for (int j = 0; j < m->count; j++)
+			m->tiles[j].placed = j == i;
+		crop_mosaic_render(m, image, canvas);
+		inference_retinaface_model_ex(app_ctx, &results, thresh);
+		single_faces += crop_mosaic_split(m, &results, dets, 128);
+	}
+	RK_U64 single_us = TEST_COMM_GetNowUs() - begin;
+	for (int i = 0; i < m->count; i++)
+		m->tiles[i].placed = placed[i];
+
+	printf("crop mosaic bench: %d/%d rois at %u px, mosaic %llu us (%d faces), per roi %llu us (%d faces), "
+	       "%.1fx\n",
+	       m->placed, m->count, m->side, (unsigned long long)mosaic_us, mosaic_faces,
+	       (unsigned long long)single_us, single_faces, mosaic_us ? (float)single_us / mosaic_us : 0.0f);
+}
+
+void crop_mosaic_dump_stats(crop_mosaic_t *m) {
+	printf("crop mosaic: %u packs, %u rois, %u spilled, %u faces, %u on tile edges, %u in gaps, render avg %llu us\n",
+	       m->packs, m->rois, m->spilled, m->dets, m->straddling, m->stray,
+	       (unsigned long long)(m->renders ? m->render_us / m->renders : 0));
+	m->packs = m->rois = m->spilled = m->dets = m->straddling = m->stray = 0;
+	m->render_us = 0;
+	m->renders = 0;
+}
+
+void crop_mosaic_deinit(crop_mosaic_t *m) {
+	free(m->xs);
+	free(m->ys);
+	m->xs = NULL;
+	m->ys = NULL;
+}
@@ -0,0 +1,335 @@
+/*****************************************************************************
+* | Function    :   Memory mapped ring file of detections with time queries
+*
+******************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "luckfox_mpi.h"
+#include "det_journal.h"
+
+#define DET_JOURNAL_PAGE 4096
+#define DET_JOURNAL_ALIGN(x) (((x) + DET_JOURNAL_PAGE - 1) & ~(size_t)(DET_JOURNAL_PAGE - 1))
+
+void det_journal_cfg_default(det_journal_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->capacity = 1 << 18;		// 8MB, ~10 hours at ~7 records/s
+	cfg->index_stride = 256;
+	cfg->sync_ahead = 256 * 1024;
+}
+
+RK_U64 det_journal_now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (RK_U64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static RK_S64 det_journal_realtime_offset(void) {
+	return (RK_S64)(det_journal_now_us() - TEST_COMM_GetNowUs());
+}
+
+static size_t det_journal_index_bytes(const det_journal_cfg_t *cfg) {
+	return DET_JOURNAL_ALIGN(cfg->capacity / cfg->index_stride * sizeof(det_journal_index_t));
+}
+
+static bool det_journal_header_ok(const det_journal_header_t *hdr, const det_journal_cfg_t *cfg) {
+	return hdr->magic == DET_JOURNAL_MAGIC && hdr->version == DET_JOURNAL_VERSION &&
+	       hdr->record_size == sizeof(det_journal_record_t) && hdr->index_stride == cfg->index_stride &&
+	       hdr->capacity == cfg->capacity && hdr->index_capacity == cfg->capacity / cfg->index_stride;
+}
+
+/* normalises the geometry and sizes the mapping */
+static int det_journal_layout(det_journal_t *journal, const det_journal_cfg_t *cfg) {
+	journal->cfg = *cfg;
+	journal->fd = -1;
+	journal->map = MAP_FAILED;
+	journal->read_only = false;
+	journal->cost_us = 0;
+	journal->appends = 0;
+	journal->sync_us = 0;
+	journal->realtime_offset_us.store(det_journal_realtime_offset(), std::memory_order_relaxed);
+	if (journal->cfg.index_stride == 0 || (journal->cfg.index_stride & (journal->cfg.index_stride - 1)))
+		journal->cfg.index_stride = 256;
+	journal->cfg.capacity -= journal->cfg.capacity % journal->cfg.index_stride;
+	if (journal->cfg.capacity == 0) {
+		printf("journal: capacity below one index stride\n");
+		return -1;
+	}
+	journal->map_size = DET_JOURNAL_PAGE + det_journal_index_bytes(&journal->cfg) +
+	                    journal->cfg.capacity * sizeof(det_journal_record_t);
+	return 0;
+}
+
+static int det_journal_map(det_journal_t *journal, int prot) {
+	journal->map = mmap(NULL, journal->map_size, prot, MAP_SHARED, journal->fd, 0);
+	if (journal->map == MAP_FAILED) {
+		printf("journal: mmap failed: %s\n", strerror(errno));
+		det_journal_close(journal);
+		return -1;
+	}
+	journal->hdr = (det_journal_header_t *)journal->map;
+	journal->index = (det_journal_index_t *)((uint8_t *)journal->map + DET_JOURNAL_PAGE);
+	journal->records = (det_journal_record_t *)((uint8_t *)journal->map + DET_JOURNAL_PAGE +
+	                                            det_journal_index_bytes(&journal->cfg));
+	return 0;
+}
+
+int det_journal_open(det_journal_t *journal, const char *path, const det_journal_cfg_t *cfg) {
+	struct stat st;
+
+	if (det_journal_layout(journal, cfg) != 0)
+		return -1;
+	journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (journal->fd < 0) {
+		printf("journal: open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(journal->fd, &st) < 0 || (size_t)st.st_size != journal->map_size) {
+		// real blocks up front: a full card fails here, not as SIGBUS in the pipeline later
+		int err = ftruncate(journal->fd, 0) < 0 ? errno : posix_fallocate(journal->fd, 0, journal->map_size);
+		if (err) {
+			printf("journal: preallocate %zu bytes failed: %s\n", journal->map_size, strerror(err));
+			det_journal_close(journal);
+			return -1;
+		}
+	}
+	if (det_journal_map(journal, PROT_READ | PROT_WRITE) != 0)
+		return -1;
+
+	if (!det_journal_header_ok(journal->hdr, &journal->cfg)) {
+		if (journal->hdr->magic == DET_JOURNAL_MAGIC)
+			printf("journal: %s has another layout, starting afresh\n", path);
+		memset(journal->hdr, 0, sizeof(*journal->hdr));
+		journal->hdr->magic = DET_JOURNAL_MAGIC;
+		journal->hdr->version = DET_JOURNAL_VERSION;
+		journal->hdr->record_size = sizeof(det_journal_record_t);
+		journal->hdr->index_stride = journal->cfg.index_stride;
+		journal->hdr->capacity = journal->cfg.capacity;
+		journal->hdr->index_capacity = journal->cfg.capacity / journal->cfg.index_stride;
+		msync(journal->map, DET_JOURNAL_PAGE, MS_SYNC);
+	}
+	journal->synced_head = journal->hdr->head;
+	printf("journal: %s, %llu of %llu records, %zu bytes\n", path, (unsigned long long)journal->hdr->head,
+	       (unsigned long long)journal->cfg.capacity, journal->map_size);
+	return 0;
+}
+
+int det_journal_open_ro(det_journal_t *journal, const char *path, const det_journal_cfg_t *cfg) {
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	if (det_journal_layout(journal, cfg) != 0)
+		return -1;
+	journal->read_only = true;
+	journal->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (journal->fd < 0) {
+		printf("journal: open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	// a short file would SIGBUS on the first read past its end
+	if (fstat(journal->fd, &st) < 0 || (size_t)st.st_size != journal->map_size) {
+		printf("journal: %s is %lld bytes, not a journal of %llu records\n", path, (long long)st.st_size,
+		       (unsigned long long)journal->cfg.capacity);
+		det_journal_close(journal);
+		return -1;
+	}
+	if (det_journal_map(journal, PROT_READ) != 0)
+		return -1;
+	if (!det_journal_header_ok(journal->hdr, &journal->cfg)) {
+		printf("journal: %s has another layout\n", path);
+		det_journal_close(journal);
+		return -1;
+	}
+	journal->synced_head = __atomic_load_n(&journal->hdr->head, __ATOMIC_ACQUIRE);
+	printf("journal: %s read only, %llu of %llu records\n", path, (unsigned long long)journal->synced_head,
+	       (unsigned long long)journal->cfg.capacity);
+	return 0;
+}
+
+void det_journal_append(det_journal_t *journal, RK_U64 pts, const track_t *track, uint8_t zones) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	det_journal_header_t *hdr = journal->hdr;
+	RK_U64 n = hdr->head;
+	RK_U64 t = pts + journal->realtime_offset_us.load(std::memory_order_relaxed);
+	det_journal_record_t *rec = &journal->records[n % journal->cfg.capacity];
+
+	// non-decreasing, or the binary search breaks
+	if (t < hdr->last_time_us)
+		t = hdr->last_time_us;
+	rec->time_us = t;
+	rec->seq = (RK_U32)n;
+	rec->track_id = track->id;
+	rec->x = (int16_t)track->box.s32X;
+	rec->y = (int16_t)track->box.s32Y;
+	rec->w = (uint16_t)track->box.u32Width;
+	rec->h = (uint16_t)track->box.u32Height;
+	rec->score = (uint16_t)(track->score * 65535.0f);
+	rec->cls = (uint8_t)track->cls;
+	rec->zones = zones;
+	rec->reserved = 0;
+	if (n % journal->cfg.index_stride == 0) {
+		det_journal_index_t *idx = &journal->index[(n / journal->cfg.index_stride) % hdr->index_capacity];
+		idx->time_us = t;
+		idx->seq = n;
+	}
+	hdr->last_time_us = t;
+	__atomic_store_n(&hdr->head, n + 1, __ATOMIC_RELEASE);
+	journal->cost_us += TEST_COMM_GetNowUs() - begin;
+	journal->appends++;
+}
+
+void det_journal_append_tracks(det_journal_t *journal, const tracker_t *tracker, const zone_analytics_t *zones) {
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		const track_t *trk = &tracker->tracks[t];
+		if (!trk->id || !trk->confirmed || trk->det_index < 0)
+			continue;
+		uint8_t mask = 0;
+		if (zones && zones->state[t].track_id == trk->id)
+			mask = zones->state[t].inside;
+		det_journal_append(journal, tracker->pts, trk, mask);
+	}
+}
+
+/* the writer may be overwriting the oldest records while we read, a copy is kept only if it survived */
+static bool det_journal_read(det_journal_t *journal, RK_U64 n, det_journal_record_t *out) {
+	memcpy(out, &journal->records[n % journal->cfg.capacity], sizeof(*out));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	RK_U64 head = __atomic_load_n(&journal->hdr->head, __ATOMIC_ACQUIRE);
+	return out->seq == (RK_U32)n && n + journal->cfg.capacity > head;
+}
+
+/* start of the stride holding the last record at or before from_us */
+static RK_U64 det_journal_seek(det_journal_t *journal, RK_U64 oldest, RK_U64 head, RK_U64 from_us) {
+	RK_U64 stride = journal->cfg.index_stride;
+	RK_U64 lo = (oldest + stride - 1) / stride;
+	RK_U64 hi = (head - 1) / stride;
+	RK_U64 found = oldest;
+
+	while (lo <= hi) {
+		RK_U64 mid = lo + (hi - lo) / 2;
+		det_journal_index_t idx = journal->index[mid % journal->hdr->index_capacity];
+		if (idx.seq != mid * stride)	// overwritten under us, the ring moved on
+			return oldest;
+		if (idx.time_us <= from_us) {
+			found = mid * stride;
+			lo = mid + 1;
+		} else {
+			if (mid == 0)
+				break;
+			hi = mid - 1;
+		}
+	}
+	return found > oldest ? found : oldest;
+}
+
+int det_journal_query(det_journal_t *journal, RK_U64 from_us, RK_U64 to_us, uint8_t zone_mask,
+                      det_journal_cb cb, void *arg) {
+	RK_U64 head = __atomic_load_n(&journal->hdr->head, __ATOMIC_ACQUIRE);
+	RK_U64 cap = journal->cfg.capacity;
+	int count = 0;
+
+	if (head == 0 || from_us >= to_us)
+		return 0;
+	// the oldest slot may be the one being rewritten
+	RK_U64 oldest = head >= cap ? head - cap + 1 : 0;
+	for (RK_U64 n = det_journal_seek(journal, oldest, head, from_us); n < head; n++) {
+		det_journal_record_t rec;
+		if (!det_journal_read(journal, n, &rec))
+			continue;
+		if (rec.time_us >= to_us)
+			break;
+		if (rec.time_us < from_us || (zone_mask && !(rec.zones & zone_mask)))
+			continue;
+		if (cb)
+			cb(&rec, arg);
+		count++;
+	}
+	return count;
+}
+
+static int det_journal_msync_records(det_journal_t *journal, RK_U64 from, RK_U64 to) {
+	uint8_t *base = (uint8_t *)journal->records;
+	size_t begin = (from * sizeof(det_journal_record_t)) & ~(size_t)(DET_JOURNAL_PAGE - 1);
+	size_t end = DET_JOURNAL_ALIGN(to * sizeof(det_journal_record_t));
+	return end > begin ? msync(base + begin, end - begin, MS_SYNC) : 0;
+}
+
+int det_journal_sync(det_journal_t *journal) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	RK_U64 head = __atomic_load_n(&journal->hdr->head, __ATOMIC_ACQUIRE);
+	RK_U64 cap = journal->cfg.capacity;
+	RK_U64 from = journal->synced_head % cap;
+	RK_U64 to = head % cap;
+	int ret = 0;
+
+	if (head == journal->synced_head)
+		goto out;
+	if (head - journal->synced_head >= cap)
+		ret = det_journal_msync_records(journal, 0, cap);
+	else if (from < to)
+		ret = det_journal_msync_records(journal, from, to);
+	else
+		ret = det_journal_msync_records(journal, from, cap) | det_journal_msync_records(journal, 0, to);
+	// the index is tiny and only dirty pages are written, then the header with the new head
+	ret |= msync(journal->index, det_journal_index_bytes(&journal->cfg), MS_SYNC);
+	ret |= msync(journal->map, DET_JOURNAL_PAGE, MS_SYNC);
+	if (ret)
+		printf("journal: msync failed: %s\n", strerror(errno));
+	journal->synced_head = head;
+
+	// fault the next pages in here, not in the pipeline on its next appends
+	{
+		size_t ahead = (size_t)to * sizeof(det_journal_record_t) & ~(size_t)(DET_JOURNAL_PAGE - 1);
+		size_t ring = cap * sizeof(det_journal_record_t);
+		size_t len = journal->cfg.sync_ahead;
+		if (ahead + len > ring)
+			len = ring - ahead;
+		madvise((uint8_t *)journal->records + ahead, len, MADV_WILLNEED);
+	}
+
+out:
+	journal->realtime_offset_us.store(det_journal_realtime_offset(), std::memory_order_relaxed);
+	journal->sync_us = TEST_COMM_GetNowUs() - begin;
+	return ret ? -1 : 0;
+}
+
+static void det_journal_count(const det_journal_record_t *record, void *arg) {
+	(void)record;
+	(*(RK_U32 *)arg)++;
+}
+
+void det_journal_dump_stats(det_journal_t *journal) {
+	RK_U64 now = det_journal_now_us();
+	RK_U32 last_min = 0;
+	RK_U64 query_begin = TEST_COMM_GetNowUs();
+	det_journal_query(journal, now - 60 * 1000000ULL, now + 1, 0, det_journal_count, &last_min);
+	RK_U64 query_us = TEST_COMM_GetNowUs() - query_begin;
+
+	printf("journal: %llu records, %u in the last minute (query %llu us), %u appends at %llu us, "
+	       "sync %llu us\n",
+	       (unsigned long long)__atomic_load_n(&journal->hdr->head, __ATOMIC_ACQUIRE), last_min,
+	       (unsigned long long)query_us, journal->appends,
+	       (unsigned long long)(journal->appends ? journal->cost_us / journal->appends : 0),
+	       (unsigned long long)journal->sync_us);
+	journal->cost_us = 0;
+	journal->appends = 0;
+}
+
+void det_journal_unlock(det_journal_t *journal) {
+	// the ring lives in the page cache: written pages go to the card and may be dropped
+	if (journal->map != MAP_FAILED && munlock(journal->map, journal->map_size) != 0)
+		printf("journal: munlock failed: %s\n", strerror(errno));
+}
+
+void det_journal_close(det_journal_t *journal) {
+	if (journal->map != MAP_FAILED) {
+		if (!journal->read_only)
+			msync(journal->map, journal->map_size, MS_SYNC);
+		munmap(journal->map, journal->map_size);
+		journal->map = MAP_FAILED;
+	}
+	if (journal->fd >= 0)
+		close(journal->fd);
+	journal->fd = -1;
+}
@@ -0,0 +1,119 @@
+/*****************************************************************************
+* | Function    :   Seqlocked shared memory publication of detection results
+*
+******************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "luckfox_mpi.h"
+#include "det_shm.h"
+
+int det_shm_open(det_shm_writer_t *writer, const char *name, RK_U32 width, RK_U32 height) {
+	memset(writer, 0, sizeof(*writer));
+	writer->fd = -1;
+	writer->width = width;
+	writer->height = height;
+
+	writer->fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (writer->fd < 0) {
+		printf("det shm: shm_open %s failed: %s\n", name, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(writer->fd, sizeof(det_shm_t)) != 0) {
+		printf("det shm: ftruncate failed: %s\n", strerror(errno));
+		det_shm_close(writer);
+		return -1;
+	}
+	void *map = mmap(NULL, sizeof(det_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, 0);
+	if (map == MAP_FAILED) {
+		printf("det shm: mmap failed: %s\n", strerror(errno));
+		det_shm_close(writer);
+		return -1;
+	}
+	writer->shm = (det_shm_t *)map;
+
+	det_shm_t *shm = writer->shm;
+	RK_U32 seq = 0;
+	// segment left by an earlier run: carry on from its seq, readers may still hold the mapping
+	if (shm->magic == DET_SHM_MAGIC && shm->version == DET_SHM_VERSION && shm->size == sizeof(det_shm_t))
+		seq = (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) + 1) & ~1u;
+	else
+		memset(shm, 0, sizeof(*shm));
+	shm->version = DET_SHM_VERSION;
+	shm->size = sizeof(det_shm_t);
+	shm->writer_pid = getpid();
+	__atomic_store_n(&shm->seq, seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&shm->magic, DET_SHM_MAGIC, __ATOMIC_RELEASE);
+	printf("det shm: /dev/shm%s, %u bytes\n", name, (RK_U32)sizeof(det_shm_t));
+	return 0;
+}
+
+void det_shm_publish(det_shm_writer_t *writer, RK_U64 pts, const object_detect_result_list *results,
+                     float sx, float sy, const tracker_t *tracker) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	det_shm_t *shm = writer->shm;
+	det_shm_result_t *dst = &shm->result;
+	RK_U32 count = results->count < DET_SHM_MAX_DETS ? results->count : DET_SHM_MAX_DETS;
+	RK_U32 seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+
+	// odd: readers that started before this see the change and retry
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	dst->pts = pts;
+	dst->publish_us = begin;
+	dst->pass++;
+	dst->count = count;
+	dst->width = writer->width;
+	dst->height = writer->height;
+	for (RK_U32 i = 0; i < count; i++) {
+		const object_detect_result *res = &results->results[i];
+		det_shm_det_t *det = &dst->dets[i];
+		det->left = (int32_t)(res->box.left * sx);
+		det->top = (int32_t)(res->box.top * sy);
+		det->right = (int32_t)(res->box.right * sx);
+		det->bottom = (int32_t)(res->box.bottom * sy);
+		det->score = res->prop;
+		det->track_id = 0;
+		for (int k = 0; k < DET_SHM_LANDMARKS; k++) {
+			det->landmarks[k][0] = (int32_t)(res->point[k].x * sx);
+			det->landmarks[k][1] = (int32_t)(res->point[k].y * sy);
+		}
+	}
+	if (tracker) {
+		for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+			const track_t *track = &tracker->tracks[t];
+			if (track->id && track->confirmed && track->det_index >= 0 && (RK_U32)track->det_index < count)
+				dst->dets[track->det_index].track_id = track->id;
+		}
+	}
+
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+	// one syscall per pass, cheaper than tracking whether anybody waits
+	syscall(SYS_futex, &shm->seq, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+
+	RK_U64 cost = TEST_COMM_GetNowUs() - begin;
+	writer->publishes++;
+	writer->cost_us += cost;
+	if (cost > writer->cost_worst_us)
+		writer->cost_worst_us = cost;
+}
+
+void det_shm_dump_stats(det_shm_writer_t *writer) {
+	printf("det shm: %u publishes, avg %llu worst %llu us\n", writer->publishes,
+	       (unsigned long long)(writer->publishes ? writer->cost_us / writer->publishes : 0),
+	       (unsigned long long)writer->cost_worst_us);
+	writer->publishes = 0;
+	writer->cost_us = 0;
+	writer->cost_worst_us = 0;
+}
+
+void det_shm_close(det_shm_writer_t *writer) {
+	if (writer->shm)
+		munmap(writer->shm, sizeof(det_shm_t));
+	if (writer->fd >= 0)
+		close(writer->fd);
+	writer->shm = NULL;
+	writer->fd = -1;
+}
@@ -0,0 +1,231 @@
+/*****************************************************************************
+* | Function    :   Rolling per-zone counts and dwell-time histograms
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "dwell_stats.h"
+
+void dwell_cfg_default(dwell_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->bucket_sec = 60;
+	cfg->bucket_count = 60;
+}
+
+int dwell_init(dwell_stats_t *ds, const dwell_cfg_t *cfg) {
+	ds->cfg = *cfg;
+	ds->head.store(0, std::memory_order_relaxed);
+	ds->started = false;
+	memset(ds->tracks, 0, sizeof(ds->tracks));
+	for (int c = 0; c < DWELL_MAX_CLASSES; c++) {
+		for (int s = 0; s < DWELL_MAX_SCOPES; s++)
+			ds->occupancy[c][s].store(0, std::memory_order_relaxed);
+	}
+	if (ds->cfg.bucket_sec == 0)
+		ds->cfg.bucket_sec = 60;
+	if (ds->cfg.bucket_count < 1 || ds->cfg.bucket_count > DWELL_MAX_BUCKETS)
+		ds->cfg.bucket_count = 60;
+	ds->buckets = (dwell_bucket_t *)calloc(ds->cfg.bucket_count, sizeof(dwell_bucket_t));
+	if (!ds->buckets) {
+		printf("dwell: bucket alloc failed\n");
+		return -1;
+	}
+	printf("dwell: %u buckets of %us, %zu bytes\n", ds->cfg.bucket_count, ds->cfg.bucket_sec,
+	       ds->cfg.bucket_count * sizeof(dwell_bucket_t));
+	return 0;
+}
+
+int dwell_hist_bin(RK_U64 dwell_ms) {
+	RK_U64 sec = dwell_ms / 1000;
+	int bin = 0;
+	while (sec && bin < DWELL_HIST_BINS - 1) {
+		sec >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+RK_U32 dwell_bin_floor_sec(int bin) {
+	return bin == 0 ? 0 : 1u << (bin - 1);
+}
+
+static void dwell_write_begin(dwell_bucket_t *b) {
+	b->seq.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void dwell_write_end(dwell_bucket_t *b) {
+	b->seq.fetch_add(1, std::memory_order_release);
+}
+
+/* bucket for pts, opening (and clearing) new ones as time moves on */
+static dwell_bucket_t *dwell_bucket_at(dwell_stats_t *ds, RK_U64 pts) {
+	RK_U64 index = pts / 1000000 / ds->cfg.bucket_sec;
+	RK_U64 head = ds->head.load(std::memory_order_relaxed);
+
+	if (!ds->started || index > head) {
+		// skip at most one ring worth of empty buckets after a long gap
+		RK_U64 from = ds->started ? head + 1 : index;
+		if (index - from >= ds->cfg.bucket_count)
+			from = index - ds->cfg.bucket_count + 1;
+		for (RK_U64 i = from; i <= index; i++) {
+			dwell_bucket_t *b = &ds->buckets[i % ds->cfg.bucket_count];
+			dwell_write_begin(b);
+			b->index = i;
+			memset(&b->counts, 0, sizeof(b->counts));
+			dwell_write_end(b);
+		}
+		ds->head.store(index, std::memory_order_release);
+		ds->started = true;
+		head = index;
+	}
+	// late pts (clock step back): account to the newest bucket
+	return &ds->buckets[head % ds->cfg.bucket_count];
+}
+
+static void dwell_leave(dwell_stats_t *ds, dwell_track_t *st, int scope, RK_U64 pts) {
+	RK_U64 dwell_ms = pts > st->enter_pts[scope] ? (pts - st->enter_pts[scope]) / 1000 : 0;
+	dwell_bucket_t *b = dwell_bucket_at(ds, pts);
+
+	dwell_write_begin(b);
+	b->counts.exits[st->cls][scope]++;
+	b->counts.hist[st->cls][scope][dwell_hist_bin(dwell_ms)]++;
+	b->counts.dwell_ms[st->cls][scope] += dwell_ms;
+	dwell_write_end(b);
+	ds->occupancy[st->cls][scope].fetch_sub(1, std::memory_order_relaxed);
+	st->inside &= ~(1 << scope);
+}
+
+static void dwell_enter(dwell_stats_t *ds, dwell_track_t *st, int scope, RK_U64 pts) {
+	dwell_bucket_t *b = dwell_bucket_at(ds, pts);
+
+	dwell_write_begin(b);
+	b->counts.entries[st->cls][scope]++;
+	dwell_write_end(b);
+	ds->occupancy[st->cls][scope].fetch_add(1, std::memory_order_relaxed);
+	st->enter_pts[scope] = pts;
+	st->inside |= 1 << scope;
+}
+
+void dwell_update(dwell_stats_t *ds, const tracker_t *tracker, const zone_analytics_t *zones) {
+	RK_U64 pts = tracker->pts;
+
+	dwell_bucket_at(ds, pts);
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		const track_t *trk = &tracker->tracks[t];
+		dwell_track_t *st = &ds->tracks[t];
+
+		if (st->track_id && st->track_id != trk->id) {
+			// ended: the dwell runs to the last time it was seen
+			for (int s = 0; s < DWELL_MAX_SCOPES; s++) {
+				if (st->inside & (1 << s))
+					dwell_leave(ds, st, s, st->last_pts);
+			}
+			memset(st, 0, sizeof(*st));
+		}
+		if (!trk->id || !trk->confirmed)
+			continue;
+		if (!st->track_id) {
+			st->track_id = trk->id;
+			st->cls = trk->cls < 0 || trk->cls >= DWELL_MAX_CLASSES ? DWELL_MAX_CLASSES - 1 : trk->cls;
+			dwell_enter(ds, st, 0, trk->first_pts);
+		}
+		st->last_pts = trk->last_pts;
+
+		// zones follow the debounced state of the zone engine, timed from where the change started
+		if (zones) {
+			const zone_track_state_t *zs = &zones->state[t];
+			uint16_t want = (uint16_t)(zs->track_id == trk->id ? zs->inside : 0) << 1;
+			for (int s = 1; s < DWELL_MAX_SCOPES; s++) {
+				uint16_t bit = 1 << s;
+				RK_U64 at = zs->track_id == trk->id ? zs->streak_pts[s - 1] : pts;
+				if ((want & bit) && !(st->inside & bit))
+					dwell_enter(ds, st, s, at);
+				else if (!(want & bit) && (st->inside & bit))
+					dwell_leave(ds, st, s, at);
+			}
+		}
+	}
+}
+
+static void dwell_read_bucket(dwell_bucket_t *b, RK_U64 *index, dwell_counts_t *counts) {
+	RK_U32 s1, s2;
+	do {
+		s1 = b->seq.load(std::memory_order_acquire);
+		if (s1 & 1)
+			continue;
+		*index = b->index;
+		memcpy(counts, &b->counts, sizeof(*counts));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		s2 = b->seq.load(std::memory_order_relaxed);
+		if (s1 == s2)
+			return;
+	} while (true);
+}
+
+void dwell_query(dwell_stats_t *ds, RK_U32 window_sec, dwell_summary_t *out) {
+	RK_U32 want = (window_sec + ds->cfg.bucket_sec - 1) / ds->cfg.bucket_sec;
+	RK_U64 head = ds->head.load(std::memory_order_acquire);
+	dwell_counts_t counts;
+	RK_U32 used = 0;
+
+	memset(out, 0, sizeof(*out));
+	if (want < 1)
+		want = 1;
+	if (want > ds->cfg.bucket_count)
+		want = ds->cfg.bucket_count;
+	for (RK_U32 k = 0; k < want && k <= head; k++) {
+		RK_U64 index;
+		dwell_read_bucket(&ds->buckets[(head - k) % ds->cfg.bucket_count], &index, &counts);
+		if (index != head - k)	// never written, or already reused by a newer bucket
+			continue;
+		used++;
+		for (int c = 0; c < DWELL_MAX_CLASSES; c++) {
+			for (int s = 0; s < DWELL_MAX_SCOPES; s++) {
+				out->counts.entries[c][s] += counts.entries[c][s];
+				out->counts.exits[c][s] += counts.exits[c][s];
+				out->counts.dwell_ms[c][s] += counts.dwell_ms[c][s];
+				for (int h = 0; h < DWELL_HIST_BINS; h++)
+					out->counts.hist[c][s][h] += counts.hist[c][s][h];
+			}
+		}
+	}
+	out->window_sec = used * ds->cfg.bucket_sec;
+	for (int c = 0; c < DWELL_MAX_CLASSES; c++) {
+		for (int s = 0; s < DWELL_MAX_SCOPES; s++)
+			out->occupancy[c][s] = ds->occupancy[c][s].load(std::memory_order_relaxed);
+	}
+}
+
+void dwell_dump_stats(dwell_stats_t *ds, const zone_analytics_t *zones, RK_U32 window_sec) {
+	dwell_summary_t sum;
+	int scopes = zones ? zones->zone_count + 1 : 1;
+
+	dwell_query(ds, window_sec, &sum);
+	for (int s = 0; s < scopes; s++) {
+		RK_U32 entries = 0, exits = 0, occupancy = 0;
+		RK_U32 hist[DWELL_HIST_BINS] = {0};
+		RK_U64 dwell_ms = 0;
+		for (int c = 0; c < DWELL_MAX_CLASSES; c++) {
+			entries += sum.counts.entries[c][s];
+			exits += sum.counts.exits[c][s];
+			dwell_ms += sum.counts.dwell_ms[c][s];
+			occupancy += sum.occupancy[c][s];
+			for (int h = 0; h < DWELL_HIST_BINS; h++)
+				hist[h] += sum.counts.hist[c][s][h];
+		}
+		int top_bin = 0;
+		for (int h = 1; h < DWELL_HIST_BINS; h++) {
+			if (hist[h] > hist[top_bin])
+				top_bin = h;
+		}
+		printf("dwell %s (last %us): %u in, %u out, %u now, mean %.1fs, mostly %us+\n",
+		       s == 0 ? "frame" : zones->zones[s - 1].name, sum.window_sec, entries, exits, occupancy,
+		       exits ? dwell_ms / 1000.0 / exits : 0.0, dwell_bin_floor_sec(top_bin));
+	}
+}
+
+void dwell_deinit(dwell_stats_t *ds) {
+	free(ds->buckets);
+	ds->buckets = NULL;
+}
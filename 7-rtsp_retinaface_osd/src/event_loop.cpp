@@ -0,0 +1,136 @@
+/*****************************************************************************
+* | Function    :   epoll loop driving the MPI channel fds and RTSP events
+*
+******************************************************************************/
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "luckfox_mpi.h"
+#include "event_loop.h"
+
+int event_loop_init(event_loop_t *loop, int tick_ms, event_loop_tick_cb tick_cb, void *tick_arg) {
+	struct epoll_event ev;
+
+	memset(loop, 0, sizeof(*loop));
+	for (int i = 0; i < EVENT_LOOP_MAX_FDS; i++)
+		loop->handlers[i].fd = -1;
+
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		printf("epoll_create1 fail %s\n", strerror(errno));
+		return -1;
+	}
+	loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->wakefd < 0) {
+		printf("eventfd fail %s\n", strerror(errno));
+		close(loop->epfd);
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = 0;	// handlers use slot + 1
+	epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev);
+
+	loop->tick_ms = tick_ms;
+	loop->tick_cb = tick_cb;
+	loop->tick_arg = tick_arg;
+	return 0;
+}
+
+int event_loop_add(event_loop_t *loop, int fd, event_loop_cb cb, void *arg) {
+	struct epoll_event ev;
+	int slot = -1;
+
+	if (fd < 0)
+		return -1;
+	for (int i = 0; i < EVENT_LOOP_MAX_FDS; i++) {
+		if (loop->handlers[i].fd < 0) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot < 0) {
+		printf("event_loop: no free slot for fd %d\n", fd);
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = (uint32_t)slot + 1;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		printf("event_loop: epoll_ctl add fd %d fail %s\n", fd, strerror(errno));
+		return -1;
+	}
+	loop->handlers[slot].fd = fd;
+	loop->handlers[slot].cb = cb;
+	loop->handlers[slot].arg = arg;
+	return 0;
+}
+
+int event_loop_del(event_loop_t *loop, int fd) {
+	for (int i = 0; i < EVENT_LOOP_MAX_FDS; i++) {
+		if (loop->handlers[i].fd == fd) {
+			epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+			loop->handlers[i].fd = -1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int event_loop_run(event_loop_t *loop) {
+	struct epoll_event events[EVENT_LOOP_MAX_FDS + 1];
+	int timeout = loop->tick_cb ? loop->tick_ms : -1;
+
+	loop->running = true;
+	loop->last_tick_us = TEST_COMM_GetNowUs();
+	while (loop->running) {
+		int n = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_FDS + 1, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("epoll_wait fail %s\n", strerror(errno));
+			return -1;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.u32 == 0) {
+				uint64_t val;
+				while (read(loop->wakefd, &val, sizeof(val)) > 0) {
+				}
+				continue;
+			}
+			event_loop_handler_t *h = &loop->handlers[events[i].data.u32 - 1];
+			if (h->fd >= 0)
+				h->cb(h->fd, events[i].events, h->arg);
+		}
+
+		// tick even under constant traffic so RTSP requests are never starved
+		if (loop->tick_cb) {
+			RK_U64 now = TEST_COMM_GetNowUs();
+			if (n == 0 || now - loop->last_tick_us >= (RK_U64)loop->tick_ms * 1000) {
+				loop->tick_cb(loop->tick_arg);
+				loop->last_tick_us = now;
+			}
+		}
+	}
+	return 0;
+}
+
+void event_loop_stop(event_loop_t *loop) {
+	uint64_t one = 1;
+
+	loop->running = false;
+	if (write(loop->wakefd, &one, sizeof(one)) < 0)
+		printf("event_loop: wake fail %s\n", strerror(errno));
+}
+
+void event_loop_deinit(event_loop_t *loop) {
+	if (loop->wakefd >= 0)
+		close(loop->wakefd);
+	if (loop->epfd >= 0)
+		close(loop->epfd);
+	loop->wakefd = -1;
+	loop->epfd = -1;
+}
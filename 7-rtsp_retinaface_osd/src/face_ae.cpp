@@ -0,0 +1,144 @@
+/*****************************************************************************
+* | Function    :   Face-priority AE metering through the rkaiq grid weights
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "face_ae.h"
+
+void face_ae_cfg_default(face_ae_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->min_interval_ms = 200;
+	cfg->hold_ms = 2000;
+	cfg->smooth_q8 = 64;
+	cfg->margin_percent = 30;
+	cfg->face_weight = 31;
+	cfg->bg_divisor = 4;
+}
+
+int face_ae_init(face_ae_t *ae, const face_ae_cfg_t *cfg, const face_ae_ops_t *ops, RK_U32 width,
+                 RK_U32 height) {
+	memset(ae, 0, sizeof(*ae));
+	ae->cfg = *cfg;
+	ae->ops = *ops;
+	ae->width = width;
+	ae->height = height;
+
+	if (ae->ops.get_weights(ae->ops.ctx, ae->defaults) != 0) {
+		printf("face_ae: cannot read the AE grid weights\n");
+		return -1;
+	}
+	for (int i = 0; i < FACE_AE_CELLS; i++) {
+		ae->target[i] = ae->defaults[i];
+		ae->applied[i] = ae->defaults[i];
+		ae->cur_q8[i] = ae->defaults[i] << 8;
+	}
+	return 0;
+}
+
+static void face_ae_build_target(face_ae_t *ae, const RECT_S *faces, int count) {
+	for (int i = 0; i < FACE_AE_CELLS; i++) {
+		int bg = ae->defaults[i] / (ae->cfg.bg_divisor ? ae->cfg.bg_divisor : 1);
+		ae->target[i] = bg > 0 ? bg : 1;
+	}
+
+	for (int f = 0; f < count && f < FACE_AE_MAX_FACES; f++) {
+		RK_S32 mx = faces[f].u32Width * ae->cfg.margin_percent / 200;
+		RK_S32 my = faces[f].u32Height * ae->cfg.margin_percent / 200;
+		RK_S32 x0 = faces[f].s32X - mx;
+		RK_S32 y0 = faces[f].s32Y - my;
+		RK_S32 x1 = faces[f].s32X + (RK_S32)faces[f].u32Width + mx;
+		RK_S32 y1 = faces[f].s32Y + (RK_S32)faces[f].u32Height + my;
+
+		// every cell the grown box touches
+		int gx0 = x0 <= 0 ? 0 : x0 * FACE_AE_GRID / (RK_S32)ae->width;
+		int gy0 = y0 <= 0 ? 0 : y0 * FACE_AE_GRID / (RK_S32)ae->height;
+		int gx1 = x1 <= 0 ? -1 : (x1 - 1) * FACE_AE_GRID / (RK_S32)ae->width;
+		int gy1 = y1 <= 0 ? -1 : (y1 - 1) * FACE_AE_GRID / (RK_S32)ae->height;
+		if (gx1 >= FACE_AE_GRID)
+			gx1 = FACE_AE_GRID - 1;
+		if (gy1 >= FACE_AE_GRID)
+			gy1 = FACE_AE_GRID - 1;
+		for (int gy = gy0; gy <= gy1; gy++)
+			for (int gx = gx0; gx <= gx1; gx++)
+				ae->target[gy * FACE_AE_GRID + gx] = ae->cfg.face_weight;
+	}
+}
+
+int face_ae_update(face_ae_t *ae, const RECT_S *faces, int count, RK_U64 now_us) {
+	if (count > 0) {
+		face_ae_build_target(ae, faces, count);
+		ae->last_face_us = now_us;
+		ae->face_mode = true;
+	} else if (ae->face_mode && now_us - ae->last_face_us > (RK_U64)ae->cfg.hold_ms * 1000) {
+		// faces gone: glide back to the tuning weights
+		memcpy(ae->target, ae->defaults, sizeof(ae->target));
+		ae->face_mode = false;
+	}
+
+	if (ae->last_push_us && now_us - ae->last_push_us < (RK_U64)ae->cfg.min_interval_ms * 1000)
+		return 0;
+
+	bool changed = false;
+	uint8_t next[FACE_AE_CELLS];
+	for (int i = 0; i < FACE_AE_CELLS; i++) {
+		RK_S32 goal = ae->target[i] << 8;
+		RK_S32 cur = ae->cur_q8[i];
+		cur += (goal - cur) * (RK_S32)ae->cfg.smooth_q8 / 256;
+		// the step rounds to 0 close to the goal, finish it
+		if (cur == ae->cur_q8[i])
+			cur = goal;
+		ae->cur_q8[i] = cur;
+		next[i] = (cur + 128) >> 8;
+		if (next[i] != ae->applied[i])
+			changed = true;
+	}
+	if (!changed)
+		return 0;
+
+	ae->last_push_us = now_us;
+	if (ae->ops.set_weights(ae->ops.ctx, next) != 0) {
+		ae->push_errors++;
+		return -1;
+	}
+	memcpy(ae->applied, next, sizeof(ae->applied));
+	ae->pushes++;
+	return 1;
+}
+
+int face_ae_restore(face_ae_t *ae) {
+	memcpy(ae->target, ae->defaults, sizeof(ae->target));
+	for (int i = 0; i < FACE_AE_CELLS; i++)
+		ae->cur_q8[i] = ae->defaults[i] << 8;
+	ae->face_mode = false;
+	if (ae->ops.set_weights(ae->ops.ctx, ae->defaults) != 0)
+		return -1;
+	memcpy(ae->applied, ae->defaults, sizeof(ae->applied));
+	return 0;
+}
+
+static int face_ae_rkaiq_get(void *ctx, uint8_t *weights) {
+	Uapi_ExpSwAttrV2_t attr;
+	if (rk_aiq_user_api2_ae_getExpSwAttr((const rk_aiq_sys_ctx_t *)ctx, &attr) != XCAM_RETURN_NO_ERROR)
+		return -1;
+	memcpy(weights, attr.GridWeights.uCoeff, FACE_AE_CELLS);
+	return 0;
+}
+
+static int face_ae_rkaiq_set(void *ctx, const uint8_t *weights) {
+	Uapi_ExpSwAttrV2_t attr;
+	if (rk_aiq_user_api2_ae_getExpSwAttr((const rk_aiq_sys_ctx_t *)ctx, &attr) != XCAM_RETURN_NO_ERROR)
+		return -1;
+	memcpy(attr.GridWeights.uCoeff, weights, FACE_AE_CELLS);
+	// async: applied by the AE thread on its next run, never blocks the caller
+	attr.sync.sync_mode = RK_AIQ_UAPI_MODE_ASYNC;
+	if (rk_aiq_user_api2_ae_setExpSwAttr((const rk_aiq_sys_ctx_t *)ctx, attr) != XCAM_RETURN_NO_ERROR)
+		return -1;
+	return 0;
+}
+
+void face_ae_ops_rkaiq(face_ae_ops_t *ops, void *aiq_ctx) {
+	ops->ctx = aiq_ctx;
+	ops->get_weights = face_ae_rkaiq_get;
+	ops->set_weights = face_ae_rkaiq_set;
+}
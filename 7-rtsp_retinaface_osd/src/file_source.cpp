@@ -0,0 +1,376 @@
+/*****************************************************************************
+* | Function    :   H.264/H.265 Annex-B file ingest through VDEC
+*
+******************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "luckfox_mpi.h"
+#include "file_source.h"
+
+#define FILE_SOURCE_SEND_TIMEOUT_MS 20	// then drain decoded frames and retry
+#define FILE_SOURCE_EOS_TIMEOUT_MS 200
+
+void file_source_cfg_default(file_source_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->codec = RK_VIDEO_ID_Unused;
+	cfg->max_width = 1920;
+	cfg->max_height = 1088;
+	cfg->fps = 30;
+	cfg->pace = FILE_SOURCE_MAX_SPEED;
+	cfg->loop = false;
+	cfg->frame_buf_cnt = 6;
+}
+
+/* position of the next 00 00 01 (or 00 00 00 01) at or after from, size if none */
+static size_t file_source_find_start(const uint8_t *p, size_t from, size_t size) {
+	size_t i = from;
+	while (i + 2 < size) {
+		if (p[i + 2] > 1)
+			i += 3;
+		else if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+			return (i > from && p[i - 1] == 0) ? i - 1 : i;
+		else
+			i++;
+	}
+	return size;
+}
+
+static size_t file_source_nal_header(const uint8_t *p, size_t sc, size_t size) {
+	while (sc < size && p[sc] == 0)
+		sc++;
+	return sc + 1;	// skip the 01
+}
+
+static RK_CODEC_ID_E file_source_guess_codec(const uint8_t *p, size_t size, const char *path) {
+	size_t h = file_source_nal_header(p, file_source_find_start(p, 0, size), size);
+	if (h + 1 < size) {
+		int hevc_type = (p[h] >> 1) & 0x3f;
+		if ((p[h] & 0x81) == 0 && p[h + 1] == 1 &&
+		    (hevc_type == 32 || hevc_type == 33 || hevc_type == 34 || hevc_type == 35 || hevc_type == 39))
+			return RK_VIDEO_ID_HEVC;
+		int avc_type = p[h] & 0x1f;
+		if ((p[h] & 0x80) == 0 && (avc_type == 1 || avc_type == 5 || avc_type == 6 || avc_type == 7 ||
+		                           avc_type == 8 || avc_type == 9))
+			return RK_VIDEO_ID_AVC;
+	}
+	const char *ext = strrchr(path, '.');
+	if (ext && (!strcasecmp(ext, ".h265") || !strcasecmp(ext, ".265") || !strcasecmp(ext, ".hevc")))
+		return RK_VIDEO_ID_HEVC;
+	if (ext && (!strcasecmp(ext, ".h264") || !strcasecmp(ext, ".264") || !strcasecmp(ext, ".avc")))
+		return RK_VIDEO_ID_AVC;
+	return RK_VIDEO_ID_Unused;
+}
+
+int file_source_open(file_source_t *src, const char *path, const file_source_cfg_t *cfg) {
+	struct stat st;
+
+	memset(src, 0, sizeof(*src));
+	src->cfg = *cfg;
+	src->fd = open(path, O_RDONLY);
+	if (src->fd < 0) {
+		printf("file_source: open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(src->fd, &st) != 0 || st.st_size < 8) {
+		printf("file_source: %s is empty\n", path);
+		file_source_close(src);
+		return -1;
+	}
+	src->size = st.st_size;
+	void *map = mmap(NULL, src->size, PROT_READ, MAP_PRIVATE, src->fd, 0);
+	if (map == MAP_FAILED) {
+		printf("file_source: mmap %s failed: %s\n", path, strerror(errno));
+		src->size = 0;
+		file_source_close(src);
+		return -1;
+	}
+	src->data = (const uint8_t *)map;
+	madvise(map, src->size, MADV_SEQUENTIAL);
+
+	if (memcmp(src->data + 4, "ftyp", 4) == 0) {
+		printf("file_source: %s is MP4, only Annex-B elementary streams are supported "
+		       "(ffmpeg -i in.mp4 -c copy -bsf:v h264_mp4toannexb out.h264)\n", path);
+		file_source_close(src);
+		return -1;
+	}
+	if (src->cfg.codec == RK_VIDEO_ID_Unused)
+		src->cfg.codec = file_source_guess_codec(src->data, src->size, path);
+	if (src->cfg.codec != RK_VIDEO_ID_AVC && src->cfg.codec != RK_VIDEO_ID_HEVC) {
+		printf("file_source: %s is not an H.264/H.265 Annex-B stream\n", path);
+		file_source_close(src);
+		return -1;
+	}
+	if (src->cfg.fps == 0)
+		src->cfg.fps = 30;
+	src->pos = file_source_find_start(src->data, 0, src->size);
+	printf("file_source: %s, %s, %zu bytes\n", path, src->cfg.codec == RK_VIDEO_ID_HEVC ? "h265" : "h264",
+	       src->size);
+	return 0;
+}
+
+void file_source_set_decoder(file_source_t *src, const file_source_dec_ops_t *dec) {
+	src->dec = *dec;
+}
+
+/* NAL starts a new access unit if one already has a picture: parameter sets, AUD, prefix SEI,
+ * or the first slice of the next picture */
+static bool file_source_nal_starts_au(RK_CODEC_ID_E codec, const uint8_t *h, size_t avail, bool *vcl) {
+	if (codec == RK_VIDEO_ID_HEVC) {
+		if (avail < 3)
+			return false;
+		int type = (h[0] >> 1) & 0x3f;
+		*vcl = type < 32;
+		if (*vcl)
+			return (h[2] & 0x80) != 0;	// first_slice_segment_in_pic_flag
+		return (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) ||
+		       (type >= 48 && type <= 55);
+	}
+	if (avail < 2)
+		return false;
+	int type = h[0] & 0x1f;
+	*vcl = type >= 1 && type <= 5;
+	if (*vcl)
+		return (h[1] & 0x80) != 0;	// first_mb_in_slice == 0
+	return (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+}
+
+size_t file_source_next_au(file_source_t *src, const uint8_t **au) {
+	const uint8_t *p = src->data;
+	size_t begin = src->pos;
+	size_t sc = begin;
+	bool have_vcl = false;
+
+	if (begin >= src->size)
+		return 0;
+	while (sc < src->size) {
+		size_t h = file_source_nal_header(p, sc, src->size);
+		if (h >= src->size)
+			break;
+		size_t next = file_source_find_start(p, h, src->size);
+		bool vcl = false;
+		bool starts = file_source_nal_starts_au(src->cfg.codec, p + h, next - h, &vcl);
+		if (have_vcl && starts)
+			break;
+		have_vcl |= vcl;
+		sc = next;
+	}
+	if (sc > src->size)
+		sc = src->size;
+	src->pos = sc;
+	*au = p + begin;
+	return sc - begin;
+}
+
+static int file_source_drain(file_source_t *src, file_source_frame_cb cb, void *arg, RK_S32 timeout_ms,
+                             bool *stop) {
+	VIDEO_FRAME_INFO_S frame;
+	int count = 0;
+
+	while (src->dec.get(src->dec.ctx, &frame, timeout_ms) == RK_SUCCESS) {
+		RK_U64 begin = TEST_COMM_GetNowUs();
+		int ret = cb(&frame, arg);
+		src->cb_us += TEST_COMM_GetNowUs() - begin;
+		src->dec.release(src->dec.ctx, &frame);
+		src->frames++;
+		count++;
+		if (ret < 0) {
+			*stop = true;
+			break;
+		}
+	}
+	return count;
+}
+
+int file_source_run(file_source_t *src, file_source_frame_cb cb, void *arg, volatile bool *quit) {
+	RK_U64 interval_us = 1000000 / src->cfg.fps;
+	RK_U64 pts = 0;
+	bool stop = false;
+
+	if (!src->dec.send) {
+		printf("file_source: no decoder\n");
+		return -1;
+	}
+	src->start_us = TEST_COMM_GetNowUs();
+	while (!stop && !(quit && *quit)) {
+		const uint8_t *au;
+		size_t len = file_source_next_au(src, &au);
+		if (len == 0) {
+			if (!src->cfg.loop)
+				break;
+			src->pos = file_source_find_start(src->data, 0, src->size);
+			continue;
+		}
+		pts = src->aus * interval_us;
+		if (src->cfg.pace == FILE_SOURCE_REALTIME) {
+			RK_U64 now = TEST_COMM_GetNowUs();
+			if (src->start_us + pts > now)
+				usleep(src->start_us + pts - now);
+		}
+		// the decoder stalls once its output buffers are full, so empty them while waiting
+		bool sent = true;
+		while (src->dec.send(src->dec.ctx, au, len, pts, false, FILE_SOURCE_SEND_TIMEOUT_MS) != RK_SUCCESS) {
+			src->send_retries++;
+			file_source_drain(src, cb, arg, 0, &stop);
+			if (stop || (quit && *quit)) {
+				sent = false;
+				break;
+			}
+		}
+		if (!sent)
+			break;
+		src->aus++;
+		src->bytes += len;
+		file_source_drain(src, cb, arg, 0, &stop);
+	}
+
+	// stopping: the pictures held for reordering go with the decoder on close
+	if (stop || (quit && *quit))
+		return 0;
+	// flush them at the end of the file; EOS too needs room in the decoder
+	RK_U64 give_up = TEST_COMM_GetNowUs() + FILE_SOURCE_EOS_TIMEOUT_MS * 1000;
+	while (src->dec.send(src->dec.ctx, NULL, 0, pts + interval_us, true, FILE_SOURCE_SEND_TIMEOUT_MS) !=
+	       RK_SUCCESS) {
+		src->send_retries++;
+		file_source_drain(src, cb, arg, 0, &stop);
+		if (stop || (quit && *quit))
+			return 0;
+		if (TEST_COMM_GetNowUs() >= give_up) {
+			printf("file_source: decoder did not take EOS in %d ms\n", FILE_SOURCE_EOS_TIMEOUT_MS);
+			return 0;
+		}
+	}
+	file_source_drain(src, cb, arg, FILE_SOURCE_EOS_TIMEOUT_MS, &stop);
+	return 0;
+}
+
+void file_source_dump_stats(file_source_t *src) {
+	RK_U64 elapsed = TEST_COMM_GetNowUs() - src->start_us;
+	if (!src->start_us || !elapsed)
+		return;
+	printf("file source: %llu au, %llu frames, %.1f fps (%s), %.1f Mbps in, consumer %llu us/frame, "
+	       "%u send retries\n",
+	       (unsigned long long)src->aus, (unsigned long long)src->frames, src->frames * 1e6 / elapsed,
+	       src->cfg.pace == FILE_SOURCE_REALTIME ? "realtime" : "max speed", src->bytes * 8.0 / elapsed,
+	       (unsigned long long)(src->frames ? src->cb_us / src->frames : 0), src->send_retries);
+}
+
+void file_source_close(file_source_t *src) {
+	if (src->dec.close) {
+		src->dec.close(src->dec.ctx);
+		memset(&src->dec, 0, sizeof(src->dec));
+	}
+	if (src->data) {
+		munmap((void *)src->data, src->size);
+		src->data = NULL;
+	}
+	if (src->fd >= 0) {
+		close(src->fd);
+		src->fd = -1;
+	}
+}
+
+typedef struct {
+	VDEC_CHN chn;
+} file_source_vdec_t;
+
+static RK_S32 file_source_vdec_free(void *opaque) {
+	(void)opaque;	// the data belongs to the file mapping
+	return 0;
+}
+
+static RK_S32 file_source_vdec_send(void *ctx, const uint8_t *data, size_t len, RK_U64 pts, bool eos,
+                                    RK_S32 timeout_ms) {
+	file_source_vdec_t *vdec = (file_source_vdec_t *)ctx;
+	VDEC_STREAM_S stStream;
+	MB_BLK blk = RK_NULL;
+	RK_S32 s32Ret;
+
+	memset(&stStream, 0, sizeof(stStream));
+	if (len > 0) {
+		MB_EXT_CONFIG_S stExt;
+		memset(&stExt, 0, sizeof(stExt));
+		stExt.pu8VirAddr = (RK_U8 *)data;
+		stExt.u64Size = len;
+		stExt.pFreeCB = file_source_vdec_free;
+		s32Ret = RK_MPI_SYS_CreateMB(&blk, &stExt);
+		if (s32Ret != RK_SUCCESS) {
+			RK_LOGE("RK_MPI_SYS_CreateMB fail %x", s32Ret);
+			return s32Ret;
+		}
+	}
+	stStream.pMbBlk = blk;
+	stStream.u32Len = len;
+	stStream.u64PTS = pts;
+	stStream.bEndOfStream = eos ? RK_TRUE : RK_FALSE;
+	stStream.bEndOfFrame = RK_TRUE;
+	stStream.bBypassMbBlk = RK_FALSE;	// VDEC copies, the mapping is read only
+	s32Ret = RK_MPI_VDEC_SendStream(vdec->chn, &stStream, timeout_ms);
+	if (blk)
+		RK_MPI_MB_ReleaseMB(blk);
+	return s32Ret;
+}
+
+static RK_S32 file_source_vdec_get(void *ctx, VIDEO_FRAME_INFO_S *frame, RK_S32 timeout_ms) {
+	file_source_vdec_t *vdec = (file_source_vdec_t *)ctx;
+	return RK_MPI_VDEC_GetFrame(vdec->chn, frame, timeout_ms);
+}
+
+static RK_S32 file_source_vdec_release(void *ctx, const VIDEO_FRAME_INFO_S *frame) {
+	file_source_vdec_t *vdec = (file_source_vdec_t *)ctx;
+	return RK_MPI_VDEC_ReleaseFrame(vdec->chn, frame);
+}
+
+static void file_source_vdec_close(void *ctx) {
+	file_source_vdec_t *vdec = (file_source_vdec_t *)ctx;
+	RK_MPI_VDEC_StopRecvStream(vdec->chn);
+	RK_MPI_VDEC_DestroyChn(vdec->chn);
+	free(vdec);
+}
+
+int file_source_dec_ops_vdec(file_source_dec_ops_t *ops, int vdec_chn, const file_source_cfg_t *cfg) {
+	printf("========%s========\n", __func__);
+	VDEC_CHN_ATTR_S stAttr;
+	VDEC_CHN_PARAM_S stParam;
+	RK_S32 s32Ret;
+
+	memset(ops, 0, sizeof(*ops));
+	memset(&stAttr, 0, sizeof(stAttr));
+	stAttr.enMode = VIDEO_MODE_FRAME;
+	stAttr.enType = cfg->codec;
+	stAttr.u32PicWidth = cfg->max_width;
+	stAttr.u32PicHeight = cfg->max_height;
+	stAttr.u32FrameBufCnt = cfg->frame_buf_cnt;
+	stAttr.u32StreamBufCnt = 4;
+	s32Ret = RK_MPI_VDEC_CreateChn(vdec_chn, &stAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VDEC_CreateChn %d fail %x", vdec_chn, s32Ret);
+		return -1;
+	}
+
+	// linear NV12 so VPSS and the CPU can both read it
+	memset(&stParam, 0, sizeof(stParam));
+	RK_MPI_VDEC_GetChnParam(vdec_chn, &stParam);
+	stParam.stVdecVideoParam.enCompressMode = COMPRESS_MODE_NONE;
+	stParam.stVdecVideoParam.enOutputOrder = VIDEO_OUTPUT_ORDER_DISP;
+	s32Ret = RK_MPI_VDEC_SetChnParam(vdec_chn, &stParam);
+	if (s32Ret != RK_SUCCESS)
+		RK_LOGE("RK_MPI_VDEC_SetChnParam %d fail %x", vdec_chn, s32Ret);
+
+	s32Ret = RK_MPI_VDEC_StartRecvStream(vdec_chn);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VDEC_StartRecvStream %d fail %x", vdec_chn, s32Ret);
+		RK_MPI_VDEC_DestroyChn(vdec_chn);
+		return -1;
+	}
+
+	file_source_vdec_t *vdec = (file_source_vdec_t *)malloc(sizeof(file_source_vdec_t));
+	vdec->chn = vdec_chn;
+	ops->ctx = vdec;
+	ops->send = file_source_vdec_send;
+	ops->get = file_source_vdec_get;
+	ops->release = file_source_vdec_release;
+	ops->close = file_source_vdec_close;
+	return 0;
+}
@@ -0,0 +1,343 @@
+/*****************************************************************************
+* | Function    :   Local frame sharing: DMA-buf fds over a Unix socket,
+*                   refcounted slots and client release
+*
+******************************************************************************/
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "luckfox_mpi.h"
+#include "rt_sched.h"
+#include "frame_share.h"
+
+#define FRAME_SHARE_TICK_MS 100
+
+void frame_share_cfg_default(frame_share_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->path = FRAME_SHARE_DEFAULT_PATH;
+	cfg->max_slots = 4;
+	cfg->max_inflight = 2;
+	cfg->lease_ms = 1000;
+	cfg->source_fd = -1;
+}
+
+static void frame_share_slot_unref(frame_share_t *share, int s) {
+	frame_share_slot_t *slot = &share->slots[s];
+
+	if (--slot->refs > 0)
+		return;
+	share->hold_us += TEST_COMM_GetNowUs() - slot->publish_us;
+	share->holds++;
+	slot->in_use = false;
+	if (share->cfg.release)
+		share->cfg.release(slot->priv, share->cfg.cb_arg);
+}
+
+static void frame_share_drop_client(frame_share_t *share, frame_share_client_state_t *client, const char *why) {
+	printf("frame share: client fd %d %s, %u sent, %u skipped\n", client->fd, why, client->sent, client->skipped);
+	event_loop_del(&share->loop, client->fd);
+	close(client->fd);
+	client->fd = -1;
+	for (int s = 0; s < FRAME_SHARE_MAX_SLOTS; s++) {
+		if (client->held & (1u << s))
+			frame_share_slot_unref(share, s);
+	}
+	client->held = 0;
+}
+
+static frame_share_client_state_t *frame_share_find_client(frame_share_t *share, int fd) {
+	for (int i = 0; i < FRAME_SHARE_MAX_CLIENTS; i++) {
+		if (share->clients[i].fd == fd)
+			return &share->clients[i];
+	}
+	return NULL;
+}
+
+static void frame_share_client_ready(int fd, RK_U32 events, void *arg) {
+	frame_share_t *share = (frame_share_t *)arg;
+	frame_share_client_state_t *client = frame_share_find_client(share, fd);
+	frame_share_msg_t msg;
+
+	(void)events;
+	if (!client)
+		return;
+	for (;;) {
+		ssize_t n = recv(fd, &msg, sizeof(msg), MSG_DONTWAIT);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0) {
+			frame_share_drop_client(share, client, "closed");
+			return;
+		}
+		if (n != (ssize_t)sizeof(msg) || msg.magic != FRAME_SHARE_MAGIC || msg.type != FRAME_SHARE_MSG_RELEASE) {
+			frame_share_drop_client(share, client, "sent garbage");
+			return;
+		}
+		// a stale or repeated release must not free somebody else's frame
+		for (RK_U32 s = 0; s < share->cfg.max_slots; s++) {
+			frame_share_slot_t *slot = &share->slots[s];
+			if (slot->in_use && slot->seq == msg.seq && (client->held & (1u << s))) {
+				client->held &= ~(1u << s);
+				frame_share_slot_unref(share, s);
+				break;
+			}
+		}
+	}
+}
+
+static void frame_share_accept(int fd, RK_U32 events, void *arg) {
+	frame_share_t *share = (frame_share_t *)arg;
+	(void)events;
+
+	int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd < 0)
+		return;
+	frame_share_client_state_t *client = frame_share_find_client(share, -1);
+	if (!client || event_loop_add(&share->loop, client_fd, frame_share_client_ready, share) != 0) {
+		printf("frame share: client limit reached\n");
+		close(client_fd);
+		return;
+	}
+	memset(client, 0, sizeof(*client));
+	client->fd = client_fd;
+	share->connects++;
+	printf("frame share: client fd %d connected\n", client_fd);
+}
+
+static void frame_share_source_ready(int fd, RK_U32 events, void *arg) {
+	frame_share_t *share = (frame_share_t *)arg;
+	(void)fd;
+	(void)events;
+	share->cfg.source(share, share->cfg.cb_arg);
+}
+
+static void frame_share_tick(void *arg) {
+	frame_share_t *share = (frame_share_t *)arg;
+	RK_U64 now = TEST_COMM_GetNowUs();
+
+	for (RK_U32 s = 0; s < share->cfg.max_slots; s++) {
+		frame_share_slot_t *slot = &share->slots[s];
+		if (!slot->in_use || now - slot->publish_us < (RK_U64)share->cfg.lease_ms * 1000)
+			continue;
+		// whoever still holds it is stuck, the buffer goes back to the pipeline
+		for (int i = 0; i < FRAME_SHARE_MAX_CLIENTS && slot->in_use; i++) {
+			frame_share_client_state_t *client = &share->clients[i];
+			if (client->fd >= 0 && (client->held & (1u << s))) {
+				share->lease_expired++;
+				frame_share_drop_client(share, client, "lease expired");
+			}
+		}
+	}
+}
+
+static int frame_share_buffer_index(frame_share_t *share, int fd) {
+	int free_index = -1;
+
+	for (int b = 0; b < FRAME_SHARE_MAX_BUFFERS; b++) {
+		if (share->buffers[b] == fd)
+			return b;
+		if (share->buffers[b] < 0 && free_index < 0)
+			free_index = b;
+	}
+	if (free_index >= 0)
+		share->buffers[free_index] = fd;
+	return free_index;
+}
+
+static int frame_share_send(frame_share_client_state_t *client, const frame_share_msg_t *msg, int fd) {
+	struct msghdr mh;
+	struct iovec iov;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = (void *)msg;
+	iov.iov_len = sizeof(*msg);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (fd >= 0) {
+		memset(&control, 0, sizeof(control));
+		mh.msg_control = control.buf;
+		mh.msg_controllen = sizeof(control.buf);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+	return sendmsg(client->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)sizeof(*msg) ? 0 : -1;
+}
+
+int frame_share_publish(frame_share_t *share, const frame_share_frame_t *frame, const void *priv, size_t priv_size) {
+	int s = -1;
+	int buffer = frame_share_buffer_index(share, frame->fd);
+
+	for (RK_U32 i = 0; i < share->cfg.max_slots; i++) {
+		if (!share->slots[i].in_use) {
+			s = i;
+			break;
+		}
+	}
+	if (s < 0 || buffer < 0 || priv_size > FRAME_SHARE_PRIV_BYTES) {
+		share->no_slot++;
+		if (share->cfg.release)
+			share->cfg.release((void *)priv, share->cfg.cb_arg);
+		return 0;
+	}
+
+	frame_share_slot_t *slot = &share->slots[s];
+	slot->in_use = true;
+	slot->seq = ++share->seq;
+	slot->buffer = buffer;
+	slot->refs = 1;				// the publisher's own, dropped below
+	slot->publish_us = TEST_COMM_GetNowUs();
+	memcpy(slot->priv, priv, priv_size);
+	share->published++;
+
+	frame_share_msg_t msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = FRAME_SHARE_MAGIC;
+	msg.version = FRAME_SHARE_VERSION;
+	msg.type = FRAME_SHARE_MSG_FRAME;
+	msg.seq = slot->seq;
+	msg.buffer = buffer;
+	msg.pts = frame->pts;
+	msg.width = frame->width;
+	msg.height = frame->height;
+	msg.hor_stride = frame->hor_stride;
+	msg.ver_stride = frame->ver_stride;
+	msg.format = FRAME_SHARE_FMT_NV12;
+	msg.size = frame->size;
+	msg.lease_ms = share->cfg.lease_ms;
+	msg.max_inflight = share->cfg.max_inflight;
+
+	int sent = 0;
+	for (int i = 0; i < FRAME_SHARE_MAX_CLIENTS; i++) {
+		frame_share_client_state_t *client = &share->clients[i];
+		if (client->fd < 0)
+			continue;
+		if ((RK_U32)__builtin_popcount(client->held) >= share->cfg.max_inflight) {
+			client->skipped++;
+			continue;
+		}
+		bool first = !(client->known & (1u << buffer));
+		msg.flags = first ? FRAME_SHARE_FLAG_FD : 0;
+		if (frame_share_send(client, &msg, first ? frame->fd : -1) != 0) {
+			// socket buffer full: a slow reader, not a dead one
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				client->skipped++;
+			else
+				frame_share_drop_client(share, client, "send failed");
+			continue;
+		}
+		client->known |= 1u << buffer;
+		client->held |= 1u << s;
+		client->sent++;
+		slot->refs++;
+		sent++;
+	}
+	if (sent == 0)
+		share->unwatched++;
+	frame_share_slot_unref(share, s);
+	return sent;
+}
+
+int frame_share_clients(const frame_share_t *share) {
+	int count = 0;
+	for (int i = 0; i < FRAME_SHARE_MAX_CLIENTS; i++)
+		count += share->clients[i].fd >= 0;
+	return count;
+}
+
+static void *frame_share_thread(void *arg) {
+	frame_share_t *share = (frame_share_t *)arg;
+	event_loop_run(&share->loop);
+	return NULL;
+}
+
+int frame_share_start(frame_share_t *share, const frame_share_cfg_t *cfg) {
+	struct sockaddr_un addr;
+
+	memset(share, 0, sizeof(*share));
+	share->cfg = *cfg;
+	share->listen_fd = -1;
+	for (int b = 0; b < FRAME_SHARE_MAX_BUFFERS; b++)
+		share->buffers[b] = -1;
+	for (int i = 0; i < FRAME_SHARE_MAX_CLIENTS; i++)
+		share->clients[i].fd = -1;
+	if (share->cfg.max_slots == 0 || share->cfg.max_slots > FRAME_SHARE_MAX_SLOTS)
+		share->cfg.max_slots = FRAME_SHARE_MAX_SLOTS;
+	if (share->cfg.max_inflight == 0)
+		share->cfg.max_inflight = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (!share->cfg.path || strlen(share->cfg.path) >= sizeof(addr.sun_path)) {
+		printf("frame share: bad socket path\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, share->cfg.path);
+	share->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (share->listen_fd < 0) {
+		printf("frame share: socket fail %s\n", strerror(errno));
+		return -1;
+	}
+	unlink(share->cfg.path);
+	if (bind(share->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(share->listen_fd, FRAME_SHARE_MAX_CLIENTS) != 0) {
+		printf("frame share: bind %s fail %s\n", share->cfg.path, strerror(errno));
+		close(share->listen_fd);
+		return -1;
+	}
+
+	if (event_loop_init(&share->loop, FRAME_SHARE_TICK_MS, frame_share_tick, share) != 0) {
+		close(share->listen_fd);
+		unlink(share->cfg.path);
+		return -1;
+	}
+	event_loop_add(&share->loop, share->listen_fd, frame_share_accept, share);
+	if (share->cfg.source_fd >= 0 && share->cfg.source)
+		event_loop_add(&share->loop, share->cfg.source_fd, frame_share_source_ready, share);
+
+	if (rt_sched_thread_create(&share->thread, RT_STAGE_SHARE, frame_share_thread, share) != 0) {
+		event_loop_deinit(&share->loop);
+		close(share->listen_fd);
+		unlink(share->cfg.path);
+		return -1;
+	}
+	share->thread_running = true;
+	printf("frame share: %s, %u slots, %u in flight per client, %u ms lease\n", share->cfg.path,
+	       share->cfg.max_slots, share->cfg.max_inflight, share->cfg.lease_ms);
+	return 0;
+}
+
+void frame_share_dump_stats(frame_share_t *share) {
+	printf("frame share: %d clients (%u connects), %u published, %u unwatched, %u no slot, %u lease expired, "
+	       "hold avg %llu us\n",
+	       frame_share_clients(share), share->connects, share->published, share->unwatched, share->no_slot,
+	       share->lease_expired, (unsigned long long)(share->holds ? share->hold_us / share->holds : 0));
+	share->hold_us = 0;
+	share->holds = 0;
+}
+
+void frame_share_stop(frame_share_t *share) {
+	if (share->thread_running) {
+		event_loop_stop(&share->loop);
+		pthread_join(share->thread, NULL);
+		share->thread_running = false;
+	}
+	for (int i = 0; i < FRAME_SHARE_MAX_CLIENTS; i++) {
+		if (share->clients[i].fd >= 0)
+			frame_share_drop_client(share, &share->clients[i], "shut down");
+	}
+	event_loop_deinit(&share->loop);
+	if (share->listen_fd >= 0) {
+		close(share->listen_fd);
+		unlink(share->cfg.path);
+		share->listen_fd = -1;
+	}
+}
@@ -0,0 +1,366 @@
+/*****************************************************************************
+* | Function    :   Decaying occupancy heatmap with PNG export and OSD overlay
+*
+******************************************************************************/
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "luckfox_mpi.h"
+#include "heatmap.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#define HEATMAP_OSD_ALPHA 0xA0
+#define HEATMAP_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+void heatmap_cfg_default(heatmap_cfg_t *cfg, RK_U32 width, RK_U32 height) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->width = width;
+	cfg->height = height;
+	cfg->cell = 8;
+	cfg->weight = 64;
+	cfg->decay_shift = 5;			// ~22 s half-life at 1 s
+	cfg->decay_interval_ms = 1000;
+	cfg->footprint_bottom = false;
+	cfg->osd_scale = 2;
+}
+
+/* blue -> cyan -> green -> yellow -> red */
+static uint32_t heatmap_colour(int i) {
+	int r, g, b;
+	if (i < 64) {
+		r = 0; g = i * 4; b = 255;
+	} else if (i < 128) {
+		r = 0; g = 255; b = 255 - (i - 64) * 4;
+	} else if (i < 192) {
+		r = (i - 128) * 4; g = 255; b = 0;
+	} else {
+		r = 255; g = 255 - (i - 192) * 4; b = 0;
+	}
+	return (uint32_t)r << 16 | (uint32_t)g << 8 | (uint32_t)b;
+}
+
+int heatmap_init(heatmap_t *hm, const heatmap_cfg_t *cfg) {
+	memset(hm, 0, sizeof(*hm));
+	hm->cfg = *cfg;
+	hm->rgn_handle = -1;
+	if (hm->cfg.cell == 0)
+		hm->cfg.cell = 8;
+	if (hm->cfg.decay_shift == 0 || hm->cfg.decay_shift > 15)
+		hm->cfg.decay_shift = 5;
+	if (hm->cfg.osd_scale == 0)
+		hm->cfg.osd_scale = 1;
+	hm->gw = (cfg->width + hm->cfg.cell - 1) / hm->cfg.cell;
+	hm->gh = (cfg->height + hm->cfg.cell - 1) / hm->cfg.cell;
+	hm->grid = (uint16_t *)calloc(hm->gw * hm->gh, sizeof(uint16_t));
+	hm->snap = (uint16_t *)calloc(hm->gw * hm->gh, sizeof(uint16_t));
+	if (!hm->grid || !hm->snap) {
+		printf("heatmap: grid alloc failed\n");
+		free(hm->grid);
+		free(hm->snap);
+		hm->grid = NULL;
+		hm->snap = NULL;
+		return -1;
+	}
+	// decays that take a full cell to 0, any more are a clear
+	for (RK_U32 v = 0xffff; v; v -= (v + (1u << hm->cfg.decay_shift) - 1) >> hm->cfg.decay_shift)
+		hm->zero_steps++;
+	for (int i = 0; i < 256; i++)
+		hm->lut[i] = heatmap_colour(i);
+	printf("heatmap: %ux%u cells of %upx\n", hm->gw, hm->gh, hm->cfg.cell);
+	return 0;
+}
+
+/* saturating row add */
+static void heatmap_add_row(uint16_t *row, RK_U32 n, uint16_t w) {
+	RK_U32 x = 0;
+#if defined(__ARM_NEON)
+	uint16x8_t vw = vdupq_n_u16(w);
+	for (; x + 8 <= n; x += 8)
+		vst1q_u16(row + x, vqaddq_u16(vld1q_u16(row + x), vw));
+#endif
+	for (; x < n; x++) {
+		RK_U32 v = row[x] + w;
+		row[x] = v > 0xffff ? 0xffff : v;
+	}
+}
+
+void heatmap_splat(heatmap_t *hm, const RECT_S *box, RK_U32 weight) {
+	RK_S32 x0 = box->s32X, y0 = box->s32Y;
+	RK_S32 x1 = box->s32X + (RK_S32)box->u32Width, y1 = box->s32Y + (RK_S32)box->u32Height;
+
+	if (hm->cfg.footprint_bottom)
+		y0 = y1 - (RK_S32)box->u32Height / 3;
+	x0 = RK_MAX(x0, 0) / (RK_S32)hm->cfg.cell;
+	y0 = RK_MAX(y0, 0) / (RK_S32)hm->cfg.cell;
+	x1 = (x1 + (RK_S32)hm->cfg.cell - 1) / (RK_S32)hm->cfg.cell;
+	y1 = (y1 + (RK_S32)hm->cfg.cell - 1) / (RK_S32)hm->cfg.cell;
+	if (x1 > (RK_S32)hm->gw)
+		x1 = hm->gw;
+	if (y1 > (RK_S32)hm->gh)
+		y1 = hm->gh;
+	if (weight > 0xffff)
+		weight = 0xffff;
+	for (RK_S32 y = y0; y < y1 && x1 > x0; y++)
+		heatmap_add_row(hm->grid + y * hm->gw + x0, x1 - x0, (uint16_t)weight);
+}
+
+/* v -= ceil(v / 2^shift): rounding the step down would stall every cell at 2^shift - 1 */
+static void heatmap_decay(heatmap_t *hm) {
+	RK_U32 n = hm->gw * hm->gh;
+	RK_U32 i = 0;
+	RK_U32 round = (1u << hm->cfg.decay_shift) - 1;
+	uint16_t *g = hm->grid;
+#if defined(__ARM_NEON)
+	// (v >> shift) + (v & round ? 1 : 0), v + round would overflow 16 bits near the top
+	int16x8_t shift = vdupq_n_s16(-(int16_t)hm->cfg.decay_shift);
+	uint16x8_t mask = vdupq_n_u16((uint16_t)round);
+	uint16x8_t one = vdupq_n_u16(1);
+	for (; i + 8 <= n; i += 8) {
+		uint16x8_t v = vld1q_u16(g + i);
+		uint16x8_t step = vaddq_u16(vshlq_u16(v, shift), vminq_u16(vandq_u16(v, mask), one));
+		vst1q_u16(g + i, vsubq_u16(v, step));
+	}
+#endif
+	for (; i < n; i++)
+		g[i] = g[i] - ((g[i] + round) >> hm->cfg.decay_shift);
+}
+
+/*
+ * steps single decays in one pass over the grid: each step keeps
+ * (2^shift - 1) / 2^shift of a cell and takes at least 1, so steps of them
+ * keep at most v * q >> 16 (q the factor applied steps times in Q16) and
+ * at most v - steps.
+ */
+static void heatmap_decay_steps(heatmap_t *hm, RK_U32 steps) {
+	RK_U32 n = hm->gw * hm->gh;
+	RK_U32 i = 0;
+	uint16_t *g = hm->grid;
+
+	if (steps >= hm->zero_steps) {
+		memset(g, 0, n * sizeof(uint16_t));
+		return;
+	}
+	if (steps == 1) {
+		heatmap_decay(hm);
+		return;
+	}
+	RK_U32 q = 0x10000;
+	for (RK_U32 k = 0; k < steps; k++)
+		q -= (q + (1u << hm->cfg.decay_shift) - 1) >> hm->cfg.decay_shift;
+#if defined(__ARM_NEON)
+	uint16x4_t vq = vdup_n_u16((uint16_t)q);
+	uint16x8_t vk = vdupq_n_u16((uint16_t)steps);
+	for (; i + 8 <= n; i += 8) {
+		uint16x8_t v = vld1q_u16(g + i);
+		uint16x8_t scaled = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(v), vq), 16),
+		                                 vshrn_n_u32(vmull_u16(vget_high_u16(v), vq), 16));
+		vst1q_u16(g + i, vminq_u16(scaled, vqsubq_u16(v, vk)));
+	}
+#endif
+	for (; i < n; i++) {
+		RK_U32 scaled = (g[i] * q) >> 16;
+		RK_U32 linear = g[i] > steps ? g[i] - steps : 0;
+		g[i] = scaled < linear ? scaled : linear;
+	}
+}
+
+void heatmap_update(heatmap_t *hm, const tracker_t *tracker, RK_U64 now_us) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	RK_U64 interval_us = (RK_U64)hm->cfg.decay_interval_ms * 1000;
+
+	if (!hm->last_decay_us)
+		hm->last_decay_us = now_us;
+	// after a stall or a long gated stretch: one pass however many intervals went by
+	RK_U64 steps = interval_us ? (now_us - hm->last_decay_us) / interval_us : 0;
+	if (steps) {
+		heatmap_decay_steps(hm, steps > hm->zero_steps ? hm->zero_steps : (RK_U32)steps);
+		hm->decays += steps;
+		hm->last_decay_us += steps * interval_us;
+	}
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		const track_t *trk = &tracker->tracks[t];
+		if (trk->id && trk->confirmed && trk->det_index >= 0)
+			heatmap_splat(hm, &trk->box, hm->cfg.weight);
+	}
+	hm->cost_us += TEST_COMM_GetNowUs() - begin;
+	hm->runs++;
+}
+
+static uint16_t heatmap_grid_max(const heatmap_t *hm, const uint16_t *grid) {
+	uint16_t max = 0;
+	for (RK_U32 i = 0; i < hm->gw * hm->gh; i++)
+		max = grid[i] > max ? grid[i] : max;
+	return max;
+}
+
+uint16_t heatmap_max(const heatmap_t *hm) {
+	return heatmap_grid_max(hm, hm->grid);
+}
+
+/* level = v * norm >> 16 maps the current peak to 255 */
+static RK_U32 heatmap_norm_q16(const heatmap_t *hm, const uint16_t *grid) {
+	uint16_t max = heatmap_grid_max(hm, grid);
+	return max ? (255u << 16) / max : 0;
+}
+
+static int heatmap_write_png(const heatmap_t *hm, const uint16_t *grid, const char *path) {
+	RK_U32 s = hm->cfg.osd_scale;
+	RK_U32 norm = heatmap_norm_q16(hm, grid);
+	cv::Mat bgr(hm->gh * s, hm->gw * s, CV_8UC3);
+
+	for (RK_U32 y = 0; y < hm->gh * s; y++) {
+		const uint16_t *src = grid + (y / s) * hm->gw;
+		uint8_t *dst = bgr.data + y * bgr.step;
+		for (RK_U32 x = 0; x < hm->gw * s; x++) {
+			uint32_t c = hm->lut[(src[x / s] * norm) >> 16];
+			dst[x * 3 + 0] = c & 0xff;
+			dst[x * 3 + 1] = (c >> 8) & 0xff;
+			dst[x * 3 + 2] = (c >> 16) & 0xff;
+		}
+	}
+	if (!cv::imwrite(path, bgr)) {
+		printf("heatmap: write %s failed\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static int heatmap_write_raw(const heatmap_t *hm, const uint16_t *grid, const char *path) {
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		printf("heatmap: open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	size_t n = fwrite(grid, sizeof(uint16_t), hm->gw * hm->gh, fp);
+	fclose(fp);
+	return n == hm->gw * hm->gh ? 0 : -1;
+}
+
+int heatmap_export_png(heatmap_t *hm, const char *path) {
+	return heatmap_write_png(hm, hm->grid, path);
+}
+
+int heatmap_export_raw(heatmap_t *hm, const char *path) {
+	return heatmap_write_raw(hm, hm->grid, path);
+}
+
+void heatmap_snapshot(heatmap_t *hm) {
+	// the last one is still being written: skip, the next interval brings a newer one
+	if (__atomic_load_n(&hm->snap_ready, __ATOMIC_ACQUIRE))
+		return;
+	memcpy(hm->snap, hm->grid, hm->gw * hm->gh * sizeof(uint16_t));
+	__atomic_store_n(&hm->snap_ready, true, __ATOMIC_RELEASE);
+}
+
+int heatmap_export_snapshot(heatmap_t *hm, const char *dir) {
+	char path[256];
+	int ret;
+
+	if (!__atomic_load_n(&hm->snap_ready, __ATOMIC_ACQUIRE))
+		return 0;
+	snprintf(path, sizeof(path), "%s/heatmap.png", dir);
+	ret = heatmap_write_png(hm, hm->snap, path);
+	snprintf(path, sizeof(path), "%s/heatmap_%ux%u.raw", dir, hm->gw, hm->gh);
+	ret |= heatmap_write_raw(hm, hm->snap, path);
+	__atomic_store_n(&hm->snap_ready, false, __ATOMIC_RELEASE);
+	return ret ? -1 : 1;
+}
+
+int heatmap_osd_attach(heatmap_t *hm, int rgn_handle, int venc_chn, RK_S32 x, RK_S32 y) {
+	RGN_ATTR_S stRgnAttr;
+	RGN_CHN_ATTR_S stRgnChnAttr;
+	MPP_CHN_S stMppChn;
+	RK_S32 s32Ret;
+
+	// overlay sizes and positions must be even
+	hm->osd_w = (hm->gw * hm->cfg.osd_scale) & ~1u;
+	hm->osd_h = (hm->gh * hm->cfg.osd_scale) & ~1u;
+	memset(&stRgnAttr, 0, sizeof(stRgnAttr));
+	stRgnAttr.enType = OVERLAY_RGN;
+	stRgnAttr.unAttr.stOverlay.enPixelFmt = RK_FMT_ARGB8888;
+	stRgnAttr.unAttr.stOverlay.stSize.u32Width = hm->osd_w;
+	stRgnAttr.unAttr.stOverlay.stSize.u32Height = hm->osd_h;
+	s32Ret = RK_MPI_RGN_Create(rgn_handle, &stRgnAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_RGN_Create (%d) failed with %#x!", rgn_handle, s32Ret);
+		return -1;
+	}
+
+	stMppChn.enModId = RK_ID_VENC;
+	stMppChn.s32DevId = 0;
+	stMppChn.s32ChnId = venc_chn;
+	memset(&stRgnChnAttr, 0, sizeof(stRgnChnAttr));
+	stRgnChnAttr.bShow = RK_TRUE;
+	stRgnChnAttr.enType = OVERLAY_RGN;
+	stRgnChnAttr.unChnAttr.stOverlayChn.stPoint.s32X = x & ~1;
+	stRgnChnAttr.unChnAttr.stOverlayChn.stPoint.s32Y = y & ~1;
+	stRgnChnAttr.unChnAttr.stOverlayChn.u32BgAlpha = 0;
+	stRgnChnAttr.unChnAttr.stOverlayChn.u32FgAlpha = 255;
+	stRgnChnAttr.unChnAttr.stOverlayChn.u32Layer = 1;
+	s32Ret = RK_MPI_RGN_AttachToChn(rgn_handle, &stMppChn, &stRgnChnAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_RGN_AttachToChn (%d) failed with %#x!", rgn_handle, s32Ret);
+		RK_MPI_RGN_Destroy(rgn_handle);
+		return -1;
+	}
+	hm->rgn_handle = rgn_handle;
+	hm->venc_chn = venc_chn;
+	return heatmap_osd_update(hm);
+}
+
+/* draws straight into the region canvas, nothing is allocated */
+int heatmap_osd_update(heatmap_t *hm) {
+	RGN_CANVAS_INFO_S stCanvas;
+	RK_U32 s = hm->cfg.osd_scale;
+
+	if (hm->rgn_handle < 0)
+		return -1;
+	memset(&stCanvas, 0, sizeof(stCanvas));
+	if (RK_MPI_RGN_GetCanvasInfo(hm->rgn_handle, &stCanvas) != RK_SUCCESS)
+		return -1;
+	RK_U32 norm = heatmap_norm_q16(hm, hm->grid);
+	RK_U32 h = HEATMAP_MIN(stCanvas.stSize.u32Height, hm->osd_h);
+	RK_U32 w = HEATMAP_MIN(stCanvas.stSize.u32Width, hm->osd_w);
+	for (RK_U32 y = 0; y < h; y++) {
+		const uint16_t *src = hm->grid + (y / s) * hm->gw;
+		uint32_t *dst = (uint32_t *)(uintptr_t)stCanvas.u64VirAddr + y * stCanvas.u32VirWidth;
+		for (RK_U32 x = 0; x < w; x++) {
+			RK_U32 level = (src[x / s] * norm) >> 16;
+			// empty cells stay transparent so the picture shows through
+			dst[x] = level ? (HEATMAP_OSD_ALPHA << 24) | hm->lut[level] : 0;
+		}
+	}
+	return RK_MPI_RGN_UpdateCanvas(hm->rgn_handle) == RK_SUCCESS ? 0 : -1;
+}
+
+void heatmap_osd_detach(heatmap_t *hm) {
+	MPP_CHN_S stMppChn;
+
+	if (hm->rgn_handle < 0)
+		return;
+	stMppChn.enModId = RK_ID_VENC;
+	stMppChn.s32DevId = 0;
+	stMppChn.s32ChnId = hm->venc_chn;
+	RK_MPI_RGN_DetachFromChn(hm->rgn_handle, &stMppChn);
+	RK_MPI_RGN_Destroy(hm->rgn_handle);
+	hm->rgn_handle = -1;
+}
+
+void heatmap_dump_stats(heatmap_t *hm) {
+	printf("heatmap: peak %u, %llu decays, %llu us/frame\n", heatmap_max(hm), (unsigned long long)hm->decays,
+	       (unsigned long long)(hm->runs ? hm->cost_us / hm->runs : 0));
+	hm->cost_us = 0;
+	hm->runs = 0;
+}
+
+void heatmap_deinit(heatmap_t *hm) {
+	heatmap_osd_detach(hm);
+	free(hm->grid);
+	free(hm->snap);
+	hm->grid = NULL;
+	hm->snap = NULL;
+}
@@ -178,6 +178,60 @@ RK_S32 rgn_overlay_release(int group) {
 	return 0;	
 }
 
+// same sequence as SAMPLE_COMM_ISP_Init/Run/Stop, but the aiq context stays reachable for uAPI2 calls
+static rk_aiq_sys_ctx_t *g_isp_ctx = NULL;
+static rk_aiq_working_mode_t g_isp_mode = RK_AIQ_WORKING_MODE_NORMAL;
+
+int isp_init(int cam_id, rk_aiq_working_mode_t hdr_mode, const char *iq_dir) {
+	printf("%s\n", __func__);
+	rk_aiq_static_info_t aiq_static_info;
+	char hdr_str[16];
+
+	snprintf(hdr_str, sizeof(hdr_str), "%d", (int)hdr_mode);
+	setenv("HDR_MODE", hdr_str, 1);
+	if (rk_aiq_uapi2_sysctl_enumStaticMetas(cam_id, &aiq_static_info) != XCAM_RETURN_NO_ERROR) {
+		printf("rk_aiq_uapi2_sysctl_enumStaticMetas fail\n");
+		return -1;
+	}
+	printf("ID: %d, sensor_name is %s, iqfiles is %s\n", cam_id, aiq_static_info.sensor_info.sensor_name,
+	       iq_dir);
+	rk_aiq_uapi2_sysctl_preInit_devBufCnt(aiq_static_info.sensor_info.sensor_name, "rkraw_rx", 2);
+	g_isp_ctx = rk_aiq_uapi2_sysctl_init(aiq_static_info.sensor_info.sensor_name, iq_dir, NULL, NULL);
+	if (g_isp_ctx == NULL) {
+		printf("rk_aiq_uapi2_sysctl_init fail\n");
+		return -1;
+	}
+	g_isp_mode = hdr_mode;
+	return 0;
+}
+
+int isp_run() {
+	if (g_isp_ctx == NULL)
+		return -1;
+	if (rk_aiq_uapi2_sysctl_prepare(g_isp_ctx, 0, 0, g_isp_mode) != XCAM_RETURN_NO_ERROR) {
+		printf("rk_aiq_uapi2_sysctl_prepare fail\n");
+		return -1;
+	}
+	if (rk_aiq_uapi2_sysctl_start(g_isp_ctx) != XCAM_RETURN_NO_ERROR) {
+		printf("rk_aiq_uapi2_sysctl_start fail\n");
+		return -1;
+	}
+	return 0;
+}
+
+int isp_stop() {
+	if (g_isp_ctx == NULL)
+		return -1;
+	rk_aiq_uapi2_sysctl_stop(g_isp_ctx, false);
+	rk_aiq_uapi2_sysctl_deinit(g_isp_ctx);
+	g_isp_ctx = NULL;
+	return 0;
+}
+
+rk_aiq_sys_ctx_t *isp_get_ctx() {
+	return g_isp_ctx;
+}
+
 int vi_dev_init() {
 	printf("%s\n", __func__);
 	int ret = 0;
@@ -225,8 +279,11 @@ int vi_dev_init() {
 }
 
 int vi_chn_init(int channelId, int width, int height) {
+	return vi_chn_init_ex(channelId, width, height, 4, 2, 0);
+}
+
+int vi_chn_init_ex(int channelId, int width, int height, int buf_cnt, int depth, int wrap_line) {
 	int ret;
-	int buf_cnt = 4;
 	// VI init
 	VI_CHN_ATTR_S vi_chn_attr;
 	memset(&vi_chn_attr, 0, sizeof(vi_chn_attr));
@@ -237,8 +294,19 @@ int vi_chn_init(int channelId, int width, int height) {
 	vi_chn_attr.stSize.u32Height = height;
 	vi_chn_attr.enPixelFormat = RK_FMT_YUV420SP;
 	vi_chn_attr.enCompressMode = COMPRESS_MODE_NONE; // COMPRESS_AFBC_16x16;
-	vi_chn_attr.u32Depth = 2; //0, get fail, 1 - u32BufCount, can get, if bind to other device, must be < u32BufCount
+	vi_chn_attr.u32Depth = depth; //0, get fail, 1 - u32BufCount, can get, if bind to other device, must be < u32BufCount
 	ret = RK_MPI_VI_SetChnAttr(0, channelId, &vi_chn_attr);
+	if (ret == RK_SUCCESS && wrap_line > 0) {
+		// line ring shared with the bound VENC instead of whole frames
+		VI_CHN_BUF_WRAP_S stViWrap;
+		memset(&stViWrap, 0, sizeof(stViWrap));
+		stViWrap.bEnable = RK_TRUE;
+		stViWrap.u32BufLine = wrap_line;
+		stViWrap.u32WrapBufferSize = wrap_line * width * 3 / 2;
+		ret = RK_MPI_VI_SetChnWrapBufAttr(0, channelId, &stViWrap);
+		if (ret != RK_SUCCESS)
+			printf("RK_MPI_VI_SetChnWrapBufAttr %x\n", ret);
+	}
 	ret |= RK_MPI_VI_EnableChn(0, channelId);
 	if (ret) {
 		printf("ERROR: create VI error! ret=%d\n", ret);
@@ -248,7 +316,35 @@ int vi_chn_init(int channelId, int width, int height) {
 	return ret;
 }
 
+int vi_chn_init_fps(int channelId, int width, int height, int buf_cnt, int depth, int dst_fps) {
+	int ret;
+	VI_CHN_ATTR_S vi_chn_attr;
+	memset(&vi_chn_attr, 0, sizeof(vi_chn_attr));
+	vi_chn_attr.stIspOpt.u32BufCount = buf_cnt;
+	vi_chn_attr.stIspOpt.enMemoryType = VI_V4L2_MEMORY_TYPE_DMABUF;
+	vi_chn_attr.stSize.u32Width = width;
+	vi_chn_attr.stSize.u32Height = height;
+	vi_chn_attr.enPixelFormat = RK_FMT_YUV420SP;
+	vi_chn_attr.enCompressMode = COMPRESS_MODE_NONE;
+	vi_chn_attr.u32Depth = depth;
+	// frames beyond dst_fps are dropped in the driver, before they take DDR bandwidth downstream
+	vi_chn_attr.stFrameRate.s32SrcFrameRate = dst_fps > 0 ? 30 : -1;
+	vi_chn_attr.stFrameRate.s32DstFrameRate = dst_fps > 0 ? dst_fps : -1;
+	ret = RK_MPI_VI_SetChnAttr(0, channelId, &vi_chn_attr);
+	ret |= RK_MPI_VI_EnableChn(0, channelId);
+	if (ret) {
+		printf("ERROR: create VI %d error! ret=%x\n", channelId, ret);
+		return ret;
+	}
+	return ret;
+}
+
 int venc_init(int chnId, int width, int height, RK_CODEC_ID_E enType) {
+	return venc_init_ex(chnId, width, height, enType, 2, width * height * 3 / 2, 0, false);
+}
+
+int venc_init_ex(int chnId, int width, int height, RK_CODEC_ID_E enType, int stream_buf_cnt,
+                 int buf_size, int wrap_line, bool ref_share) {
 	printf("========%s========\n", __func__);
 	VENC_RECV_PIC_PARAM_S stRecvParam;
 	VENC_CHN_ATTR_S stAttr;
@@ -275,15 +371,231 @@ int venc_init(int chnId, int width, int height, RK_CODEC_ID_E enType) {
 	stAttr.stVencAttr.u32PicHeight = height;
 	stAttr.stVencAttr.u32VirWidth = width;
 	stAttr.stVencAttr.u32VirHeight = height;
-	stAttr.stVencAttr.u32StreamBufCnt = 2;
-	stAttr.stVencAttr.u32BufSize = width * height * 3 / 2;
+	stAttr.stVencAttr.u32StreamBufCnt = stream_buf_cnt;
+	stAttr.stVencAttr.u32BufSize = buf_size;
 	stAttr.stVencAttr.enMirror = MIRROR_NONE;
 
 	RK_MPI_VENC_CreateChn(chnId, &stAttr);
 
+	// both must be set before StartRecvFrame
+	if (wrap_line > 0) {
+		VENC_CHN_BUF_WRAP_S stBufWrap;
+		memset(&stBufWrap, 0, sizeof(stBufWrap));
+		stBufWrap.bEnable = RK_TRUE;
+		stBufWrap.u32BufLine = wrap_line;
+		if (RK_MPI_VENC_SetChnBufWrapAttr(chnId, &stBufWrap) != RK_SUCCESS)
+			RK_LOGE("RK_MPI_VENC_SetChnBufWrapAttr fail");
+	}
+	if (ref_share) {
+		// reconstructed frame written over the reference it replaces
+		VENC_CHN_REF_BUF_SHARE_S stRefShare;
+		memset(&stRefShare, 0, sizeof(stRefShare));
+		stRefShare.bEnable = RK_TRUE;
+		if (RK_MPI_VENC_SetChnRefBufShareAttr(chnId, &stRefShare) != RK_SUCCESS)
+			RK_LOGE("RK_MPI_VENC_SetChnRefBufShareAttr fail");
+	}
+
 	memset(&stRecvParam, 0, sizeof(VENC_RECV_PIC_PARAM_S));
 	stRecvParam.s32RecvPicNum = -1;
 	RK_MPI_VENC_StartRecvFrame(chnId, &stRecvParam);
 
 	return 0;
 }
+
+int venc_set_low_latency(int chnId, int width, int height, int slices) {
+	printf("========%s========\n", __func__);
+	RK_S32 s32Ret;
+	VENC_CHN_ATTR_S stAttr;
+	VENC_SLICE_SPLIT_S stSliceSplit;
+	VENC_CHN_PARAM_S stParam;
+
+	if (slices < 1)
+		slices = 1;
+	int mb_width = (width + 15) / 16;
+	int mb_height = (height + 15) / 16;
+	int rows_per_slice = (mb_height + slices - 1) / slices;
+
+	// P-only gop, no long-term reference: no frame ever waits for a later one
+	s32Ret = RK_MPI_VENC_GetChnAttr(chnId, &stAttr);
+	if (s32Ret == RK_SUCCESS) {
+		stAttr.stGopAttr.enGopMode = VENC_GOPMODE_NORMALP;
+		stAttr.stGopAttr.u32MaxLtrCount = 0;
+		s32Ret = RK_MPI_VENC_SetChnAttr(chnId, &stAttr);
+	}
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("set gop attr fail %x", s32Ret);
+		return -1;
+	}
+
+	// split by whole macroblock rows, each slice is fetched as its own pack
+	memset(&stSliceSplit, 0, sizeof(stSliceSplit));
+	stSliceSplit.bSplitEnable = slices > 1 ? RK_TRUE : RK_FALSE;
+	stSliceSplit.u32SplitMode = 1;
+	stSliceSplit.u32SplitSize = mb_width * rows_per_slice;
+	s32Ret = RK_MPI_VENC_SetSliceSplit(chnId, &stSliceSplit);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_SetSliceSplit fail %x", s32Ret);
+		return -1;
+	}
+
+	// wake the stream fd for every output instead of batching frames
+	s32Ret = RK_MPI_VENC_GetChnParam(chnId, &stParam);
+	if (s32Ret == RK_SUCCESS) {
+		stParam.u32MaxStrmCnt = 2;
+		stParam.u32PollWakeUpFrmCnt = 1;
+		s32Ret = RK_MPI_VENC_SetChnParam(chnId, &stParam);
+	}
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_SetChnParam fail %x", s32Ret);
+		return -1;
+	}
+
+	printf("low latency: %d slices, %d mb rows each\n", slices, rows_per_slice);
+	return 0;
+}
+
+int venc_enable_svc(int chnId, int layers) {
+	printf("========%s========\n", __func__);
+	RK_S32 s32Ret;
+	VENC_CHN_ATTR_S stAttr;
+
+	// 2 layers: 30/15 fps, 3 layers: 30/15/7.5 fps, 4 layers: down to 3.75 fps
+	VENC_GOP_MODE_E enGopMode;
+	switch (layers) {
+	case 2:
+		enGopMode = VENC_GOPMODE_TSVC2;
+		break;
+	case 3:
+		enGopMode = VENC_GOPMODE_TSVC3;
+		break;
+	case 4:
+		enGopMode = VENC_GOPMODE_TSVC4;
+		break;
+	default:
+		RK_LOGE("svc: %d temporal layers not supported", layers);
+		return -1;
+	}
+
+	s32Ret = RK_MPI_VENC_GetChnAttr(chnId, &stAttr);
+	if (s32Ret == RK_SUCCESS) {
+		stAttr.stGopAttr.enGopMode = enGopMode;
+		stAttr.stGopAttr.u32TsvcPreload = 0;
+		s32Ret = RK_MPI_VENC_SetChnAttr(chnId, &stAttr);
+	}
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("set tsvc gop attr fail %x", s32Ret);
+		return -1;
+	}
+
+	s32Ret = RK_MPI_VENC_EnableSvc(chnId, RK_TRUE);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_EnableSvc fail %x", s32Ret);
+		return -1;
+	}
+	printf("svc: %d temporal layers\n", layers);
+	return 0;
+}
+
+int venc_set_bitrate(int chnId, int kbps) {
+	VENC_CHN_ATTR_S stAttr;
+	RK_S32 s32Ret;
+
+	s32Ret = RK_MPI_VENC_GetChnAttr(chnId, &stAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_GetChnAttr %d fail %x", chnId, s32Ret);
+		return -1;
+	}
+	switch (stAttr.stRcAttr.enRcMode) {
+	case VENC_RC_MODE_H264CBR:
+		stAttr.stRcAttr.stH264Cbr.u32BitRate = kbps;
+		break;
+	case VENC_RC_MODE_H265CBR:
+		stAttr.stRcAttr.stH265Cbr.u32BitRate = kbps;
+		break;
+	case VENC_RC_MODE_MJPEGCBR:
+		stAttr.stRcAttr.stMjpegCbr.u32BitRate = kbps;
+		break;
+	default:
+		RK_LOGE("venc %d: rc mode %d has no bitrate", chnId, stAttr.stRcAttr.enRcMode);
+		return -1;
+	}
+	// rate control attributes apply from the next frame, the channel keeps running
+	s32Ret = RK_MPI_VENC_SetChnAttr(chnId, &stAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_SetChnAttr %d fail %x", chnId, s32Ret);
+		return -1;
+	}
+	return 0;
+}
+
+int venc_jpeg_init(int chnId, int width, int height, int qfactor) {
+	printf("========%s========\n", __func__);
+	VENC_RECV_PIC_PARAM_S stRecvParam;
+	VENC_CHN_ATTR_S stAttr;
+	RK_S32 s32Ret;
+	memset(&stAttr, 0, sizeof(VENC_CHN_ATTR_S));
+
+	// fixed quality: frames are only sent one at a time, there is no rate to control
+	stAttr.stRcAttr.enRcMode = VENC_RC_MODE_MJPEGFIXQP;
+	stAttr.stRcAttr.stMjpegFixQp.u32SrcFrameRateNum = 1;
+	stAttr.stRcAttr.stMjpegFixQp.u32SrcFrameRateDen = 1;
+	stAttr.stRcAttr.stMjpegFixQp.fr32DstFrameRateNum = 1;
+	stAttr.stRcAttr.stMjpegFixQp.fr32DstFrameRateDen = 1;
+	stAttr.stRcAttr.stMjpegFixQp.u32Qfactor = qfactor;
+
+	stAttr.stVencAttr.enType = RK_VIDEO_ID_MJPEG;
+	stAttr.stVencAttr.enPixelFormat = RK_FMT_YUV420SP;
+	stAttr.stVencAttr.u32PicWidth = width;
+	stAttr.stVencAttr.u32PicHeight = height;
+	stAttr.stVencAttr.u32VirWidth = width;
+	stAttr.stVencAttr.u32VirHeight = height;
+	stAttr.stVencAttr.u32StreamBufCnt = 1;
+	stAttr.stVencAttr.u32BufSize = width * height * 3 / 2;
+	stAttr.stVencAttr.enMirror = MIRROR_NONE;
+
+	s32Ret = RK_MPI_VENC_CreateChn(chnId, &stAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_CreateChn %d fail %x", chnId, s32Ret);
+		return -1;
+	}
+
+	memset(&stRecvParam, 0, sizeof(VENC_RECV_PIC_PARAM_S));
+	stRecvParam.s32RecvPicNum = -1;
+	s32Ret = RK_MPI_VENC_StartRecvFrame(chnId, &stRecvParam);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_StartRecvFrame %d fail %x", chnId, s32Ret);
+		RK_MPI_VENC_DestroyChn(chnId);
+		return -1;
+	}
+	return 0;
+}
+
+int venc_encode_frame(int chnId, const VIDEO_FRAME_INFO_S *frame, void *out, int out_size, int timeout_ms) {
+	VENC_STREAM_S stStream;
+	VENC_PACK_S stPack;
+	RK_S32 s32Ret;
+	int len = 0;
+
+	s32Ret = RK_MPI_VENC_SendFrame(chnId, frame, timeout_ms);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_SendFrame %d fail %x", chnId, s32Ret);
+		return -1;
+	}
+	memset(&stStream, 0, sizeof(stStream));
+	stStream.pstPack = &stPack;
+	s32Ret = RK_MPI_VENC_GetStream(chnId, &stStream, timeout_ms);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_GetStream %d fail %x", chnId, s32Ret);
+		return -1;
+	}
+	void *data = RK_MPI_MB_Handle2VirAddr(stPack.pMbBlk);
+	if (data && (int)stPack.u32Len <= out_size) {
+		memcpy(out, data, stPack.u32Len);
+		len = stPack.u32Len;
+	} else {
+		RK_LOGE("venc %d: %u byte picture, %d byte buffer", chnId, stPack.u32Len, out_size);
+		len = -1;
+	}
+	RK_MPI_VENC_ReleaseStream(chnId, &stStream);
+	return len;
+}
@@ -0,0 +1,184 @@
+/*****************************************************************************
+* | Function    :   DMA/CMA budget planner for the VI/VENC/VPSS/NPU pipeline
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "mem_plan.h"
+
+#define MEM_PLAN_WRAP_MIN_LINE 128			// lower bound accepted by VI/VENC wrap
+#define MEM_PLAN_REF_SHARE_LINES 64			// estimated overlap margin of a shared ref buffer
+#define MEM_PLAN_IFRAME_RATIO 8				// I frame vs. average frame at CBR
+#define MEM_PLAN_MISMATCH_PERCENT 125		// warn if measured > 125% of plan
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+void mem_plan_cfg_default(mem_plan_cfg_t *cfg, RK_U32 width, RK_U32 height) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->width = width;
+	cfg->height = height;
+	cfg->fps = 30;
+	cfg->bitrate_kbps = 10 * 1024;
+	cfg->codec = RK_VIDEO_ID_AVC;
+	cfg->vi_chn_count = 2;
+	cfg->vi_role[0] = MEM_PLAN_VI_VENC;
+	cfg->vi_role[1] = MEM_PLAN_VI_USER;
+}
+
+void mem_plan_cfg_from_env(mem_plan_cfg_t *cfg) {
+	const char *val = getenv("MEM_BUDGET_KB");
+	if (val)
+		cfg->budget_kb = strtoul(val, NULL, 10);
+}
+
+RK_U64 mem_plan_frame_bytes(RK_U32 width, RK_U32 height, RK_U32 align) {
+	return (RK_U64)ALIGN_UP(width, align) * ALIGN_UP(height, align) * 3 / 2;
+}
+
+RK_U64 mem_plan_venc_ref_bytes(RK_U32 width, RK_U32 height, RK_CODEC_ID_E codec, bool ref_share) {
+	// H.264 works on 16x16 macroblocks, H.265 on 64x64 CTUs
+	RK_U32 align = codec == RK_VIDEO_ID_HEVC ? 64 : 16;
+	RK_U64 frame = mem_plan_frame_bytes(width, height, align);
+	if (!ref_share)
+		return frame * 2;	// reference + reconstruction
+	return frame + (RK_U64)ALIGN_UP(width, align) * MEM_PLAN_REF_SHARE_LINES * 3 / 2;
+}
+
+RK_U32 mem_plan_venc_buf_size(RK_U32 width, RK_U32 height, RK_U32 fps, RK_U32 bitrate_kbps) {
+	RK_U64 max_size = (RK_U64)width * height * 3 / 2;
+	RK_U64 min_size = (RK_U64)width * height / 4;
+	RK_U64 size = fps ? (RK_U64)bitrate_kbps * 1024 / 8 / fps * MEM_PLAN_IFRAME_RATIO : max_size;
+	if (size < min_size)
+		size = min_size;
+	if (size > max_size)
+		size = max_size;
+	return ALIGN_UP(size, 4096);
+}
+
+void mem_plan_add(mem_plan_t *plan, const char *name, RK_U64 bytes) {
+	if (plan->entry_count >= MEM_PLAN_MAX_ENTRIES) {
+		printf("mem_plan: too many entries, %s not added\n", name);
+		return;
+	}
+	plan->entries[plan->entry_count].name = name;
+	plan->entries[plan->entry_count].bytes = bytes;
+	plan->entry_count++;
+	plan->total_bytes += bytes;
+}
+
+static const char *g_vi_names[MEM_PLAN_MAX_VI_CHN] = {"vi chn0", "vi chn1", "vi chn2"};
+
+void mem_plan_compute(const mem_plan_cfg_t *cfg, mem_plan_t *plan) {
+	long cma_start = plan->cma_free_start_kb;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->cfg = *cfg;
+	plan->cma_free_start_kb = cma_start;
+	RK_U64 frame = mem_plan_frame_bytes(cfg->width, cfg->height, 16);
+
+	int wrap_line = 0;
+	if (cfg->save && cfg->height >= MEM_PLAN_WRAP_MIN_LINE) {
+		wrap_line = ALIGN_UP(cfg->height / 4, 16);
+		if (wrap_line < MEM_PLAN_WRAP_MIN_LINE)
+			wrap_line = MEM_PLAN_WRAP_MIN_LINE;
+	}
+
+	for (int i = 0; i < cfg->vi_chn_count && i < MEM_PLAN_MAX_VI_CHN; i++) {
+		mem_plan_vi_chn_t *vi = &plan->vi[i];
+		if (!cfg->save) {
+			// what vi_chn_init() always used
+			vi->buf_cnt = 4;
+			vi->depth = 2;
+		} else if (cfg->vi_role[i] == MEM_PLAN_VI_USER) {
+			// one frame held by the reader, one being written
+			vi->buf_cnt = 2;
+			vi->depth = 1;
+		} else {
+			vi->buf_cnt = 2;
+			vi->depth = 0;
+			if (cfg->vi_role[i] == MEM_PLAN_VI_VENC)
+				vi->wrap_line = wrap_line;
+		}
+		if (vi->wrap_line > 0)
+			mem_plan_add(plan, g_vi_names[i], (RK_U64)vi->wrap_line * ALIGN_UP(cfg->width, 16) * 3 / 2);
+		else
+			mem_plan_add(plan, g_vi_names[i], frame * vi->buf_cnt);
+	}
+
+	plan->venc.stream_buf_cnt = 2;
+	if (cfg->save) {
+		plan->venc.buf_size = mem_plan_venc_buf_size(cfg->width, cfg->height, cfg->fps, cfg->bitrate_kbps);
+		plan->venc.wrap_line = wrap_line;
+		plan->venc.ref_share = true;
+	} else {
+		plan->venc.buf_size = cfg->width * cfg->height * 3 / 2;
+	}
+	mem_plan_add(plan, "venc ref", mem_plan_venc_ref_bytes(cfg->width, cfg->height, cfg->codec,
+	                                                       plan->venc.ref_share));
+	mem_plan_add(plan, "venc stream", (RK_U64)plan->venc.stream_buf_cnt * plan->venc.buf_size);
+}
+
+long mem_plan_cma_free_kb() {
+	FILE *fp = fopen("/proc/meminfo", "r");
+	char line[128];
+	long kb = -1;
+
+	if (fp == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "CmaFree: %ld kB", &kb) == 1)
+			break;
+	}
+	fclose(fp);
+	return kb;
+}
+
+void mem_plan_mark_start(mem_plan_t *plan) {
+	plan->cma_free_start_kb = mem_plan_cma_free_kb();
+}
+
+void mem_plan_report(const mem_plan_t *plan) {
+	printf("mem plan (%s):\n", plan->cfg.save ? "save" : "default");
+	for (int i = 0; i < plan->entry_count; i++)
+		printf("  %-12s %6llu KB\n", plan->entries[i].name,
+		       (unsigned long long)(plan->entries[i].bytes / 1024));
+	printf("  %-12s %6llu KB", "total", (unsigned long long)(plan->total_bytes / 1024));
+	if (plan->cfg.budget_kb)
+		printf(" / budget %u KB", plan->cfg.budget_kb);
+	printf("\n");
+	for (int i = 0; i < plan->cfg.vi_chn_count && i < MEM_PLAN_MAX_VI_CHN; i++)
+		printf("  vi chn%d: %d bufs, depth %d, wrap %d lines\n", i, plan->vi[i].buf_cnt, plan->vi[i].depth,
+		       plan->vi[i].wrap_line);
+	printf("  venc: %d x %d KB stream bufs, wrap %d lines, ref share %d\n", plan->venc.stream_buf_cnt,
+	       plan->venc.buf_size / 1024, plan->venc.wrap_line, plan->venc.ref_share);
+}
+
+int mem_plan_verify(const mem_plan_t *plan) {
+	return mem_plan_check(plan, mem_plan_cma_free_kb());
+}
+
+int mem_plan_check(const mem_plan_t *plan, long now_kb) {
+	RK_U64 planned_kb = plan->total_bytes / 1024;
+	int ret = 0;
+
+	if (plan->cma_free_start_kb < 0 || now_kb < 0) {
+		printf("mem plan: %llu KB planned, CMA usage not reported by the kernel\n",
+		       (unsigned long long)planned_kb);
+	} else {
+		long used_kb = plan->cma_free_start_kb - now_kb;
+		// the rest is ISP, RGA and driver buffers the plan does not model
+		printf("mem plan: %llu KB planned, %ld KB CMA taken, %ld KB CMA free\n",
+		       (unsigned long long)planned_kb, used_kb, now_kb);
+		if (used_kb > 0 && (RK_U64)used_kb * 100 > planned_kb * MEM_PLAN_MISMATCH_PERCENT)
+			printf("mem plan: %ld KB not covered by the plan\n", used_kb - (long)planned_kb);
+		if (plan->cfg.budget_kb && used_kb > (long)plan->cfg.budget_kb) {
+			RK_LOGE("CMA usage %ld KB exceeds budget %u KB", used_kb, plan->cfg.budget_kb);
+			ret = -1;
+		}
+	}
+	if (plan->cfg.budget_kb && planned_kb > plan->cfg.budget_kb) {
+		RK_LOGE("planned %llu KB exceeds budget %u KB", (unsigned long long)planned_kb, plan->cfg.budget_kb);
+		ret = -1;
+	}
+	return ret;
+}
@@ -0,0 +1,283 @@
+/*****************************************************************************
+* | Function    :   IVS motion/occlusion gate with a NEON software fallback
+*
+******************************************************************************/
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "luckfox_mpi.h"
+#include "motion_gate.h"
+
+#define MOTION_GATE_IVS_CHN 0
+#define MOTION_GATE_CELL 8
+#define MOTION_GATE_DECIMATED_W 160
+// stddev below ~5 grey levels over the whole frame: lens covered or sensor dead
+#define MOTION_GATE_OCCLUDED_VAR 25
+
+void motion_gate_cfg_default(motion_gate_cfg_t *cfg, RK_U32 width, RK_U32 height) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->width = width;
+	cfg->height = height;
+	cfg->min_cells = 2;
+	cfg->hold_frames = 5;
+	cfg->force_interval = 30;
+	cfg->sad_thresh = 12;
+	cfg->ivs_sensibility = 2;
+	cfg->try_ivs = true;
+}
+
+static int motion_gate_ivs_init(motion_gate_t *gate) {
+	IVS_CHN_ATTR_S stAttr;
+	IVS_MD_ATTR_S stMdAttr;
+	IVS_OD_ATTR_S stOdAttr;
+	RK_S32 s32Ret;
+
+	memset(&stAttr, 0, sizeof(stAttr));
+	stAttr.enMode = IVS_MODE_MD_OD;
+	stAttr.u32PicWidth = gate->cfg.width;
+	stAttr.u32PicHeight = gate->cfg.height;
+	stAttr.enPixelFormat = RK_FMT_YUV420SP;
+	stAttr.s32Gop = 30;
+	stAttr.bSmearEnable = RK_FALSE;
+	stAttr.bWeightpEnable = RK_FALSE;
+	stAttr.bMDEnable = RK_TRUE;
+	stAttr.s32MDInterval = 1;
+	stAttr.bMDNightMode = RK_FALSE;
+	stAttr.u32MDSensibility = gate->cfg.ivs_sensibility;
+	stAttr.bODEnable = RK_TRUE;
+	stAttr.s32ODInterval = 1;
+	stAttr.s32ODPercent = 7;
+	stAttr.u32MaxWidth = gate->cfg.width;
+	stAttr.u32MaxHeight = gate->cfg.height;
+	s32Ret = RK_MPI_IVS_CreateChn(gate->ivs_chn, &stAttr);
+	if (s32Ret != RK_SUCCESS) {
+		printf("motion_gate: RK_MPI_IVS_CreateChn fail %x\n", s32Ret);
+		return -1;
+	}
+
+	memset(&stMdAttr, 0, sizeof(stMdAttr));
+	s32Ret = RK_MPI_IVS_GetMdAttr(gate->ivs_chn, &stMdAttr);
+	if (s32Ret == RK_SUCCESS) {
+		stMdAttr.s32ThreshSad = 40;
+		stMdAttr.s32ThreshMove = 2;
+		stMdAttr.s32SwitchSad = 0;
+		RK_MPI_IVS_SetMdAttr(gate->ivs_chn, &stMdAttr);
+	}
+
+	memset(&stOdAttr, 0, sizeof(stOdAttr));
+	stOdAttr.s32ODPercent = 7;
+	stOdAttr.bODUserRectEnable = RK_FALSE;
+	RK_MPI_IVS_SetOdAttr(gate->ivs_chn, &stOdAttr);
+	return 0;
+}
+
+static int motion_gate_soft_init(motion_gate_t *gate) {
+	gate->step = gate->cfg.width / MOTION_GATE_DECIMATED_W;
+	if (gate->step < 1)
+		gate->step = 1;
+	gate->dw = (gate->cfg.width / gate->step) & ~(MOTION_GATE_CELL - 1);
+	gate->dh = (gate->cfg.height / gate->step) & ~(MOTION_GATE_CELL - 1);
+	if ((gate->dw / MOTION_GATE_CELL) * (gate->dh / MOTION_GATE_CELL) > MOTION_GATE_MAX_CELLS) {
+		printf("motion_gate: %ux%u too large\n", gate->cfg.width, gate->cfg.height);
+		return -1;
+	}
+	gate->prev = (uint8_t *)malloc(gate->dw * gate->dh);
+	gate->cur = (uint8_t *)malloc(gate->dw * gate->dh);
+	if (gate->prev == NULL || gate->cur == NULL)
+		return -1;
+	gate->have_prev = false;
+	return 0;
+}
+
+int motion_gate_init(motion_gate_t *gate, const motion_gate_cfg_t *cfg) {
+	memset(gate, 0, sizeof(*gate));
+	gate->cfg = *cfg;
+	gate->ivs_chn = MOTION_GATE_IVS_CHN;
+
+	if (cfg->try_ivs && motion_gate_ivs_init(gate) == 0) {
+		gate->backend = MOTION_GATE_IVS;
+		printf("motion_gate: IVS %ux%u\n", cfg->width, cfg->height);
+		return 0;
+	}
+
+	gate->backend = MOTION_GATE_SOFT;
+	if (motion_gate_soft_init(gate) != 0) {
+		motion_gate_deinit(gate);
+		return -1;
+	}
+	printf("motion_gate: software %ux%u, 1/%u luma %ux%u\n", cfg->width, cfg->height, gate->step,
+	       gate->dw, gate->dh);
+	return 0;
+}
+
+static void motion_gate_add_roi(motion_gate_result_t *res, RK_S32 x, RK_S32 y, RK_U32 w, RK_U32 h) {
+	// grow an overlapping roi, else take a free slot, else grow the first one
+	int idx = -1;
+	for (int i = 0; i < res->roi_count; i++) {
+		RECT_S *r = &res->rois[i];
+		if (x <= r->s32X + (RK_S32)r->u32Width && r->s32X <= x + (RK_S32)w &&
+		    y <= r->s32Y + (RK_S32)r->u32Height && r->s32Y <= y + (RK_S32)h) {
+			idx = i;
+			break;
+		}
+	}
+	if (idx < 0 && res->roi_count < MOTION_GATE_MAX_ROIS) {
+		RECT_S *r = &res->rois[res->roi_count++];
+		r->s32X = x;
+		r->s32Y = y;
+		r->u32Width = w;
+		r->u32Height = h;
+		return;
+	}
+	if (idx < 0)
+		idx = 0;
+	RECT_S *r = &res->rois[idx];
+	RK_S32 x1 = r->s32X + r->u32Width > x + w ? r->s32X + r->u32Width : x + w;
+	RK_S32 y1 = r->s32Y + r->u32Height > y + h ? r->s32Y + r->u32Height : y + h;
+	r->s32X = r->s32X < x ? r->s32X : x;
+	r->s32Y = r->s32Y < y ? r->s32Y : y;
+	r->u32Width = x1 - r->s32X;
+	r->u32Height = y1 - r->s32Y;
+}
+
+static void motion_gate_decimate(motion_gate_t *gate, const uint8_t *y_plane, RK_U32 stride) {
+	for (RK_U32 y = 0; y < gate->dh; y++) {
+		const uint8_t *src = y_plane + (y * gate->step) * stride;
+		uint8_t *dst = gate->cur + y * gate->dw;
+		RK_U32 x = 0;
+#if defined(__ARM_NEON)
+		if (gate->step == 2) {
+			// keep the even pixels of each row
+			for (; x + 16 <= gate->dw; x += 16)
+				vst1q_u8(dst + x, vld2q_u8(src + x * 2).val[0]);
+		}
+#endif
+		for (; x < gate->dw; x++)
+			dst[x] = src[x * gate->step];
+	}
+}
+
+static RK_U32 motion_gate_cell_sad(const uint8_t *a, const uint8_t *b, RK_U32 stride) {
+#if defined(__ARM_NEON)
+	uint16x8_t acc = vdupq_n_u16(0);
+	for (int r = 0; r < MOTION_GATE_CELL; r++)
+		acc = vabal_u8(acc, vld1_u8(a + r * stride), vld1_u8(b + r * stride));
+	uint32x4_t s4 = vpaddlq_u16(acc);
+	uint64x2_t s2 = vpaddlq_u32(s4);
+	return (RK_U32)(vgetq_lane_u64(s2, 0) + vgetq_lane_u64(s2, 1));
+#else
+	RK_U32 sad = 0;
+	for (int r = 0; r < MOTION_GATE_CELL; r++)
+		for (int c = 0; c < MOTION_GATE_CELL; c++)
+			sad += abs((int)a[r * stride + c] - (int)b[r * stride + c]);
+	return sad;
+#endif
+}
+
+static int motion_gate_soft_process(motion_gate_t *gate, const VIDEO_FRAME_INFO_S *frame,
+                                    motion_gate_result_t *res) {
+	const uint8_t *y_plane = (const uint8_t *)RK_MPI_MB_Handle2VirAddr(frame->stVFrame.pMbBlk);
+	if (y_plane == NULL)
+		return -1;
+	RK_U32 stride = frame->stVFrame.u32VirWidth ? frame->stVFrame.u32VirWidth : gate->cfg.width;
+	// cached pool: drop stale lines before the CPU reads what the hardware wrote
+	RK_MPI_SYS_MmzFlushCache(frame->stVFrame.pMbBlk, RK_TRUE);
+
+	motion_gate_decimate(gate, y_plane, stride);
+
+	RK_U64 sum = 0, sum_sq = 0;
+	RK_U32 n = gate->dw * gate->dh;
+	for (RK_U32 i = 0; i < n; i++) {
+		sum += gate->cur[i];
+		sum_sq += gate->cur[i] * gate->cur[i];
+	}
+	RK_U64 mean = sum / n;
+	res->occluded = (sum_sq / n - mean * mean) < MOTION_GATE_OCCLUDED_VAR;
+
+	if (gate->have_prev) {
+		RK_U32 cell_px = MOTION_GATE_CELL * gate->step;
+		RK_U32 thresh = gate->cfg.sad_thresh * MOTION_GATE_CELL * MOTION_GATE_CELL;
+		for (RK_U32 cy = 0; cy < gate->dh; cy += MOTION_GATE_CELL) {
+			for (RK_U32 cx = 0; cx < gate->dw; cx += MOTION_GATE_CELL) {
+				RK_U32 off = cy * gate->dw + cx;
+				if (motion_gate_cell_sad(gate->cur + off, gate->prev + off, gate->dw) > thresh) {
+					res->motion_cells++;
+					if (gate->cfg.rois)
+						motion_gate_add_roi(res, cx * gate->step, cy * gate->step, cell_px, cell_px);
+				}
+			}
+		}
+	}
+
+	uint8_t *tmp = gate->prev;
+	gate->prev = gate->cur;
+	gate->cur = tmp;
+	gate->have_prev = true;
+	return 0;
+}
+
+static int motion_gate_ivs_process(motion_gate_t *gate, const VIDEO_FRAME_INFO_S *frame,
+                                   motion_gate_result_t *res) {
+	IVS_RESULT_INFO_S stResults;
+	RK_S32 s32Ret;
+
+	s32Ret = RK_MPI_IVS_SendFrame(gate->ivs_chn, frame, 100);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_IVS_SendFrame fail %x", s32Ret);
+		return -1;
+	}
+	memset(&stResults, 0, sizeof(stResults));
+	s32Ret = RK_MPI_IVS_GetResults(gate->ivs_chn, &stResults, 100);
+	if (s32Ret != RK_SUCCESS)
+		return -1;
+
+	if (stResults.s32ResultNum > 0 && stResults.pstResults != NULL) {
+		IVS_MD_INFO_S *md = &stResults.pstResults[0].stMdInfo;
+		res->occluded = stResults.pstResults[0].stOdInfo.u32Flag != 0;
+		res->motion_cells = md->u32RectNum;
+		for (RK_U32 i = 0; gate->cfg.rois && i < md->u32RectNum && i < 4096; i++)
+			motion_gate_add_roi(res, md->stRect[i].s32X, md->stRect[i].s32Y, md->stRect[i].u32Width,
+			                    md->stRect[i].u32Height);
+	}
+	RK_MPI_IVS_ReleaseResults(gate->ivs_chn, &stResults);
+	return 0;
+}
+
+int motion_gate_process(motion_gate_t *gate, const VIDEO_FRAME_INFO_S *frame, motion_gate_result_t *res) {
+	int ret;
+
+	memset(res, 0, sizeof(*res));
+	if (gate->backend == MOTION_GATE_IVS)
+		ret = motion_gate_ivs_process(gate, frame, res);
+	else
+		ret = motion_gate_soft_process(gate, frame, res);
+	gate->frames++;
+
+	if (ret != 0) {
+		// no answer from the gate: do not starve the detector
+		res->run_detector = true;
+		return ret;
+	}
+
+	if (res->motion_cells >= gate->cfg.min_cells) {
+		gate->idle_frames = 0;
+		gate->triggered++;
+	} else {
+		gate->idle_frames++;
+	}
+	res->run_detector = !res->occluded &&
+	                    (gate->idle_frames <= gate->cfg.hold_frames ||
+	                     (gate->cfg.force_interval && gate->frames % gate->cfg.force_interval == 0));
+	return 0;
+}
+
+void motion_gate_deinit(motion_gate_t *gate) {
+	if (gate->backend == MOTION_GATE_IVS)
+		RK_MPI_IVS_DestroyChn(gate->ivs_chn);
+	free(gate->prev);
+	free(gate->cur);
+	gate->prev = NULL;
+	gate->cur = NULL;
+}
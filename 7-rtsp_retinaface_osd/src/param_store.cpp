@@ -0,0 +1,250 @@
+/*****************************************************************************
+* | Function    :   Runtime parameter store: immutable snapshots behind an
+*                   atomic pointer, quiescent-state slot reuse, file watch
+*
+******************************************************************************/
+
+#include <libgen.h>
+#include <sys/inotify.h>
+
+#include "luckfox_mpi.h"
+#include "param_store.h"
+
+#define PARAM_STORE_WAIT_US 10000
+
+void params_default(params_t *params) {
+	memset(params, 0, sizeof(*params));
+	params->det.score_thresh = 0.5f;
+	params->det.nms_iou = 0.2f;
+	params->det.score_thresh_q = -129;
+	params->bitrate_kbps = 10 * 1024;
+	params->infer_interval_ms = PARAMS_INFER_INTERVAL_MS;
+}
+
+void param_store_cfg_default(param_store_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->grace_ms = 2000;
+}
+
+static int params_check(const params_t *params) {
+	if (!(params->det.score_thresh > 0.0f && params->det.score_thresh < 1.0f)) {
+		printf("params: score_thresh %.3f out of (0, 1)\n", params->det.score_thresh);
+		return -1;
+	}
+	if (!(params->det.nms_iou > 0.0f && params->det.nms_iou <= 1.0f)) {
+		printf("params: nms_iou %.3f out of (0, 1]\n", params->det.nms_iou);
+		return -1;
+	}
+	if (params->bitrate_kbps < 64 || params->bitrate_kbps > 20 * 1024) {
+		printf("params: bitrate_kbps %u out of [64, 20480]\n", params->bitrate_kbps);
+		return -1;
+	}
+	if (params->infer_interval_ms > 10000) {
+		printf("params: infer_interval_ms %u above 10000\n", params->infer_interval_ms);
+		return -1;
+	}
+	return 0;
+}
+
+/* A slot that is not current and that no reader can still be looking at */
+static int param_store_free_slot(param_store_t *store) {
+	const params_t *current = store->current.load(std::memory_order_relaxed);
+	RK_U32 readers = store->readers.load(std::memory_order_acquire);
+
+	for (int s = 0; s < PARAM_STORE_SLOTS; s++) {
+		if (&store->slots[s] == current)
+			continue;
+		bool free = true;
+		for (RK_U32 r = 0; r < readers && store->retired[s]; r++) {
+			if ((RK_S32)(store->reader_seen[r].load(std::memory_order_acquire) - store->retired[s]) < 0) {
+				free = false;
+				break;
+			}
+		}
+		if (free)
+			return s;
+	}
+	return -1;
+}
+
+int param_store_update(param_store_t *store, const params_t *next) {
+	const params_t *old = store->current.load(std::memory_order_relaxed);
+	int s;
+
+	if (params_check(next) != 0) {
+		store->rejected++;
+		return -1;
+	}
+	// readers pass a quiescent state once per pass, up to an infer interval apart;
+	// a stuck one must not hang the caller
+	RK_U32 grace_ms = store->cfg.grace_ms + (old ? old->infer_interval_ms : 0);
+	RK_U64 give_up = TEST_COMM_GetNowUs() + (RK_U64)grace_ms * 1000;
+	while ((s = param_store_free_slot(store)) < 0) {
+		if (TEST_COMM_GetNowUs() >= give_up) {
+			printf("params: readers did not pass a quiescent state in %u ms, update refused\n", grace_ms);
+			store->rejected++;
+			return -1;
+		}
+		usleep(PARAM_STORE_WAIT_US);
+	}
+
+	params_t *slot = &store->slots[s];
+	*slot = *next;
+	slot->version = (old ? old->version : 0) + 1;
+	if (store->cfg.derive)
+		store->cfg.derive(slot, store->cfg.cb_arg);
+	store->retired[s] = 0;
+	store->current.store(slot, std::memory_order_seq_cst);
+	if (old)
+		store->retired[old - store->slots] = slot->version;
+	store->updates++;
+
+	if (old && store->cfg.apply)
+		store->cfg.apply(old, slot, store->cfg.cb_arg);
+	return 0;
+}
+
+static char *params_trim(char *str) {
+	while (*str == ' ' || *str == '\t')
+		str++;
+	char *end = str + strlen(str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+		*--end = '\0';
+	return str;
+}
+
+int param_store_reload(param_store_t *store) {
+	params_t next = *param_store_get(store);
+	char line[128];
+	int line_no = 0;
+
+	FILE *fp = fopen(store->cfg.path, "r");
+	if (!fp) {
+		printf("params: open %s failed: %s\n", store->cfg.path, strerror(errno));
+		return -1;
+	}
+	// all or nothing: one bad line rejects the whole file
+	while (fgets(line, sizeof(line), fp)) {
+		line_no++;
+		char *hash = strchr(line, '#');
+		if (hash)
+			*hash = '\0';
+		char *key = params_trim(line);
+		if (*key == '\0')
+			continue;
+		char *eq = strchr(key, '=');
+		if (!eq) {
+			printf("params: %s:%d: expected key = value\n", store->cfg.path, line_no);
+			fclose(fp);
+			store->rejected++;
+			return -1;
+		}
+		*eq = '\0';
+		key = params_trim(key);
+		char *value = params_trim(eq + 1);
+		char *end;
+		double v = strtod(value, &end);
+		if (end == value || *end != '\0') {
+			printf("params: %s:%d: bad value '%s'\n", store->cfg.path, line_no, value);
+			fclose(fp);
+			store->rejected++;
+			return -1;
+		}
+		if (strcmp(key, "score_thresh") == 0)
+			next.det.score_thresh = (float)v;
+		else if (strcmp(key, "nms_iou") == 0)
+			next.det.nms_iou = (float)v;
+		else if (strcmp(key, "bitrate_kbps") == 0)
+			next.bitrate_kbps = v < 0 ? 0 : (RK_U32)v;
+		else if (strcmp(key, "infer_interval_ms") == 0)
+			next.infer_interval_ms = v < 0 ? 0 : (RK_U32)v;
+		else
+			printf("params: %s:%d: unknown key '%s' ignored\n", store->cfg.path, line_no, key);
+	}
+	fclose(fp);
+
+	if (param_store_update(store, &next) != 0)
+		return -1;
+	param_store_dump(store);
+	return 0;
+}
+
+int param_store_poll(param_store_t *store) {
+	char buf[1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+
+	if (store->inotify_fd < 0)
+		return 0;
+	while ((len = read(store->inotify_fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len;) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			// editors write a temporary and rename it over the file, so watch the directory
+			if (ev->len && strcmp(ev->name, store->file_name) == 0)
+				changed = true;
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	if (!changed)
+		return 0;
+	return param_store_reload(store) == 0 ? 1 : 0;
+}
+
+int param_store_init(param_store_t *store, const param_store_cfg_t *cfg, const params_t *initial) {
+	store->cfg = *cfg;
+	store->current.store(NULL, std::memory_order_relaxed);
+	memset(store->slots, 0, sizeof(store->slots));
+	memset(store->retired, 0, sizeof(store->retired));
+	for (int r = 0; r < PARAM_STORE_MAX_READERS; r++)
+		store->reader_seen[r].store(0, std::memory_order_relaxed);
+	store->readers.store(0, std::memory_order_relaxed);
+	store->inotify_fd = -1;
+	store->file_name[0] = '\0';
+	store->updates = 0;
+	store->rejected = 0;
+
+	if (param_store_update(store, initial) != 0)
+		return -1;
+	if (!store->cfg.path)
+		return 0;
+
+	char dir[256];
+	char name[256];
+	snprintf(dir, sizeof(dir), "%s", store->cfg.path);
+	snprintf(name, sizeof(name), "%s", store->cfg.path);
+	snprintf(store->file_name, sizeof(store->file_name), "%s", basename(name));
+	store->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (store->inotify_fd < 0 ||
+	    inotify_add_watch(store->inotify_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		printf("params: cannot watch %s: %s, changes need a restart\n", store->cfg.path, strerror(errno));
+		if (store->inotify_fd >= 0)
+			close(store->inotify_fd);
+		store->inotify_fd = -1;
+	}
+	if (access(store->cfg.path, R_OK) == 0)
+		param_store_reload(store);
+	return 0;
+}
+
+int param_store_register_reader(param_store_t *store) {
+	RK_U32 id = store->readers.load(std::memory_order_relaxed);
+	if (id >= PARAM_STORE_MAX_READERS)
+		return -1;
+	store->reader_seen[id].store(param_store_get(store)->version, std::memory_order_relaxed);
+	store->readers.store(id + 1, std::memory_order_release);
+	return id;
+}
+
+void param_store_dump(param_store_t *store) {
+	const params_t *params = param_store_get(store);
+	printf("params v%u: score_thresh %.3f (raw > %d), nms_iou %.3f, bitrate %u kbps, infer interval %u ms"
+	       " (%u updates, %u rejected)\n",
+	       params->version, params->det.score_thresh, params->det.score_thresh_q, params->det.nms_iou,
+	       params->bitrate_kbps, params->infer_interval_ms, store->updates, store->rejected);
+}
+
+void param_store_deinit(param_store_t *store) {
+	if (store->inotify_fd >= 0)
+		close(store->inotify_fd);
+	store->inotify_fd = -1;
+}
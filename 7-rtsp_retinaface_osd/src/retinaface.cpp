@@ -21,7 +21,7 @@
 
 #include "rknn_box_priors.h"
 
-#define USE_RKNN_MEM_SHARE 0
+#define USE_RKNN_MEM_SHARE 1
 
 int clamp(float x, int min, int max) {
     if (x > max) return max;
@@ -45,7 +45,12 @@ int init_retinaface_model(const char *model_path, rknn_app_context_t *app_ctx)
     char *model;
     rknn_context ctx = 0;
 
+#if USE_RKNN_MEM_SHARE
+    // weight and internal buffers are allocated here, so the internal one can be shared between models
+    ret = rknn_init(&ctx, (char *)model_path, 0, RKNN_FLAG_MEM_ALLOC_OUTSIDE, NULL);
+#else
     ret = rknn_init(&ctx, (char *)model_path, 0, 0, NULL);
+#endif
     if (ret < 0)
     {
         printf("rknn_init fail! ret=%d\n", ret);
@@ -95,6 +100,33 @@ int init_retinaface_model(const char *model_path, rknn_app_context_t *app_ctx)
         dump_tensor_attr(&(output_attrs[i]));
     }
 
+#if USE_RKNN_MEM_SHARE
+    rknn_mem_size mem_size;
+    ret = rknn_query(ctx, RKNN_QUERY_MEM_SIZE, &mem_size, sizeof(mem_size));
+    if (ret != RKNN_SUCC)
+    {
+        printf("rknn_query mem size fail! ret=%d\n", ret);
+        return -1;
+    }
+    printf("weight size=%u, internal size=%u\n", mem_size.total_weight_size, mem_size.total_internal_size);
+    app_ctx->net_mem = rknn_create_mem(ctx, mem_size.total_weight_size);
+    ret = rknn_set_weight_mem(ctx, app_ctx->net_mem);
+    if (ret < 0) {
+        printf("rknn_set_weight_mem fail! ret=%d\n", ret);
+        return -1;
+    }
+    // max_mem set by the caller: internal buffer of an earlier model, reused if large enough
+    if (app_ctx->max_mem == NULL || app_ctx->max_mem->size < mem_size.total_internal_size) {
+        app_ctx->max_mem = rknn_create_mem(ctx, mem_size.total_internal_size);
+        app_ctx->own_max_mem = true;
+    }
+    ret = rknn_set_internal_mem(ctx, app_ctx->max_mem);
+    if (ret < 0) {
+        printf("rknn_set_internal_mem fail! ret=%d\n", ret);
+        return -1;
+    }
+#endif
+
     // default input type is int8 (normalize and quantize need compute in outside)
     // if set uint8, will fuse normalize and quantize to npu
     input_attrs[0].type = RKNN_TENSOR_UINT8;
@@ -186,6 +218,15 @@ int release_retinaface_model(rknn_app_context_t *app_ctx)
             rknn_destroy_mem(app_ctx->rknn_ctx, app_ctx->output_mems[i]);
         }
     }
+    if (app_ctx->net_mem != NULL) {
+        rknn_destroy_mem(app_ctx->rknn_ctx, app_ctx->net_mem);
+        app_ctx->net_mem = NULL;
+    }
+    if (app_ctx->max_mem != NULL && app_ctx->own_max_mem) {
+        rknn_destroy_mem(app_ctx->rknn_ctx, app_ctx->max_mem);
+        app_ctx->max_mem = NULL;
+        app_ctx->own_max_mem = false;
+    }
     if (app_ctx->rknn_ctx != 0)
     {
         rknn_destroy(app_ctx->rknn_ctx);
@@ -278,7 +319,33 @@ static int8_t qnt_f32_to_affine(float f32, int32_t zp, float scale)
 
 static float deqnt_affine_to_f32(int8_t qnt, int32_t zp, float scale) { return ((float)qnt - (float)zp) * scale; }
 
+void retinaface_thresh_default(const rknn_app_context_t *app_ctx, retinaface_thresh_t *thresh)
+{
+    thresh->score_thresh = 0.5f;
+    thresh->nms_iou = 0.2f;
+    thresh->score_thresh_q = retinaface_quantize_score(app_ctx, thresh->score_thresh);
+}
+
+int retinaface_quantize_score(const rknn_app_context_t *app_ctx, float score)
+{
+    // (q - zp) * scale > score  <=>  q > floor(score / scale + zp), for scale > 0
+    float q = floorf(score / app_ctx->output_attrs[1].scale + app_ctx->output_attrs[1].zp);
+    if (q < -129)
+        return -129;
+    if (q > 127)
+        return 127;
+    return (int)q;
+}
+
 int inference_retinaface_model(rknn_app_context_t *app_ctx, object_detect_result_list *od_results)
+{
+    retinaface_thresh_t thresh;
+    retinaface_thresh_default(app_ctx, &thresh);
+    return inference_retinaface_model_ex(app_ctx, od_results, &thresh);
+}
+
+int inference_retinaface_model_ex(rknn_app_context_t *app_ctx, object_detect_result_list *od_results,
+                                  const retinaface_thresh_t *thresh)
 {
     int ret;
     ret = rknn_run(app_ctx->rknn_ctx, nullptr);
@@ -327,9 +394,10 @@ int inference_retinaface_model(rknn_app_context_t *app_ctx, object_detect_result
     //box_process
     for(int i = 0;i < num_priors; i++)
     {
-        float face_score = deqnt_affine_to_f32(scores[i*2+1], scores_zp, scores_scale);
-        if (face_score >  0.5)//获取全部的bbox的数据
+        // raw int8 compare, only the candidates are dequantized
+        if ((int8_t)scores[i*2+1] > thresh->score_thresh_q)//获取全部的bbox的数据
         {
+            float face_score = deqnt_affine_to_f32(scores[i*2+1], scores_zp, scores_scale);
             //printf("i = %d , face_score = %f\n",i,face_score);
             filter_indices[validCount] = i;
             props[validCount] = face_score; //储存
@@ -367,7 +435,7 @@ int inference_retinaface_model(rknn_app_context_t *app_ctx, object_detect_result
     quick_sort_indice_inverse(props, 0, validCount - 1, filter_indices);
 
     //nms
-    nms(validCount, loc_fp32, filter_indices, 0.2, 640, 640);
+    nms(validCount, loc_fp32, filter_indices, thresh->nms_iou, 640, 640);
 
     uint8_t num_face_count = 0; 
     for (int i = 0; i < validCount; ++i) {
@@ -375,7 +443,7 @@ int inference_retinaface_model(rknn_app_context_t *app_ctx, object_detect_result
             printf("Warning: detected more than 128 faces, can not handle that");
             break;
         }
-        if (filter_indices[i] == -1 || props[i] < 0.5) {
+        if (filter_indices[i] == -1 || props[i] < thresh->score_thresh) {
             continue;
         }
 
@@ -0,0 +1,336 @@
+/*****************************************************************************
+* | Function    :   Track-guided ROI re-detection scheduler and replay scoring
+*
+******************************************************************************/
+
+#include <math.h>
+
+#include "luckfox_mpi.h"
+#include "mem_plan.h"
+#include "roi_sched.h"
+
+#define ROI_SCHED_MAX_DT 1.0f		// seconds, longer gaps do not extrapolate further
+#define ROI_SCHED_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+void roi_sched_cfg_default(roi_sched_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->full_every = 5;			// 2.5 s at the default 500 ms infer interval
+	cfg->full_max_ms = 3000;
+	cfg->window = 2.0f;
+	cfg->min_window = 48;
+	cfg->velocity_alpha = 0.5f;
+	cfg->dedup_iou = 0.5f;
+	cfg->vi_chn = 2;
+	cfg->width = 1920;			// VI self path limit on the RV1106
+	cfg->height = 1080;
+	cfg->fps = 15;
+}
+
+void roi_sched_cfg_from_env(roi_sched_cfg_t *cfg) {
+	const char *value;
+	RK_U32 w, h;
+
+	value = getenv("ROI_FULL_EVERY");
+	if (value && atoi(value) > 0)
+		cfg->full_every = atoi(value);
+	value = getenv("ROI_FULL_MAX_MS");
+	if (value && atoi(value) > 0)
+		cfg->full_max_ms = atoi(value);
+	value = getenv("ROI_WINDOW");
+	if (value && atof(value) >= 1.0)
+		cfg->window = atof(value);
+	value = getenv("ROI_VI_CHN");
+	if (value)
+		cfg->vi_chn = atoi(value);
+	value = getenv("ROI_SIZE");
+	if (value && sscanf(value, "%ux%u", &w, &h) == 2 && w >= 64 && h >= 64) {
+		cfg->width = w;
+		cfg->height = h;
+	}
+	value = getenv("ROI_FPS");
+	if (value)
+		cfg->fps = atoi(value);
+}
+
+RK_U64 roi_sched_source_bytes(const roi_sched_cfg_t *cfg) {
+	return mem_plan_frame_bytes(cfg->width, cfg->height, 16) * ROI_SCHED_VI_BUF_CNT;
+}
+
+void roi_sched_init(roi_sched_t *sched, const roi_sched_cfg_t *cfg) {
+	memset(sched, 0, sizeof(*sched));
+	sched->cfg = *cfg;
+	if (sched->cfg.full_every == 0)
+		sched->cfg.full_every = 1;
+	// nothing to re-check before the first full pass
+	sched->force_full = true;
+}
+
+void roi_sched_hint(roi_sched_t *sched, const RECT_S *rois, int count, float sx, float sy) {
+	sched->hint_count = 0;
+	for (int i = 0; i < count && i < ROI_SCHED_MAX_HINTS; i++) {
+		RECT_S *h = &sched->hints[sched->hint_count++];
+		h->s32X = (RK_S32)(rois[i].s32X * sx);
+		h->s32Y = (RK_S32)(rois[i].s32Y * sy);
+		h->u32Width = (RK_U32)(rois[i].u32Width * sx);
+		h->u32Height = (RK_U32)(rois[i].u32Height * sy);
+	}
+}
+
+static bool roi_sched_inside(const RECT_S *r, float x, float y) {
+	return x >= r->s32X && x < r->s32X + (float)r->u32Width && y >= r->s32Y && y < r->s32Y + (float)r->u32Height;
+}
+
+roi_sched_pass_e roi_sched_plan(roi_sched_t *sched, const tracker_t *tracker, RK_U64 pts, RK_U32 frame_w,
+                                RK_U32 frame_h, RECT_S *rois, int *tags, int *count) {
+	const roi_sched_cfg_t *cfg = &sched->cfg;
+	int n = 0;
+	int hint_count = sched->hint_count;
+
+	*count = 0;
+	sched->hint_count = 0;
+	if (sched->force_full || sched->since_full + 1 >= cfg->full_every ||
+	    pts >= sched->last_full_pts + (RK_U64)cfg->full_max_ms * 1000)
+		return ROI_SCHED_FULL;
+
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		const track_t *trk = &tracker->tracks[t];
+		if (!trk->id)
+			continue;
+		if (n == ROI_SCHED_MAX_ROIS)
+			return ROI_SCHED_FULL;		// too many to re-check in one mosaic
+
+		const roi_sched_motion_t *m = &sched->motion[t];
+		float cx = trk->box.s32X + trk->box.u32Width * 0.5f;
+		float cy = trk->box.s32Y + trk->box.u32Height * 0.5f;
+		float dx = 0.0f, dy = 0.0f;
+		if (m->id == trk->id && pts > m->pts) {
+			float dt = ROI_SCHED_MIN((pts - m->pts) / 1000000.0f, ROI_SCHED_MAX_DT);
+			dx = m->vx * dt;
+			dy = m->vy * dt;
+			cx = m->cx + dx;
+			cy = m->cy + dy;
+		}
+		// the window grows with the distance extrapolated, the prediction is only that good
+		float w = RK_MAX((float)cfg->min_window, trk->box.u32Width * cfg->window + 2.0f * fabsf(dx));
+		float h = RK_MAX((float)cfg->min_window, trk->box.u32Height * cfg->window + 2.0f * fabsf(dy));
+		rois[n].s32X = (RK_S32)(cx - w * 0.5f);
+		rois[n].s32Y = (RK_S32)(cy - h * 0.5f);
+		rois[n].u32Width = (RK_U32)w;
+		rois[n].u32Height = (RK_U32)h;
+		if (rois[n].s32X >= (RK_S32)frame_w || rois[n].s32Y >= (RK_S32)frame_h ||
+		    rois[n].s32X + (RK_S32)rois[n].u32Width <= 0 || rois[n].s32Y + (RK_S32)rois[n].u32Height <= 0)
+			continue;		// predicted out of the picture, it ends on its own
+		tags[n] = trk->id;
+		n++;
+	}
+	if (n == 0)
+		return ROI_SCHED_FULL;
+
+	// moving, and not the tracked faces moving: possibly someone new
+	int tracked = n;
+	for (int i = 0; i < hint_count && n < ROI_SCHED_MAX_ROIS; i++) {
+		const RECT_S *h = &sched->hints[i];
+		float cx = h->s32X + h->u32Width * 0.5f;
+		float cy = h->s32Y + h->u32Height * 0.5f;
+		int k = 0;
+		for (; k < tracked && !roi_sched_inside(&rois[k], cx, cy); k++) {
+		}
+		if (k < tracked)
+			continue;
+		float w = RK_MAX((float)cfg->min_window, (float)h->u32Width);
+		float hh = RK_MAX((float)cfg->min_window, (float)h->u32Height);
+		rois[n].s32X = (RK_S32)(cx - w * 0.5f);
+		rois[n].s32Y = (RK_S32)(cy - hh * 0.5f);
+		rois[n].u32Width = (RK_U32)w;
+		rois[n].u32Height = (RK_U32)hh;
+		tags[n] = 0;
+		n++;
+	}
+	*count = n;
+	return ROI_SCHED_ROI;
+}
+
+static float roi_sched_iou(const image_rect_t *a, const image_rect_t *b) {
+	int x0 = RK_MAX(a->left, b->left);
+	int y0 = RK_MAX(a->top, b->top);
+	int x1 = ROI_SCHED_MIN(a->right, b->right);
+	int y1 = ROI_SCHED_MIN(a->bottom, b->bottom);
+	if (x1 <= x0 || y1 <= y0)
+		return 0.0f;
+	float inter = (float)(x1 - x0) * (y1 - y0);
+	float uni = (float)(a->right - a->left) * (a->bottom - a->top) +
+	            (float)(b->right - b->left) * (b->bottom - b->top) - inter;
+	return uni > 0 ? inter / uni : 0.0f;
+}
+
+int roi_sched_dedup(roi_sched_t *sched, crop_mosaic_det_t *dets, int count) {
+	// best first, insertion sort on a few dozen entries at most
+	for (int i = 1; i < count; i++) {
+		crop_mosaic_det_t d = dets[i];
+		int j = i;
+		for (; j > 0 && dets[j - 1].det.prop < d.det.prop; j--)
+			dets[j] = dets[j - 1];
+		dets[j] = d;
+	}
+	int n = 0;
+	for (int i = 0; i < count; i++) {
+		bool keep = true;
+		for (int k = 0; k < n && keep; k++)
+			keep = roi_sched_iou(&dets[i].det.box, &dets[k].det.box) <= sched->cfg.dedup_iou;
+		if (keep)
+			dets[n++] = dets[i];
+	}
+	return n;
+}
+
+void roi_sched_done(roi_sched_t *sched, roi_sched_pass_e pass, RK_U64 pts, const crop_mosaic_t *mosaic,
+                    const crop_mosaic_det_t *dets, int count, RK_U64 cost_us) {
+	if (pass == ROI_SCHED_FULL) {
+		sched->full_passes++;
+		sched->full_us += cost_us;
+		sched->since_full = 0;
+		sched->last_full_pts = pts;
+		sched->force_full = false;
+		return;
+	}
+
+	sched->roi_passes++;
+	sched->roi_us += cost_us;
+	sched->since_full++;
+	for (int t = 0; t < mosaic->count; t++) {
+		bool hint = mosaic->tiles[t].tag == 0;
+		if (hint && !mosaic->tiles[t].placed)
+			continue;
+		if (!mosaic->tiles[t].placed) {
+			// never looked at, only a full pass can tell whether it is still there
+			sched->spilled++;
+			sched->force_full = true;
+			continue;
+		}
+		// by position: a duplicate kept from an overlapping window still counts for this one
+		const RECT_S *roi = &mosaic->tiles[t].roi;
+		int k = 0;
+		for (; k < count; k++) {
+			int cx = (dets[k].det.box.left + dets[k].det.box.right) / 2;
+			int cy = (dets[k].det.box.top + dets[k].det.box.bottom) / 2;
+			if (roi_sched_inside(roi, cx, cy))
+				break;
+		}
+		if (hint) {
+			// a new face here becomes a track in tracker_update(), nothing here proves nothing
+			sched->hinted++;
+			sched->hint_found += k < count;
+			continue;
+		}
+		sched->windows++;
+		if (k < count) {
+			sched->refound++;
+		} else {
+			// left its window: too fast, turned away or gone, the full frame knows
+			sched->lost++;
+			sched->force_full = true;
+		}
+	}
+}
+
+void roi_sched_observe(roi_sched_t *sched, const tracker_t *tracker) {
+	float alpha = sched->cfg.velocity_alpha;
+
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		const track_t *trk = &tracker->tracks[t];
+		roi_sched_motion_t *m = &sched->motion[t];
+		if (!trk->id) {
+			m->id = 0;
+			continue;
+		}
+		if (trk->det_index < 0)
+			continue;
+		float cx = trk->box.s32X + trk->box.u32Width * 0.5f;
+		float cy = trk->box.s32Y + trk->box.u32Height * 0.5f;
+		if (m->id == trk->id && tracker->pts > m->pts) {
+			float dt = (tracker->pts - m->pts) / 1000000.0f;
+			m->vx = alpha * (cx - m->cx) / dt + (1.0f - alpha) * m->vx;
+			m->vy = alpha * (cy - m->cy) / dt + (1.0f - alpha) * m->vy;
+		} else {
+			m->id = trk->id;
+			m->vx = 0.0f;
+			m->vy = 0.0f;
+		}
+		m->cx = cx;
+		m->cy = cy;
+		m->pts = tracker->pts;
+	}
+}
+
+void roi_sched_dump_stats(roi_sched_t *sched) {
+	printf("roi sched: %u full (avg %llu us), %u roi (avg %llu us), %u windows, %u refound, %u lost, %u spilled, "
+	       "%u/%u motion windows with a face\n",
+	       sched->full_passes, (unsigned long long)(sched->full_passes ? sched->full_us / sched->full_passes : 0),
+	       sched->roi_passes, (unsigned long long)(sched->roi_passes ? sched->roi_us / sched->roi_passes : 0),
+	       sched->windows, sched->refound, sched->lost, sched->spilled, sched->hint_found, sched->hinted);
+	sched->full_passes = sched->roi_passes = 0;
+	sched->windows = sched->refound = sched->lost = sched->spilled = 0;
+	sched->hinted = sched->hint_found = 0;
+	sched->full_us = sched->roi_us = 0;
+}
+
+void roi_sched_replay_init(roi_sched_replay_t *replay) {
+	memset(replay, 0, sizeof(*replay));
+	replay->iou = 0.5f;
+}
+
+bool roi_sched_replay_due(roi_sched_replay_t *replay, RK_U64 pts) {
+	RK_U64 interval_us = (RK_U64)replay->interval_ms * 1000;
+	// a jump back of more than an interval is a loop or a new file: start over
+	if (pts < replay->next_pts && replay->next_pts - pts <= interval_us)
+		return false;
+	replay->next_pts = pts + interval_us;
+	return true;
+}
+
+void roi_sched_replay_frame(roi_sched_replay_t *replay, const object_detect_result *ref, int ref_count,
+                            const object_detect_result *got, int got_count) {
+	bool used[128];
+	int matched = 0;
+
+	if (got_count > 128)
+		got_count = 128;
+	memset(used, 0, sizeof(used));
+	for (int r = 0; r < ref_count; r++) {
+		float best = replay->iou;
+		int best_g = -1;
+		for (int g = 0; g < got_count; g++) {
+			if (used[g])
+				continue;
+			float iou = roi_sched_iou(&ref[r].box, &got[g].box);
+			if (iou >= best) {
+				best = iou;
+				best_g = g;
+			}
+		}
+		if (best_g >= 0) {
+			used[best_g] = true;
+			matched++;
+		}
+	}
+	replay->frames++;
+	replay->ref_faces += ref_count;
+	replay->matched += matched;
+	replay->extra += got_count - matched;
+}
+
+void roi_sched_replay_report(const roi_sched_replay_t *replay, const roi_sched_t *sched) {
+	RK_U64 policy_us = sched->full_us + sched->roi_us;
+	if (!replay->frames)
+		return;
+	printf("roi replay: %llu passes %u ms apart, %u full + %u roi (full every %u / %u ms, window %.1fx)\n",
+	       (unsigned long long)replay->frames, replay->interval_ms, sched->full_passes, sched->roi_passes,
+	       sched->cfg.full_every, sched->cfg.full_max_ms, sched->cfg.window);
+	printf("roi replay: detector time %llu ms vs %llu ms full frame every pass (%.2fx), "
+	       "recall %.3f (%llu/%llu faces), %llu found by the windows only, %u windows lost\n",
+	       (unsigned long long)(policy_us / 1000), (unsigned long long)(replay->ref_us / 1000),
+	       policy_us ? (float)replay->ref_us / policy_us : 0.0f,
+	       replay->ref_faces ? (float)replay->matched / replay->ref_faces : 1.0f,
+	       (unsigned long long)replay->matched, (unsigned long long)replay->ref_faces,
+	       (unsigned long long)replay->extra, sched->lost);
+}
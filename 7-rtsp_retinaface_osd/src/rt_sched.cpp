@@ -0,0 +1,250 @@
+/*****************************************************************************
+* | Function    :   SCHED_FIFO profile, stack prefault and deadline counters
+*                   for the capture / inference / streaming threads
+*
+******************************************************************************/
+
+#include <alloca.h>
+#include <atomic>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "luckfox_mpi.h"
+#include "rt_sched.h"
+
+#define RT_STACK_GUARD (16 * 1024)
+
+typedef struct {
+	std::atomic<RK_U64> runs;
+	std::atomic<RK_U64> misses;
+	std::atomic<RK_U64> worst_us;
+	std::atomic<RK_U64> total_us;
+} rt_stage_stats_t;
+
+typedef struct {
+	rt_stage_e stage;
+	void *(*fn)(void *);
+	void *arg;
+} rt_thread_start_t;
+
+static rt_sched_profile_t g_profile;
+static rt_stage_stats_t g_stats[RT_STAGE_NUM];
+static const char *g_env_suffix[RT_STAGE_NUM] = {"STREAM", "AUDIO", "INFER", "LOG", "STORAGE", "SNAPSHOT", "SHARE",
+                                                 "BEST_SHOT"};
+
+void rt_sched_profile_default(rt_sched_profile_t *profile) {
+	memset(profile, 0, sizeof(*profile));
+
+	profile->stage[RT_STAGE_STREAM].name = "stream";
+	profile->stage[RT_STAGE_STREAM].priority = 60;
+	profile->stage[RT_STAGE_STREAM].deadline_us = 33 * 1000;	// one frame at 30fps
+	profile->stage[RT_STAGE_STREAM].stack_size = 256 * 1024;
+
+	profile->stage[RT_STAGE_AUDIO].name = "audio";
+	profile->stage[RT_STAGE_AUDIO].priority = 55;
+	profile->stage[RT_STAGE_AUDIO].deadline_us = 20 * 1000;	// one 160-sample G.711 frame
+	profile->stage[RT_STAGE_AUDIO].stack_size = 128 * 1024;
+
+	profile->stage[RT_STAGE_INFER].name = "infer";
+	profile->stage[RT_STAGE_INFER].priority = 30;
+	profile->stage[RT_STAGE_INFER].deadline_us = 400 * 1000;
+	// inference_retinaface_model() keeps ~1.1MB of VLAs on the stack
+	profile->stage[RT_STAGE_INFER].stack_size = 2 * 1024 * 1024;
+
+	profile->stage[RT_STAGE_LOG].name = "log";
+	profile->stage[RT_STAGE_LOG].priority = 0;
+	profile->stage[RT_STAGE_LOG].deadline_us = 0;
+	profile->stage[RT_STAGE_LOG].stack_size = 128 * 1024;
+
+	profile->stage[RT_STAGE_STORAGE].name = "storage";
+	profile->stage[RT_STAGE_STORAGE].priority = 0;
+	profile->stage[RT_STAGE_STORAGE].nice = 10;
+	profile->stage[RT_STAGE_STORAGE].deadline_us = 0;
+	profile->stage[RT_STAGE_STORAGE].stack_size = 128 * 1024;
+
+	profile->stage[RT_STAGE_SNAPSHOT].name = "snapshot";
+	profile->stage[RT_STAGE_SNAPSHOT].priority = 0;
+	profile->stage[RT_STAGE_SNAPSHOT].nice = 5;
+	profile->stage[RT_STAGE_SNAPSHOT].deadline_us = 0;
+	profile->stage[RT_STAGE_SNAPSHOT].stack_size = 64 * 1024;
+
+	profile->stage[RT_STAGE_SHARE].name = "share";
+	profile->stage[RT_STAGE_SHARE].priority = 0;
+	profile->stage[RT_STAGE_SHARE].deadline_us = 0;
+	profile->stage[RT_STAGE_SHARE].stack_size = 64 * 1024;
+
+	profile->stage[RT_STAGE_BEST_SHOT].name = "bestshot";
+	profile->stage[RT_STAGE_BEST_SHOT].priority = 0;
+	profile->stage[RT_STAGE_BEST_SHOT].nice = 5;
+	profile->stage[RT_STAGE_BEST_SHOT].deadline_us = 0;
+	// room for the OpenCV encoder when there is no MJPEG channel
+	profile->stage[RT_STAGE_BEST_SHOT].stack_size = 256 * 1024;
+
+	profile->lock_memory = true;
+}
+
+void rt_sched_profile_from_env(rt_sched_profile_t *profile) {
+	char key[64];
+	const char *val;
+
+	for (int i = 0; i < RT_STAGE_NUM; i++) {
+		snprintf(key, sizeof(key), "RT_PRIO_%s", g_env_suffix[i]);
+		val = getenv(key);
+		if (val != NULL) {
+			int prio = atoi(val);
+			if (prio < 0 || prio > sched_get_priority_max(SCHED_FIFO)) {
+				printf("%s=%s out of range, ignored\n", key, val);
+			} else {
+				profile->stage[i].priority = prio;
+			}
+		}
+		snprintf(key, sizeof(key), "RT_DEADLINE_US_%s", g_env_suffix[i]);
+		val = getenv(key);
+		if (val != NULL)
+			profile->stage[i].deadline_us = (RK_U32)strtoul(val, NULL, 10);
+	}
+
+	val = getenv("RT_MLOCK");
+	if (val != NULL)
+		profile->lock_memory = atoi(val) != 0;
+}
+
+int rt_sched_init(const rt_sched_profile_t *profile) {
+	g_profile = *profile;
+	for (int i = 0; i < RT_STAGE_NUM; i++) {
+		g_stats[i].runs = 0;
+		g_stats[i].misses = 0;
+		g_stats[i].worst_us = 0;
+		g_stats[i].total_us = 0;
+		printf("rt_sched: %-6s prio=%d deadline=%uus stack=%zuKB\n", g_profile.stage[i].name,
+		       g_profile.stage[i].priority, g_profile.stage[i].deadline_us,
+		       g_profile.stage[i].stack_size / 1024);
+	}
+	return 0;
+}
+
+static void rt_sched_prefault_stack(size_t size) {
+	// Touch every page now so the first deep call in the loop does not page-fault.
+	if (size <= RT_STACK_GUARD)
+		return;
+	size_t len = size - RT_STACK_GUARD;
+	volatile char *buf = (volatile char *)alloca(len);
+	long page = sysconf(_SC_PAGESIZE);
+	for (size_t off = 0; off < len; off += page)
+		buf[off] = 0;
+}
+
+static void *rt_sched_thread_entry(void *arg) {
+	rt_thread_start_t start = *(rt_thread_start_t *)arg;
+	free(arg);
+
+	const rt_stage_cfg_t *cfg = &g_profile.stage[start.stage];
+	rt_sched_prefault_stack(cfg->stack_size);
+	// per thread on Linux; with no ioprio set the I/O class follows nice
+	if (cfg->priority == 0 && cfg->nice != 0 && setpriority(PRIO_PROCESS, syscall(SYS_gettid), cfg->nice) != 0)
+		printf("rt_sched: setpriority %s fail %d\n", cfg->name, errno);
+	return start.fn(start.arg);
+}
+
+int rt_sched_thread_create(pthread_t *tid, rt_stage_e stage, void *(*fn)(void *), void *arg) {
+	const rt_stage_cfg_t *cfg = &g_profile.stage[stage];
+	pthread_attr_t attr;
+	struct sched_param param;
+	int ret;
+
+	rt_thread_start_t *start = (rt_thread_start_t *)malloc(sizeof(rt_thread_start_t));
+	start->stage = stage;
+	start->fn = fn;
+	start->arg = arg;
+
+	pthread_attr_init(&attr);
+	if (cfg->stack_size)
+		pthread_attr_setstacksize(&attr, cfg->stack_size);
+	if (cfg->priority > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = cfg->priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	ret = pthread_create(tid, &attr, rt_sched_thread_entry, start);
+	if (ret == EPERM && cfg->priority > 0) {
+		printf("rt_sched: no permission for SCHED_FIFO, %s runs as SCHED_OTHER\n", cfg->name);
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		ret = pthread_create(tid, &attr, rt_sched_thread_entry, start);
+	}
+	pthread_attr_destroy(&attr);
+
+	if (ret != 0) {
+		printf("rt_sched: pthread_create %s fail %d\n", cfg->name, ret);
+		free(start);
+		return -1;
+	}
+	pthread_setname_np(*tid, cfg->name);
+	return 0;
+}
+
+int rt_sched_apply_current(rt_stage_e stage) {
+	const rt_stage_cfg_t *cfg = &g_profile.stage[stage];
+	struct sched_param param;
+	int ret;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = cfg->priority;
+	ret = pthread_setschedparam(pthread_self(), cfg->priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param);
+	if (ret != 0) {
+		printf("rt_sched: pthread_setschedparam %s fail %d\n", cfg->name, ret);
+		return -1;
+	}
+	pthread_setname_np(pthread_self(), cfg->name);
+	return 0;
+}
+
+int rt_sched_lock_memory() {
+	if (!g_profile.lock_memory)
+		return 0;
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		printf("rt_sched: mlockall fail %s\n", strerror(errno));
+		return -1;
+	}
+	printf("rt_sched: memory locked\n");
+	return 0;
+}
+
+RK_U64 rt_sched_stage_begin(rt_stage_e stage) {
+	(void)stage;
+	return TEST_COMM_GetNowUs();
+}
+
+void rt_sched_stage_end(rt_stage_e stage, RK_U64 begin_us) {
+	rt_stage_stats_t *st = &g_stats[stage];
+	RK_U64 cost = TEST_COMM_GetNowUs() - begin_us;
+	RK_U64 worst = st->worst_us.load(std::memory_order_relaxed);
+
+	st->runs.fetch_add(1, std::memory_order_relaxed);
+	st->total_us.fetch_add(cost, std::memory_order_relaxed);
+	while (cost > worst && !st->worst_us.compare_exchange_weak(worst, cost, std::memory_order_relaxed)) {
+	}
+	if (g_profile.stage[stage].deadline_us && cost > g_profile.stage[stage].deadline_us)
+		st->misses.fetch_add(1, std::memory_order_relaxed);
+}
+
+RK_U64 rt_sched_stage_runs(rt_stage_e stage) {
+	return g_stats[stage].runs.load(std::memory_order_relaxed);
+}
+
+void rt_sched_dump_stats() {
+	for (int i = 0; i < RT_STAGE_NUM; i++) {
+		RK_U64 runs = g_stats[i].runs.load(std::memory_order_relaxed);
+		if (runs == 0)
+			continue;
+		printf("rt_sched: %-6s runs=%llu miss=%llu avg=%lluus worst=%lluus\n", g_profile.stage[i].name,
+		       (unsigned long long)runs,
+		       (unsigned long long)g_stats[i].misses.load(std::memory_order_relaxed),
+		       (unsigned long long)(g_stats[i].total_us.load(std::memory_order_relaxed) / runs),
+		       (unsigned long long)g_stats[i].worst_us.load(std::memory_order_relaxed));
+	}
+}
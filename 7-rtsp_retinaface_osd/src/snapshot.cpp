@@ -0,0 +1,288 @@
+/*****************************************************************************
+* | Function    :   Full resolution still capture: on-demand VI channel,
+*                   MJPEG VENC straight from the DMA frame, async delivery
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "rt_sched.h"
+#include "mem_plan.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_VI_BUF_CNT 2
+
+void snapshot_cfg_default(snapshot_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->vi_chn = 2;
+	cfg->venc_chn = 2;
+	cfg->width = 2304;			// SC3336 on the Luckfox Pico boards
+	cfg->height = 1296;
+	cfg->qfactor = 90;
+	cfg->standby_fps = 0;
+	cfg->idle_ms = 10000;
+	cfg->timeout_ms = 1000;
+}
+
+void snapshot_cfg_from_env(snapshot_cfg_t *cfg) {
+	const char *value;
+	RK_U32 w, h;
+
+	value = getenv("SNAPSHOT_SIZE");
+	if (value && sscanf(value, "%ux%u", &w, &h) == 2 && w >= 64 && h >= 64) {
+		cfg->width = w;
+		cfg->height = h;
+	}
+	value = getenv("SNAPSHOT_VI_CHN");
+	if (value)
+		cfg->vi_chn = atoi(value);
+	value = getenv("SNAPSHOT_STANDBY_FPS");
+	if (value)
+		cfg->standby_fps = atoi(value);
+	value = getenv("SNAPSHOT_QUALITY");
+	if (value && atoi(value) > 0 && atoi(value) < 100)
+		cfg->qfactor = atoi(value);
+}
+
+RK_U64 snapshot_open_bytes(const snapshot_cfg_t *cfg) {
+	RK_U64 frame = mem_plan_frame_bytes(cfg->width, cfg->height, 16);
+	return frame * SNAPSHOT_VI_BUF_CNT + (RK_U64)cfg->width * cfg->height * 3 / 2;
+}
+
+static void snapshot_close(snapshot_ctx_t *snap) {
+	if (snap->venc_open) {
+		RK_MPI_VENC_StopRecvFrame(snap->cfg.venc_chn);
+		RK_MPI_VENC_DestroyChn(snap->cfg.venc_chn);
+		snap->venc_open = false;
+	}
+	if (snap->vi_open) {
+		RK_MPI_VI_DisableChn(0, snap->cfg.vi_chn);
+		snap->vi_open = false;
+	}
+	free(snap->jpeg);
+	snap->jpeg = NULL;
+	snap->jpeg_cap = 0;
+}
+
+static int snapshot_open(snapshot_ctx_t *snap) {
+	const snapshot_cfg_t *cfg = &snap->cfg;
+
+	// depth 1: the channel keeps only its newest frame while nobody asks
+	if (vi_chn_init_fps(cfg->vi_chn, cfg->width, cfg->height, SNAPSHOT_VI_BUF_CNT, 1, cfg->standby_fps) != 0)
+		return -1;
+	snap->vi_open = true;
+	if (venc_jpeg_init(cfg->venc_chn, cfg->width, cfg->height, cfg->qfactor) != 0) {
+		snapshot_close(snap);
+		return -1;
+	}
+	snap->venc_open = true;
+	snap->jpeg_cap = cfg->width * cfg->height * 3 / 2;
+	snap->jpeg = (uint8_t *)malloc(snap->jpeg_cap);
+	if (!snap->jpeg) {
+		snapshot_close(snap);
+		return -1;
+	}
+	snap->opens++;
+	printf("snapshot: vi%d %ux%u open\n", cfg->vi_chn, cfg->width, cfg->height);
+	return 0;
+}
+
+static void snapshot_write(snapshot_ctx_t *snap, snapshot_t *shot, char *path, size_t path_size) {
+	snprintf(path, path_size, "%s/snap_%u_%llu.jpg", snap->cfg.dir, shot->id, (unsigned long long)shot->pts);
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		printf("snapshot: open %s failed: %s\n", path, strerror(errno));
+		return;
+	}
+	if (fwrite(shot->jpeg, 1, shot->jpeg_size, fp) == (size_t)shot->jpeg_size)
+		shot->path = path;
+	else
+		printf("snapshot: write %s failed: %s\n", path, strerror(errno));
+	fclose(fp);
+}
+
+static void snapshot_take(snapshot_ctx_t *snap, const snapshot_request_t *req) {
+	const snapshot_cfg_t *cfg = &snap->cfg;
+	VIDEO_FRAME_INFO_S frame;
+	snapshot_t shot;
+	char path[256];
+	bool got = false;
+
+	memset(&shot, 0, sizeof(shot));
+	shot.id = req->id;
+	shot.request_us = req->request_us;
+	shot.width = cfg->width;
+	shot.height = cfg->height;
+	shot.jpeg_size = -1;
+
+	if (snap->vi_open || snapshot_open(snap) == 0) {
+		// a standby channel may need one frame interval on top
+		int wait_ms = cfg->timeout_ms + (cfg->standby_fps ? 1000 / cfg->standby_fps : 0);
+		RK_U64 give_up_us = TEST_COMM_GetNowUs() + (RK_U64)wait_ms * 1000;
+		while (!got) {
+			if (RK_MPI_VI_GetChnFrame(0, cfg->vi_chn, &frame, wait_ms) != RK_SUCCESS)
+				break;
+			// the queued frame may predate the request, the caller wants what happens now
+			if (frame.stVFrame.u64PTS >= req->request_us || TEST_COMM_GetNowUs() >= give_up_us) {
+				got = true;
+			} else {
+				RK_MPI_VI_ReleaseChnFrame(0, cfg->vi_chn, &frame);
+				snap->stale++;
+			}
+		}
+	}
+	if (got) {
+		RK_U64 begin = TEST_COMM_GetNowUs();
+		// the VENC reads the VI buffer by DMA, only the compressed result is copied
+		shot.jpeg_size = venc_encode_frame(cfg->venc_chn, &frame, snap->jpeg, snap->jpeg_cap, cfg->timeout_ms);
+		snap->encode_us += TEST_COMM_GetNowUs() - begin;
+		shot.pts = frame.stVFrame.u64PTS;
+		RK_MPI_VI_ReleaseChnFrame(0, cfg->vi_chn, &frame);
+	}
+
+	RK_U64 now = TEST_COMM_GetNowUs();
+	snap->last_use_us = now;
+	if (shot.jpeg_size > 0) {
+		RK_U64 latency = now - req->request_us;
+		shot.jpeg = snap->jpeg;
+		snap->taken++;
+		snap->bytes += shot.jpeg_size;
+		snap->latency_us += latency;
+		if (latency > snap->latency_worst_us)
+			snap->latency_worst_us = latency;
+		if (cfg->dir)
+			snapshot_write(snap, &shot, path, sizeof(path));
+	} else {
+		shot.jpeg_size = -1;
+		snap->failed++;
+		printf("snapshot: %u failed\n", shot.id);
+	}
+	if (req->cb)
+		req->cb(&shot, req->cb_arg);
+}
+
+static void snapshot_deadline(struct timespec *ts, RK_U64 us) {
+	ts->tv_sec = us / 1000000;
+	ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+static void *snapshot_thread(void *arg) {
+	snapshot_ctx_t *snap = (snapshot_ctx_t *)arg;
+	snapshot_request_t req;
+
+	if (snap->cfg.standby_fps > 0 && snapshot_open(snap) != 0)
+		printf("snapshot: standby channel unavailable, opening per request\n");
+
+	pthread_mutex_lock(&snap->lock);
+	for (;;) {
+		while (!snap->quit && snap->queue_count == 0) {
+			if (snap->vi_open && snap->cfg.standby_fps == 0) {
+				// on-demand channel: give its CMA back once requests stop
+				RK_U64 close_us = snap->last_use_us + (RK_U64)snap->cfg.idle_ms * 1000;
+				if (TEST_COMM_GetNowUs() >= close_us) {
+					pthread_mutex_unlock(&snap->lock);
+					snapshot_close(snap);
+					pthread_mutex_lock(&snap->lock);
+					continue;
+				}
+				struct timespec ts;
+				snapshot_deadline(&ts, close_us);
+				pthread_cond_timedwait(&snap->cond, &snap->lock, &ts);
+			} else {
+				pthread_cond_wait(&snap->cond, &snap->lock);
+			}
+		}
+		if (snap->queue_count == 0)
+			break;
+		req = snap->queue[snap->queue_head];
+		snap->queue_head = (snap->queue_head + 1) % SNAPSHOT_QUEUE;
+		snap->queue_count--;
+		pthread_mutex_unlock(&snap->lock);
+
+		snapshot_take(snap, &req);
+
+		pthread_mutex_lock(&snap->lock);
+	}
+	pthread_mutex_unlock(&snap->lock);
+
+	snapshot_close(snap);
+	return NULL;
+}
+
+int snapshot_start(snapshot_ctx_t *snap, const snapshot_cfg_t *cfg) {
+	pthread_mutexattr_t mutex_attr;
+	pthread_condattr_t cond_attr;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->cfg = *cfg;
+	if (snap->cfg.timeout_ms == 0)
+		snap->cfg.timeout_ms = 1000;
+
+	// requests come from SCHED_FIFO threads, the worker is SCHED_OTHER: no inversion on the lock
+	pthread_mutexattr_init(&mutex_attr);
+	pthread_mutexattr_setprotocol(&mutex_attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&snap->lock, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
+	// idle close deadlines are in TEST_COMM_GetNowUs() time
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&snap->cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+
+	if (rt_sched_thread_create(&snap->thread, RT_STAGE_SNAPSHOT, snapshot_thread, snap) != 0) {
+		pthread_cond_destroy(&snap->cond);
+		pthread_mutex_destroy(&snap->lock);
+		return -1;
+	}
+	snap->thread_running = true;
+	printf("snapshot: vi%d -> venc%d, %ux%u q%u, %s\n", snap->cfg.vi_chn, snap->cfg.venc_chn,
+	       snap->cfg.width, snap->cfg.height, snap->cfg.qfactor,
+	       snap->cfg.standby_fps ? "standby" : "on demand");
+	return 0;
+}
+
+int snapshot_request(snapshot_ctx_t *snap, snapshot_cb cb, void *cb_arg) {
+	RK_U64 now = TEST_COMM_GetNowUs();
+	int id = -1;
+
+	pthread_mutex_lock(&snap->lock);
+	snap->requests++;
+	if (snap->thread_running && !snap->quit && snap->queue_count < SNAPSHOT_QUEUE) {
+		snapshot_request_t *req = &snap->queue[(snap->queue_head + snap->queue_count) % SNAPSHOT_QUEUE];
+		req->id = ++snap->next_id & 0x7fffffff;
+		req->request_us = now;
+		req->cb = cb ? cb : snap->cfg.cb;
+		req->cb_arg = cb ? cb_arg : snap->cfg.cb_arg;
+		snap->queue_count++;
+		id = req->id;
+		pthread_cond_signal(&snap->cond);
+	} else {
+		snap->dropped++;
+	}
+	pthread_mutex_unlock(&snap->lock);
+	return id;
+}
+
+void snapshot_dump_stats(snapshot_ctx_t *snap) {
+	printf("snapshot: %u requests, %u taken, %u failed, %u dropped, %u stale frames, %u opens (%s), "
+	       "latency avg %llu worst %llu ms, encode avg %llu ms, %lluKB\n",
+	       snap->requests, snap->taken, snap->failed, snap->dropped, snap->stale, snap->opens,
+	       snap->vi_open ? "open" : "closed",
+	       (unsigned long long)(snap->taken ? snap->latency_us / snap->taken / 1000 : 0),
+	       (unsigned long long)(snap->latency_worst_us / 1000),
+	       (unsigned long long)(snap->taken ? snap->encode_us / snap->taken / 1000 : 0),
+	       (unsigned long long)(snap->bytes / 1024));
+	snap->latency_worst_us = 0;
+}
+
+void snapshot_stop(snapshot_ctx_t *snap) {
+	if (!snap->thread_running)
+		return;
+	pthread_mutex_lock(&snap->lock);
+	snap->quit = true;
+	pthread_cond_signal(&snap->cond);
+	pthread_mutex_unlock(&snap->lock);
+	pthread_join(snap->thread, NULL);
+	snap->thread_running = false;
+	pthread_cond_destroy(&snap->cond);
+	pthread_mutex_destroy(&snap->lock);
+}
@@ -0,0 +1,340 @@
+/*****************************************************************************
+* | Function    :   Write-behind SD card writer: SPSC ring, O_DIRECT blocks,
+*                   preallocated segments and batched fdatasync
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "rt_sched.h"
+#include "storage_writer.h"
+
+#define STORAGE_WRITER_ALIGN 4096
+#define STORAGE_WRITER_PAD 0x80000000	// rest of the ring is unused, continue at 0
+#define STORAGE_WRITER_NAP_US 10000
+#define STORAGE_ALIGN8(x) (((x) + 7) & ~7u)
+#define STORAGE_ALIGN4K(x) (((x) + STORAGE_WRITER_ALIGN - 1) & ~(RK_U64)(STORAGE_WRITER_ALIGN - 1))
+
+typedef struct {
+	RK_U32 len;
+	RK_U32 flags;
+} storage_item_t;
+
+void storage_writer_cfg_default(storage_writer_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->prefix = "rec";
+	cfg->suffix = ".h264";
+	cfg->segment_bytes = 64ULL << 20;
+	cfg->block_bytes = 256 * 1024;
+	cfg->queue_bytes = 4 << 20;		// ~16 s of a 2 Mbps stream while the card is busy
+	cfg->sync_blocks = 16;
+	cfg->sync_ms = 2000;
+	cfg->max_segments = 0;
+	cfg->idle_ms = 5000;
+}
+
+RK_U32 storage_writer_queue_depth(storage_writer_t *writer) {
+	return writer->head.load(std::memory_order_relaxed) - writer->tail.load(std::memory_order_relaxed);
+}
+
+int storage_writer_pushv(storage_writer_t *writer, const struct iovec *iov, int count, RK_U32 flags) {
+	RK_U32 size = writer->cfg.queue_bytes;
+	RK_U32 len = 0;
+
+	for (int i = 0; i < count; i++)
+		len += iov[i].iov_len;
+	RK_U32 total = sizeof(storage_item_t) + STORAGE_ALIGN8(len);
+	RK_U32 head = writer->head.load(std::memory_order_relaxed);
+	RK_U32 tail = writer->tail.load(std::memory_order_acquire);
+	RK_U32 pos = head & (size - 1);
+	RK_U32 contig = size - pos;
+	// an item never wraps, the end of the ring is skipped instead
+	RK_U32 need = contig < total ? contig + total : total;
+
+	if (total > size / 2 || head - tail + need > size) {
+		writer->dropped.fetch_add(1, std::memory_order_relaxed);
+		writer->dropped_bytes.fetch_add(len, std::memory_order_relaxed);
+		return -1;
+	}
+	if (contig < total) {
+		storage_item_t *pad = (storage_item_t *)(writer->queue + pos);
+		pad->len = contig - sizeof(storage_item_t);
+		pad->flags = STORAGE_WRITER_PAD;
+		pos = 0;
+	}
+	storage_item_t *item = (storage_item_t *)(writer->queue + pos);
+	uint8_t *dst = (uint8_t *)(item + 1);
+	item->len = len;
+	item->flags = flags;
+	for (int i = 0; i < count; i++) {
+		memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+		dst += iov[i].iov_len;
+	}
+	writer->head.store(head + need, std::memory_order_release);
+
+	RK_U32 depth = head - tail + need;
+	if (depth > writer->queue_max.load(std::memory_order_relaxed))
+		writer->queue_max.store(depth, std::memory_order_relaxed);
+	return 0;
+}
+
+int storage_writer_push(storage_writer_t *writer, const void *data, RK_U32 len, RK_U32 flags) {
+	struct iovec iov;
+	iov.iov_base = (void *)data;
+	iov.iov_len = len;
+	return storage_writer_pushv(writer, &iov, 1, flags);
+}
+
+static void storage_writer_sync(storage_writer_t *writer) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	if (fdatasync(writer->fd) != 0) {
+		printf("storage: fdatasync failed: %s\n", strerror(errno));
+		writer->errors++;
+	}
+	RK_U64 cost = TEST_COMM_GetNowUs() - begin;
+	writer->sync_us += cost;
+	if (cost > writer->sync_worst_us)
+		writer->sync_worst_us = cost;
+	writer->syncs++;
+	writer->unsynced_blocks = 0;
+	writer->unsynced_since_us = 0;
+	if (!writer->direct)
+		posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+/* len is a multiple of 4096 for O_DIRECT */
+static void storage_writer_write(storage_writer_t *writer, RK_U32 len) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	ssize_t ret = pwrite(writer->fd, writer->block, len, writer->seg_written);
+	RK_U64 cost = TEST_COMM_GetNowUs() - begin;
+
+	if (ret != (ssize_t)len) {
+		printf("storage: write failed: %s\n", ret < 0 ? strerror(errno) : "short write");
+		writer->errors++;
+	}
+	writer->write_us += cost;
+	if (cost > writer->write_worst_us)
+		writer->write_worst_us = cost;
+	writer->blocks++;
+	writer->unsynced_blocks++;
+	if (!writer->unsynced_since_us)
+		writer->unsynced_since_us = begin;
+}
+
+static void storage_writer_close_segment(storage_writer_t *writer) {
+	if (writer->fd < 0)
+		return;
+	RK_U64 length = writer->seg_written + writer->block_fill;
+	if (writer->block_fill) {
+		// O_DIRECT wants whole sectors: pad, then cut the file back to the real length
+		RK_U32 padded = STORAGE_ALIGN4K(writer->block_fill);
+		memset(writer->block + writer->block_fill, 0, padded - writer->block_fill);
+		storage_writer_write(writer, padded);
+		writer->block_fill = 0;
+	}
+	if (ftruncate(writer->fd, length) != 0) {
+		printf("storage: ftruncate failed: %s\n", strerror(errno));
+		writer->errors++;
+	}
+	storage_writer_sync(writer);
+	close(writer->fd);
+	writer->fd = -1;
+	writer->seg_written = 0;
+}
+
+static int storage_writer_open_segment(storage_writer_t *writer) {
+	char stamp[32];
+	time_t now = time(NULL);
+	struct tm tm;
+	RK_U32 slot = writer->seg_index % STORAGE_WRITER_MAX_SEGMENTS;
+	char *path = writer->seg_names[slot];
+
+	// the oldest file leaves before its name slot is reused
+	if (writer->cfg.max_segments && writer->seg_index >= writer->cfg.max_segments) {
+		char *oldest = writer->seg_names[(writer->seg_index - writer->cfg.max_segments) % STORAGE_WRITER_MAX_SEGMENTS];
+		if (oldest[0] && unlink(oldest) != 0)
+			printf("storage: unlink %s failed: %s\n", oldest, strerror(errno));
+		oldest[0] = 0;
+	}
+	localtime_r(&now, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &tm);
+	snprintf(path, sizeof(writer->seg_names[0]), "%s/%s_%s_%u%s", writer->cfg.dir, writer->cfg.prefix, stamp,
+	         writer->seg_index, writer->cfg.suffix);
+	writer->seg_index++;
+
+	writer->direct = true;
+	writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+	if (writer->fd < 0 && errno == EINVAL) {
+		// tmpfs and some FUSE mounts: buffered, the thread still keeps the pipeline out of it
+		writer->direct = false;
+		writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	if (writer->fd < 0) {
+		printf("storage: open %s failed: %s\n", path, strerror(errno));
+		writer->errors++;
+		return -1;
+	}
+	if (fallocate(writer->fd, 0, 0, writer->cfg.segment_bytes) != 0)
+		printf("storage: fallocate %s failed: %s\n", path, strerror(errno));
+	writer->segments++;
+	printf("storage: %s (%s)\n", path, writer->direct ? "direct" : "buffered");
+	return 0;
+}
+
+static void storage_writer_consume(storage_writer_t *writer, const uint8_t *data, RK_U32 len, RK_U32 flags) {
+	if (!writer->cfg.dir)
+		return;
+	// new file at a sync point once the segment is mostly full, so files start decodable
+	if ((flags & STORAGE_WRITER_SYNC_POINT) && writer->fd >= 0 &&
+	    writer->seg_written + writer->block_fill >= writer->cfg.segment_bytes / 4 * 3)
+		storage_writer_close_segment(writer);
+	if (writer->fd < 0 && storage_writer_open_segment(writer) != 0)
+		return;
+
+	writer->bytes += len;
+	while (len) {
+		RK_U32 n = writer->cfg.block_bytes - writer->block_fill;
+		if (n > len)
+			n = len;
+		memcpy(writer->block + writer->block_fill, data, n);
+		writer->block_fill += n;
+		data += n;
+		len -= n;
+		if (writer->block_fill == writer->cfg.block_bytes) {
+			storage_writer_write(writer, writer->block_fill);
+			writer->seg_written += writer->block_fill;
+			writer->block_fill = 0;
+			// no sync point came in time, cut mid-stream
+			if (writer->seg_written >= writer->cfg.segment_bytes) {
+				storage_writer_close_segment(writer);
+				if (len && storage_writer_open_segment(writer) != 0)
+					return;
+			}
+		}
+	}
+}
+
+/* everything queued so far, returns the number of items */
+static int storage_writer_drain(storage_writer_t *writer) {
+	RK_U32 mask = writer->cfg.queue_bytes - 1;
+	RK_U32 tail = writer->tail.load(std::memory_order_relaxed);
+	RK_U32 head = writer->head.load(std::memory_order_acquire);
+	int items = 0;
+
+	while (tail != head) {
+		const storage_item_t *item = (const storage_item_t *)(writer->queue + (tail & mask));
+		if (!(item->flags & STORAGE_WRITER_PAD)) {
+			storage_writer_consume(writer, (const uint8_t *)(item + 1), item->len, item->flags);
+			items++;
+		}
+		tail += sizeof(storage_item_t) + STORAGE_ALIGN8(item->len);
+		writer->tail.store(tail, std::memory_order_release);
+	}
+	return items;
+}
+
+static void *storage_writer_thread(void *arg) {
+	storage_writer_t *writer = (storage_writer_t *)arg;
+
+	while (!writer->quit) {
+		int items = storage_writer_drain(writer);
+		RK_U64 now = TEST_COMM_GetNowUs();
+		if (writer->unsynced_blocks && (writer->unsynced_blocks >= writer->cfg.sync_blocks ||
+		                                now - writer->unsynced_since_us >= writer->cfg.sync_ms * 1000ULL))
+			storage_writer_sync(writer);
+		if (writer->cfg.idle && now >= writer->next_idle_us) {
+			writer->cfg.idle(writer->cfg.idle_arg);
+			writer->next_idle_us = now + writer->cfg.idle_ms * 1000ULL;
+		}
+		if (!items)
+			usleep(STORAGE_WRITER_NAP_US);
+	}
+	storage_writer_drain(writer);
+	storage_writer_close_segment(writer);
+	if (writer->cfg.idle)
+		writer->cfg.idle(writer->cfg.idle_arg);
+	return NULL;
+}
+
+int storage_writer_start(storage_writer_t *writer, const storage_writer_cfg_t *cfg) {
+	writer->cfg = *cfg;
+	writer->head.store(0, std::memory_order_relaxed);
+	writer->tail.store(0, std::memory_order_relaxed);
+	writer->queue_max.store(0, std::memory_order_relaxed);
+	writer->dropped.store(0, std::memory_order_relaxed);
+	writer->dropped_bytes.store(0, std::memory_order_relaxed);
+	writer->thread_running = false;
+	writer->quit = false;
+	writer->block_fill = 0;
+	writer->fd = -1;
+	writer->direct = false;
+	writer->seg_written = 0;
+	writer->seg_index = 0;
+	memset(writer->seg_names, 0, sizeof(writer->seg_names));
+	writer->unsynced_blocks = 0;
+	writer->unsynced_since_us = 0;
+	writer->next_idle_us = 0;
+	writer->bytes = writer->write_us = writer->write_worst_us = 0;
+	writer->sync_us = writer->sync_worst_us = 0;
+	writer->blocks = writer->syncs = writer->segments = writer->errors = 0;
+	writer->block = NULL;
+
+	RK_U32 block = writer->cfg.block_bytes;
+	if (block == 0 || block % STORAGE_WRITER_ALIGN)
+		writer->cfg.block_bytes = STORAGE_ALIGN4K(block ? block : 256 * 1024);
+	if (writer->cfg.queue_bytes & (writer->cfg.queue_bytes - 1) || writer->cfg.queue_bytes < 64 * 1024)
+		writer->cfg.queue_bytes = 4 << 20;
+	if (writer->cfg.max_segments > STORAGE_WRITER_MAX_SEGMENTS)
+		writer->cfg.max_segments = STORAGE_WRITER_MAX_SEGMENTS;
+	if (writer->cfg.segment_bytes < writer->cfg.block_bytes)
+		writer->cfg.segment_bytes = writer->cfg.block_bytes;
+
+	writer->queue = (uint8_t *)malloc(writer->cfg.queue_bytes);
+	if (!writer->queue || posix_memalign((void **)&writer->block, STORAGE_WRITER_ALIGN, writer->cfg.block_bytes)) {
+		printf("storage: buffer alloc failed\n");
+		writer->block = NULL;
+		storage_writer_stop(writer);
+		return -1;
+	}
+	if (rt_sched_thread_create(&writer->thread, RT_STAGE_STORAGE, storage_writer_thread, writer) != 0) {
+		storage_writer_stop(writer);
+		return -1;
+	}
+	writer->thread_running = true;
+	printf("storage: %s, %uKB queue, %uKB blocks, %lluMB segments\n", writer->cfg.dir ? writer->cfg.dir : "no files",
+	       writer->cfg.queue_bytes / 1024, writer->cfg.block_bytes / 1024,
+	       (unsigned long long)(writer->cfg.segment_bytes >> 20));
+	return 0;
+}
+
+void storage_writer_dump_stats(storage_writer_t *writer) {
+	printf("storage: queue %uKB (max %uKB of %uKB), %u dropped (%lluKB), %lluKB in %u blocks, "
+	       "write avg %llu worst %llu us, %u syncs avg %llu worst %llu us, %u segments, %u errors\n",
+	       storage_writer_queue_depth(writer) / 1024,
+	       writer->queue_max.exchange(0, std::memory_order_relaxed) / 1024, writer->cfg.queue_bytes / 1024,
+	       writer->dropped.exchange(0, std::memory_order_relaxed),
+	       (unsigned long long)(writer->dropped_bytes.exchange(0, std::memory_order_relaxed) / 1024),
+	       (unsigned long long)(writer->bytes / 1024), writer->blocks,
+	       (unsigned long long)(writer->blocks ? writer->write_us / writer->blocks : 0),
+	       (unsigned long long)writer->write_worst_us, writer->syncs,
+	       (unsigned long long)(writer->syncs ? writer->sync_us / writer->syncs : 0),
+	       (unsigned long long)writer->sync_worst_us, writer->segments, writer->errors);
+	writer->bytes = 0;
+	writer->blocks = 0;
+	writer->write_us = 0;
+	writer->write_worst_us = 0;
+	writer->syncs = 0;
+	writer->sync_us = 0;
+	writer->sync_worst_us = 0;
+}
+
+void storage_writer_stop(storage_writer_t *writer) {
+	if (writer->thread_running) {
+		writer->quit = true;
+		pthread_join(writer->thread, NULL);
+		writer->thread_running = false;
+	}
+	free(writer->queue);
+	free(writer->block);
+	writer->queue = NULL;
+	writer->block = NULL;
+}
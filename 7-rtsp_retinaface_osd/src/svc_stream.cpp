@@ -0,0 +1,196 @@
+/*****************************************************************************
+* | Function    :   Temporal SVC layer parsing and per-session layer caps
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "svc_stream.h"
+
+#define SVC_ADAPT_WINDOW 30			// forwarded frames per adaptation step
+#define SVC_SLOW_SEND_US 10000		// a send blocking longer than this counts as congestion
+#define SVC_SLOW_LIMIT 3			// slow sends per window before dropping a layer
+#define SVC_UPGRADE_WINDOWS 3		// clean windows before adding a layer back
+
+static int svc_add_client(svc_stream_t *svc, rtsp_demo_handle demo, const char *path, int max_layer,
+                          bool adaptive, RK_CODEC_ID_E codec) {
+	svc_client_t *client = &svc->clients[svc->client_count];
+
+	memset(client, 0, sizeof(*client));
+	snprintf(client->path, sizeof(client->path), "%s", path);
+	client->session = rtsp_new_session(demo, client->path);
+	if (client->session == NULL) {
+		printf("svc: rtsp session %s fail\n", client->path);
+		return -1;
+	}
+	rtsp_set_video(client->session,
+	               codec == RK_VIDEO_ID_HEVC ? RTSP_CODEC_ID_VIDEO_H265 : RTSP_CODEC_ID_VIDEO_H264, NULL, 0);
+	client->max_layer = max_layer;
+	client->adaptive = adaptive;
+	svc->client_count++;
+	printf("svc: %s layers 0..%d%s\n", client->path, max_layer, adaptive ? " (adaptive)" : "");
+	return 0;
+}
+
+int svc_stream_init(svc_stream_t *svc, rtsp_demo_handle demo, const char *base_path, int layers,
+                    RK_CODEC_ID_E codec) {
+	char path[64];
+
+	memset(svc, 0, sizeof(*svc));
+	if (layers < 2 || layers > SVC_MAX_LAYERS) {
+		printf("svc: %d layers not supported\n", layers);
+		return -1;
+	}
+	svc->layers = layers;
+	svc->hevc = codec == RK_VIDEO_ID_HEVC;
+	svc->cur_pts = (RK_U64)-1;
+
+	for (int i = 0; i < layers - 1; i++) {
+		snprintf(path, sizeof(path), "%s/t%d", base_path, i);
+		if (svc_add_client(svc, demo, path, i, false, codec) != 0)
+			return -1;
+	}
+	snprintf(path, sizeof(path), "%s/auto", base_path);
+	return svc_add_client(svc, demo, path, layers - 1, true, codec);
+}
+
+void svc_stream_sync_ts(svc_stream_t *svc, uint64_t ts, uint64_t ntptime) {
+	for (int i = 0; i < svc->client_count; i++)
+		rtsp_sync_video_ts(svc->clients[i].session, ts, ntptime);
+}
+
+int svc_temporal_id(const uint8_t *data, RK_U32 len, bool hevc, bool *idr) {
+	int tid = -1;
+
+	for (RK_U32 i = 0; i + 3 < len; i++) {
+		// 00 00 01 start code, the 4-byte form ends with the same three bytes
+		if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+			continue;
+		const uint8_t *nal = data + i + 3;
+		RK_U32 left = len - i - 3;
+		if (hevc) {
+			if (left < 2)
+				break;
+			int type = (nal[0] >> 1) & 0x3f;
+			if (type == 19 || type == 20)
+				*idr = true;
+			// nuh_temporal_id_plus1 is in every NAL header
+			if (type < 32)
+				return (nal[1] & 0x07) - 1;
+		} else {
+			int type = nal[0] & 0x1f;
+			if (type == 5)
+				*idr = true;
+			// prefix NAL (14) / coded slice extension (20): nal_unit_header_svc_extension
+			if ((type == 14 || type == 20) && left >= 4 && (nal[1] & 0x80))
+				tid = nal[3] >> 5;
+			if (type == 1 || type == 5)
+				return tid;
+		}
+		i += 2;
+	}
+	return tid;
+}
+
+/* TSVC reference pattern: period 2^(layers-1), e.g. 3 layers -> 0 2 1 2 */
+static int svc_pattern_layer(RK_U32 gop_pos, int layers) {
+	RK_U32 period = 1u << (layers - 1);
+	RK_U32 pos = gop_pos % period;
+	if (pos == 0)
+		return 0;
+	int tid = layers - 1;
+	while ((pos & 1) == 0 && tid > 0) {
+		pos >>= 1;
+		tid--;
+	}
+	return tid;
+}
+
+static void svc_adapt(svc_stream_t *svc, svc_client_t *client, bool slow) {
+	client->window_frames++;
+	if (slow)
+		client->window_slow++;
+	if (client->window_frames < SVC_ADAPT_WINDOW)
+		return;
+
+	if (client->window_slow > SVC_SLOW_LIMIT) {
+		client->good_windows = 0;
+		if (client->max_layer > 0) {
+			client->max_layer--;
+			printf("svc: %s congested, layers 0..%d\n", client->path, client->max_layer);
+		}
+	} else if (client->window_slow == 0 && ++client->good_windows >= SVC_UPGRADE_WINDOWS) {
+		client->good_windows = 0;
+		if (client->max_layer < svc->layers - 1) {
+			client->max_layer++;
+			printf("svc: %s recovered, layers 0..%d\n", client->path, client->max_layer);
+		}
+	}
+	client->window_frames = 0;
+	client->window_slow = 0;
+}
+
+void svc_stream_sink(const venc_au_t *au, void *arg) {
+	svc_stream_t *svc = (svc_stream_t *)arg;
+
+	// decide once per frame, on its first slice
+	if (au->pts != svc->cur_pts) {
+		bool idr = false;
+		int tid = -1;
+		for (RK_U32 i = 0; i < au->pack_count && tid < 0; i++)
+			tid = svc_temporal_id(au->packs[i].data, au->packs[i].len, svc->hevc, &idr);
+		if (idr)
+			svc->gop_pos = 0;
+		if (tid >= 0) {
+			svc->parsed_frames++;
+		} else {
+			tid = svc_pattern_layer(svc->gop_pos, svc->layers);
+			svc->pattern_frames++;
+		}
+		if (tid >= svc->layers)
+			tid = svc->layers - 1;
+		svc->gop_pos++;
+		svc->cur_pts = au->pts;
+		svc->cur_layer = tid;
+		svc->layer_frames[tid]++;
+	}
+
+	for (int c = 0; c < svc->client_count; c++) {
+		svc_client_t *client = &svc->clients[c];
+		if (svc->cur_layer > client->max_layer) {
+			if (au->frame_end)
+				client->dropped++;
+			continue;
+		}
+		RK_U64 begin = TEST_COMM_GetNowUs();
+		bool failed = false;
+		for (RK_U32 i = 0; i < au->pack_count; i++)
+			if (rtsp_tx_video(client->session, au->packs[i].data, au->packs[i].len, au->pts) < 0)
+				failed = true;
+		if (!au->frame_end)
+			continue;
+		client->sent++;
+		if (client->adaptive)
+			svc_adapt(svc, client, failed || TEST_COMM_GetNowUs() - begin > SVC_SLOW_SEND_US);
+	}
+}
+
+void svc_stream_dump_stats(svc_stream_t *svc) {
+	printf("svc: %d layers, frames per layer", svc->layers);
+	for (int i = 0; i < svc->layers; i++)
+		printf(" %u", svc->layer_frames[i]);
+	printf(" (parsed %u, pattern %u)\n", svc->parsed_frames, svc->pattern_frames);
+	for (int c = 0; c < svc->client_count; c++) {
+		svc_client_t *client = &svc->clients[c];
+		printf("  %s: layers 0..%d, sent %u, dropped %u\n", client->path, client->max_layer, client->sent,
+		       client->dropped);
+	}
+}
+
+void svc_stream_deinit(svc_stream_t *svc) {
+	for (int c = 0; c < svc->client_count; c++) {
+		if (svc->clients[c].session)
+			rtsp_del_session(svc->clients[c].session);
+		svc->clients[c].session = NULL;
+	}
+	svc->client_count = 0;
+}
@@ -0,0 +1,140 @@
+/*****************************************************************************
+* | Function    :   Greedy IoU multi object tracker
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "tracker.h"
+
+#define TRACKER_MAX_DETS 128
+#define TRACKER_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+void tracker_cfg_default(tracker_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->iou_min = 0.3f;
+	cfg->min_hits = 2;
+	cfg->max_misses = 5;
+}
+
+void tracker_init(tracker_t *tracker, const tracker_cfg_t *cfg) {
+	memset(tracker, 0, sizeof(*tracker));
+	tracker->cfg = *cfg;
+	tracker->next_id = 1;
+}
+
+static float tracker_iou(const RECT_S *a, const RECT_S *b) {
+	RK_S32 x0 = RK_MAX(a->s32X, b->s32X);
+	RK_S32 y0 = RK_MAX(a->s32Y, b->s32Y);
+	RK_S32 x1 = TRACKER_MIN(a->s32X + (RK_S32)a->u32Width, b->s32X + (RK_S32)b->u32Width);
+	RK_S32 y1 = TRACKER_MIN(a->s32Y + (RK_S32)a->u32Height, b->s32Y + (RK_S32)b->u32Height);
+	if (x1 <= x0 || y1 <= y0)
+		return 0.0f;
+	float inter = (float)(x1 - x0) * (y1 - y0);
+	float uni = (float)a->u32Width * a->u32Height + (float)b->u32Width * b->u32Height - inter;
+	return uni > 0 ? inter / uni : 0.0f;
+}
+
+static void tracker_end(tracker_t *tracker, track_t *t) {
+	if (t->confirmed && tracker->cfg.on_end)
+		tracker->cfg.on_end(t, tracker->cfg.cb_arg);
+	if (t->confirmed)
+		tracker->ended++;
+	memset(t, 0, sizeof(*t));
+}
+
+int tracker_update(tracker_t *tracker, const tracker_det_t *dets, int count, RK_U64 pts) {
+	bool det_used[TRACKER_MAX_DETS];
+	bool trk_used[TRACKER_MAX_TRACKS];
+	int active = 0;
+
+	if (count > TRACKER_MAX_DETS)
+		count = TRACKER_MAX_DETS;
+	memset(det_used, 0, sizeof(det_used));
+	memset(trk_used, 0, sizeof(trk_used));
+	tracker->pts = pts;
+
+	// greedy: take the best remaining pair until nothing overlaps enough
+	for (;;) {
+		float best = tracker->cfg.iou_min;
+		int best_t = -1, best_d = -1;
+		for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+			if (!tracker->tracks[t].id || trk_used[t])
+				continue;
+			for (int d = 0; d < count; d++) {
+				if (det_used[d] || dets[d].cls != tracker->tracks[t].cls)
+					continue;
+				float iou = tracker_iou(&tracker->tracks[t].box, &dets[d].box);
+				if (iou >= best) {
+					best = iou;
+					best_t = t;
+					best_d = d;
+				}
+			}
+		}
+		if (best_t < 0)
+			break;
+		track_t *trk = &tracker->tracks[best_t];
+		trk->box = dets[best_d].box;
+		trk->score = dets[best_d].score;
+		trk->det_index = dets[best_d].index;
+		trk->hits++;
+		trk->misses = 0;
+		trk->last_pts = pts;
+		trk->confirmed |= trk->hits >= tracker->cfg.min_hits;
+		trk_used[best_t] = true;
+		det_used[best_d] = true;
+	}
+
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		track_t *trk = &tracker->tracks[t];
+		if (!trk->id || trk_used[t])
+			continue;
+		trk->det_index = -1;
+		if (++trk->misses > tracker->cfg.max_misses)
+			tracker_end(tracker, trk);
+	}
+
+	for (int d = 0; d < count; d++) {
+		if (det_used[d])
+			continue;
+		int t = 0;
+		while (t < TRACKER_MAX_TRACKS && tracker->tracks[t].id)
+			t++;
+		if (t == TRACKER_MAX_TRACKS) {
+			tracker->dropped++;
+			continue;
+		}
+		track_t *trk = &tracker->tracks[t];
+		trk->id = tracker->next_id++;
+		if (tracker->next_id == 0)
+			tracker->next_id = 1;
+		trk->cls = dets[d].cls;
+		trk->box = dets[d].box;
+		trk->score = dets[d].score;
+		trk->det_index = dets[d].index;
+		trk->hits = 1;
+		trk->misses = 0;
+		trk->first_pts = pts;
+		trk->last_pts = pts;
+		trk->confirmed = tracker->cfg.min_hits <= 1;
+		tracker->created++;
+	}
+
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++)
+		active += tracker->tracks[t].id != 0;
+	return active;
+}
+
+void tracker_flush(tracker_t *tracker) {
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		if (tracker->tracks[t].id)
+			tracker_end(tracker, &tracker->tracks[t]);
+	}
+}
+
+POINT_S tracker_anchor(const RECT_S *box, bool bottom) {
+	POINT_S p;
+	p.s32X = box->s32X + (RK_S32)box->u32Width / 2;
+	p.s32Y = box->s32Y + (RK_S32)(bottom ? box->u32Height : box->u32Height / 2);
+	return p;
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+* | Function    :   Multi-pack VENC stream reader with scatter-gather sinks
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "venc_stream.h"
+
+int venc_stream_reader_init(venc_stream_reader_t *reader, int chn) {
+	memset(reader, 0, sizeof(*reader));
+	reader->chn = chn;
+	reader->au.chn = chn;
+	reader->stream.pstPack = reader->packs;
+	return 0;
+}
+
+int venc_stream_add_sink(venc_stream_reader_t *reader, venc_sink_cb cb, void *arg) {
+	if (reader->sink_count >= VENC_STREAM_MAX_SINKS) {
+		printf("venc_stream: too many sinks on chn %d\n", reader->chn);
+		return -1;
+	}
+	reader->sinks[reader->sink_count].cb = cb;
+	reader->sinks[reader->sink_count].arg = arg;
+	reader->sink_count++;
+	return 0;
+}
+
+RK_S32 venc_stream_read(venc_stream_reader_t *reader, RK_S32 timeout_ms) {
+	VENC_CHN_STATUS_S stStatus;
+	venc_au_t *au = &reader->au;
+	RK_S32 s32Ret;
+
+	bool overflow = RK_MPI_VENC_QueryStatus(reader->chn, &stStatus) == RK_SUCCESS &&
+	                stStatus.u32CurPacks > VENC_STREAM_MAX_PACKS;
+
+	// capacity in, actual pack count out
+	reader->stream.pstPack = reader->packs;
+	reader->stream.u32PackCount = VENC_STREAM_MAX_PACKS;
+	s32Ret = RK_MPI_VENC_GetStream(reader->chn, &reader->stream, timeout_ms);
+	if (s32Ret != RK_SUCCESS)
+		return s32Ret;
+
+	RK_U64 pts = reader->stream.u32PackCount ? reader->packs[0].u64PTS : 0;
+	if (overflow) {
+		// a truncated frame corrupts every decoder downstream: drop it whole, restart from an IDR
+		reader->overflow_frames++;
+		reader->dropping = true;
+		reader->drop_pts = pts;
+		reader->resync = true;
+		RK_MPI_VENC_RequestIDR(reader->chn, RK_TRUE);
+	} else if (reader->dropping && pts != reader->drop_pts) {
+		reader->dropping = false;
+	}
+	if (reader->dropping) {
+		// slices of a dropped frame share its pts and go with it
+		reader->dropped_streams++;
+		goto release;
+	}
+
+	au->seq = reader->stream.u32Seq;
+	au->pack_count = 0;
+	au->total_len = 0;
+	au->frame_end = true;
+	for (RK_U32 i = 0; i < reader->stream.u32PackCount && i < VENC_STREAM_MAX_PACKS; i++) {
+		VENC_PACK_S *pack = &reader->packs[i];
+		uint8_t *base = (uint8_t *)RK_MPI_MB_Handle2VirAddr(pack->pMbBlk);
+		if (base == RK_NULL || pack->u32Len == 0)
+			continue;
+		if (au->pack_count == 0)
+			au->pts = pack->u64PTS;
+		au->packs[au->pack_count].data = base + pack->u32Offset;
+		au->packs[au->pack_count].len = pack->u32Len;
+		au->total_len += pack->u32Len;
+		au->frame_end = pack->bFrameEnd ? true : false;
+		au->pack_count++;
+	}
+
+	reader->frames++;
+	if (au->pack_count > 1)
+		reader->multi_pack_frames++;
+
+	if (au->pack_count > 0) {
+		au->after_drop = reader->resync;
+		reader->resync = false;
+		for (int i = 0; i < reader->sink_count; i++)
+			reader->sinks[i].cb(au, reader->sinks[i].arg);
+	}
+
+release:
+	s32Ret = RK_MPI_VENC_ReleaseStream(reader->chn, &reader->stream);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VENC_ReleaseStream fail %x", s32Ret);
+	}
+	return RK_SUCCESS;
+}
+
+void venc_stream_dump_stats(venc_stream_reader_t *reader) {
+	printf("venc_stream: chn %d frames=%u multi_pack=%u overflow=%u dropped=%u\n", reader->chn,
+	       reader->frames, reader->multi_pack_frames, reader->overflow_frames, reader->dropped_streams);
+}
@@ -0,0 +1,212 @@
+/*****************************************************************************
+* | Function    :   VPSS group with several hardware scaled outputs
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "vpss_node.h"
+
+RK_U32 vpss_node_frame_size(RK_U32 width, RK_U32 height, PIXEL_FORMAT_E format) {
+	switch (format) {
+	case RK_FMT_RGB888:
+	case RK_FMT_BGR888:
+		return width * height * 3;
+	case RK_FMT_YUV420SP:
+	default:
+		return width * height * 3 / 2;
+	}
+}
+
+RK_U64 vpss_node_pool_bytes(const vpss_node_t *node) {
+	RK_U64 bytes = 0;
+	for (int i = 0; i < node->output_count; i++) {
+		const vpss_output_cfg_t *out = &node->outputs[i];
+		bytes += (RK_U64)vpss_node_frame_size(out->width, out->height, out->format) * out->pool_blk_cnt;
+	}
+	return bytes;
+}
+
+static int vpss_node_setup_output(vpss_node_t *node, int i) {
+	const vpss_output_cfg_t *out = &node->outputs[i];
+	VPSS_CHN_ATTR_S stChnAttr;
+	RK_S32 s32Ret;
+
+	memset(&stChnAttr, 0, sizeof(stChnAttr));
+	stChnAttr.enChnMode = VPSS_CHN_MODE_USER;
+	stChnAttr.enDynamicRange = DYNAMIC_RANGE_SDR8;
+	stChnAttr.enPixelFormat = out->format;
+	stChnAttr.enCompressMode = COMPRESS_MODE_NONE;
+	stChnAttr.stFrameRate.s32SrcFrameRate = -1;
+	stChnAttr.stFrameRate.s32DstFrameRate = -1;
+	stChnAttr.u32Width = out->width;
+	stChnAttr.u32Height = out->height;
+	stChnAttr.u32Depth = out->depth;
+	stChnAttr.u32FrameBufCnt = out->pool_blk_cnt ? out->pool_blk_cnt : 2;
+	s32Ret = RK_MPI_VPSS_SetChnAttr(node->grp, i, &stChnAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VPSS_SetChnAttr %s fail %x", out->name, s32Ret);
+		return -1;
+	}
+
+	if (out->crop.u32Width > 0) {
+		VPSS_CROP_INFO_S stCrop;
+		memset(&stCrop, 0, sizeof(stCrop));
+		stCrop.bEnable = RK_TRUE;
+		stCrop.enCropCoordinate = VPSS_CROP_ABS_COOR;
+		stCrop.stCropRect = out->crop;
+		s32Ret = RK_MPI_VPSS_SetChnCrop(node->grp, i, &stCrop);
+		if (s32Ret != RK_SUCCESS) {
+			RK_LOGE("RK_MPI_VPSS_SetChnCrop %s fail %x", out->name, s32Ret);
+			return -1;
+		}
+	}
+
+	if (out->rotation != ROTATION_0) {
+		s32Ret = RK_MPI_VPSS_SetChnRotation(node->grp, i, out->rotation);
+		if (s32Ret != RK_SUCCESS) {
+			RK_LOGE("RK_MPI_VPSS_SetChnRotation %s fail %x", out->name, s32Ret);
+			return -1;
+		}
+	}
+
+	if (out->pool_blk_cnt > 0) {
+		MB_POOL_CONFIG_S stPoolCfg;
+		memset(&stPoolCfg, 0, sizeof(stPoolCfg));
+		stPoolCfg.u64MBSize = vpss_node_frame_size(out->width, out->height, out->format);
+		stPoolCfg.u32MBCnt = out->pool_blk_cnt;
+		stPoolCfg.enAllocType = MB_ALLOC_TYPE_DMA;
+		stPoolCfg.enRemapMode = MB_REMAP_MODE_CACHED;
+		stPoolCfg.bPreAlloc = RK_TRUE;
+		node->pools[i] = RK_MPI_MB_CreatePool(&stPoolCfg);
+		if (node->pools[i] == MB_INVALID_POOLID) {
+			RK_LOGE("RK_MPI_MB_CreatePool %s fail", out->name);
+			return -1;
+		}
+		s32Ret = RK_MPI_VPSS_AttachMbPool(node->grp, i, node->pools[i]);
+		if (s32Ret != RK_SUCCESS) {
+			RK_LOGE("RK_MPI_VPSS_AttachMbPool %s fail %x", out->name, s32Ret);
+			return -1;
+		}
+	}
+
+	s32Ret = RK_MPI_VPSS_EnableChn(node->grp, i);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VPSS_EnableChn %s fail %x", out->name, s32Ret);
+		return -1;
+	}
+	printf("vpss grp %d chn %d: %s %ux%u fmt %d\n", node->grp, i, out->name, out->width, out->height,
+	       out->format);
+	return 0;
+}
+
+int vpss_node_create(vpss_node_t *node, int grp, RK_U32 in_width, RK_U32 in_height,
+                     const vpss_output_cfg_t *outputs, int output_count) {
+	printf("========%s========\n", __func__);
+	VPSS_GRP_ATTR_S stGrpAttr;
+	RK_S32 s32Ret;
+
+	memset(node, 0, sizeof(*node));
+	node->grp = grp;
+	node->in_width = in_width;
+	node->in_height = in_height;
+	for (int i = 0; i < VPSS_NODE_MAX_OUTPUTS; i++) {
+		node->pools[i] = MB_INVALID_POOLID;
+		node->fds[i] = -1;
+	}
+	if (output_count < 1 || output_count > VPSS_NODE_MAX_OUTPUTS) {
+		printf("vpss_node: %d outputs not supported\n", output_count);
+		return -1;
+	}
+	node->output_count = output_count;
+	memcpy(node->outputs, outputs, output_count * sizeof(vpss_output_cfg_t));
+
+	memset(&stGrpAttr, 0, sizeof(stGrpAttr));
+	stGrpAttr.u32MaxW = in_width;
+	stGrpAttr.u32MaxH = in_height;
+	stGrpAttr.enPixelFormat = RK_FMT_YUV420SP;
+	stGrpAttr.enDynamicRange = DYNAMIC_RANGE_SDR8;
+	stGrpAttr.enCompressMode = COMPRESS_MODE_NONE;
+	stGrpAttr.stFrameRate.s32SrcFrameRate = -1;
+	stGrpAttr.stFrameRate.s32DstFrameRate = -1;
+	s32Ret = RK_MPI_VPSS_CreateGrp(grp, &stGrpAttr);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VPSS_CreateGrp %d fail %x", grp, s32Ret);
+		return -1;
+	}
+
+	for (int i = 0; i < output_count; i++) {
+		if (vpss_node_setup_output(node, i) != 0) {
+			vpss_node_destroy(node);
+			return -1;
+		}
+	}
+
+	s32Ret = RK_MPI_VPSS_StartGrp(grp);
+	if (s32Ret != RK_SUCCESS) {
+		RK_LOGE("RK_MPI_VPSS_StartGrp %d fail %x", grp, s32Ret);
+		vpss_node_destroy(node);
+		return -1;
+	}
+	return 0;
+}
+
+int vpss_node_bind_vi(vpss_node_t *node, int vi_dev, int vi_chn) {
+	MPP_CHN_S stDstChn;
+
+	node->src_chn.enModId = RK_ID_VI;
+	node->src_chn.s32DevId = vi_dev;
+	node->src_chn.s32ChnId = vi_chn;
+	stDstChn.enModId = RK_ID_VPSS;
+	stDstChn.s32DevId = node->grp;
+	stDstChn.s32ChnId = 0;
+	if (RK_MPI_SYS_Bind(&node->src_chn, &stDstChn) != RK_SUCCESS) {
+		RK_LOGE("bind vi %d to vpss grp %d failed", vi_chn, node->grp);
+		return -1;
+	}
+	node->bound = true;
+	return 0;
+}
+
+RK_S32 vpss_node_send_frame(vpss_node_t *node, const VIDEO_FRAME_INFO_S *frame, RK_S32 timeout_ms) {
+	return RK_MPI_VPSS_SendFrame(node->grp, 0, frame, timeout_ms);
+}
+
+int vpss_node_get_fd(vpss_node_t *node, int output) {
+	if (node->fds[output] < 0)
+		node->fds[output] = RK_MPI_VPSS_GetChnFd(node->grp, output);
+	return node->fds[output];
+}
+
+RK_S32 vpss_node_get_frame(vpss_node_t *node, int output, VIDEO_FRAME_INFO_S *frame, RK_S32 timeout_ms) {
+	return RK_MPI_VPSS_GetChnFrame(node->grp, output, frame, timeout_ms);
+}
+
+RK_S32 vpss_node_release_frame(vpss_node_t *node, int output, VIDEO_FRAME_INFO_S *frame) {
+	return RK_MPI_VPSS_ReleaseChnFrame(node->grp, output, frame);
+}
+
+void vpss_node_destroy(vpss_node_t *node) {
+	MPP_CHN_S stDstChn;
+
+	if (node->bound) {
+		stDstChn.enModId = RK_ID_VPSS;
+		stDstChn.s32DevId = node->grp;
+		stDstChn.s32ChnId = 0;
+		RK_MPI_SYS_UnBind(&node->src_chn, &stDstChn);
+		node->bound = false;
+	}
+	RK_MPI_VPSS_StopGrp(node->grp);
+	for (int i = 0; i < node->output_count; i++) {
+		if (node->fds[i] >= 0) {
+			RK_MPI_VPSS_CloseFd(node->grp, i);
+			node->fds[i] = -1;
+		}
+		RK_MPI_VPSS_DisableChn(node->grp, i);
+		if (node->pools[i] != MB_INVALID_POOLID) {
+			RK_MPI_VPSS_DetachMbPool(node->grp, i);
+			RK_MPI_MB_DestroyPool(node->pools[i]);
+			node->pools[i] = MB_INVALID_POOLID;
+		}
+	}
+	RK_MPI_VPSS_DestroyGrp(node->grp);
+}
@@ -0,0 +1,261 @@
+/*****************************************************************************
+* | Function    :   Zone intrusion and tripwire events on tracked objects
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "zone_analytics.h"
+
+void zone_cfg_default(zone_cfg_t *cfg, RK_U32 width, RK_U32 height) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->width = width;
+	cfg->height = height;
+	cfg->cell = 8;
+	cfg->enter_frames = 2;
+	cfg->exit_frames = 3;
+	cfg->cross_frames = 2;
+	cfg->anchor_bottom = false;
+}
+
+int zone_init(zone_analytics_t *za, const zone_cfg_t *cfg) {
+	memset(za, 0, sizeof(*za));
+	za->cfg = *cfg;
+	if (za->cfg.cell == 0)
+		za->cfg.cell = 8;
+	za->gw = (cfg->width + za->cfg.cell - 1) / za->cfg.cell;
+	za->gh = (cfg->height + za->cfg.cell - 1) / za->cfg.cell;
+	za->grid = (uint8_t *)calloc(za->gw * za->gh, 1);
+	if (!za->grid) {
+		printf("zone: grid alloc failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* even-odd rule */
+static bool zone_point_in_polygon(const zone_polygon_t *poly, RK_S32 x, RK_S32 y) {
+	bool in = false;
+	for (int i = 0, j = poly->count - 1; i < poly->count; j = i++) {
+		const POINT_S *a = &poly->points[i];
+		const POINT_S *b = &poly->points[j];
+		if ((a->s32Y > y) != (b->s32Y > y)) {
+			RK_S64 lhs = (RK_S64)(x - a->s32X) * (b->s32Y - a->s32Y);
+			RK_S64 rhs = (RK_S64)(b->s32X - a->s32X) * (y - a->s32Y);
+			// x < intersection, sign flipped when the edge goes up
+			if ((b->s32Y > a->s32Y) ? lhs < rhs : lhs > rhs)
+				in = !in;
+		}
+	}
+	return in;
+}
+
+int zone_add_polygon(zone_analytics_t *za, const char *name, const POINT_S *points, int count) {
+	if (za->zone_count >= ZONE_MAX_ZONES || count < 3 || count > ZONE_MAX_POINTS) {
+		printf("zone: can't add %s (%d zones, %d points)\n", name, za->zone_count, count);
+		return -1;
+	}
+	int index = za->zone_count++;
+	zone_polygon_t *poly = &za->zones[index];
+	snprintf(poly->name, sizeof(poly->name), "%s", name);
+	poly->count = count;
+	memcpy(poly->points, points, count * sizeof(POINT_S));
+
+	// rasterize once at cell centres, lookups are then O(1) per track
+	RK_U32 cells = 0;
+	for (RK_U32 gy = 0; gy < za->gh; gy++) {
+		for (RK_U32 gx = 0; gx < za->gw; gx++) {
+			RK_S32 x = gx * za->cfg.cell + za->cfg.cell / 2;
+			RK_S32 y = gy * za->cfg.cell + za->cfg.cell / 2;
+			if (zone_point_in_polygon(poly, x, y)) {
+				za->grid[gy * za->gw + gx] |= 1 << index;
+				cells++;
+			}
+		}
+	}
+	printf("zone %d: %s, %d points, %u cells\n", index, poly->name, count, cells);
+	return index;
+}
+
+int zone_add_tripwire(zone_analytics_t *za, const char *name, POINT_S a, POINT_S b) {
+	if (za->wire_count >= ZONE_MAX_WIRES) {
+		printf("zone: can't add wire %s\n", name);
+		return -1;
+	}
+	int index = za->wire_count++;
+	zone_tripwire_t *wire = &za->wires[index];
+	snprintf(wire->name, sizeof(wire->name), "%s", name);
+	wire->a = a;
+	wire->b = b;
+	printf("wire %d: %s (%d,%d)-(%d,%d)\n", index, wire->name, a.s32X, a.s32Y, b.s32X, b.s32Y);
+	return index;
+}
+
+int zone_load_file(zone_analytics_t *za, const char *path) {
+	FILE *fp = fopen(path, "r");
+	char line[512];
+	int rules = 0;
+
+	if (!fp) {
+		printf("zone: open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		char kind[8], name[ZONE_NAME_LEN];
+		POINT_S points[ZONE_MAX_POINTS];
+		int count = 0, used = 0;
+
+		if (line[0] == '#' || sscanf(line, "%7s %15s %n", kind, name, &used) != 2)
+			continue;
+		const char *p = line + used;
+		int n = 0;
+		while (count < ZONE_MAX_POINTS &&
+		       sscanf(p, "%d,%d %n", &points[count].s32X, &points[count].s32Y, &n) == 2) {
+			count++;
+			p += n;
+		}
+		if (!strcmp(kind, "zone") && zone_add_polygon(za, name, points, count) >= 0)
+			rules++;
+		else if (!strcmp(kind, "wire") && count == 2 && zone_add_tripwire(za, name, points[0], points[1]) >= 0)
+			rules++;
+		else
+			printf("zone: bad rule in %s: %s", path, line);
+	}
+	fclose(fp);
+	return rules;
+}
+
+uint8_t zone_mask_at(const zone_analytics_t *za, RK_S32 x, RK_S32 y) {
+	if (x < 0 || y < 0 || (RK_U32)x >= za->cfg.width || (RK_U32)y >= za->cfg.height)
+		return 0;
+	return za->grid[(y / za->cfg.cell) * za->gw + x / za->cfg.cell];
+}
+
+static RK_S64 zone_orient(POINT_S a, POINT_S b, POINT_S p) {
+	return (RK_S64)(b.s32X - a.s32X) * (p.s32Y - a.s32Y) - (RK_S64)(b.s32Y - a.s32Y) * (p.s32X - a.s32X);
+}
+
+static int zone_sign(RK_S64 v) {
+	return (v > 0) - (v < 0);
+}
+
+/* proper or touching intersection of p0-p1 with a-b */
+static bool zone_segments_cross(POINT_S p0, POINT_S p1, POINT_S a, POINT_S b) {
+	int d1 = zone_sign(zone_orient(a, b, p0));
+	int d2 = zone_sign(zone_orient(a, b, p1));
+	int d3 = zone_sign(zone_orient(p0, p1, a));
+	int d4 = zone_sign(zone_orient(p0, p1, b));
+	return d1 != d2 && d3 != d4;
+}
+
+static void zone_emit(zone_analytics_t *za, zone_event_e type, int rule, const char *name, const track_t *trk,
+                      int direction, RK_U64 pts) {
+	zone_event_t ev;
+	ev.type = type;
+	ev.rule = rule;
+	ev.name = name;
+	ev.track_id = trk->id;
+	ev.cls = trk->cls;
+	ev.direction = direction;
+	ev.pts = pts;
+	za->events[type]++;
+	if (za->cfg.cb)
+		za->cfg.cb(&ev, za->cfg.cb_arg);
+}
+
+static void zone_update_zones(zone_analytics_t *za, zone_track_state_t *st, const track_t *trk, POINT_S p,
+                              RK_U64 pts) {
+	uint8_t mask = zone_mask_at(za, p.s32X, p.s32Y);
+	for (int z = 0; z < za->zone_count; z++) {
+		bool now_in = mask & (1 << z);
+		bool was_in = st->inside & (1 << z);
+		if (now_in == was_in) {
+			st->streak[z] = 0;
+			continue;
+		}
+		if (st->streak[z]++ == 0)
+			st->streak_pts[z] = pts;
+		if (st->streak[z] >= (now_in ? za->cfg.enter_frames : za->cfg.exit_frames)) {
+			st->inside ^= 1 << z;
+			st->streak[z] = 0;
+			zone_emit(za, now_in ? ZONE_EVENT_ENTER : ZONE_EVENT_EXIT, z, za->zones[z].name, trk, 0,
+			          st->streak_pts[z]);
+		}
+	}
+}
+
+static void zone_update_wires(zone_analytics_t *za, zone_track_state_t *st, const track_t *trk, POINT_S p,
+                              RK_U64 pts) {
+	for (int w = 0; w < za->wire_count; w++) {
+		const zone_tripwire_t *wire = &za->wires[w];
+		int side = zone_sign(zone_orient(wire->a, wire->b, p));
+
+		if (st->have_last && zone_segments_cross(st->last, p, wire->a, wire->b) && side != 0) {
+			if (side == st->side[w]) {
+				st->pending[w] = 0;	// went over and came back
+			} else {
+				st->pending[w] = side;
+				st->pending_frames[w] = 0;
+				st->pending_pts[w] = pts;
+			}
+		}
+		if (st->pending[w]) {
+			if (side != st->pending[w]) {
+				st->pending[w] = 0;
+			} else if (++st->pending_frames[w] >= za->cfg.cross_frames) {
+				st->side[w] = side;
+				st->pending[w] = 0;
+				zone_emit(za, ZONE_EVENT_CROSS, w, wire->name, trk, side, st->pending_pts[w]);
+			}
+		} else if (side != 0 && st->side[w] == 0) {
+			st->side[w] = side;
+		}
+	}
+}
+
+void zone_process(zone_analytics_t *za, const tracker_t *tracker) {
+	RK_U64 begin = TEST_COMM_GetNowUs();
+
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++) {
+		const track_t *trk = &tracker->tracks[t];
+		zone_track_state_t *st = &za->state[t];
+
+		if (st->track_id && st->track_id != trk->id) {
+			// track ended: close its zones at the last time it was seen
+			track_t gone;
+			memset(&gone, 0, sizeof(gone));
+			gone.id = st->track_id;
+			gone.cls = st->cls;
+			for (int z = 0; z < za->zone_count; z++) {
+				if (st->inside & (1 << z))
+					zone_emit(za, ZONE_EVENT_EXIT, z, za->zones[z].name, &gone, 0, st->last_pts);
+			}
+			memset(st, 0, sizeof(*st));
+		}
+		if (!trk->id || !trk->confirmed || trk->det_index < 0)
+			continue;
+
+		POINT_S p = tracker_anchor(&trk->box, za->cfg.anchor_bottom);
+		st->track_id = trk->id;
+		st->cls = trk->cls;
+		st->last_pts = tracker->pts;
+		zone_update_zones(za, st, trk, p, tracker->pts);
+		zone_update_wires(za, st, trk, p, tracker->pts);
+		st->last = p;
+		st->have_last = true;
+	}
+	za->cost_us += TEST_COMM_GetNowUs() - begin;
+	za->runs++;
+}
+
+void zone_dump_stats(zone_analytics_t *za) {
+	printf("zones: %d zones, %d wires, %u enter, %u exit, %u cross, %llu us/frame\n", za->zone_count,
+	       za->wire_count, za->events[ZONE_EVENT_ENTER], za->events[ZONE_EVENT_EXIT],
+	       za->events[ZONE_EVENT_CROSS], (unsigned long long)(za->runs ? za->cost_us / za->runs : 0));
+	za->cost_us = 0;
+	za->runs = 0;
+}
+
+void zone_deinit(zone_analytics_t *za) {
+	free(za->grid);
+	za->grid = NULL;
+}
@@ -0,0 +1,927 @@
+/*****************************************************************************
+* | Function    :   Fake MPI for the host tests: media blocks and pools,
+*                   VENC streams, VPSS groups and binds, IVS results; no VDEC or RGN, no VENC channels
+*
+******************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "rk_debug.h"
+#include "rk_mpi_mb.h"
+#include "rk_mpi_sys.h"
+#include "rk_mpi_vdec.h"
+#include "rk_mpi_rgn.h"
+#include "rk_mpi_ivs.h"
+#include "rk_mpi_venc.h"
+#include "rk_mpi_vpss.h"
+#include "fake_mpi.h"
+
+#define FAKE_MB_MAGIC 0x66616b65
+#define FAKE_MPI_MAX_POOLS 32
+
+typedef struct {
+	RK_U32 magic;
+	RK_U32 size;
+	int refs;
+	MB_POOL pool;				// MB_INVALID_POOLID: freed on the last release
+	uint8_t *data;
+} fake_mb_t;
+
+typedef struct {
+	bool used;
+	RK_U32 blk_size;
+	std::vector<fake_mb_t *> blocks;
+	std::vector<fake_mb_t *> free;
+} fake_pool_t;
+
+typedef struct {
+	std::deque<std::vector<VENC_PACK_S>> queued;
+	std::deque<std::vector<VENC_PACK_S>> got;
+	RK_U32 seq;
+	RK_U32 idr_requests;
+} fake_venc_chn_t;
+
+typedef struct {
+	fake_vpss_grp_t state;
+	std::deque<VIDEO_FRAME_INFO_S> frames[VPSS_MAX_CHN_NUM];
+} fake_vpss_t;
+
+typedef struct {
+	bool created;
+	std::deque<fake_ivs_result_t> queued;
+	std::deque<fake_ivs_result_t> ready;	// sent, waiting for GetResults()
+	RK_U32 sent;
+	RK_U32 outstanding;
+} fake_ivs_chn_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static fake_venc_chn_t g_venc[FAKE_MPI_MAX_CHN];
+static fake_vpss_t g_vpss[FAKE_MPI_MAX_CHN];
+static fake_ivs_chn_t g_ivs[FAKE_MPI_MAX_CHN];
+static fake_pool_t g_pools[FAKE_MPI_MAX_POOLS];
+static RK_U32 g_mb_live = 0;
+static std::string g_fail_call;
+static int g_fail_countdown = 0;
+
+// channels of groups never created must not look like open fd 0
+static struct FakeVpssInit {
+	FakeVpssInit() {
+		for (int g = 0; g < FAKE_MPI_MAX_CHN; g++) {
+			for (int c = 0; c < VPSS_MAX_CHN_NUM; c++) {
+				g_vpss[g].state.pool[c] = MB_INVALID_POOLID;
+				g_vpss[g].state.fd[c] = -1;
+			}
+		}
+	}
+} g_vpss_init;
+
+class FakeLock {
+public:
+	FakeLock() { pthread_mutex_lock(&g_lock); }
+	~FakeLock() { pthread_mutex_unlock(&g_lock); }
+};
+
+RK_U64 TEST_COMM_GetNowUs() {
+	struct timespec time = {0, 0};
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (RK_U64)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+void RK_LOG(RK_S32 level, RK_S32 modId, const char *fmt, const char *fname, const RK_U32 row, ...) {
+	va_list args;
+	(void)level;
+	(void)modId;
+	printf("%s:%u: ", fname, row);
+	va_start(args, row);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+}
+
+void fake_mpi_fail(const char *call, int nth) {
+	FakeLock lock;
+	g_fail_call = call ? call : "";
+	g_fail_countdown = nth;
+}
+
+static bool fake_fail(const char *call) {
+	if (g_fail_countdown <= 0 || g_fail_call != call)
+		return false;
+	return --g_fail_countdown == 0;
+}
+
+/* media blocks */
+
+static fake_mb_t *fake_mb_new(RK_U32 size, MB_POOL pool) {
+	fake_mb_t *mb = (fake_mb_t *)calloc(1, sizeof(fake_mb_t));
+	mb->magic = FAKE_MB_MAGIC;
+	mb->size = size;
+	mb->refs = 1;
+	mb->pool = pool;
+	mb->data = (uint8_t *)calloc(1, size ? size : 1);
+	g_mb_live++;
+	return mb;
+}
+
+static void fake_mb_delete(fake_mb_t *mb) {
+	mb->magic = 0;
+	free(mb->data);
+	free(mb);
+	g_mb_live--;
+}
+
+static fake_mb_t *fake_mb(MB_BLK blk) {
+	fake_mb_t *mb = (fake_mb_t *)blk;
+	return mb && mb->magic == FAKE_MB_MAGIC ? mb : NULL;
+}
+
+static RK_S32 fake_mb_release(MB_BLK blk) {
+	fake_mb_t *mb = fake_mb(blk);
+	if (!mb || mb->refs <= 0)
+		return RK_FAILURE;
+	if (--mb->refs > 0)
+		return RK_SUCCESS;
+	if (mb->pool == MB_INVALID_POOLID)
+		fake_mb_delete(mb);
+	else
+		g_pools[mb->pool].free.push_back(mb);
+	return RK_SUCCESS;
+}
+
+MB_BLK fake_mb_alloc(RK_U32 size) {
+	FakeLock lock;
+	return fake_mb_new(size, MB_INVALID_POOLID);
+}
+
+RK_U32 fake_mb_live() {
+	FakeLock lock;
+	return g_mb_live;
+}
+
+RK_U32 fake_mb_pools() {
+	FakeLock lock;
+	RK_U32 count = 0;
+	for (int p = 0; p < FAKE_MPI_MAX_POOLS; p++)
+		count += g_pools[p].used;
+	return count;
+}
+
+RK_U32 fake_mb_pool_free(MB_POOL pool) {
+	FakeLock lock;
+	if (pool >= FAKE_MPI_MAX_POOLS || !g_pools[pool].used)
+		return 0;
+	return g_pools[pool].free.size();
+}
+
+MB_POOL RK_MPI_MB_CreatePool(MB_POOL_CONFIG_S *pstMbPoolCfg) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_MB_CreatePool"))
+		return MB_INVALID_POOLID;
+	for (MB_POOL p = 0; p < FAKE_MPI_MAX_POOLS; p++) {
+		fake_pool_t *pool = &g_pools[p];
+		if (pool->used)
+			continue;
+		pool->used = true;
+		pool->blk_size = pstMbPoolCfg->u64MBSize;
+		for (RK_U32 i = 0; i < pstMbPoolCfg->u32MBCnt; i++) {
+			fake_mb_t *mb = fake_mb_new(pool->blk_size, p);
+			mb->refs = 0;
+			pool->blocks.push_back(mb);
+			pool->free.push_back(mb);
+		}
+		return p;
+	}
+	return MB_INVALID_POOLID;
+}
+
+RK_S32 RK_MPI_MB_DestroyPool(MB_POOL pool) {
+	FakeLock lock;
+	if (pool >= FAKE_MPI_MAX_POOLS || !g_pools[pool].used)
+		return RK_FAILURE;
+	// blocks still out are leaked by the caller, the fake keeps counting them as live
+	for (fake_mb_t *mb : g_pools[pool].free)
+		fake_mb_delete(mb);
+	g_pools[pool].blocks.clear();
+	g_pools[pool].free.clear();
+	g_pools[pool].used = false;
+	return RK_SUCCESS;
+}
+
+MB_BLK RK_MPI_MB_GetMB(MB_POOL pool, RK_U64 u64Size, RK_BOOL block) {
+	FakeLock lock;
+	(void)block;
+	if (pool >= FAKE_MPI_MAX_POOLS || !g_pools[pool].used || g_pools[pool].free.empty() ||
+	    u64Size > g_pools[pool].blk_size)
+		return RK_NULL;
+	fake_mb_t *mb = g_pools[pool].free.back();
+	g_pools[pool].free.pop_back();
+	mb->refs = 1;
+	return mb;
+}
+
+RK_S32 RK_MPI_MB_ReleaseMB(MB_BLK blk) {
+	FakeLock lock;
+	return fake_mb_release(blk);
+}
+
+RK_VOID *RK_MPI_MB_Handle2VirAddr(MB_BLK blk) {
+	FakeLock lock;
+	fake_mb_t *mb = fake_mb(blk);
+	return mb ? mb->data : RK_NULL;
+}
+
+RK_U64 RK_MPI_MB_GetSize(MB_BLK blk) {
+	FakeLock lock;
+	fake_mb_t *mb = fake_mb(blk);
+	return mb ? mb->size : 0;
+}
+
+RK_S32 RK_MPI_SYS_MmzFlushCache(MB_BLK blk, RK_BOOL bReadOnly) {
+	FakeLock lock;
+	(void)bReadOnly;
+	return fake_mb(blk) ? RK_SUCCESS : RK_FAILURE;
+}
+
+/* VENC */
+
+int fake_venc_queue(int chn, const fake_venc_pack_t *packs, int count) {
+	FakeLock lock;
+	std::vector<VENC_PACK_S> stream(count);
+
+	if (chn < 0 || chn >= FAKE_MPI_MAX_CHN)
+		return -1;
+	for (int i = 0; i < count; i++) {
+		VENC_PACK_S *pack = &stream[i];
+		memset(pack, 0, sizeof(*pack));
+		fake_mb_t *mb = fake_mb_new(packs[i].offset + packs[i].len, MB_INVALID_POOLID);
+		uint8_t *data = mb->data + packs[i].offset;
+		for (RK_U32 b = 0; b < packs[i].len; b++)
+			data[b] = (uint8_t)(packs[i].fill + b);
+		pack->pMbBlk = mb;
+		pack->u32Len = packs[i].len;
+		pack->u32Offset = packs[i].offset;
+		pack->u64PTS = packs[i].pts;
+		pack->bFrameEnd = packs[i].frame_end ? RK_TRUE : RK_FALSE;
+	}
+	g_venc[chn].queued.push_back(stream);
+	return 0;
+}
+
+RK_U32 fake_venc_queued(int chn) {
+	FakeLock lock;
+	return g_venc[chn].queued.size();
+}
+
+RK_U32 fake_venc_outstanding(int chn) {
+	FakeLock lock;
+	return g_venc[chn].got.size();
+}
+
+RK_U32 fake_venc_idr_requests(int chn) {
+	FakeLock lock;
+	return g_venc[chn].idr_requests;
+}
+
+RK_S32 RK_MPI_VENC_RequestIDR(VENC_CHN VeChn, RK_BOOL bInstant) {
+	FakeLock lock;
+	(void)bInstant;
+	if (VeChn < 0 || VeChn >= FAKE_MPI_MAX_CHN)
+		return RK_ERR_VENC_INVALID_CHNID;
+	g_venc[VeChn].idr_requests++;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VENC_QueryStatus(VENC_CHN VeChn, VENC_CHN_STATUS_S *pstStatus) {
+	FakeLock lock;
+	if (VeChn < 0 || VeChn >= FAKE_MPI_MAX_CHN)
+		return RK_ERR_VENC_INVALID_CHNID;
+	memset(pstStatus, 0, sizeof(*pstStatus));
+	pstStatus->u32LeftStreamFrames = g_venc[VeChn].queued.size();
+	if (!g_venc[VeChn].queued.empty())
+		pstStatus->u32CurPacks = g_venc[VeChn].queued.front().size();
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VENC_GetStream(VENC_CHN VeChn, VENC_STREAM_S *pstStream, RK_S32 s32MilliSec) {
+	FakeLock lock;
+	(void)s32MilliSec;
+	if (VeChn < 0 || VeChn >= FAKE_MPI_MAX_CHN)
+		return RK_ERR_VENC_INVALID_CHNID;
+	fake_venc_chn_t *chn = &g_venc[VeChn];
+	if (chn->queued.empty())
+		return RK_ERR_VENC_BUF_EMPTY;
+	std::vector<VENC_PACK_S> &stream = chn->queued.front();
+	// the caller's capacity is all it gets, like the driver
+	RK_U32 count = stream.size() < pstStream->u32PackCount ? stream.size() : pstStream->u32PackCount;
+	memcpy(pstStream->pstPack, stream.data(), count * sizeof(VENC_PACK_S));
+	pstStream->u32PackCount = count;
+	pstStream->u32Seq = chn->seq++;
+	chn->got.push_back(stream);
+	chn->queued.pop_front();
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VENC_ReleaseStream(VENC_CHN VeChn, VENC_STREAM_S *pstStream) {
+	FakeLock lock;
+	if (VeChn < 0 || VeChn >= FAKE_MPI_MAX_CHN)
+		return RK_ERR_VENC_INVALID_CHNID;
+	fake_venc_chn_t *chn = &g_venc[VeChn];
+	if (chn->got.empty() || pstStream->u32PackCount == 0 ||
+	    chn->got.front()[0].pMbBlk != pstStream->pstPack[0].pMbBlk)
+		return RK_ERR_VENC_ILLEGAL_PARAM;
+	for (VENC_PACK_S &pack : chn->got.front())
+		fake_mb_release(pack.pMbBlk);
+	chn->got.pop_front();
+	return RK_SUCCESS;
+}
+
+// channels are never created here: teardown of one that does not exist
+RK_S32 RK_MPI_VENC_StopRecvFrame(VENC_CHN VeChn) {
+	(void)VeChn;
+	return RK_ERR_VENC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VENC_DestroyChn(VENC_CHN VeChn) {
+	(void)VeChn;
+	return RK_ERR_VENC_UNEXIST;
+}
+
+/* VPSS */
+
+static fake_vpss_t *fake_vpss(VPSS_GRP grp, VPSS_CHN chn) {
+	if (grp < 0 || grp >= FAKE_MPI_MAX_CHN || !g_vpss[grp].state.created)
+		return NULL;
+	if (chn < 0 || chn >= VPSS_MAX_CHN_NUM)
+		return NULL;
+	return &g_vpss[grp];
+}
+
+static void fake_vpss_pop(fake_vpss_t *vpss, VPSS_CHN chn) {
+	uint64_t val;
+	fake_mb_release(vpss->frames[chn].front().stVFrame.pMbBlk);
+	vpss->frames[chn].pop_front();
+	vpss->state.queued[chn]--;
+	if (vpss->state.fd[chn] >= 0 && read(vpss->state.fd[chn], &val, sizeof(val)) < 0)
+		printf("fake vpss: fd read %s\n", strerror(errno));
+}
+
+const fake_vpss_grp_t *fake_vpss_grp(int grp) {
+	FakeLock lock;
+	return grp >= 0 && grp < FAKE_MPI_MAX_CHN ? &g_vpss[grp].state : NULL;
+}
+
+RK_U32 fake_vpss_live() {
+	FakeLock lock;
+	RK_U32 count = 0;
+	for (int g = 0; g < FAKE_MPI_MAX_CHN; g++)
+		count += g_vpss[g].state.created;
+	return count;
+}
+
+RK_U32 fake_vpss_open_fds() {
+	FakeLock lock;
+	RK_U32 count = 0;
+	for (int g = 0; g < FAKE_MPI_MAX_CHN; g++) {
+		for (int c = 0; c < VPSS_MAX_CHN_NUM; c++)
+			count += g_vpss[g].state.fd[c] >= 0;
+	}
+	return count;
+}
+
+RK_S32 RK_MPI_VPSS_CreateGrp(VPSS_GRP VpssGrp, const VPSS_GRP_ATTR_S *pstGrpAttr) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_VPSS_CreateGrp"))
+		return RK_ERR_VPSS_NOBUF;
+	if (VpssGrp < 0 || VpssGrp >= FAKE_MPI_MAX_CHN)
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	fake_vpss_grp_t *state = &g_vpss[VpssGrp].state;
+	if (state->created)
+		return RK_ERR_VPSS_EXIST;
+	memset(state, 0, sizeof(*state));
+	state->created = true;
+	state->attr = *pstGrpAttr;
+	for (int c = 0; c < VPSS_MAX_CHN_NUM; c++) {
+		state->pool[c] = MB_INVALID_POOLID;
+		state->fd[c] = -1;
+	}
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_DestroyGrp(VPSS_GRP VpssGrp) {
+	FakeLock lock;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, 0);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	for (int c = 0; c < VPSS_MAX_CHN_NUM; c++) {
+		if (vpss->state.enabled[c] || vpss->state.pool[c] != MB_INVALID_POOLID)
+			return RK_ERR_VPSS_NOT_PERM;
+	}
+	vpss->state.created = false;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_StartGrp(VPSS_GRP VpssGrp) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_VPSS_StartGrp"))
+		return RK_ERR_VPSS_NOT_PERM;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, 0);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	vpss->state.started = true;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_StopGrp(VPSS_GRP VpssGrp) {
+	FakeLock lock;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, 0);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	vpss->state.started = false;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_SetChnAttr(VPSS_GRP VpssGrp, VPSS_CHN VpssChn, const VPSS_CHN_ATTR_S *pstChnAttr) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_VPSS_SetChnAttr"))
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	vpss->state.chn[VpssChn] = *pstChnAttr;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_SetChnCrop(VPSS_GRP VpssGrp, VPSS_CHN VpssChn, const VPSS_CROP_INFO_S *pstCropInfo) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_VPSS_SetChnCrop"))
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	vpss->state.crop[VpssChn] = *pstCropInfo;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_SetChnRotation(VPSS_GRP VpssGrp, VPSS_CHN VpssChn, ROTATION_E enRotation) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_VPSS_SetChnRotation"))
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	vpss->state.rotation[VpssChn] = enRotation;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_AttachMbPool(VPSS_GRP VpssGrp, VPSS_CHN VpssChn, MB_POOL hVbPool) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_VPSS_AttachMbPool"))
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	if (hVbPool >= FAKE_MPI_MAX_POOLS || !g_pools[hVbPool].used)
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	vpss->state.pool[VpssChn] = hVbPool;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_DetachMbPool(VPSS_GRP VpssGrp, VPSS_CHN VpssChn) {
+	FakeLock lock;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	vpss->state.pool[VpssChn] = MB_INVALID_POOLID;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_EnableChn(VPSS_GRP VpssGrp, VPSS_CHN VpssChn) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_VPSS_EnableChn"))
+		return RK_ERR_VPSS_NOT_PERM;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	vpss->state.enabled[VpssChn] = true;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_DisableChn(VPSS_GRP VpssGrp, VPSS_CHN VpssChn) {
+	FakeLock lock;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	while (!vpss->frames[VpssChn].empty())
+		fake_vpss_pop(vpss, VpssChn);
+	vpss->state.enabled[VpssChn] = false;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_GetChnFd(VPSS_GRP VpssGrp, VPSS_CHN VpssChn) {
+	FakeLock lock;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return -1;
+	if (vpss->state.fd[VpssChn] < 0) {
+		vpss->state.fd[VpssChn] = eventfd(vpss->state.queued[VpssChn], EFD_NONBLOCK | EFD_SEMAPHORE | EFD_CLOEXEC);
+	}
+	return vpss->state.fd[VpssChn];
+}
+
+RK_S32 RK_MPI_VPSS_CloseFd(VPSS_GRP VpssGrp, VPSS_CHN VpssChn) {
+	FakeLock lock;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss || vpss->state.fd[VpssChn] < 0)
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	close(vpss->state.fd[VpssChn]);
+	vpss->state.fd[VpssChn] = -1;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_SendFrame(VPSS_GRP VpssGrp, VPSS_GRP_PIPE VpssGrpPipe, const VIDEO_FRAME_INFO_S *pstVideoFrame,
+                             RK_S32 s32MilliSec) {
+	FakeLock lock;
+	(void)VpssGrpPipe;
+	(void)s32MilliSec;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, 0);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	if (!vpss->state.started)
+		return RK_ERR_VPSS_NOT_PERM;
+	for (int c = 0; c < VPSS_MAX_CHN_NUM; c++) {
+		const VPSS_CHN_ATTR_S *attr = &vpss->state.chn[c];
+		if (!vpss->state.enabled[c] || attr->u32Depth == 0)
+			continue;
+		bool swap = vpss->state.rotation[c] == ROTATION_90 || vpss->state.rotation[c] == ROTATION_270;
+		RK_U32 width = swap ? attr->u32Height : attr->u32Width;
+		RK_U32 height = swap ? attr->u32Width : attr->u32Height;
+		RK_U32 size = attr->enPixelFormat == RK_FMT_YUV420SP ? width * height * 3 / 2 : width * height * 3;
+		fake_mb_t *mb;
+		MB_POOL pool = vpss->state.pool[c];
+		if (pool != MB_INVALID_POOLID) {
+			if (g_pools[pool].free.empty() || g_pools[pool].blk_size < size) {
+				vpss->state.dropped[c]++;
+				continue;
+			}
+			mb = g_pools[pool].free.back();
+			g_pools[pool].free.pop_back();
+			mb->refs = 1;
+		} else {
+			mb = fake_mb_new(size, MB_INVALID_POOLID);
+		}
+		memcpy(mb->data, &pstVideoFrame->stVFrame.u64PTS, sizeof(RK_U64));
+
+		VIDEO_FRAME_INFO_S frame;
+		memset(&frame, 0, sizeof(frame));
+		frame.stVFrame.pMbBlk = mb;
+		frame.stVFrame.u32Width = width;
+		frame.stVFrame.u32Height = height;
+		frame.stVFrame.u32VirWidth = width;
+		frame.stVFrame.u32VirHeight = height;
+		frame.stVFrame.enPixelFormat = attr->enPixelFormat;
+		frame.stVFrame.u64PTS = pstVideoFrame->stVFrame.u64PTS;
+		vpss->frames[c].push_back(frame);
+		vpss->state.queued[c]++;
+		uint64_t one = 1;
+		if (vpss->state.fd[c] >= 0 && write(vpss->state.fd[c], &one, sizeof(one)) < 0)
+			printf("fake vpss: fd write %s\n", strerror(errno));
+		if (vpss->state.queued[c] > attr->u32Depth) {
+			fake_vpss_pop(vpss, c);
+			vpss->state.dropped[c]++;
+		}
+	}
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_GetChnFrame(VPSS_GRP VpssGrp, VPSS_CHN VpssChn, VIDEO_FRAME_INFO_S *pstVideoFrame,
+                               RK_S32 s32MilliSec) {
+	FakeLock lock;
+	uint64_t val;
+	(void)s32MilliSec;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	if (vpss->frames[VpssChn].empty())
+		return RK_ERR_VPSS_BUF_EMPTY;
+	*pstVideoFrame = vpss->frames[VpssChn].front();
+	vpss->frames[VpssChn].pop_front();
+	vpss->state.queued[VpssChn]--;
+	vpss->state.outstanding[VpssChn]++;
+	if (vpss->state.fd[VpssChn] >= 0 && read(vpss->state.fd[VpssChn], &val, sizeof(val)) < 0)
+		printf("fake vpss: fd read %s\n", strerror(errno));
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_VPSS_ReleaseChnFrame(VPSS_GRP VpssGrp, VPSS_CHN VpssChn, const VIDEO_FRAME_INFO_S *pstVideoFrame) {
+	FakeLock lock;
+	fake_vpss_t *vpss = fake_vpss(VpssGrp, VpssChn);
+	if (!vpss)
+		return RK_ERR_VPSS_UNEXIST;
+	if (vpss->state.outstanding[VpssChn] == 0 || fake_mb_release(pstVideoFrame->stVFrame.pMbBlk) != RK_SUCCESS)
+		return RK_ERR_VPSS_ILLEGAL_PARAM;
+	vpss->state.outstanding[VpssChn]--;
+	return RK_SUCCESS;
+}
+
+/* binds: only VPSS groups record theirs */
+
+RK_S32 RK_MPI_SYS_Bind(const MPP_CHN_S *pstSrcChn, const MPP_CHN_S *pstDestChn) {
+	FakeLock lock;
+	if (fake_fail("RK_MPI_SYS_Bind"))
+		return RK_FAILURE;
+	if (pstDestChn->enModId == RK_ID_VPSS) {
+		fake_vpss_t *vpss = fake_vpss(pstDestChn->s32DevId, 0);
+		if (!vpss || vpss->state.bound)
+			return RK_FAILURE;
+		vpss->state.bound = true;
+		vpss->state.bind_src = *pstSrcChn;
+	}
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_SYS_UnBind(const MPP_CHN_S *pstSrcChn, const MPP_CHN_S *pstDestChn) {
+	FakeLock lock;
+	(void)pstSrcChn;
+	if (pstDestChn->enModId == RK_ID_VPSS) {
+		fake_vpss_t *vpss = fake_vpss(pstDestChn->s32DevId, 0);
+		if (!vpss || !vpss->state.bound)
+			return RK_FAILURE;
+		vpss->state.bound = false;
+	}
+	return RK_SUCCESS;
+}
+
+/* IVS */
+
+int fake_ivs_queue(int chn, const fake_ivs_result_t *result) {
+	FakeLock lock;
+	if (chn < 0 || chn >= FAKE_MPI_MAX_CHN)
+		return -1;
+	g_ivs[chn].queued.push_back(*result);
+	return 0;
+}
+
+bool fake_ivs_created(int chn) {
+	FakeLock lock;
+	return g_ivs[chn].created;
+}
+
+RK_U32 fake_ivs_sent(int chn) {
+	FakeLock lock;
+	return g_ivs[chn].sent;
+}
+
+RK_U32 fake_ivs_outstanding(int chn) {
+	FakeLock lock;
+	return g_ivs[chn].outstanding;
+}
+
+static fake_ivs_chn_t *fake_ivs(IVS_CHN chn) {
+	if (chn < 0 || chn >= FAKE_MPI_MAX_CHN || !g_ivs[chn].created)
+		return NULL;
+	return &g_ivs[chn];
+}
+
+RK_S32 RK_MPI_IVS_CreateChn(IVS_CHN IvsChn, IVS_CHN_ATTR_S *pstAttr) {
+	FakeLock lock;
+	(void)pstAttr;
+	if (IvsChn < 0 || IvsChn >= FAKE_MPI_MAX_CHN)
+		return RK_ERR_IVS_INVALID_CHNID;
+	if (g_ivs[IvsChn].created)
+		return RK_ERR_IVS_EXIST;
+	if (fake_fail("RK_MPI_IVS_CreateChn"))
+		return RK_ERR_IVS_NOT_SUPPORT;
+	g_ivs[IvsChn].created = true;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_IVS_DestroyChn(IVS_CHN IvsChn) {
+	FakeLock lock;
+	fake_ivs_chn_t *ivs = fake_ivs(IvsChn);
+	if (!ivs)
+		return RK_ERR_IVS_UNEXIST;
+	ivs->created = false;
+	ivs->ready.clear();
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_IVS_GetMdAttr(IVS_CHN IvsChn, IVS_MD_ATTR_S *pstMdAttr) {
+	FakeLock lock;
+	if (!fake_ivs(IvsChn))
+		return RK_ERR_IVS_UNEXIST;
+	memset(pstMdAttr, 0, sizeof(*pstMdAttr));
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_IVS_SetMdAttr(IVS_CHN IvsChn, IVS_MD_ATTR_S *pstMdAttr) {
+	FakeLock lock;
+	(void)pstMdAttr;
+	return fake_ivs(IvsChn) ? RK_SUCCESS : RK_ERR_IVS_UNEXIST;
+}
+
+RK_S32 RK_MPI_IVS_SetOdAttr(IVS_CHN IvsChn, IVS_OD_ATTR_S *pstOdAttr) {
+	FakeLock lock;
+	(void)pstOdAttr;
+	return fake_ivs(IvsChn) ? RK_SUCCESS : RK_ERR_IVS_UNEXIST;
+}
+
+RK_S32 RK_MPI_IVS_SendFrame(IVS_CHN VdChn, const VIDEO_FRAME_INFO_S *pstFrame, RK_S32 s32MilliSec) {
+	FakeLock lock;
+	(void)pstFrame;
+	(void)s32MilliSec;
+	fake_ivs_chn_t *ivs = fake_ivs(VdChn);
+	if (!ivs)
+		return RK_ERR_IVS_UNEXIST;
+	if (fake_fail("RK_MPI_IVS_SendFrame"))
+		return RK_ERR_IVS_BUSY;
+	ivs->sent++;
+	if (!ivs->queued.empty()) {
+		ivs->ready.push_back(ivs->queued.front());
+		ivs->queued.pop_front();
+	}
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_IVS_GetResults(IVS_CHN VdChn, IVS_RESULT_INFO_S *pstResults, RK_S32 s32MilliSec) {
+	FakeLock lock;
+	(void)s32MilliSec;
+	fake_ivs_chn_t *ivs = fake_ivs(VdChn);
+	if (!ivs)
+		return RK_ERR_IVS_UNEXIST;
+	if (ivs->ready.empty())
+		return RK_ERR_IVS_BUF_EMPTY;
+	const fake_ivs_result_t &result = ivs->ready.front();
+	// the MD rectangle array alone is 64KB, off the caller's stack like the driver's
+	IVS_RESULT_S *out = (IVS_RESULT_S *)calloc(1, sizeof(IVS_RESULT_S));
+	out->stOdInfo.u32Flag = result.occluded;
+	out->stMdInfo.u32RectNum = result.rect_count;
+	memcpy(out->stMdInfo.stRect, result.rects, result.rect_count * sizeof(RECT_S));
+	ivs->ready.pop_front();
+	ivs->outstanding++;
+	pstResults->s32ResultNum = 1;
+	pstResults->pstResults = out;
+	return RK_SUCCESS;
+}
+
+RK_S32 RK_MPI_IVS_ReleaseResults(IVS_CHN IvsChn, IVS_RESULT_INFO_S *pstResults) {
+	FakeLock lock;
+	if (IvsChn < 0 || IvsChn >= FAKE_MPI_MAX_CHN)
+		return RK_ERR_IVS_INVALID_CHNID;
+	if (pstResults->pstResults) {
+		free(pstResults->pstResults);
+		pstResults->pstResults = NULL;
+		g_ivs[IvsChn].outstanding--;
+	}
+	return RK_SUCCESS;
+}
+
+/* VDEC: not emulated, the tests decode with soft_dec.cpp; channels never get created */
+
+RK_S32 RK_MPI_SYS_CreateMB(MB_BLK *pBlk, MB_EXT_CONFIG_S *pstMbExtConfig) {
+	(void)pstMbExtConfig;
+	*pBlk = RK_NULL;
+	return RK_ERR_SYS_NOT_SUPPORT;
+}
+
+RK_S32 RK_MPI_VDEC_CreateChn(VDEC_CHN VdChn, const VDEC_CHN_ATTR_S *pstAttr) {
+	(void)VdChn;
+	(void)pstAttr;
+	return RK_ERR_VDEC_NOT_SUPPORT;
+}
+
+RK_S32 RK_MPI_VDEC_DestroyChn(VDEC_CHN VdChn) {
+	(void)VdChn;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VDEC_GetChnParam(VDEC_CHN VdChn, VDEC_CHN_PARAM_S *pstParam) {
+	(void)VdChn;
+	(void)pstParam;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VDEC_SetChnParam(VDEC_CHN VdChn, const VDEC_CHN_PARAM_S *pstParam) {
+	(void)VdChn;
+	(void)pstParam;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VDEC_StartRecvStream(VDEC_CHN VdChn) {
+	(void)VdChn;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VDEC_StopRecvStream(VDEC_CHN VdChn) {
+	(void)VdChn;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VDEC_SendStream(VDEC_CHN VdChn, const VDEC_STREAM_S *pstStream, RK_S32 s32MilliSec) {
+	(void)VdChn;
+	(void)pstStream;
+	(void)s32MilliSec;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VDEC_GetFrame(VDEC_CHN VdChn, VIDEO_FRAME_INFO_S *pstFrameInfo, RK_S32 s32MilliSec) {
+	(void)VdChn;
+	(void)pstFrameInfo;
+	(void)s32MilliSec;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+RK_S32 RK_MPI_VDEC_ReleaseFrame(VDEC_CHN VdChn, const VIDEO_FRAME_INFO_S *pstFrameInfo) {
+	(void)VdChn;
+	(void)pstFrameInfo;
+	return RK_ERR_VDEC_UNEXIST;
+}
+
+/* RGN: not emulated, overlays are never created */
+
+RK_S32 RK_MPI_RGN_Create(RGN_HANDLE Handle, const RGN_ATTR_S *pstRegion) {
+	(void)Handle;
+	(void)pstRegion;
+	return RK_ERR_RGN_NOT_SUPPORT;
+}
+
+RK_S32 RK_MPI_RGN_Destroy(RGN_HANDLE Handle) {
+	(void)Handle;
+	return RK_ERR_RGN_UNEXIST;
+}
+
+RK_S32 RK_MPI_RGN_AttachToChn(RGN_HANDLE Handle, const MPP_CHN_S *pstChn, const RGN_CHN_ATTR_S *pstChnAttr) {
+	(void)Handle;
+	(void)pstChn;
+	(void)pstChnAttr;
+	return RK_ERR_RGN_UNEXIST;
+}
+
+RK_S32 RK_MPI_RGN_DetachFromChn(RGN_HANDLE Handle, const MPP_CHN_S *pstChn) {
+	(void)Handle;
+	(void)pstChn;
+	return RK_ERR_RGN_UNEXIST;
+}
+
+RK_S32 RK_MPI_RGN_GetCanvasInfo(RGN_HANDLE Handle, RGN_CANVAS_INFO_S *pstCanvasInfo) {
+	(void)Handle;
+	(void)pstCanvasInfo;
+	return RK_ERR_RGN_UNEXIST;
+}
+
+RK_S32 RK_MPI_RGN_UpdateCanvas(RGN_HANDLE Handle) {
+	(void)Handle;
+	return RK_ERR_RGN_UNEXIST;
+}
+
+void fake_mpi_reset() {
+	FakeLock lock;
+	for (int c = 0; c < FAKE_MPI_MAX_CHN; c++) {
+		for (auto *list : {&g_venc[c].queued, &g_venc[c].got}) {
+			for (std::vector<VENC_PACK_S> &stream : *list) {
+				for (VENC_PACK_S &pack : stream)
+					fake_mb_release(pack.pMbBlk);
+			}
+			list->clear();
+		}
+		g_venc[c].seq = 0;
+
+		g_ivs[c].created = false;
+		g_ivs[c].queued.clear();
+		g_ivs[c].ready.clear();
+		g_ivs[c].sent = 0;
+		g_ivs[c].outstanding = 0;
+
+		fake_vpss_t *vpss = &g_vpss[c];
+		for (int k = 0; k < VPSS_MAX_CHN_NUM; k++) {
+			while (!vpss->frames[k].empty())
+				fake_vpss_pop(vpss, k);
+			if (vpss->state.fd[k] >= 0)
+				close(vpss->state.fd[k]);
+		}
+		memset(&vpss->state, 0, sizeof(vpss->state));
+		for (int k = 0; k < VPSS_MAX_CHN_NUM; k++) {
+			vpss->state.pool[k] = MB_INVALID_POOLID;
+			vpss->state.fd[k] = -1;
+		}
+	}
+	for (int p = 0; p < FAKE_MPI_MAX_POOLS; p++) {
+		if (!g_pools[p].used)
+			continue;
+		for (fake_mb_t *mb : g_pools[p].blocks)
+			fake_mb_delete(mb);
+		g_pools[p].blocks.clear();
+		g_pools[p].free.clear();
+		g_pools[p].used = false;
+	}
+	g_fail_countdown = 0;
+}
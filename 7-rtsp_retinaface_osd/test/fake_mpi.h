@@ -0,0 +1,99 @@
+#ifndef __FAKE_MPI_H
+#define __FAKE_MPI_H
+
+#include <stdint.h>
+
+#include "rk_type.h"
+#include "rk_common.h"
+#include "rk_comm_mb.h"
+#include "rk_comm_vpss.h"
+
+#define FAKE_MPI_MAX_CHN 8			// VENC channels and VPSS groups
+
+/*
+ * Host stand-in for the MPI calls the tested modules make. Media blocks are
+ * heap buffers, pools hand them out and take them back; each channel is a
+ * queue the test fills and the module under test drains through the normal
+ * RK_MPI_* calls. One lock serializes every call, nothing ever waits for a
+ * frame: an empty queue fails right away whatever the timeout. There is no
+ * VDEC or RGN: creating a channel or region fails; file_source tests decode
+ * with soft_dec.h.
+ */
+
+/* Block of size bytes outside any pool, refcount 1, released by RK_MPI_MB_ReleaseMB(). */
+MB_BLK fake_mb_alloc(RK_U32 size);
+/* Blocks allocated and not freed yet, pool blocks included, for leak checks. */
+RK_U32 fake_mb_live();
+RK_U32 fake_mb_pools();
+/* Blocks of a pool that are not handed out. */
+RK_U32 fake_mb_pool_free(MB_POOL pool);
+
+/* Makes the nth next call of the named RK_MPI_* function fail (1: the next one), 0 clears it. */
+void fake_mpi_fail(const char *call, int nth);
+
+/* One pack of a queued VENC stream; data is filled with (fill + byte index) */
+typedef struct {
+	RK_U32 len;
+	RK_U32 offset;				// valid data starts here inside the block
+	RK_U64 pts;
+	bool frame_end;
+	uint8_t fill;
+} fake_venc_pack_t;
+
+/* What the next RK_MPI_VENC_GetStream() on chn returns. */
+int fake_venc_queue(int chn, const fake_venc_pack_t *packs, int count);
+RK_U32 fake_venc_queued(int chn);
+/* Streams got and not released yet. */
+RK_U32 fake_venc_outstanding(int chn);
+/* RK_MPI_VENC_RequestIDR() calls on chn. */
+RK_U32 fake_venc_idr_requests(int chn);
+
+/*
+ * VPSS group as configured through the MPI. RK_MPI_VPSS_SendFrame() puts one
+ * output frame on every enabled channel with a depth, from its attached pool
+ * or a private block, the input pts in its first 8 bytes; the oldest frame
+ * goes when the depth is exceeded. GetChnFd() is an eventfd counting queued frames.
+ */
+typedef struct {
+	bool created;
+	bool started;
+	bool bound;
+	MPP_CHN_S bind_src;
+	VPSS_GRP_ATTR_S attr;
+	VPSS_CHN_ATTR_S chn[VPSS_MAX_CHN_NUM];
+	bool enabled[VPSS_MAX_CHN_NUM];
+	VPSS_CROP_INFO_S crop[VPSS_MAX_CHN_NUM];
+	ROTATION_E rotation[VPSS_MAX_CHN_NUM];
+	MB_POOL pool[VPSS_MAX_CHN_NUM];
+	int fd[VPSS_MAX_CHN_NUM];
+	RK_U32 queued[VPSS_MAX_CHN_NUM];
+	RK_U32 outstanding[VPSS_MAX_CHN_NUM];	// got and not released
+	RK_U32 dropped[VPSS_MAX_CHN_NUM];		// depth exceeded or pool empty
+} fake_vpss_grp_t;
+
+const fake_vpss_grp_t *fake_vpss_grp(int grp);
+/* Groups created and not destroyed, and channel fds not closed. */
+RK_U32 fake_vpss_live();
+RK_U32 fake_vpss_open_fds();
+
+/*
+ * IVS channel. RK_MPI_IVS_SendFrame() takes the next queued result, which the
+ * following GetResults() hands out as one MD + OD result; with nothing queued
+ * GetResults() fails like a timeout.
+ */
+typedef struct {
+	bool occluded;				// OD flag
+	RK_U32 rect_count;			// MD rectangles
+	RECT_S rects[8];
+} fake_ivs_result_t;
+
+int fake_ivs_queue(int chn, const fake_ivs_result_t *result);
+bool fake_ivs_created(int chn);
+RK_U32 fake_ivs_sent(int chn);
+/* Results got and not released. */
+RK_U32 fake_ivs_outstanding(int chn);
+
+/* Drops every queued stream, frame, group and block. */
+void fake_mpi_reset();
+
+#endif
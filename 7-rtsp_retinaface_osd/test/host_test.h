@@ -0,0 +1,43 @@
+#ifndef __HOST_TEST_H
+#define __HOST_TEST_H
+
+#include <stdio.h>
+
+/*
+ * Checks for the host tests: a failed one is printed with its location and
+ * the test keeps going, HOST_TEST_RESULT() turns the count into the exit code.
+ */
+static int host_test_failures = 0;
+
+#define CHECK(cond)                                                                    \
+	do {                                                                               \
+		if (!(cond)) {                                                                 \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);            \
+			host_test_failures++;                                                      \
+		}                                                                              \
+	} while (0)
+
+#define CHECK_EQ(a, b)                                                                 \
+	do {                                                                               \
+		long long va_ = (long long)(a), vb_ = (long long)(b);                          \
+		if (va_ != vb_) {                                                              \
+			printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, \
+			       #a, #b, va_, vb_);                                                  \
+			host_test_failures++;                                                      \
+		}                                                                              \
+	} while (0)
+
+#define CHECK_NEAR(a, b, eps)                                                          \
+	do {                                                                               \
+		double va_ = (double)(a), vb_ = (double)(b);                                   \
+		if (va_ - vb_ > (eps) || vb_ - va_ > (eps)) {                                  \
+			printf("%s:%d: CHECK_NEAR(%s, %s) failed: %f != %f\n", __FILE__, __LINE__,  \
+			       #a, #b, va_, vb_);                                                  \
+			host_test_failures++;                                                      \
+		}                                                                              \
+	} while (0)
+
+#define HOST_TEST_RESULT()                                                             \
+	(printf("%s: %s\n", __FILE__, host_test_failures ? "FAILED" : "ok"), host_test_failures ? 1 : 0)
+
+#endif
@@ -0,0 +1,73 @@
+/*****************************************************************************
+* | Function    :   Throttled pwrite/fdatasync standing in for a slow SD
+*                   card under the storage_writer tests
+*
+******************************************************************************/
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "slow_card.h"
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static slow_card_cfg_t g_cfg;
+static slow_card_stats_t g_stats;
+static bool g_hold;
+
+void slow_card_set(const slow_card_cfg_t *cfg) {
+	pthread_mutex_lock(&g_lock);
+	g_cfg = *cfg;
+	memset(&g_stats, 0, sizeof(g_stats));
+	pthread_mutex_unlock(&g_lock);
+}
+
+void slow_card_hold(bool hold) {
+	pthread_mutex_lock(&g_lock);
+	g_hold = hold;
+	pthread_cond_broadcast(&g_cond);
+	pthread_mutex_unlock(&g_lock);
+}
+
+void slow_card_stats(slow_card_stats_t *stats) {
+	pthread_mutex_lock(&g_lock);
+	*stats = g_stats;
+	pthread_mutex_unlock(&g_lock);
+}
+
+static void slow_card_wait(void) {
+	if (!g_hold)
+		return;
+	g_stats.blocked++;
+	while (g_hold)
+		pthread_cond_wait(&g_cond, &g_lock);
+	g_stats.blocked--;
+}
+
+// same headers as the writer, so this is whichever symbol its pwrite() resolves to
+ssize_t pwrite(int fd, const void *buf, size_t len, off_t offset) {
+	pthread_mutex_lock(&g_lock);
+	slow_card_wait();
+	RK_U64 us = g_cfg.write_us + (g_cfg.bytes_per_ms ? len * 1000ULL / g_cfg.bytes_per_ms : 0);
+	g_stats.writes++;
+	g_stats.bytes += len;
+	pthread_mutex_unlock(&g_lock);
+	usleep(us);
+	return syscall(SYS_pwrite64, fd, buf, len, offset);
+}
+
+int fdatasync(int fd) {
+	pthread_mutex_lock(&g_lock);
+	slow_card_wait();
+	g_stats.syncs++;
+	RK_U32 us = g_cfg.sync_us;
+	if (g_cfg.stall_every && g_stats.syncs % g_cfg.stall_every == 0) {
+		us = g_cfg.stall_us;
+		g_stats.stalls++;
+	}
+	pthread_mutex_unlock(&g_lock);
+	usleep(us);
+	return syscall(SYS_fdatasync, fd);
+}
@@ -0,0 +1,36 @@
+#ifndef __SLOW_CARD_H
+#define __SLOW_CARD_H
+
+#include <stdint.h>
+
+#include "rk_type.h"
+
+/*
+ * Throttled storage for the storage_writer tests. slow_card.cpp defines
+ * pwrite() and fdatasync() for the whole test binary: the data still
+ * reaches the file through the raw syscalls, but each call first sleeps
+ * like a slow SD card, stalls now and then like one collecting garbage,
+ * and can be held outright until released.
+ */
+typedef struct {
+	RK_U32 write_us;			// per pwrite, plus len / bytes_per_ms
+	RK_U32 bytes_per_ms;		// 0: no bandwidth limit
+	RK_U32 sync_us;				// per fdatasync
+	RK_U32 stall_every;			// every nth fdatasync takes stall_us instead, 0: never
+	RK_U32 stall_us;
+} slow_card_cfg_t;
+
+typedef struct {
+	RK_U32 writes;
+	RK_U64 bytes;
+	RK_U32 syncs;
+	RK_U32 stalls;
+	RK_U32 blocked;				// threads waiting in a held call
+} slow_card_stats_t;
+
+void slow_card_set(const slow_card_cfg_t *cfg);
+/* While held, pwrite and fdatasync wait for the release */
+void slow_card_hold(bool hold);
+void slow_card_stats(slow_card_stats_t *stats);
+
+#endif
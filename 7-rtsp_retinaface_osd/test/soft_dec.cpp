@@ -0,0 +1,146 @@
+/*****************************************************************************
+* | Function    :   Software stand-in decoder for file_source: access units
+*                   in, tagged NV12 frames out, VDEC-like buffering
+*
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <deque>
+
+#include "rk_mpi_mb.h"
+#include "rk_comm_vdec.h"
+#include "soft_dec.h"
+
+typedef struct {
+	soft_dec_cfg_t cfg;
+	soft_dec_stats_t own_stats;
+	soft_dec_stats_t *stats;
+	MB_POOL pool;
+	RK_U32 seq;
+	std::deque<VIDEO_FRAME_INFO_S> held;	// waiting for reordering
+	std::deque<VIDEO_FRAME_INFO_S> ready;
+} soft_dec_t;
+
+void soft_dec_cfg_default(soft_dec_cfg_t *cfg) {
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->width = 640;
+	cfg->height = 360;
+	cfg->frame_buf_cnt = 6;
+	cfg->reorder = 2;
+}
+
+static RK_S32 soft_dec_send(void *ctx, const uint8_t *data, size_t len, RK_U64 pts, bool eos, RK_S32 timeout_ms) {
+	soft_dec_t *dec = (soft_dec_t *)ctx;
+	(void)timeout_ms;
+
+	if (eos) {
+		if (dec->stats->eos_refused < dec->cfg.eos_refused) {
+			dec->stats->eos_refused++;
+			return RK_ERR_VDEC_BUF_FULL;
+		}
+		dec->stats->eos++;
+		while (!dec->held.empty()) {
+			dec->ready.push_back(dec->held.front());
+			dec->held.pop_front();
+		}
+		return RK_SUCCESS;
+	}
+	dec->stats->sends++;
+	if (dec->cfg.busy_every && dec->stats->sends % dec->cfg.busy_every == 0) {
+		dec->stats->busy++;
+		return RK_ERR_VDEC_BUF_FULL;
+	}
+	RK_U32 size = dec->cfg.width * dec->cfg.height * 3 / 2;
+	MB_BLK blk = RK_MPI_MB_GetMB(dec->pool, size, RK_FALSE);
+	if (!blk) {
+		dec->stats->full++;
+		return RK_ERR_VDEC_BUF_FULL;
+	}
+
+	soft_dec_pic_t pic;
+	pic.seq = dec->seq++;
+	pic.len = len;
+	pic.sum = 0;
+	for (size_t i = 0; i < len; i++)
+		pic.sum += data[i];
+	memcpy(RK_MPI_MB_Handle2VirAddr(blk), &pic, sizeof(pic));
+	if (dec->cfg.decode_us)
+		usleep(dec->cfg.decode_us);
+
+	VIDEO_FRAME_INFO_S frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.stVFrame.pMbBlk = blk;
+	frame.stVFrame.u32Width = dec->cfg.width;
+	frame.stVFrame.u32Height = dec->cfg.height;
+	frame.stVFrame.u32VirWidth = dec->cfg.width;
+	frame.stVFrame.u32VirHeight = dec->cfg.height;
+	frame.stVFrame.enPixelFormat = RK_FMT_YUV420SP;
+	frame.stVFrame.u64PTS = pts;
+	dec->held.push_back(frame);
+	if (dec->held.size() > dec->cfg.reorder) {
+		dec->ready.push_back(dec->held.front());
+		dec->held.pop_front();
+	}
+	return RK_SUCCESS;
+}
+
+static RK_S32 soft_dec_get(void *ctx, VIDEO_FRAME_INFO_S *frame, RK_S32 timeout_ms) {
+	soft_dec_t *dec = (soft_dec_t *)ctx;
+	(void)timeout_ms;	// nothing decodes in the background, waiting would not help
+
+	if (dec->ready.empty())
+		return RK_ERR_VDEC_BUF_EMPTY;
+	*frame = dec->ready.front();
+	dec->ready.pop_front();
+	dec->stats->frames++;
+	dec->stats->outstanding++;
+	return RK_SUCCESS;
+}
+
+static RK_S32 soft_dec_release(void *ctx, const VIDEO_FRAME_INFO_S *frame) {
+	soft_dec_t *dec = (soft_dec_t *)ctx;
+	dec->stats->outstanding--;
+	return RK_MPI_MB_ReleaseMB(frame->stVFrame.pMbBlk);
+}
+
+static void soft_dec_close(void *ctx) {
+	soft_dec_t *dec = (soft_dec_t *)ctx;
+	for (auto *list : {&dec->held, &dec->ready}) {
+		for (VIDEO_FRAME_INFO_S &frame : *list)
+			RK_MPI_MB_ReleaseMB(frame.stVFrame.pMbBlk);
+	}
+	RK_MPI_MB_DestroyPool(dec->pool);
+	delete dec;
+}
+
+int soft_dec_ops(file_source_dec_ops_t *ops, const soft_dec_cfg_t *cfg, soft_dec_stats_t *stats) {
+	MB_POOL_CONFIG_S pool_cfg;
+
+	memset(ops, 0, sizeof(*ops));
+	if (cfg->frame_buf_cnt <= cfg->reorder) {
+		printf("soft_dec: %u buffers cannot hold %u pictures for reordering\n", cfg->frame_buf_cnt,
+		       cfg->reorder);
+		return -1;
+	}
+	memset(&pool_cfg, 0, sizeof(pool_cfg));
+	pool_cfg.u64MBSize = cfg->width * cfg->height * 3 / 2;
+	pool_cfg.u32MBCnt = cfg->frame_buf_cnt;
+	MB_POOL pool = RK_MPI_MB_CreatePool(&pool_cfg);
+	if (pool == MB_INVALID_POOLID)
+		return -1;
+
+	soft_dec_t *dec = new soft_dec_t();
+	dec->cfg = *cfg;
+	dec->pool = pool;
+	dec->stats = stats ? stats : &dec->own_stats;
+	memset(dec->stats, 0, sizeof(*dec->stats));
+	ops->ctx = dec;
+	ops->send = soft_dec_send;
+	ops->get = soft_dec_get;
+	ops->release = soft_dec_release;
+	ops->close = soft_dec_close;
+	return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef __SOFT_DEC_H
+#define __SOFT_DEC_H
+
+#include <stdint.h>
+
+#include "file_source.h"
+
+/*
+ * Software stand-in for VDEC behind file_source_dec_ops_t. Nothing is
+ * decoded: every access unit becomes one NV12 frame from a pool of
+ * frame_buf_cnt blocks, the first bytes of its luma carrying a
+ * soft_dec_pic_t so the test can tell which access unit it came from.
+ * Like VDEC, a picture holds its block while it waits for reordering,
+ * send fails while every block is in use, and EOS flushes what is held.
+ */
+typedef struct {
+	RK_U32 width;
+	RK_U32 height;
+	RK_U32 frame_buf_cnt;		// output blocks, more than reorder
+	RK_U32 reorder;				// pictures held before the oldest is output
+	RK_U32 decode_us;			// busy time per access unit
+	RK_U32 busy_every;			// every nth send fails as if the stream buffer was full, 0: never
+	RK_U32 eos_refused;			// EOS sends that fail as if the stream buffer was full, ~0: all
+} soft_dec_cfg_t;
+
+/* At the start of every output frame */
+typedef struct {
+	RK_U32 seq;					// access unit index since open
+	RK_U32 len;
+	RK_U32 sum;					// byte sum of the access unit
+} soft_dec_pic_t;
+
+typedef struct {
+	RK_U32 sends;
+	RK_U32 busy;				// sends refused by busy_every
+	RK_U32 full;				// sends refused for want of a block
+	RK_U32 eos;					// EOS taken
+	RK_U32 eos_refused;
+	RK_U32 frames;
+	RK_U32 outstanding;			// frames got and not released
+} soft_dec_stats_t;
+
+void soft_dec_cfg_default(soft_dec_cfg_t *cfg);
+/* stats, if set, stays valid until close and is kept up to date by the ops */
+int soft_dec_ops(file_source_dec_ops_t *ops, const soft_dec_cfg_t *cfg, soft_dec_stats_t *stats);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * Host tests: retinaface.h pulls in OpenCV. Only what heatmap.cpp and
+ * best_shot.cpp use: a Mat over its own or a caller's buffer, filled by the
+ * module or by the conversion and codec calls a test defines.
+ */
+#ifndef __STUB_OPENCV2_CORE_HPP
+#define __STUB_OPENCV2_CORE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define CV_8UC1 0
+#define CV_8UC3 16
+
+namespace cv {
+
+class Mat {
+public:
+	Mat() : rows(0), cols(0), step(0), data(NULL) {}
+	Mat(int rows, int cols, int type) : rows(rows), cols(cols), step((size_t)cols * Channels(type)) {
+		buf.resize((size_t)rows * step);
+		data = buf.data();
+	}
+	Mat(int rows, int cols, int type, void *data)
+	    : rows(rows), cols(cols), step((size_t)cols * Channels(type)), data((uint8_t *)data) {}
+	void create(int r, int c, int type) {
+		rows = r;
+		cols = c;
+		step = (size_t)c * Channels(type);
+		buf.resize((size_t)r * step);
+		data = buf.data();
+	}
+	int rows;
+	int cols;
+	size_t step;
+	uint8_t *data;
+
+private:
+	static int Channels(int type) { return type == CV_8UC3 ? 3 : 1; }
+	std::vector<uint8_t> buf;
+};
+
+}
+
+#endif
@@ -0,0 +1,17 @@
+/* Host tests: retinaface.h pulls in OpenCV. The codec calls are defined by the tests that need them. */
+#ifndef __STUB_OPENCV2_HIGHGUI_HPP
+#define __STUB_OPENCV2_HIGHGUI_HPP
+
+#include "opencv2/core/core.hpp"
+
+namespace cv {
+
+enum { IMWRITE_JPEG_QUALITY = 1 };
+
+bool imwrite(const std::string &filename, const Mat &img, const std::vector<int> &params = std::vector<int>());
+bool imencode(const std::string &ext, const Mat &img, std::vector<uint8_t> &buf,
+              const std::vector<int> &params = std::vector<int>());
+
+}
+
+#endif
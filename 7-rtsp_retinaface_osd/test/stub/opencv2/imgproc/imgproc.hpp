@@ -0,0 +1,15 @@
+/* Host tests: retinaface.h pulls in OpenCV. cvtColor() is defined by the test that needs it. */
+#ifndef __STUB_OPENCV2_IMGPROC_HPP
+#define __STUB_OPENCV2_IMGPROC_HPP
+
+#include "opencv2/core/core.hpp"
+
+namespace cv {
+
+enum { COLOR_YUV2BGR_NV12 = 90 };
+
+void cvtColor(const Mat &src, Mat &dst, int code);
+
+}
+
+#endif
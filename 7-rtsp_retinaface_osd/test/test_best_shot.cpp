@@ -0,0 +1,381 @@
+/*****************************************************************************
+* | Function    :   Host test: best_shot ends tracks without waiting for the
+*                   JPEG encoder, which runs on its own thread
+*
+******************************************************************************/
+
+#include <sys/stat.h>
+#include <map>
+
+#include "luckfox_mpi.h"
+#include "best_shot.h"
+#include "rt_sched.h"
+#include "host_test.h"
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+// the CPU encoder: "JPEG" is FF D8, the chip's mean byte, FF D9; it can be held or made to fail
+static pthread_mutex_t g_enc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_enc_cond = PTHREAD_COND_INITIALIZER;
+static bool g_enc_hold;
+static bool g_enc_fail;
+static int g_enc_calls;
+static RK_U32 g_enc_sleep_us;
+
+namespace cv {
+void cvtColor(const Mat &src, Mat &dst, int code) {
+	(void)code;
+	int rows = src.rows * 2 / 3;
+	dst.create(rows, src.cols, CV_8UC3);
+	for (int i = 0; i < rows * src.cols; i++)
+		dst.data[i * 3] = dst.data[i * 3 + 1] = dst.data[i * 3 + 2] = src.data[i];
+}
+
+bool imencode(const std::string &ext, const Mat &img, std::vector<uint8_t> &buf, const std::vector<int> &params) {
+	(void)ext;
+	(void)params;
+	pthread_mutex_lock(&g_enc_lock);
+	g_enc_calls++;
+	while (g_enc_hold)
+		pthread_cond_wait(&g_enc_cond, &g_enc_lock);
+	bool fail = g_enc_fail;
+	pthread_mutex_unlock(&g_enc_lock);
+	if (g_enc_sleep_us)
+		usleep(g_enc_sleep_us);
+	if (fail)
+		return false;
+	RK_U64 sum = 0;
+	for (int i = 0; i < img.rows * (int)img.step; i++)
+		sum += img.data[i];
+	buf.assign({0xff, 0xd8, (uint8_t)(sum / (img.rows * img.step)), 0xff, 0xd9});
+	return true;
+}
+}
+
+// no MJPEG channel on the host
+int venc_jpeg_init(int chnId, int width, int height, int qfactor) {
+	(void)chnId;
+	(void)width;
+	(void)height;
+	(void)qfactor;
+	return -1;
+}
+
+int venc_encode_frame(int chnId, const VIDEO_FRAME_INFO_S *frame, void *out, int out_size, int timeout_ms) {
+	(void)chnId;
+	(void)frame;
+	(void)out;
+	(void)out_size;
+	(void)timeout_ms;
+	return -1;
+}
+
+static void Hold(bool hold) {
+	pthread_mutex_lock(&g_enc_lock);
+	g_enc_hold = hold;
+	pthread_cond_broadcast(&g_enc_cond);
+	pthread_mutex_unlock(&g_enc_lock);
+}
+
+static int EncodeCalls() {
+	pthread_mutex_lock(&g_enc_lock);
+	int calls = g_enc_calls;
+	pthread_mutex_unlock(&g_enc_lock);
+	return calls;
+}
+
+typedef struct {
+	pthread_mutex_t lock;
+	std::map<RK_U32, int> mean;		// track id -> mean byte of its JPEG
+	pthread_t thread;
+} shots_t;
+
+static shots_t g_shots = {PTHREAD_MUTEX_INITIALIZER, {}, 0};
+
+static void OnShot(const best_shot_t *shot, void *arg) {
+	shots_t *shots = (shots_t *)arg;
+	pthread_mutex_lock(&shots->lock);
+	shots->mean[shot->track_id] = shot->jpeg_size == 5 ? shot->jpeg[2] : -1;
+	shots->thread = pthread_self();
+	pthread_mutex_unlock(&shots->lock);
+}
+
+static size_t ShotCount() {
+	pthread_mutex_lock(&g_shots.lock);
+	size_t n = g_shots.mean.size();
+	pthread_mutex_unlock(&g_shots.lock);
+	return n;
+}
+
+static bool WaitShots(size_t n) {
+	for (int i = 0; i < 200 && ShotCount() < n; i++)
+		usleep(10000);
+	return ShotCount() >= n;
+}
+
+// 320x320 NV12, 4 px checkers of lo/hi grey: sharp enough for a full sharpness score
+static std::vector<uint8_t> Image(uint8_t lo, uint8_t hi) {
+	std::vector<uint8_t> nv12(320 * 320 * 3 / 2, 128);
+	for (int y = 0; y < 320; y++)
+		for (int x = 0; x < 320; x++)
+			nv12[y * 320 + x] = ((x / 4 + y / 4) & 1) ? hi : lo;
+	return nv12;
+}
+
+static best_shot_image_t View(const std::vector<uint8_t> &nv12, RK_U32 side = 320, float scale = 1.0f) {
+	best_shot_image_t image;
+	image.y = nv12.data();
+	image.uv = nv12.data() + side * side;
+	image.width = side;
+	image.height = side;
+	image.stride = side;
+	image.sx = scale;
+	image.sy = scale;
+	return image;
+}
+
+static track_t Track(RK_U32 id, float score, RK_U64 pts, RK_U32 size = 96) {
+	track_t t;
+	memset(&t, 0, sizeof(t));
+	t.id = id;
+	t.score = score;
+	t.box.s32X = 100;
+	t.box.s32Y = 100;
+	t.box.u32Width = size;
+	t.box.u32Height = size;
+	t.first_pts = pts;
+	t.last_pts = pts;
+	t.confirmed = true;
+	return t;
+}
+
+// frontal: nose half way between the eyes, a little above half way to the mouth
+static const POINT_S g_landmarks[BEST_SHOT_LANDMARKS] = {{124, 130}, {172, 130}, {148, 150}, {128, 175}, {168, 175}};
+
+static char g_dir[64];
+
+static void Init(best_shot_ctx_t *bs, RK_U32 slots) {
+	best_shot_cfg_t cfg;
+
+	pthread_mutex_lock(&g_shots.lock);
+	g_shots.mean.clear();
+	pthread_mutex_unlock(&g_shots.lock);
+	g_enc_calls = 0;
+	g_enc_fail = false;
+	g_enc_sleep_us = 0;
+	best_shot_cfg_default(&cfg);
+	cfg.slots = slots;
+	cfg.dir = g_dir;
+	cfg.cb = OnShot;
+	cfg.cb_arg = &g_shots;
+	CHECK_EQ(best_shot_init(bs, &cfg), 0);
+}
+
+static const best_shot_slot_t *Slot(const best_shot_ctx_t *bs, RK_U32 track_id) {
+	for (RK_U32 i = 0; i < bs->cfg.slots; i++) {
+		if (bs->slots[i].track_id == track_id)
+			return &bs->slots[i];
+	}
+	return NULL;
+}
+
+// the end returns with the encoder stuck; the JPEG and the file come from the encoder thread
+static void TestTrackEndDoesNotWait() {
+	best_shot_ctx_t bs;
+	std::vector<uint8_t> nv12 = Image(0, 255);
+	best_shot_image_t image = View(nv12);
+	track_t track = Track(7, 0.9f, 123456);
+
+	Init(&bs, 4);
+	best_shot_offer(&bs, &track, &image, g_landmarks);
+	CHECK(Slot(&bs, 7) != NULL);
+	CHECK(Slot(&bs, 7)->score > bs.cfg.min_score);
+
+	Hold(true);
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	best_shot_track_end(&track, &bs);
+	RK_U64 took = TEST_COMM_GetNowUs() - begin;
+	CHECK(took < 20000);
+	CHECK(Slot(&bs, 7) != NULL && Slot(&bs, 7)->queued);
+	for (int i = 0; i < 100 && EncodeCalls() == 0; i++)
+		usleep(1000);
+	CHECK_EQ(EncodeCalls(), 1);
+	CHECK_EQ(ShotCount(), 0);
+
+	Hold(false);
+	CHECK(WaitShots(1));
+	CHECK(!pthread_equal(g_shots.thread, pthread_self()));
+	CHECK_EQ(g_shots.mean[7], 127);
+	char path[128];
+	struct stat st;
+	snprintf(path, sizeof(path), "%s/best_7_123456.jpg", g_dir);
+	CHECK_EQ(stat(path, &st), 0);
+	CHECK_EQ(st.st_size, 5);
+	unlink(path);
+
+	// given back on the next call from the detection thread
+	track_t other = Track(8, 0.9f, 200000);
+	best_shot_offer(&bs, &other, &image, g_landmarks);
+	CHECK(Slot(&bs, 7) == NULL);
+	CHECK_EQ(bs.emitted, 1);
+	best_shot_deinit(&bs);
+}
+
+// a queued chip is neither evicted nor overwritten by new tracks
+static void TestQueuedSlotIsKept() {
+	best_shot_ctx_t bs;
+	std::vector<uint8_t> grey = Image(100, 156);
+	std::vector<uint8_t> sharp = Image(0, 255);
+	best_shot_image_t weak = View(grey);
+	best_shot_image_t strong = View(sharp);
+	track_t a = Track(1, 0.6f, 1000);
+	track_t b = Track(2, 0.6f, 2000);
+	track_t c = Track(3, 0.95f, 3000);
+	track_t d = Track(4, 0.95f, 4000);
+
+	Init(&bs, 2);
+	best_shot_offer(&bs, &a, &weak, g_landmarks);
+	best_shot_offer(&bs, &b, &weak, g_landmarks);
+	Hold(true);
+	best_shot_track_end(&a, &bs);
+
+	// the weakest unqueued chip goes, a's stays with the encoder
+	best_shot_offer(&bs, &c, &strong, g_landmarks);
+	CHECK_EQ(bs.evicted, 1);
+	CHECK(Slot(&bs, 1) != NULL && Slot(&bs, 1)->queued);
+	CHECK(Slot(&bs, 2) == NULL);
+	CHECK(Slot(&bs, 3) != NULL);
+	// nothing weaker left to evict
+	best_shot_offer(&bs, &d, &strong, g_landmarks);
+	CHECK_EQ(bs.rejected, 1);
+	CHECK(Slot(&bs, 4) == NULL);
+
+	Hold(false);
+	CHECK(WaitShots(1));
+	CHECK_EQ(g_shots.mean[1], 128);
+	best_shot_offer(&bs, &d, &strong, g_landmarks);
+	CHECK(Slot(&bs, 4) != NULL);
+	best_shot_deinit(&bs);
+}
+
+// below min_score, out of tokens or a failed encode: the slot comes back, nothing is written
+static void TestNothingToEmit() {
+	best_shot_ctx_t bs;
+	std::vector<uint8_t> nv12 = Image(0, 255);
+	best_shot_image_t image = View(nv12);
+
+	Init(&bs, 4);
+	track_t low = Track(1, 0.2f, 1000);
+	best_shot_offer(&bs, &low, &image, g_landmarks);
+	best_shot_track_end(&low, &bs);
+	CHECK(Slot(&bs, 1) == NULL);
+
+	bs.tokens = 0.0f;
+	track_t limited = Track(2, 0.9f, 2000);
+	best_shot_offer(&bs, &limited, &image, g_landmarks);
+	best_shot_track_end(&limited, &bs);
+	CHECK(Slot(&bs, 2) == NULL);
+	CHECK_EQ(bs.limited, 1);
+	CHECK_EQ(EncodeCalls(), 0);
+
+	bs.tokens = 1.0f;
+	g_enc_fail = true;
+	track_t failed = Track(3, 0.9f, 3000);
+	best_shot_offer(&bs, &failed, &image, g_landmarks);
+	best_shot_track_end(&failed, &bs);
+	best_shot_deinit(&bs);
+	CHECK_EQ(bs.encode_errors, 1);
+	CHECK_EQ(bs.emitted, 0);
+	CHECK_EQ(ShotCount(), 0);
+}
+
+/*
+ * Sharpness comes from the face at the frame's own resolution: a small face
+ * of one pixel detail scores full, however much its chip is upsampled, a
+ * smooth one scores low. The chip is NV12 cut from the same frame.
+ */
+static void TestNativeSharpness() {
+	best_shot_ctx_t bs;
+	// 640x640 with box coordinates in 320x320, like a 2x sensor frame under display boxes
+	std::vector<uint8_t> fine(640 * 640 * 3 / 2);
+	std::vector<uint8_t> ramp(640 * 640 * 3 / 2);
+	for (int y = 0; y < 640; y++) {
+		for (int x = 0; x < 640; x++) {
+			fine[y * 640 + x] = ((x + y) & 1) ? 255 : 0;
+			ramp[y * 640 + x] = (uint8_t)((x + y) / 5);
+		}
+	}
+	for (int i = 640 * 640; i < 640 * 640 * 3 / 2; i += 2) {
+		fine[i] = ramp[i] = 60;
+		fine[i + 1] = ramp[i + 1] = 200;
+	}
+	best_shot_image_t sharp = View(fine, 640, 2.0f);
+	best_shot_image_t smooth = View(ramp, 640, 2.0f);
+	track_t small = Track(1, 0.9f, 1000, 48);
+	track_t soft = Track(2, 0.9f, 2000, 48);
+
+	Init(&bs, 4);
+	best_shot_offer(&bs, &small, &sharp, g_landmarks);
+	best_shot_offer(&bs, &soft, &smooth, g_landmarks);
+	CHECK(Slot(&bs, 1) != NULL && Slot(&bs, 2) != NULL);
+	CHECK_NEAR(Slot(&bs, 1)->sharpness, 1.0f, 1e-6f);
+	CHECK(Slot(&bs, 2)->sharpness < 0.1f);
+	CHECK(Slot(&bs, 1)->score > Slot(&bs, 2)->score);
+
+	// luma samples of the source, chroma pairs copied as they are
+	RK_U32 chip = bs.cfg.chip;
+	const uint8_t *nv12 = Slot(&bs, 1)->nv12;
+	bool binary = true, chroma = true;
+	for (RK_U32 i = 0; i < chip * chip; i++)
+		binary = binary && (nv12[i] == 0 || nv12[i] == 255);
+	for (RK_U32 i = chip * chip; i < chip * chip * 3 / 2; i += 2)
+		chroma = chroma && nv12[i] == 60 && nv12[i + 1] == 200;
+	CHECK(binary);
+	CHECK(chroma);
+	best_shot_deinit(&bs);
+}
+
+// shutdown encodes what is still queued
+static void TestDeinitDrains() {
+	best_shot_ctx_t bs;
+	std::vector<uint8_t> nv12 = Image(0, 255);
+	best_shot_image_t image = View(nv12);
+
+	Init(&bs, 4);
+	g_enc_sleep_us = 30000;
+	for (RK_U32 id = 1; id <= 3; id++) {
+		track_t t = Track(id, 0.9f, id * 1000);
+		best_shot_offer(&bs, &t, &image, g_landmarks);
+	}
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	for (RK_U32 id = 1; id <= 3; id++) {
+		track_t t = Track(id, 0.9f, id * 1000);
+		best_shot_track_end(&t, &bs);
+	}
+	CHECK(TEST_COMM_GetNowUs() - begin < 30000);
+	best_shot_deinit(&bs);
+	CHECK_EQ(bs.emitted, 3);
+	CHECK_EQ(ShotCount(), 3);
+	for (RK_U32 id = 1; id <= 3; id++) {
+		char path[128];
+		snprintf(path, sizeof(path), "%s/best_%u_%u.jpg", g_dir, id, id * 1000);
+		CHECK_EQ(unlink(path), 0);
+	}
+}
+
+int main() {
+	rt_sched_profile_t profile;
+
+	rt_sched_profile_default(&profile);
+	rt_sched_init(&profile);
+	snprintf(g_dir, sizeof(g_dir), "/tmp/test_best_shot_%d", (int)getpid());
+	mkdir(g_dir, 0755);
+	TestTrackEndDoesNotWait();
+	TestQueuedSlotIsKept();
+	TestNothingToEmit();
+	TestNativeSharpness();
+	TestDeinitDrains();
+	rmdir(g_dir);
+	return HOST_TEST_RESULT();
+}
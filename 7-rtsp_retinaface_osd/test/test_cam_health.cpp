@@ -0,0 +1,229 @@
+/*****************************************************************************
+* | Function    :   Host test: camera health events on synthetic degraded
+*                   luma planes (blur, occlusion, exposure, noise)
+*
+******************************************************************************/
+
+#include <math.h>
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "cam_health.h"
+#include "host_test.h"
+
+// the gate frame of the VPSS path, analysed at 1/4
+#define W 360
+#define H 240
+
+typedef std::vector<uint8_t> plane_t;
+
+static int g_on[CAM_HEALTH_EVENT_NUM];
+static int g_off[CAM_HEALTH_EVENT_NUM];
+
+static void OnEvent(cam_health_event_e event, bool active, const cam_health_metrics_t *m, void *arg) {
+	(void)m;
+	(void)arg;
+	if (active)
+		g_on[event]++;
+	else
+		g_off[event]++;
+}
+
+static RK_U32 g_seed;
+
+static RK_U32 Random() {
+	g_seed = g_seed * 1103515245 + 12345;
+	return g_seed >> 16;
+}
+
+// 12x12 blocks of random grey between 60 and 200: sharp edges, flat insides
+static plane_t Scene() {
+	plane_t p(W * H);
+	uint8_t blocks[(W / 12) * (H / 12)];
+
+	g_seed = 1;
+	for (RK_U32 i = 0; i < sizeof(blocks); i++)
+		blocks[i] = 60 + Random() % 141;
+	for (int y = 0; y < H; y++)
+		for (int x = 0; x < W; x++)
+			p[y * W + x] = blocks[(y / 12) * (W / 12) + x / 12];
+	return p;
+}
+
+// box blur of the given radius, a lens out of focus
+static plane_t Blur(const plane_t &src, int r) {
+	plane_t dst(W * H);
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			int sum = 0, n = 0;
+			for (int dy = -r; dy <= r; dy++) {
+				for (int dx = -r; dx <= r; dx++) {
+					int sx = x + dx, sy = y + dy;
+					if (sx < 0 || sy < 0 || sx >= W || sy >= H)
+						continue;
+					sum += src[sy * W + sx];
+					n++;
+				}
+			}
+			dst[y * W + x] = sum / n;
+		}
+	}
+	return dst;
+}
+
+// level * src / 256 + offset, clipped
+static plane_t Levels(const plane_t &src, int level, int offset) {
+	plane_t dst(W * H);
+	for (int i = 0; i < W * H; i++) {
+		int v = src[i] * level / 256 + offset;
+		dst[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+	return dst;
+}
+
+// gaussian sensor noise, Box-Muller
+static plane_t Noise(const plane_t &src, float sigma) {
+	plane_t dst(W * H);
+	g_seed = 7;
+	for (int i = 0; i < W * H; i++) {
+		float u1 = (Random() + 1.0f) / 65537.0f;
+		float u2 = Random() / 65536.0f;
+		float g = sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+		int v = src[i] + (int)lrintf(g * sigma);
+		dst[i] = v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+	return dst;
+}
+
+// a lens cap: flat dark grey with a little sensor noise
+static plane_t Covered() {
+	return Noise(plane_t(W * H, 40), 2.0f);
+}
+
+static void Init(cam_health_t *health) {
+	cam_health_cfg_t cfg;
+
+	memset(g_on, 0, sizeof(g_on));
+	memset(g_off, 0, sizeof(g_off));
+	cam_health_cfg_default(&cfg, W, H, 4);
+	cfg.cb = OnEvent;
+	CHECK_EQ(cam_health_init(health, &cfg), 0);
+}
+
+static void Run(cam_health_t *health, const plane_t &p, int times) {
+	for (int i = 0; i < times; i++)
+		cam_health_process_luma(health, p.data(), W);
+}
+
+static int EventCount() {
+	int n = 0;
+	for (int i = 0; i < CAM_HEALTH_EVENT_NUM; i++)
+		n += g_on[i] + g_off[i];
+	return n;
+}
+
+// a healthy scene raises nothing and learns its sharpness
+static void TestHealthySceneIsQuiet() {
+	cam_health_t health;
+
+	Init(&health);
+	Run(&health, Scene(), 20);
+	CHECK_EQ(EventCount(), 0);
+	CHECK(health.have_baseline);
+	// block edges below the edge gradient leak in a little
+	CHECK(health.metrics.noise_sigma < 3.0f);
+	cam_health_deinit(&health);
+}
+
+// defocus after the debounce, and it clears when the lens is sharp again
+static void TestBlurIsDefocus() {
+	cam_health_t health;
+	plane_t sharp = Scene();
+	plane_t blurred = Blur(sharp, 6);
+
+	Init(&health);
+	Run(&health, sharp, 10);
+	Run(&health, blurred, 2);
+	CHECK_EQ(g_on[CAM_HEALTH_DEFOCUS], 0);
+	Run(&health, blurred, 1);
+	CHECK_EQ(g_on[CAM_HEALTH_DEFOCUS], 1);
+	// the baseline does not follow the blur down
+	Run(&health, blurred, 30);
+	CHECK(health.active[CAM_HEALTH_DEFOCUS]);
+	Run(&health, sharp, 3);
+	CHECK_EQ(g_off[CAM_HEALTH_DEFOCUS], 1);
+	CHECK_EQ(EventCount(), 2);
+	cam_health_deinit(&health);
+}
+
+// a sudden flat picture is an occlusion, not defocus or underexposure
+static void TestSuddenFlatIsOcclusion() {
+	cam_health_t health;
+	plane_t scene = Scene();
+
+	Init(&health);
+	Run(&health, scene, 10);
+	Run(&health, Covered(), 5);
+	CHECK_EQ(g_on[CAM_HEALTH_OCCLUDED], 1);
+	CHECK_EQ(g_on[CAM_HEALTH_DEFOCUS], 0);
+	CHECK_EQ(g_on[CAM_HEALTH_UNDEREXPOSED], 0);
+	Run(&health, scene, 3);
+	CHECK_EQ(g_off[CAM_HEALTH_OCCLUDED], 1);
+	cam_health_deinit(&health);
+}
+
+// night falling: the same flat dark picture reached slowly is underexposure, not an occlusion
+static void TestSlowFadeIsUnderexposure() {
+	cam_health_t health;
+	plane_t scene = Scene();
+
+	Init(&health);
+	Run(&health, scene, 10);
+	for (int level = 256; level >= 8; level -= 8)
+		Run(&health, Levels(scene, level, 0), 1);
+	Run(&health, Levels(scene, 8, 0), 5);
+	CHECK_EQ(g_on[CAM_HEALTH_OCCLUDED], 0);
+	CHECK_EQ(g_on[CAM_HEALTH_UNDEREXPOSED], 1);
+	CHECK(health.metrics.dark_ratio > 0.25f);
+	cam_health_deinit(&health);
+}
+
+static void TestClippedHighlightsAreOverexposure() {
+	cam_health_t health;
+	plane_t scene = Scene();
+
+	Init(&health);
+	Run(&health, scene, 10);
+	Run(&health, Levels(scene, 256, 110), 3);
+	CHECK_EQ(g_on[CAM_HEALTH_OVEREXPOSED], 1);
+	CHECK(health.metrics.bright_ratio > 0.25f);
+	CHECK_EQ(g_on[CAM_HEALTH_OCCLUDED], 0);
+	Run(&health, scene, 3);
+	CHECK_EQ(g_off[CAM_HEALTH_OVEREXPOSED], 1);
+	cam_health_deinit(&health);
+}
+
+// sensor noise is measured on the flat areas only, the block edges do not count
+static void TestNoiseIsMeasured() {
+	cam_health_t health;
+	plane_t scene = Scene();
+
+	Init(&health);
+	Run(&health, Noise(scene, 5.0f), 3);
+	CHECK_NEAR(health.metrics.noise_sigma, 5.0f, 1.5f);
+	CHECK_EQ(g_on[CAM_HEALTH_NOISY], 0);
+	Run(&health, Noise(scene, 20.0f), 3);
+	CHECK(health.metrics.noise_sigma > 12.0f);
+	CHECK_EQ(g_on[CAM_HEALTH_NOISY], 1);
+	cam_health_deinit(&health);
+}
+
+int main() {
+	TestHealthySceneIsQuiet();
+	TestBlurIsDefocus();
+	TestSuddenFlatIsOcclusion();
+	TestSlowFadeIsUnderexposure();
+	TestClippedHighlightsAreOverexposure();
+	TestNoiseIsMeasured();
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,247 @@
+/*****************************************************************************
+* | Function    :   Host test: crop mosaic shelf packing, cut edges, rendering
+*                   and canvas detections mapped back to the frame
+*
+******************************************************************************/
+
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "crop_mosaic.h"
+#include "host_test.h"
+
+#define FRAME_W 720
+#define FRAME_H 480
+#define CANVAS 640
+
+// no NPU on the host: crop_mosaic_bench() is not covered, split gets hand made canvas detections
+int inference_retinaface_model_ex(rknn_app_context_t *app_ctx, object_detect_result_list *od_results,
+                                  const retinaface_thresh_t *thresh) {
+	(void)app_ctx;
+	(void)thresh;
+	od_results->count = 0;
+	return 0;
+}
+
+static void Init(crop_mosaic_t *m) {
+	crop_mosaic_cfg_t cfg;
+	crop_mosaic_cfg_default(&cfg, CANVAS, CANVAS);
+	CHECK_EQ(crop_mosaic_init(m, &cfg), 0);
+}
+
+static void CheckTile(const crop_mosaic_tile_t *tile, int tag, RK_S32 x, RK_S32 y, RK_U32 w, RK_U32 h,
+                      RK_U32 cut_edges) {
+	CHECK(tile->placed);
+	CHECK_EQ(tile->tag, tag);
+	CHECK_EQ(tile->x, x);
+	CHECK_EQ(tile->y, y);
+	CHECK_EQ(tile->w, w);
+	CHECK_EQ(tile->h, h);
+	CHECK_EQ(tile->cut_edges, cut_edges);
+}
+
+static void CheckRect(const RECT_S *r, RK_S32 x, RK_S32 y, RK_U32 w, RK_U32 h) {
+	CHECK_EQ(r->s32X, x);
+	CHECK_EQ(r->s32Y, y);
+	CHECK_EQ(r->u32Width, w);
+	CHECK_EQ(r->u32Height, h);
+}
+
+/*
+ * a 80x80 inside:       x2 -> 160x160, every edge cut
+ * b 40x80 inside:       x2 -> 80x160
+ * c 160x80 inside:      x1 -> 160x80
+ * d 20x20 at 0,0:       x4 (capped) -> 80x80, left and top are the frame's
+ * e 80x80 over the corner: clipped to 40x40, x4 -> 160x160, right and bottom are the frame's
+ * f off the frame:      dropped
+ * Tallest first, equal heights in order: a b e on shelf 0, then c, d does not fit there any more.
+ */
+static const RECT_S g_rois[6] = {{100, 100, 80, 80}, {300, 100, 40, 80}, {500, 300, 160, 80},
+                                 {0, 0, 20, 20},     {680, 440, 80, 80}, {800, 0, 50, 50}};
+static const int g_tags[6] = {10, 11, 12, 13, 14, 15};
+
+#define ALL_EDGES (CROP_MOSAIC_EDGE_LEFT | CROP_MOSAIC_EDGE_TOP | CROP_MOSAIC_EDGE_RIGHT | CROP_MOSAIC_EDGE_BOTTOM)
+
+static void TestPack() {
+	crop_mosaic_t m;
+
+	Init(&m);
+	CHECK_EQ(crop_mosaic_pack(&m, g_rois, g_tags, 6, FRAME_W, FRAME_H), 5);
+	CHECK_EQ(m.count, 5);
+	CHECK_EQ(m.side, 160);
+	CheckTile(&m.tiles[0], 10, 0, 0, 160, 160, ALL_EDGES);
+	CheckTile(&m.tiles[1], 11, 168, 0, 80, 160, ALL_EDGES);
+	CheckTile(&m.tiles[2], 12, 424, 0, 160, 80, ALL_EDGES);
+	CheckTile(&m.tiles[3], 13, 0, 168, 80, 80, CROP_MOSAIC_EDGE_RIGHT | CROP_MOSAIC_EDGE_BOTTOM);
+	CheckTile(&m.tiles[4], 14, 256, 0, 160, 160, CROP_MOSAIC_EDGE_LEFT | CROP_MOSAIC_EDGE_TOP);
+	CheckRect(&m.tiles[4].roi, 680, 440, 40, 40);
+	CHECK_EQ(m.spilled, 0);
+
+	// no tags: the index in the caller's list
+	CHECK_EQ(crop_mosaic_pack(&m, g_rois, NULL, 2, FRAME_W, FRAME_H), 2);
+	CHECK_EQ(m.tiles[1].tag, 1);
+	crop_mosaic_deinit(&m);
+}
+
+// 16 of 160 only place 9; at 0.8x (128) four shelves of four take them all; below min_tile the rest spill
+static void TestShrinkAndSpill() {
+	crop_mosaic_t m;
+	RECT_S rois[CROP_MOSAIC_MAX_TILES];
+
+	for (int i = 0; i < CROP_MOSAIC_MAX_TILES; i++) {
+		rois[i].s32X = 10 + (i % 6) * 110;
+		rois[i].s32Y = 10 + (i / 6) * 110;
+		rois[i].u32Width = 100;
+		rois[i].u32Height = 100;
+	}
+	Init(&m);
+	CHECK_EQ(crop_mosaic_pack(&m, rois, NULL, CROP_MOSAIC_MAX_TILES, FRAME_W, FRAME_H), CROP_MOSAIC_MAX_TILES);
+	CHECK_EQ(m.side, 128);
+	for (int i = 0; i < CROP_MOSAIC_MAX_TILES; i++) {
+		CHECK_EQ(m.tiles[i].w, 128);
+		CHECK_EQ(m.tiles[i].x, (i % 4) * 136);
+		CHECK_EQ(m.tiles[i].y, (i / 4) * 136);
+	}
+	crop_mosaic_deinit(&m);
+
+	crop_mosaic_cfg_t cfg;
+	crop_mosaic_cfg_default(&cfg, CANVAS, CANVAS);
+	cfg.min_tile = 160;
+	CHECK_EQ(crop_mosaic_init(&m, &cfg), 0);
+	CHECK_EQ(crop_mosaic_pack(&m, rois, NULL, CROP_MOSAIC_MAX_TILES, FRAME_W, FRAME_H), 9);
+	CHECK_EQ(m.spilled, 7);
+	for (int i = 0; i < CROP_MOSAIC_MAX_TILES; i++)
+		CHECK_EQ(m.tiles[i].placed, i < 9);
+	crop_mosaic_deinit(&m);
+}
+
+// tile pixel centres sample the ROI; gaps and the unused canvas stay black
+static void TestRender() {
+	crop_mosaic_t m;
+	crop_mosaic_image_t image;
+	std::vector<uint8_t> bgr(FRAME_W * FRAME_H * 3);
+	std::vector<uint8_t> canvas(CANVAS * CANVAS * 3, 0xaa);
+
+	for (int y = 0; y < FRAME_H; y++) {
+		for (int x = 0; x < FRAME_W; x++) {
+			uint8_t *p = &bgr[(y * FRAME_W + x) * 3];
+			p[0] = (uint8_t)(x / 3);
+			p[1] = (uint8_t)(y / 2);
+			p[2] = 200;
+		}
+	}
+	memset(&image, 0, sizeof(image));
+	image.data = bgr.data();
+	image.format = CROP_MOSAIC_BGR888;
+	image.width = FRAME_W;
+	image.height = FRAME_H;
+	image.stride = FRAME_W * 3;
+	image.sx = 1.0f;
+	image.sy = 1.0f;
+	Init(&m);
+	crop_mosaic_pack(&m, g_rois, g_tags, 6, FRAME_W, FRAME_H);
+	crop_mosaic_render(&m, &image, canvas.data());
+
+	// a at 2x: canvas (10, 20) is frame (100 + 10.5 / 2, 100 + 20.5 / 2) = (105, 110)
+	const uint8_t *p = &canvas[(20 * CANVAS + 10) * 3];
+	CHECK_EQ(p[0], 105 / 3);
+	CHECK_EQ(p[1], 110 / 2);
+	CHECK_EQ(p[2], 200);
+	// e at 4x from the clipped ROI: canvas (256 + 159, 159) is frame (719, 479)
+	p = &canvas[(159 * CANVAS + 415) * 3];
+	CHECK_EQ(p[0], 719 / 3);
+	CHECK_EQ(p[1], 479 / 2);
+	// the gap between a and b, and below the last shelf
+	p = &canvas[(50 * CANVAS + 163) * 3];
+	CHECK(p[0] == 0 && p[1] == 0 && p[2] == 0);
+	p = &canvas[(600 * CANVAS + 300) * 3];
+	CHECK(p[0] == 0 && p[1] == 0 && p[2] == 0);
+	crop_mosaic_deinit(&m);
+}
+
+static object_detect_result Det(int left, int top, int right, int bottom) {
+	object_detect_result det;
+	memset(&det, 0, sizeof(det));
+	det.box.left = left;
+	det.box.top = top;
+	det.box.right = right;
+	det.box.bottom = bottom;
+	det.prop = 0.9f;
+	for (int k = 0; k < 5; k++) {
+		det.point[k].x = left + (right - left) * (k + 1) / 6;
+		det.point[k].y = top + (bottom - top) * (k + 1) / 6;
+	}
+	return det;
+}
+
+/*
+ * Canvas boxes back in frame pixels. Near a cut edge a box is a partial
+ * face and goes; near an edge the ROI shares with the frame it is whole
+ * and stays. A centre in no tile is stray.
+ */
+static void TestSplit() {
+	crop_mosaic_t m;
+	object_detect_result_list canvas;
+	crop_mosaic_det_t out[8];
+
+	Init(&m);
+	crop_mosaic_pack(&m, g_rois, g_tags, 6, FRAME_W, FRAME_H);
+	canvas.count = 0;
+	canvas.results[canvas.count++] = Det(40, 40, 120, 120);		// a, inside
+	canvas.results[canvas.count++] = Det(100, 40, 159, 120);	// a, on its cut right edge
+	canvas.results[canvas.count++] = Det(0, 170, 40, 210);		// d, on the frame's left edge
+	canvas.results[canvas.count++] = Det(20, 200, 60, 248);		// d, on its cut bottom edge
+	canvas.results[canvas.count++] = Det(336, 80, 416, 160);	// e, on the frame's corner
+	canvas.results[canvas.count++] = Det(256, 40, 296, 80);		// e, on its cut left edge
+	canvas.results[canvas.count++] = Det(158, 50, 170, 60);		// centre in the gap between a and b
+	canvas.results[canvas.count++] = Det(200, 400, 240, 440);	// below the shelves
+	canvas.results[canvas.count++] = Det(448, 10, 528, 70);		// c, inside
+
+	int n = crop_mosaic_split(&m, &canvas, out, 8);
+	CHECK_EQ(n, 4);
+	CHECK_EQ(m.straddling, 3);
+	CHECK_EQ(m.stray, 2);
+	CHECK_EQ(m.dets, 4);
+
+	// a: 80 frame pixels on 160 canvas pixels
+	CHECK_EQ(out[0].tile, 0);
+	CHECK_EQ(out[0].tag, 10);
+	CHECK_EQ(out[0].det.box.left, 120);
+	CHECK_EQ(out[0].det.box.top, 120);
+	CHECK_EQ(out[0].det.box.right, 160);
+	CHECK_EQ(out[0].det.box.bottom, 160);
+	// landmarks too: canvas 53 -> 100 + 26
+	CHECK_EQ(out[0].det.point[0].x, 126);
+	CHECK_EQ(out[0].det.point[0].y, 126);
+	CHECK_NEAR(out[0].det.prop, 0.9f, 1e-6f);
+	// d: 20 on 80
+	CHECK_EQ(out[1].tag, 13);
+	CHECK_EQ(out[1].det.box.left, 0);
+	CHECK_EQ(out[1].det.box.top, 0);
+	CHECK_EQ(out[1].det.box.right, 10);
+	CHECK_EQ(out[1].det.box.bottom, 10);
+	// e: 40 on 160 from the clipped corner
+	CHECK_EQ(out[2].tag, 14);
+	CHECK_EQ(out[2].det.box.left, 700);
+	CHECK_EQ(out[2].det.box.top, 460);
+	CHECK_EQ(out[2].det.box.right, 720);
+	CHECK_EQ(out[2].det.box.bottom, 480);
+	// c: 1:1
+	CHECK_EQ(out[3].tag, 12);
+	CHECK_EQ(out[3].det.box.left, 524);
+	CHECK_EQ(out[3].det.box.top, 310);
+	CHECK_EQ(out[3].det.box.right, 604);
+	CHECK_EQ(out[3].det.box.bottom, 370);
+
+	// out is bounded by max
+	CHECK_EQ(crop_mosaic_split(&m, &canvas, out, 1), 1);
+	crop_mosaic_deinit(&m);
+}
+
+int main() {
+	TestPack();
+	TestShrinkAndSpill();
+	TestRender();
+	TestSplit();
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,196 @@
+/*****************************************************************************
+* | Function    :   Host test: det_journal read only opens for -Q leave the
+*                   ring file alone and refuse files of another geometry
+*
+******************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "det_journal.h"
+#include "host_test.h"
+
+#define SEC 1000000ULL
+
+static char g_path[64];
+
+static void Cfg(det_journal_cfg_t *cfg, RK_U64 capacity) {
+	det_journal_cfg_default(cfg);
+	cfg->capacity = capacity;
+	cfg->index_stride = 16;
+}
+
+static std::vector<uint8_t> Contents(const char *path) {
+	std::vector<uint8_t> data;
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return data;
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(fp);
+	return data;
+}
+
+// count records of track id, a second apart, appended with pts from 0 s
+static void Write(det_journal_t *journal, RK_U32 id, int count) {
+	track_t track;
+	memset(&track, 0, sizeof(track));
+	track.id = id;
+	track.score = 0.5f;
+	track.box.u32Width = 64;
+	track.box.u32Height = 64;
+	for (int i = 0; i < count; i++)
+		det_journal_append(journal, i * SEC, &track, i & 1 ? 0x1 : 0x2);
+}
+
+static void Count(const det_journal_record_t *record, void *arg) {
+	(void)record;
+	(*(int *)arg)++;
+}
+
+static int QueryAll(det_journal_t *journal, uint8_t zone_mask) {
+	int seen = 0;
+	int count = det_journal_query(journal, 0, ~0ULL, zone_mask, Count, &seen);
+	CHECK_EQ(count, seen);
+	return count;
+}
+
+// the query sees what the writer wrote; the bytes on disk do not change
+static void TestQueryLeavesFile() {
+	det_journal_t writer, reader;
+	det_journal_cfg_t cfg;
+
+	Cfg(&cfg, 256);
+	unlink(g_path);
+	CHECK_EQ(det_journal_open(&writer, g_path, &cfg), 0);
+	Write(&writer, 1, 100);
+	det_journal_close(&writer);
+	std::vector<uint8_t> before = Contents(g_path);
+
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &cfg), 0);
+	CHECK_EQ(QueryAll(&reader, 0), 100);
+	CHECK_EQ(QueryAll(&reader, 0x1), 50);
+	det_journal_dump_stats(&reader);
+	det_journal_close(&reader);
+	CHECK(Contents(g_path) == before);
+
+	// read only files are fine, the rw open is not
+	chmod(g_path, 0444);
+	if (access(g_path, W_OK) != 0) {
+		CHECK_EQ(det_journal_open_ro(&reader, g_path, &cfg), 0);
+		CHECK_EQ(QueryAll(&reader, 0), 100);
+		det_journal_close(&reader);
+	}
+	chmod(g_path, 0644);
+}
+
+// a reader beside the live writer follows the head through the shared mapping
+static void TestLiveWriter() {
+	det_journal_t writer, reader;
+	det_journal_cfg_t cfg;
+
+	Cfg(&cfg, 256);
+	unlink(g_path);
+	CHECK_EQ(det_journal_open(&writer, g_path, &cfg), 0);
+	Write(&writer, 1, 10);
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &cfg), 0);
+	CHECK_EQ(QueryAll(&reader, 0), 10);
+	Write(&writer, 2, 300);
+	// wrapped: a full ring less the slot being rewritten
+	CHECK_EQ(QueryAll(&reader, 0), 255);
+	det_journal_close(&reader);
+	det_journal_close(&writer);
+}
+
+// another geometry, a short file, junk or no file at all: refused, nothing touched or created
+static void TestRefused() {
+	det_journal_t writer, reader;
+	det_journal_cfg_t cfg, other;
+
+	Cfg(&cfg, 256);
+	unlink(g_path);
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &cfg), -1);
+	CHECK(access(g_path, F_OK) != 0);
+
+	CHECK_EQ(det_journal_open(&writer, g_path, &cfg), 0);
+	Write(&writer, 1, 20);
+	det_journal_close(&writer);
+	std::vector<uint8_t> before = Contents(g_path);
+
+	Cfg(&other, 512);
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &other), -1);
+	other = cfg;
+	other.index_stride = 32;
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &other), -1);
+	CHECK(Contents(g_path) == before);
+
+	// same size, not a journal
+	std::vector<uint8_t> junk(before.size(), 0x5a);
+	FILE *fp = fopen(g_path, "wb");
+	fwrite(junk.data(), 1, junk.size(), fp);
+	fclose(fp);
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &cfg), -1);
+	CHECK(Contents(g_path) == junk);
+
+	// truncated
+	CHECK_EQ(truncate(g_path, 4096), 0);
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &cfg), -1);
+	struct stat st;
+	CHECK_EQ(stat(g_path, &st), 0);
+	CHECK_EQ(st.st_size, 4096);
+
+	// the rw open, by contrast, starts afresh
+	CHECK_EQ(det_journal_open(&writer, g_path, &cfg), 0);
+	CHECK_EQ(writer.hdr->head, 0);
+	det_journal_close(&writer);
+	CHECK_EQ(det_journal_open_ro(&reader, g_path, &cfg), 0);
+	CHECK_EQ(QueryAll(&reader, 0), 0);
+	det_journal_close(&reader);
+}
+
+static long LockedKb() {
+	char line[128];
+	long kb = -1;
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp))
+		if (sscanf(line, "VmLck: %ld kB", &kb) == 1)
+			break;
+	fclose(fp);
+	return kb;
+}
+
+// locked with the rest of the process, then let go so the ring is not pinned in RAM
+static void TestUnlock() {
+	det_journal_t writer;
+	det_journal_cfg_t cfg;
+
+	Cfg(&cfg, 256);
+	unlink(g_path);
+	CHECK_EQ(det_journal_open(&writer, g_path, &cfg), 0);
+	if (mlock(writer.map, writer.map_size) == 0) {
+		CHECK(LockedKb() >= (long)(writer.map_size / 1024));
+		det_journal_unlock(&writer);
+		CHECK_EQ(LockedKb(), 0);
+	}
+	Write(&writer, 1, 10);
+	det_journal_close(&writer);
+
+	det_journal_cfg_default(&cfg);
+	CHECK(cfg.capacity * sizeof(det_journal_record_t) <= 8 << 20);
+}
+
+int main() {
+	snprintf(g_path, sizeof(g_path), "/tmp/test_det_journal_%d.bin", (int)getpid());
+	TestQueryLeavesFile();
+	TestLiveWriter();
+	TestRefused();
+	TestUnlock();
+	unlink(g_path);
+	return HOST_TEST_RESULT();
+}
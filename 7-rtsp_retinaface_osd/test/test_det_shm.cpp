@@ -0,0 +1,174 @@
+/*****************************************************************************
+* | Function    :   Host test: det_shm seqlock under forked readers, no torn
+*                   result ever read, futex waits woken by every pass
+*
+******************************************************************************/
+
+#include <sys/wait.h>
+
+#include "luckfox_mpi.h"
+#include "det_shm.h"
+#include "host_test.h"
+
+#define READERS 4				// the first half spin on read, the rest sleep in wait
+#define RUN_US 2000000ULL
+
+static char g_name[64];
+
+/*
+ * Pass p carries p % 100 faces, face i of it at p + i everywhere, so any
+ * mix of two passes shows up as a count or a coordinate that does not fit.
+ */
+static void Pass(object_detect_result_list *res, RK_U32 pass) {
+	res->count = pass % 100;
+	for (int i = 0; i < res->count; i++) {
+		int v = (int)(pass + i);
+		res->results[i].box.left = v;
+		res->results[i].box.top = v;
+		res->results[i].box.right = v + 10;
+		res->results[i].box.bottom = v + 10;
+		for (int k = 0; k < DET_SHM_LANDMARKS; k++) {
+			res->results[i].point[k].x = v;
+			res->results[i].point[k].y = v;
+		}
+		res->results[i].prop = 0.5f;
+	}
+}
+
+static bool Consistent(const det_shm_result_t *r) {
+	if (r->count != r->pass % 100)
+		return false;
+	for (RK_U32 i = 0; i < r->count; i++) {
+		const det_shm_det_t *d = &r->dets[i];
+		int v = (int)(r->pass + i);
+		if (d->left != v || d->top != v || d->right != v + 10 || d->bottom != v + 10 ||
+		    d->landmarks[DET_SHM_LANDMARKS - 1][1] != v)
+			return false;
+	}
+	return true;
+}
+
+// child process: exit status 0 if nothing torn or out of order was read
+static int Reader(int id, bool wait) {
+	det_shm_client_t c;
+	det_shm_result_t r;
+	RK_U32 reads = 0, torn = 0, wakes = 0, last = 0;
+	RK_U64 latency = 0;
+
+	if (det_shm_client_open(&c, g_name) != 0)
+		return 2;
+	RK_U64 end = TEST_COMM_GetNowUs() + RUN_US;
+	while (TEST_COMM_GetNowUs() < end) {
+		if (wait) {
+			if (!det_shm_client_wait(&c, 100))
+				continue;
+			wakes++;
+		}
+		if (det_shm_client_read(&c, &r) != 0)
+			continue;
+		if (wait)
+			latency += TEST_COMM_GetNowUs() - r.publish_us;
+		reads++;
+		if (r.pass < last || !Consistent(&r))
+			torn++;
+		last = r.pass;
+	}
+	printf("reader %d (%s): %u reads, %u torn, %u wakes, wake latency avg %llu us\n", id, wait ? "wait" : "spin",
+	       reads, torn, wakes, (unsigned long long)(wakes ? latency / wakes : 0));
+	fflush(stdout);
+	if (torn)
+		return 1;
+	return reads && (!wait || wakes) ? 0 : 3;
+}
+
+// a writer flat out against spinning and sleeping readers in other processes
+static void TestStress() {
+	det_shm_writer_t w;
+	static object_detect_result_list res;
+	pid_t kids[READERS];
+
+	CHECK_EQ(det_shm_open(&w, g_name, 720, 480), 0);
+	// a pass before the readers start, so none of them waits for the first
+	Pass(&res, 1);
+	det_shm_publish(&w, 0, &res, 1.0f, 1.0f, NULL);
+	fflush(stdout);
+	for (int i = 0; i < READERS; i++) {
+		kids[i] = fork();
+		if (kids[i] == 0)
+			_exit(Reader(i, i >= READERS / 2));
+	}
+
+	RK_U32 passes = 0;
+	RK_U64 end = TEST_COMM_GetNowUs() + RUN_US + 100000;
+	while (TEST_COMM_GetNowUs() < end) {
+		Pass(&res, w.shm->result.pass + 1);
+		det_shm_publish(&w, passes, &res, 1.0f, 1.0f, NULL);
+		// now and then let the sleepers catch up, like the real pass rate would
+		if (++passes % 1000 == 0)
+			usleep(100);
+	}
+	printf("writer: %u passes\n", passes);
+	det_shm_dump_stats(&w);
+	for (int i = 0; i < READERS; i++) {
+		int status = -1;
+		CHECK_EQ(waitpid(kids[i], &status, 0), kids[i]);
+		CHECK(WIFEXITED(status));
+		CHECK_EQ(WEXITSTATUS(status), 0);
+	}
+	CHECK(passes > 10000);
+	det_shm_close(&w);
+}
+
+// tracked faces carry the track id; a restarted writer continues seq under a reader's mapping
+static void TestTrackIdsAndRestart() {
+	det_shm_writer_t w;
+	det_shm_client_t c;
+	det_shm_result_t r;
+	static object_detect_result_list res;
+	static tracker_t tracker;
+
+	CHECK_EQ(det_shm_open(&w, g_name, 720, 480), 0);
+	CHECK_EQ(det_shm_client_open(&c, g_name), 0);
+	memset(&tracker, 0, sizeof(tracker));
+	for (int t = 0; t < TRACKER_MAX_TRACKS; t++)
+		tracker.tracks[t].det_index = -1;
+	tracker.tracks[0].id = 7;
+	tracker.tracks[0].confirmed = true;
+	tracker.tracks[0].det_index = 1;
+	tracker.tracks[1].id = 8;				// not confirmed yet
+	tracker.tracks[1].det_index = 2;
+	Pass(&res, 3);
+	det_shm_publish(&w, 1234, &res, 2.0f, 0.5f, &tracker);
+	CHECK_EQ(det_shm_client_read(&c, &r), 0);
+	CHECK_EQ(r.pts, 1234);
+	CHECK_EQ(r.count, 3);
+	CHECK_EQ(r.dets[0].track_id, 0);
+	CHECK_EQ(r.dets[1].track_id, 7);
+	CHECK_EQ(r.dets[2].track_id, 0);
+	CHECK_EQ(r.dets[1].left, 2 * 4);
+	CHECK_EQ(r.dets[1].bottom, (4 + 10) / 2);
+	CHECK_EQ(det_shm_client_wait(&c, 0), 0);
+
+	uint32_t seq = c.shm->seq;
+	det_shm_close(&w);
+	CHECK_EQ(det_shm_open(&w, g_name, 720, 480), 0);
+	CHECK_EQ(c.shm->seq, seq);
+	CHECK_EQ(c.shm->seq & 1, 0);
+	Pass(&res, 5);
+	det_shm_publish(&w, 5678, &res, 1.0f, 1.0f, NULL);
+	CHECK_EQ(det_shm_client_wait(&c, 100), 1);
+	CHECK_EQ(det_shm_client_read(&c, &r), 0);
+	CHECK_EQ(r.pts, 5678);
+	CHECK_EQ(r.count, 5);
+	det_shm_client_close(&c);
+	det_shm_close(&w);
+}
+
+int main() {
+	snprintf(g_name, sizeof(g_name), "/test_det_shm_%d", (int)getpid());
+	shm_unlink(g_name);
+	TestStress();
+	TestTrackIdsAndRestart();
+	shm_unlink(g_name);
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,225 @@
+/*****************************************************************************
+* | Function    :   Host test: dwell_stats on a synthetic track trace
+*                   through the tracker and the zone engine
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "dwell_stats.h"
+#include "host_test.h"
+
+#define W 720
+#define H 480
+#define SEC 1000000ULL
+
+// one frame a second, 10 s buckets, a minute of history; "door" is the band 300 <= x < 500
+typedef struct {
+	tracker_t tracker;
+	zone_analytics_t zones;
+	dwell_stats_t ds;
+	RK_U64 pts;
+} trace_t;
+
+static void Init(trace_t *t) {
+	static const POINT_S door[4] = {{300, 0}, {500, 0}, {500, H}, {300, H}};
+	tracker_cfg_t tcfg;
+	zone_cfg_t zcfg;
+	dwell_cfg_t dcfg;
+
+	tracker_cfg_default(&tcfg);
+	tracker_init(&t->tracker, &tcfg);
+	zone_cfg_default(&zcfg, W, H);
+	CHECK_EQ(zone_init(&t->zones, &zcfg), 0);
+	CHECK_EQ(zone_add_polygon(&t->zones, "door", door, 4), 0);
+	dwell_cfg_default(&dcfg);
+	dcfg.bucket_sec = 10;
+	dcfg.bucket_count = 6;
+	CHECK_EQ(dwell_init(&t->ds, &dcfg), 0);
+	t->pts = 0;
+}
+
+static void Deinit(trace_t *t) {
+	dwell_deinit(&t->ds);
+	zone_deinit(&t->zones);
+}
+
+// one frame with a face centred at x (none if x < 0), then the next second
+static void Frame(trace_t *t, int x) {
+	tracker_det_t det;
+	int count = 0;
+
+	if (x >= 0) {
+		det.box.s32X = x - 40;
+		det.box.s32Y = 200;
+		det.box.u32Width = 80;
+		det.box.u32Height = 80;
+		det.score = 0.9f;
+		det.cls = 0;
+		det.index = 0;
+		count = 1;
+	}
+	tracker_update(&t->tracker, &det, count, t->pts);
+	zone_process(&t->zones, &t->tracker);
+	dwell_update(&t->ds, &t->tracker, &t->zones);
+	t->pts += SEC;
+}
+
+static void Empty(trace_t *t, int frames) {
+	for (int i = 0; i < frames; i++)
+		Frame(t, -1);
+}
+
+/*
+ * 0-29 s: A walks into the door band (in from 5 s) and stands there until it
+ * is lost while still inside; the tracker ends it at 35 s, 6 misses later.
+ * 40-56 s: B walks through the band, in from 47 s, out from 53 s.
+ */
+static void TraceA(trace_t *t) {
+	for (int i = 0; i < 30; i++)
+		Frame(t, i < 10 ? 210 + 20 * i : 410);
+}
+
+static void TraceB(trace_t *t) {
+	for (int k = 0; k < 17; k++)
+		Frame(t, 115 + 30 * k);
+}
+
+// a track lost inside a zone leaves the zone and the frame where it was last seen
+static void TestTrackEndsInsideZone() {
+	trace_t t;
+	dwell_summary_t sum;
+
+	Init(&t);
+	TraceA(&t);
+	dwell_query(&t.ds, 3600, &sum);
+	CHECK_EQ(sum.occupancy[0][0], 1);
+	CHECK_EQ(sum.occupancy[0][1], 1);
+	CHECK_EQ(sum.counts.entries[0][0], 1);
+	CHECK_EQ(sum.counts.entries[0][1], 1);
+	CHECK_EQ(sum.counts.exits[0][1], 0);
+
+	// coasting on misses is still inside
+	Empty(&t, 5);
+	dwell_query(&t.ds, 3600, &sum);
+	CHECK_EQ(sum.occupancy[0][1], 1);
+	CHECK_EQ(sum.counts.exits[0][0], 0);
+
+	Empty(&t, 1);
+	dwell_query(&t.ds, 3600, &sum);
+	CHECK_EQ(sum.window_sec, 40);
+	CHECK_EQ(sum.occupancy[0][0], 0);
+	CHECK_EQ(sum.occupancy[0][1], 0);
+	CHECK_EQ(sum.counts.exits[0][0], 1);
+	CHECK_EQ(sum.counts.exits[0][1], 1);
+	// frame 0 -> 29 s, door from the first frame inside (5 s) -> 29 s, not to the end at 35 s
+	CHECK_EQ(sum.counts.dwell_ms[0][0], 29000);
+	CHECK_EQ(sum.counts.dwell_ms[0][1], 24000);
+	CHECK_EQ(sum.counts.hist[0][0][dwell_hist_bin(29000)], 1);
+	CHECK_EQ(sum.counts.hist[0][1][dwell_hist_bin(24000)], 1);
+	CHECK_EQ(dwell_hist_bin(24000), 5);
+	// the exits land in the bucket of the frame that noticed, 30-40 s
+	dwell_query(&t.ds, 10, &sum);
+	CHECK_EQ(sum.counts.exits[0][1], 1);
+	CHECK_EQ(sum.counts.entries[0][1], 0);
+	Deinit(&t);
+}
+
+// windows sum whole buckets from the newest back, rounded up; old buckets roll out of the ring
+static void TestWindowsAndRollover() {
+	trace_t t;
+	dwell_summary_t sum;
+
+	Init(&t);
+	TraceA(&t);
+	Empty(&t, 10);
+	TraceB(&t);
+	Empty(&t, 14);
+	CHECK_EQ(t.pts, 71 * SEC);
+
+	// newest bucket 70-80 s: nothing happened yet
+	dwell_query(&t.ds, 10, &sum);
+	CHECK_EQ(sum.window_sec, 10);
+	CHECK_EQ(sum.counts.exits[0][0] + sum.counts.entries[0][0], 0);
+
+	// 15 s is two buckets, 60-80 s: B leaving the frame when it was ended at 62 s
+	dwell_query(&t.ds, 15, &sum);
+	CHECK_EQ(sum.window_sec, 20);
+	CHECK_EQ(sum.counts.exits[0][0], 1);
+	CHECK_EQ(sum.counts.dwell_ms[0][0], 16000);
+	CHECK_EQ(sum.counts.exits[0][1], 0);
+
+	// 50-80 s: B's door exit, streak from 53 s
+	dwell_query(&t.ds, 30, &sum);
+	CHECK_EQ(sum.counts.exits[0][1], 1);
+	CHECK_EQ(sum.counts.dwell_ms[0][1], 6000);
+	CHECK_EQ(sum.counts.hist[0][1][3], 1);
+
+	// the whole ring, 20-80 s: A's entries at 0-10 s were overwritten, its exits at 35 s were not
+	dwell_query(&t.ds, 3600, &sum);
+	CHECK_EQ(sum.window_sec, 60);
+	CHECK_EQ(sum.counts.entries[0][0], 1);
+	CHECK_EQ(sum.counts.entries[0][1], 1);
+	CHECK_EQ(sum.counts.exits[0][0], 2);
+	CHECK_EQ(sum.counts.exits[0][1], 2);
+	CHECK_EQ(sum.counts.dwell_ms[0][1], 24000 + 6000);
+	CHECK_EQ(sum.counts.hist[0][0][5], 2);
+	CHECK_EQ(sum.counts.hist[0][1][5], 1);
+	CHECK_EQ(sum.counts.hist[0][1][3], 1);
+	CHECK_EQ(sum.occupancy[0][0], 0);
+
+	// once the newest bucket is 90-100 s, A's exits at 30-40 s go too
+	Empty(&t, 19);
+	dwell_query(&t.ds, 3600, &sum);
+	CHECK_EQ(sum.counts.exits[0][0], 2);
+	Empty(&t, 1);
+	dwell_query(&t.ds, 3600, &sum);
+	CHECK_EQ(sum.counts.exits[0][0], 1);
+	CHECK_EQ(sum.counts.exits[0][1], 1);
+	Deinit(&t);
+}
+
+// a gap longer than the ring clears it all; a clock stepping back counts into the newest bucket
+static void TestGapAndLatePts() {
+	trace_t t;
+	dwell_summary_t sum;
+
+	Init(&t);
+	TraceA(&t);
+	Empty(&t, 6);
+	t.pts = 1000 * SEC;
+	Frame(&t, -1);
+	dwell_query(&t.ds, 3600, &sum);
+	CHECK_EQ(sum.window_sec, 60);
+	CHECK_EQ(sum.counts.entries[0][0] + sum.counts.exits[0][0], 0);
+	CHECK_EQ(t.ds.head.load(), 100);
+
+	t.pts = 900 * SEC;
+	TraceB(&t);
+	Empty(&t, 6);
+	CHECK_EQ(t.ds.head.load(), 100);
+	dwell_query(&t.ds, 10, &sum);
+	CHECK_EQ(sum.counts.entries[0][0], 1);
+	CHECK_EQ(sum.counts.exits[0][0], 1);
+	CHECK_EQ(sum.counts.exits[0][1], 1);
+	Deinit(&t);
+}
+
+static void TestHistBins() {
+	CHECK_EQ(dwell_hist_bin(0), 0);
+	CHECK_EQ(dwell_hist_bin(999), 0);
+	CHECK_EQ(dwell_hist_bin(1000), 1);
+	CHECK_EQ(dwell_hist_bin(3999), 2);
+	CHECK_EQ(dwell_hist_bin(4000), 3);
+	CHECK_EQ(dwell_hist_bin(1024000), DWELL_HIST_BINS - 1);
+	CHECK_EQ(dwell_hist_bin(100000000), DWELL_HIST_BINS - 1);
+	for (int bin = 1; bin < DWELL_HIST_BINS; bin++)
+		CHECK_EQ(dwell_hist_bin(dwell_bin_floor_sec(bin) * 1000ULL), bin);
+}
+
+int main() {
+	TestTrackEndsInsideZone();
+	TestWindowsAndRollover();
+	TestGapAndLatePts();
+	TestHistBins();
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,196 @@
+/*****************************************************************************
+* | Function    :   Host test: face-priority AE weights through
+*                   face_ae_ops_rkaiq() against a stubbed rkaiq AE
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "face_ae.h"
+#include "host_test.h"
+
+// the AE attribute as the ISP holds it; the stub only has the grid weights
+static Uapi_ExpSwAttrV2_t g_ae_attr;
+static int g_get_calls;
+static int g_set_calls;
+static bool g_fail_get;
+static bool g_fail_set;
+static rk_aiq_uapi_mode_sync_e g_last_sync;
+
+XCamReturn rk_aiq_user_api2_ae_getExpSwAttr(const rk_aiq_sys_ctx_t *ctx, Uapi_ExpSwAttrV2_t *pExpSwAttr) {
+	(void)ctx;
+	g_get_calls++;
+	if (g_fail_get)
+		return XCAM_RETURN_ERROR_FAILED;
+	*pExpSwAttr = g_ae_attr;
+	return XCAM_RETURN_NO_ERROR;
+}
+
+XCamReturn rk_aiq_user_api2_ae_setExpSwAttr(const rk_aiq_sys_ctx_t *ctx, const Uapi_ExpSwAttrV2_t expSwAttr) {
+	(void)ctx;
+	g_set_calls++;
+	if (g_fail_set)
+		return XCAM_RETURN_ERROR_FAILED;
+	g_ae_attr = expSwAttr;
+	g_last_sync = expSwAttr.sync.sync_mode;
+	return XCAM_RETURN_NO_ERROR;
+}
+
+static uint8_t Weight(int gx, int gy) {
+	return g_ae_attr.GridWeights.uCoeff[gy * FACE_AE_GRID + gx];
+}
+
+// centre-weighted tuning grid: 32 in the middle 5x5, 8 elsewhere
+static void ResetIsp() {
+	memset(&g_ae_attr, 0, sizeof(g_ae_attr));
+	for (int gy = 0; gy < FACE_AE_GRID; gy++)
+		for (int gx = 0; gx < FACE_AE_GRID; gx++)
+			g_ae_attr.GridWeights.uCoeff[gy * FACE_AE_GRID + gx] = gx >= 5 && gx < 10 && gy >= 5 && gy < 10 ? 32 : 8;
+	g_get_calls = g_set_calls = 0;
+	g_fail_get = g_fail_set = false;
+	g_last_sync = RK_AIQ_UAPI_MODE_SYNC;
+}
+
+static void Init(face_ae_t *ae) {
+	face_ae_cfg_t cfg;
+	face_ae_ops_t ops;
+
+	ResetIsp();
+	face_ae_cfg_default(&cfg);
+	face_ae_ops_rkaiq(&ops, (void *)&g_ae_attr);
+	CHECK_EQ(face_ae_init(ae, &cfg, &ops, 1500, 1500), 0);
+}
+
+// updates every min_interval for 10 s, long enough to reach the target; returns the time reached.
+// A push-less update does not mean settled: the Q8 state still moves below the rounding.
+static RK_U64 Settle(face_ae_t *ae, const RECT_S *faces, int count, RK_U64 now_us) {
+	for (int i = 0; i < 50; i++) {
+		now_us += 200000;
+		face_ae_update(ae, faces, count, now_us);
+	}
+	return now_us;
+}
+
+// a face in the top left corner: its cells at face weight, margin included, the rest a quarter of the tuning
+static void TestFaceIsMetered() {
+	face_ae_t ae;
+	// cells are 100x100; 30% margin grows 200x200 at (150, 150) to (120, 120)-(380, 380): cells 1..3
+	RECT_S face = {150, 150, 200, 200};
+
+	Init(&ae);
+	CHECK_EQ(ae.defaults[7 * FACE_AE_GRID + 7], 32);
+	CHECK_EQ(g_set_calls, 0);
+
+	CHECK_EQ(face_ae_update(&ae, &face, 1, 1000000), 1);
+	CHECK_EQ(g_last_sync, RK_AIQ_UAPI_MODE_ASYNC);
+	// one smoothing step, not the target yet
+	CHECK(Weight(2, 2) > 8 && Weight(2, 2) < 31);
+
+	Settle(&ae, &face, 1, 1000000);
+	for (int gy = 0; gy < FACE_AE_GRID; gy++) {
+		for (int gx = 0; gx < FACE_AE_GRID; gx++) {
+			bool in_face = gx >= 1 && gx <= 3 && gy >= 1 && gy <= 3;
+			int tuning = gx >= 5 && gx < 10 && gy >= 5 && gy < 10 ? 32 : 8;
+			CHECK_EQ(Weight(gx, gy), in_face ? 31 : tuning / 4);
+		}
+	}
+}
+
+// no more than one push per min_interval, and none when nothing changes
+static void TestPushesAreRateLimited() {
+	face_ae_t ae;
+	RECT_S face = {700, 700, 100, 100};
+
+	Init(&ae);
+	CHECK_EQ(face_ae_update(&ae, &face, 1, 1000000), 1);
+	int sets = g_set_calls;
+	CHECK_EQ(face_ae_update(&ae, &face, 1, 1100000), 0);
+	CHECK_EQ(face_ae_update(&ae, &face, 1, 1199999), 0);
+	CHECK_EQ(g_set_calls, sets);
+	CHECK_EQ(face_ae_update(&ae, &face, 1, 1200000), 1);
+
+	RK_U64 now = Settle(&ae, &face, 1, 1200000);
+	sets = g_set_calls;
+	CHECK_EQ(face_ae_update(&ae, &face, 1, now + 1000000), 0);
+	CHECK_EQ(g_set_calls, sets);
+}
+
+// faces gone: the face weights hold for hold_ms, then glide back to the tuning weights
+static void TestHoldThenBackToTuning() {
+	face_ae_t ae;
+	RECT_S face = {700, 700, 100, 100};
+	uint8_t tuning[FACE_AE_CELLS];
+
+	Init(&ae);
+	memcpy(tuning, g_ae_attr.GridWeights.uCoeff, sizeof(tuning));
+	RK_U64 now = Settle(&ae, &face, 1, 0);
+	RK_U64 last_face = now;
+	CHECK_EQ(Weight(0, 0), 2);
+
+	for (now += 200000; now <= last_face + 2000000; now += 200000)
+		CHECK_EQ(face_ae_update(&ae, NULL, 0, now), 0);
+	CHECK(ae.face_mode);
+	CHECK_EQ(face_ae_update(&ae, NULL, 0, now), 1);
+	CHECK(!ae.face_mode);
+	Settle(&ae, NULL, 0, now);
+	CHECK(!memcmp(g_ae_attr.GridWeights.uCoeff, tuning, sizeof(tuning)));
+}
+
+// a failed push is counted and tried again on the next update; restore jumps straight to the tuning
+static void TestFailedPushAndRestore() {
+	face_ae_t ae;
+	RECT_S face = {0, 0, 1500, 1500};
+	uint8_t tuning[FACE_AE_CELLS];
+
+	Init(&ae);
+	memcpy(tuning, g_ae_attr.GridWeights.uCoeff, sizeof(tuning));
+	g_fail_set = true;
+	CHECK_EQ(face_ae_update(&ae, &face, 1, 1000000), -1);
+	CHECK_EQ(ae.push_errors, 1);
+	CHECK(!memcmp(ae.applied, tuning, sizeof(tuning)));
+	g_fail_set = false;
+	CHECK_EQ(face_ae_update(&ae, &face, 1, 1200000), 1);
+	CHECK_EQ(ae.pushes, 1);
+
+	CHECK_EQ(face_ae_restore(&ae), 0);
+	CHECK(!memcmp(g_ae_attr.GridWeights.uCoeff, tuning, sizeof(tuning)));
+	CHECK(!ae.face_mode);
+}
+
+// boxes reaching outside the frame are clipped to the grid
+static void TestBoxesAtTheEdges() {
+	face_ae_t ae;
+	RECT_S faces[2] = {{-300, -300, 350, 350}, {1450, 1450, 400, 400}};
+
+	Init(&ae);
+	Settle(&ae, faces, 2, 0);
+	CHECK_EQ(Weight(0, 0), 31);
+	CHECK_EQ(Weight(14, 14), 31);
+	// margin: (-300, -300) 350 reaches x 155, cell 1; (1450, 1450) 400 starts at 1330, cell 13
+	CHECK_EQ(Weight(1, 1), 31);
+	CHECK_EQ(Weight(13, 13), 31);
+	CHECK_EQ(Weight(2, 2), 2);
+	CHECK_EQ(Weight(12, 12), 2);
+}
+
+static void TestInitNeedsTheIsp() {
+	face_ae_t ae;
+	face_ae_cfg_t cfg;
+	face_ae_ops_t ops;
+
+	ResetIsp();
+	g_fail_get = true;
+	face_ae_cfg_default(&cfg);
+	face_ae_ops_rkaiq(&ops, (void *)&g_ae_attr);
+	CHECK_EQ(face_ae_init(&ae, &cfg, &ops, 1500, 1500), -1);
+	CHECK_EQ(g_set_calls, 0);
+}
+
+int main() {
+	TestFaceIsMetered();
+	TestPushesAreRateLimited();
+	TestHoldThenBackToTuning();
+	TestFailedPushAndRestore();
+	TestBoxesAtTheEdges();
+	TestInitNeedsTheIsp();
+	return HOST_TEST_RESULT();
+}
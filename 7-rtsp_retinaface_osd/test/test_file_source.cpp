@@ -0,0 +1,401 @@
+/*****************************************************************************
+* | Function    :   Host test: file_source access unit splitting, pacing
+*                   and max-speed throughput through the soft decoder
+*
+******************************************************************************/
+
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "file_source.h"
+#include "soft_dec.h"
+#include "fake_mpi.h"
+#include "host_test.h"
+
+#define GOP 30
+
+typedef std::vector<uint8_t> bytes_t;
+
+typedef struct {
+	bytes_t data;
+	std::vector<size_t> au_begin;	// offset of every access unit, in order
+	std::vector<RK_U32> au_sum;
+} stream_t;
+
+static RK_U32 g_seed;
+
+static RK_U32 Random() {
+	g_seed = g_seed * 1103515245 + 12345;
+	return g_seed >> 16;
+}
+
+// NAL with a 4 or 3 byte start code; the payload has no start code in it but
+// does have emulation prevention (00 00 03) and lone zeros
+static void Nal(bytes_t *out, bool long_sc, const uint8_t *header, int header_len, int payload) {
+	static const uint8_t sc[4] = {0, 0, 0, 1};
+	out->insert(out->end(), sc + (long_sc ? 0 : 1), sc + 4);
+	out->insert(out->end(), header, header + header_len);
+	for (int i = 0; i < payload; i++) {
+		RK_U32 r = Random() % 64;
+		if (r == 0) {
+			static const uint8_t epb[4] = {0, 0, 3, 1};
+			out->insert(out->end(), epb, epb + 4);
+		} else if (r == 1) {
+			out->push_back(0);
+			out->push_back(1 + Random() % 255);
+		} else {
+			out->push_back(1 + Random() % 255);
+		}
+	}
+}
+
+// H.264: SPS, PPS and IDR every GOP pictures, P pictures of slices slices, an SEI before some
+static stream_t H264(int pictures, int slices, int payload) {
+	static const uint8_t sps[2] = {0x67, 0x42};
+	static const uint8_t pps[2] = {0x68, 0xce};
+	static const uint8_t sei[2] = {0x06, 0x05};
+	static const uint8_t idr[2] = {0x65, 0x88};			// first_mb_in_slice 0
+	static const uint8_t p_first[2] = {0x41, 0x9a};
+	static const uint8_t p_next[2] = {0x41, 0x40};		// first_mb_in_slice 1
+	stream_t s;
+
+	g_seed = 3;
+	for (int i = 0; i < pictures; i++) {
+		s.au_begin.push_back(s.data.size());
+		if (i % GOP == 0) {
+			Nal(&s.data, true, sps, 2, 12);
+			Nal(&s.data, true, pps, 2, 4);
+			Nal(&s.data, true, idr, 2, payload * 4);
+		} else {
+			if (i % 7 == 0)
+				Nal(&s.data, true, sei, 2, 16);
+			Nal(&s.data, true, p_first, 2, payload);
+			for (int k = 1; k < slices; k++)
+				Nal(&s.data, false, p_next, 2, payload);
+		}
+	}
+	s.au_begin.push_back(s.data.size());
+	for (int i = 0; i < pictures; i++) {
+		RK_U32 sum = 0;
+		for (size_t k = s.au_begin[i]; k < s.au_begin[i + 1]; k++)
+			sum += s.data[k];
+		s.au_sum.push_back(sum);
+	}
+	return s;
+}
+
+static void WriteFile(const char *path, const bytes_t &data) {
+	FILE *fp = fopen(path, "wb");
+	CHECK(fp != NULL);
+	if (!fp)
+		return;
+	fwrite(data.data(), 1, data.size(), fp);
+	fclose(fp);
+}
+
+static const char *Path(const char *ext) {
+	static char path[64];
+	snprintf(path, sizeof(path), "/tmp/test_file_source_%d%s", (int)getpid(), ext);
+	return path;
+}
+
+typedef struct {
+	const stream_t *stream;
+	RK_U64 interval_us;
+	RK_U32 frames;
+	RK_U32 bad;					// out of order, wrong pts or not the access unit sent
+	RK_U32 stop_after;			// cb returns -1 on this frame, 0: never
+	volatile bool *quit;
+	RK_U32 quit_after;
+	RK_U64 last_pts;
+} consumer_t;
+
+static int OnFrame(const VIDEO_FRAME_INFO_S *frame, void *arg) {
+	consumer_t *c = (consumer_t *)arg;
+	soft_dec_pic_t pic;
+	size_t pictures = c->stream->au_sum.size();
+
+	memcpy(&pic, RK_MPI_MB_Handle2VirAddr(frame->stVFrame.pMbBlk), sizeof(pic));
+	size_t au = pic.seq % pictures;
+	if (pic.seq != c->frames || frame->stVFrame.u64PTS != pic.seq * c->interval_us ||
+	    pic.len != c->stream->au_begin[au + 1] - c->stream->au_begin[au] || pic.sum != c->stream->au_sum[au])
+		c->bad++;
+	c->last_pts = frame->stVFrame.u64PTS;
+	c->frames++;
+	if (c->quit_after && c->frames == c->quit_after)
+		*c->quit = true;
+	return c->stop_after && c->frames == c->stop_after ? -1 : 0;
+}
+
+static void Consumer(consumer_t *c, const stream_t *stream, const file_source_cfg_t *cfg) {
+	memset(c, 0, sizeof(*c));
+	c->stream = stream;
+	c->interval_us = 1000000 / cfg->fps;
+}
+
+static int Open(file_source_t *src, const file_source_cfg_t *cfg, const soft_dec_cfg_t *dcfg,
+                soft_dec_stats_t *stats) {
+	file_source_dec_ops_t ops;
+
+	if (file_source_open(src, Path(".h264"), cfg) != 0)
+		return -1;
+	if (soft_dec_ops(&ops, dcfg, stats) != 0) {
+		file_source_close(src);
+		return -1;
+	}
+	file_source_set_decoder(src, &ops);
+	return 0;
+}
+
+// every access unit is one picture with its parameter sets and SEI, all slices together
+static void TestAccessUnits() {
+	stream_t stream = H264(65, 3, 40);
+	file_source_cfg_t cfg;
+	file_source_t src;
+	const uint8_t *au;
+	size_t len;
+	size_t n = 0;
+
+	WriteFile(Path(".h264"), stream.data);
+	file_source_cfg_default(&cfg);
+	CHECK_EQ(file_source_open(&src, Path(".h264"), &cfg), 0);
+	CHECK_EQ(src.cfg.codec, RK_VIDEO_ID_AVC);
+	while ((len = file_source_next_au(&src, &au)) > 0) {
+		if (n < stream.au_sum.size()) {
+			CHECK_EQ(au - src.data, stream.au_begin[n]);
+			CHECK_EQ(len, stream.au_begin[n + 1] - stream.au_begin[n]);
+		}
+		n++;
+	}
+	CHECK_EQ(n, 65);
+	CHECK_EQ(file_source_next_au(&src, &au), 0);
+	file_source_close(&src);
+}
+
+// every access unit decoded once, in order, with its pts; the reorder tail comes out on EOS
+static void TestMaxSpeedThroughput() {
+	const int pictures = 3000;
+	stream_t stream = H264(pictures, 2, 600);
+	file_source_cfg_t cfg;
+	soft_dec_cfg_t dcfg;
+	soft_dec_stats_t stats;
+	file_source_t src;
+	consumer_t c;
+
+	WriteFile(Path(".h264"), stream.data);
+	file_source_cfg_default(&cfg);
+	soft_dec_cfg_default(&dcfg);
+	CHECK_EQ(Open(&src, &cfg, &dcfg, &stats), 0);
+	Consumer(&c, &stream, &cfg);
+
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	CHECK_EQ(file_source_run(&src, OnFrame, &c, NULL), 0);
+	RK_U64 elapsed = TEST_COMM_GetNowUs() - begin;
+	file_source_dump_stats(&src);
+
+	CHECK_EQ(src.aus, pictures);
+	CHECK_EQ(src.frames, pictures);
+	CHECK_EQ(src.bytes, stream.data.size());
+	CHECK_EQ(src.send_retries, 0);
+	CHECK_EQ(c.frames, pictures);
+	CHECK_EQ(c.bad, 0);
+	CHECK_EQ(stats.eos, 1);
+	CHECK_EQ(stats.outstanding, 0);
+	// demux and hand-off alone: far above any camera rate on the build machine
+	double fps = pictures * 1e6 / (elapsed ? elapsed : 1);
+	printf("max speed: %d frames, %.1f MB in %llu us, %.0f fps\n", pictures, stream.data.size() / 1e6,
+	       (unsigned long long)elapsed, fps);
+	CHECK(fps > 1000);
+
+	file_source_close(&src);
+	CHECK_EQ(fake_mb_live(), 0);
+	CHECK_EQ(fake_mb_pools(), 0);
+}
+
+// a decoder refusing input is retried after a drain, nothing is lost or sent twice
+static void TestBusyDecoderIsRetried() {
+	stream_t stream = H264(200, 1, 100);
+	file_source_cfg_t cfg;
+	soft_dec_cfg_t dcfg;
+	soft_dec_stats_t stats;
+	file_source_t src;
+	consumer_t c;
+
+	WriteFile(Path(".h264"), stream.data);
+	file_source_cfg_default(&cfg);
+	soft_dec_cfg_default(&dcfg);
+	dcfg.busy_every = 7;
+	CHECK_EQ(Open(&src, &cfg, &dcfg, &stats), 0);
+	Consumer(&c, &stream, &cfg);
+	file_source_run(&src, OnFrame, &c, NULL);
+	CHECK(stats.busy > 0);
+	CHECK_EQ(src.send_retries, stats.busy);
+	CHECK_EQ(c.frames, 200);
+	CHECK_EQ(c.bad, 0);
+	file_source_close(&src);
+	CHECK_EQ(fake_mb_live(), 0);
+}
+
+// realtime: access units no earlier than their pts, and not much later
+static void TestRealtimePace() {
+	stream_t stream = H264(40, 1, 100);
+	file_source_cfg_t cfg;
+	soft_dec_cfg_t dcfg;
+	file_source_t src;
+	consumer_t c;
+
+	WriteFile(Path(".h264"), stream.data);
+	file_source_cfg_default(&cfg);
+	cfg.fps = 200;
+	cfg.pace = FILE_SOURCE_REALTIME;
+	soft_dec_cfg_default(&dcfg);
+	dcfg.reorder = 0;
+	CHECK_EQ(Open(&src, &cfg, &dcfg, NULL), 0);
+	Consumer(&c, &stream, &cfg);
+
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	file_source_run(&src, OnFrame, &c, NULL);
+	RK_U64 elapsed = TEST_COMM_GetNowUs() - begin;
+	CHECK_EQ(c.frames, 40);
+	CHECK_EQ(c.bad, 0);
+	CHECK(elapsed >= 39 * 5000);
+	CHECK(elapsed < 1000000);
+	file_source_close(&src);
+}
+
+// the consumer stopping ends the run; the pictures still in the decoder go back with it
+static void TestConsumerStops() {
+	stream_t stream = H264(100, 1, 100);
+	file_source_cfg_t cfg;
+	soft_dec_cfg_t dcfg;
+	soft_dec_stats_t stats;
+	file_source_t src;
+	consumer_t c;
+
+	WriteFile(Path(".h264"), stream.data);
+	file_source_cfg_default(&cfg);
+	soft_dec_cfg_default(&dcfg);
+	CHECK_EQ(Open(&src, &cfg, &dcfg, &stats), 0);
+	Consumer(&c, &stream, &cfg);
+	c.stop_after = 10;
+	CHECK_EQ(file_source_run(&src, OnFrame, &c, NULL), 0);
+	CHECK_EQ(c.frames, 10);
+	CHECK_EQ(src.frames, 10);
+	CHECK(src.aus < 100);
+	CHECK_EQ(stats.outstanding, 0);
+	file_source_close(&src);
+	CHECK_EQ(fake_mb_live(), 0);
+}
+
+// -F with loop: the file is rewound and the pts keeps going until quit
+static void TestLoopUntilQuit() {
+	stream_t stream = H264(50, 2, 100);
+	file_source_cfg_t cfg;
+	soft_dec_cfg_t dcfg;
+	soft_dec_stats_t stats;
+	file_source_t src;
+	consumer_t c;
+	volatile bool quit = false;
+
+	WriteFile(Path(".h264"), stream.data);
+	file_source_cfg_default(&cfg);
+	cfg.loop = true;
+	soft_dec_cfg_default(&dcfg);
+	dcfg.busy_every = 3;
+	CHECK_EQ(Open(&src, &cfg, &dcfg, &stats), 0);
+	Consumer(&c, &stream, &cfg);
+	c.quit = &quit;
+	c.quit_after = 125;
+	file_source_run(&src, OnFrame, &c, &quit);
+	CHECK(src.aus >= 125);
+	CHECK(c.frames >= 125);
+	// only what the decoder took counts, and a quit sends no EOS
+	CHECK_EQ(src.aus, stats.sends - stats.busy - stats.full);
+	CHECK_EQ(stats.eos, 0);
+	CHECK_EQ(stats.eos_refused, 0);
+	CHECK_EQ(c.bad, 0);
+	CHECK_EQ(c.last_pts, (c.frames - 1) * c.interval_us);
+	file_source_close(&src);
+}
+
+// EOS is retried with drains in between, and given up on in bounded time
+static void TestEosRetriedAndBounded() {
+	stream_t stream = H264(30, 1, 100);
+	file_source_cfg_t cfg;
+	soft_dec_cfg_t dcfg;
+	soft_dec_stats_t stats;
+	file_source_t src;
+	consumer_t c;
+
+	WriteFile(Path(".h264"), stream.data);
+	file_source_cfg_default(&cfg);
+	soft_dec_cfg_default(&dcfg);
+	dcfg.eos_refused = 3;
+	CHECK_EQ(Open(&src, &cfg, &dcfg, &stats), 0);
+	Consumer(&c, &stream, &cfg);
+	file_source_run(&src, OnFrame, &c, NULL);
+	CHECK_EQ(stats.eos_refused, 3);
+	CHECK_EQ(stats.eos, 1);
+	CHECK_EQ(c.frames, 30);
+	CHECK_EQ(c.bad, 0);
+	file_source_close(&src);
+
+	// a decoder that never takes it: the held pictures are lost, the run still ends
+	dcfg.eos_refused = ~0u;
+	CHECK_EQ(Open(&src, &cfg, &dcfg, &stats), 0);
+	Consumer(&c, &stream, &cfg);
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	CHECK_EQ(file_source_run(&src, OnFrame, &c, NULL), 0);
+	CHECK(TEST_COMM_GetNowUs() - begin < 1000000);
+	CHECK(stats.eos_refused > 0);
+	CHECK_EQ(stats.eos, 0);
+	CHECK_EQ(c.frames, 30 - dcfg.reorder);
+	file_source_close(&src);
+	CHECK_EQ(fake_mb_live(), 0);
+}
+
+// codec from the first NAL, else the extension; MP4 and unknown input are refused
+static void TestOpenChecks() {
+	static const uint8_t vps[] = {0, 0, 0, 1, 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff};
+	static const uint8_t mp4[] = {0, 0, 0, 0x20, 'f', 't', 'y', 'p', 'i', 's', 'o', 'm'};
+	static const uint8_t junk[] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x11};
+	file_source_cfg_t cfg;
+	file_source_t src;
+
+	file_source_cfg_default(&cfg);
+	WriteFile(Path(".bin"), bytes_t(vps, vps + sizeof(vps)));
+	CHECK_EQ(file_source_open(&src, Path(".bin"), &cfg), 0);
+	CHECK_EQ(src.cfg.codec, RK_VIDEO_ID_HEVC);
+	file_source_close(&src);
+	unlink(Path(".bin"));
+
+	WriteFile(Path(".h265"), bytes_t(junk, junk + sizeof(junk)));
+	CHECK_EQ(file_source_open(&src, Path(".h265"), &cfg), 0);
+	CHECK_EQ(src.cfg.codec, RK_VIDEO_ID_HEVC);
+	file_source_close(&src);
+	unlink(Path(".h265"));
+
+	WriteFile(Path(".bin"), bytes_t(junk, junk + sizeof(junk)));
+	CHECK_EQ(file_source_open(&src, Path(".bin"), &cfg), -1);
+	WriteFile(Path(".bin"), bytes_t(mp4, mp4 + sizeof(mp4)));
+	CHECK_EQ(file_source_open(&src, Path(".bin"), &cfg), -1);
+	unlink(Path(".bin"));
+
+	// no decoder set, and no VDEC on the host
+	file_source_dec_ops_t ops;
+	CHECK_EQ(file_source_dec_ops_vdec(&ops, 0, &cfg), -1);
+	CHECK(ops.send == NULL);
+}
+
+int main() {
+	TestAccessUnits();
+	TestMaxSpeedThroughput();
+	TestBusyDecoderIsRetried();
+	TestRealtimePace();
+	TestConsumerStops();
+	TestLoopUntilQuit();
+	TestEosRetriedAndBounded();
+	TestOpenChecks();
+	unlink(Path(".h264"));
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,345 @@
+/*****************************************************************************
+* | Function    :   Host test: frame_share lifetimes with memfd buffers,
+*                   release, lease expiry and client drop
+*
+******************************************************************************/
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "luckfox_mpi.h"
+#include "rt_sched.h"
+#include "frame_share.h"
+#include "host_test.h"
+
+#define BUFFERS 6
+#define W 64
+#define H 48
+#define SIZE (W * H * 3 / 2)
+
+/*
+ * The source stands in for the VPSS pool: six memfd buffers, a frame goes
+ * into a free one when the test kicks the eventfd, the release callback
+ * gives it back. The server thread runs both callbacks.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int kick;					// eventfd, source_fd of the server
+	int fd[BUFFERS];
+	uint8_t *map[BUFFERS];
+	bool busy[BUFFERS];
+	RK_U32 frame;				// next frame number
+	RK_U32 published;			// frames through frame_share_publish()
+	int last_sent;				// its return for the last one
+	RK_U32 released[BUFFERS];
+	RK_U32 starved;				// kicks with no free buffer
+} source_t;
+
+static source_t g_src;
+static char g_path[64];
+
+static void Source(frame_share_t *share, void *arg) {
+	source_t *src = (source_t *)arg;
+	uint64_t kicks;
+
+	if (read(src->kick, &kicks, sizeof(kicks)) != sizeof(kicks))
+		return;
+	while (kicks--) {
+		int b = -1;
+		pthread_mutex_lock(&src->lock);
+		for (int i = 0; i < BUFFERS && b < 0; i++) {
+			if (!src->busy[i])
+				b = i;
+		}
+		if (b < 0) {
+			src->starved++;
+			pthread_cond_broadcast(&src->cond);
+			pthread_mutex_unlock(&src->lock);
+			continue;
+		}
+		RK_U32 n = src->frame++;
+		src->busy[b] = true;
+		memset(src->map[b], (uint8_t)n, SIZE);
+		memcpy(src->map[b], &n, sizeof(n));
+		pthread_mutex_unlock(&src->lock);
+
+		frame_share_frame_t frame;
+		frame.fd = src->fd[b];
+		frame.pts = n * 40000ULL;
+		frame.width = W;
+		frame.height = H;
+		frame.hor_stride = W;
+		frame.ver_stride = H;
+		frame.size = SIZE;
+		int sent = frame_share_publish(share, &frame, &b, sizeof(b));
+
+		pthread_mutex_lock(&src->lock);
+		src->published++;
+		src->last_sent = sent;
+		pthread_cond_broadcast(&src->cond);
+		pthread_mutex_unlock(&src->lock);
+	}
+}
+
+static void Release(void *priv, void *arg) {
+	source_t *src = (source_t *)arg;
+	int b;
+
+	memcpy(&b, priv, sizeof(b));
+	pthread_mutex_lock(&src->lock);
+	CHECK(src->busy[b]);
+	src->busy[b] = false;
+	src->released[b]++;
+	pthread_cond_broadcast(&src->cond);
+	pthread_mutex_unlock(&src->lock);
+}
+
+static void SourceInit(void) {
+	memset(&g_src, 0, sizeof(g_src));
+	pthread_mutex_init(&g_src.lock, NULL);
+	pthread_cond_init(&g_src.cond, NULL);
+	g_src.kick = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	for (int b = 0; b < BUFFERS; b++) {
+		g_src.fd[b] = memfd_create("frame_share_test", MFD_CLOEXEC);
+		CHECK_EQ(ftruncate(g_src.fd[b], SIZE), 0);
+		g_src.map[b] = (uint8_t *)mmap(NULL, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, g_src.fd[b], 0);
+	}
+}
+
+static void SourceDeinit(void) {
+	for (int b = 0; b < BUFFERS; b++) {
+		munmap(g_src.map[b], SIZE);
+		close(g_src.fd[b]);
+	}
+	close(g_src.kick);
+	pthread_cond_destroy(&g_src.cond);
+	pthread_mutex_destroy(&g_src.lock);
+}
+
+// waits up to a second for cond(), under the source lock
+template <typename F> static bool Wait(F cond) {
+	struct timespec ts;
+	bool ok;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 1;
+	pthread_mutex_lock(&g_src.lock);
+	while (!(ok = cond()) && pthread_cond_timedwait(&g_src.cond, &g_src.lock, &ts) == 0) {
+	}
+	pthread_mutex_unlock(&g_src.lock);
+	return ok;
+}
+
+// one frame through the server, returns the number of clients it went to
+static int Publish(void) {
+	RK_U32 before;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&g_src.lock);
+	before = g_src.published;
+	pthread_mutex_unlock(&g_src.lock);
+	CHECK_EQ(write(g_src.kick, &one, sizeof(one)), sizeof(one));
+	CHECK(Wait([&] { return g_src.published > before; }));
+	return g_src.last_sent;
+}
+
+static RK_U32 Released(void) {
+	RK_U32 total = 0;
+	pthread_mutex_lock(&g_src.lock);
+	for (int b = 0; b < BUFFERS; b++)
+		total += g_src.released[b];
+	pthread_mutex_unlock(&g_src.lock);
+	return total;
+}
+
+static int Busy(void) {
+	int busy = 0;
+	pthread_mutex_lock(&g_src.lock);
+	for (int b = 0; b < BUFFERS; b++)
+		busy += g_src.busy[b];
+	pthread_mutex_unlock(&g_src.lock);
+	return busy;
+}
+
+static bool WaitClients(frame_share_t *share, int count) {
+	for (int i = 0; i < 100; i++) {
+		if (frame_share_clients(share) == count)
+			return true;
+		usleep(10000);
+	}
+	return false;
+}
+
+static void Start(frame_share_t *share, RK_U32 lease_ms) {
+	frame_share_cfg_t cfg;
+
+	SourceInit();
+	frame_share_cfg_default(&cfg);
+	cfg.path = g_path;
+	cfg.lease_ms = lease_ms;
+	cfg.source_fd = g_src.kick;
+	cfg.source = Source;
+	cfg.release = Release;
+	cfg.cb_arg = &g_src;
+	CHECK_EQ(frame_share_start(share, &cfg), 0);
+}
+
+static void Connect(frame_share_t *share, frame_share_client_t *c, int clients) {
+	CHECK_EQ(frame_share_client_open(c, g_path), 0);
+	CHECK(WaitClients(share, clients));
+}
+
+// the frame number the source wrote at the start of the mapping
+static RK_U32 FrameNumber(const uint8_t *nv12) {
+	RK_U32 n;
+	memcpy(&n, nv12, sizeof(n));
+	return n;
+}
+
+// the client maps each buffer once, sees the frame written into it, and its release frees the buffer
+static void TestRelease() {
+	frame_share_t share;
+	frame_share_client_t c;
+	frame_share_msg_t msg;
+
+	Start(&share, 1000);
+	// nobody watching: back at once
+	CHECK_EQ(Publish(), 0);
+	CHECK_EQ(Released(), 1);
+
+	Connect(&share, &c, 1);
+	for (RK_U32 i = 0; i < 2 * BUFFERS; i++) {
+		CHECK_EQ(Publish(), 1);
+		const uint8_t *nv12 = frame_share_client_recv(&c, &msg, 1000);
+		CHECK(nv12 != NULL);
+		if (!nv12)
+			break;
+		CHECK_EQ(msg.format, FRAME_SHARE_FMT_NV12);
+		CHECK_EQ(msg.size, SIZE);
+		CHECK_EQ(FrameNumber(nv12), i + 1);
+		CHECK_EQ(nv12[SIZE - 1], (uint8_t)(i + 1));
+		// the released buffer is reused first, so only one fd ever crosses
+		CHECK_EQ(msg.flags & FRAME_SHARE_FLAG_FD, i == 0 ? FRAME_SHARE_FLAG_FD : 0);
+		CHECK_EQ(Busy(), 1);
+		CHECK_EQ(frame_share_client_release(&c, &msg), 0);
+		CHECK(Wait([] { return !g_src.busy[0]; }));
+	}
+	CHECK_EQ(Released(), 2 * BUFFERS + 1);
+
+	// max_inflight 2: the third is skipped and comes straight back
+	frame_share_msg_t held[2];
+	for (int i = 0; i < 2; i++) {
+		CHECK_EQ(Publish(), 1);
+		CHECK(frame_share_client_recv(&c, &held[i], 1000) != NULL);
+	}
+	CHECK_EQ(Publish(), 0);
+	CHECK_EQ(Busy(), 2);
+	// a repeated release frees nothing more
+	CHECK_EQ(frame_share_client_release(&c, &held[0]), 0);
+	CHECK_EQ(frame_share_client_release(&c, &held[0]), 0);
+	CHECK(Wait([] { return g_src.busy[0] + g_src.busy[1] + g_src.busy[2] == 1; }));
+	usleep(20000);
+	CHECK_EQ(Busy(), 1);
+	CHECK_EQ(frame_share_client_release(&c, &held[1]), 0);
+	CHECK(Wait([] { return g_src.busy[0] + g_src.busy[1] + g_src.busy[2] == 0; }));
+
+	frame_share_client_close(&c);
+	frame_share_stop(&share);
+	CHECK_EQ(share.published, 2 * BUFFERS + 4);
+	CHECK_EQ(share.unwatched, 2);
+	CHECK_EQ(share.lease_expired, 0);
+	SourceDeinit();
+}
+
+// a client that keeps a frame past the lease is cut off and the buffer goes back; others carry on
+static void TestLeaseExpiry() {
+	frame_share_t share;
+	frame_share_client_t stuck, good;
+	frame_share_msg_t msg, got;
+
+	Start(&share, 200);
+	Connect(&share, &stuck, 1);
+	Connect(&share, &good, 2);
+	CHECK_EQ(Publish(), 2);
+	CHECK(frame_share_client_recv(&stuck, &msg, 1000) != NULL);
+	CHECK(frame_share_client_recv(&good, &got, 1000) != NULL);
+	CHECK_EQ(frame_share_client_release(&good, &got), 0);
+	usleep(50000);
+	CHECK_EQ(Busy(), 1);
+
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	CHECK(Wait([] { return g_src.busy[0] == false; }));
+	RK_U64 took = TEST_COMM_GetNowUs() - begin;
+	CHECK(took < 400000);
+	CHECK(WaitClients(&share, 1));
+	// the server hung up on it
+	CHECK(frame_share_client_recv(&stuck, &msg, 1000) == NULL);
+	CHECK_EQ(frame_share_client_release(&stuck, &msg), -1);
+
+	CHECK_EQ(Publish(), 1);
+	CHECK(frame_share_client_recv(&good, &got, 1000) != NULL);
+	CHECK_EQ(frame_share_client_release(&good, &got), 0);
+	CHECK(Wait([] { return g_src.busy[0] + g_src.busy[1] == 0; }));
+
+	frame_share_client_close(&stuck);
+	frame_share_client_close(&good);
+	frame_share_stop(&share);
+	CHECK_EQ(share.lease_expired, 1);
+	CHECK_EQ(share.connects, 2);
+	SourceDeinit();
+}
+
+// a client going away hands back whatever it held; the buffer waits for the last holder
+static void TestClientDrop() {
+	frame_share_t share;
+	frame_share_client_t a, b;
+	frame_share_msg_t ma[2], mb;
+
+	Start(&share, 1000);
+	Connect(&share, &a, 1);
+	Connect(&share, &b, 2);
+	CHECK_EQ(Publish(), 2);
+	CHECK_EQ(Publish(), 2);
+	CHECK(frame_share_client_recv(&a, &ma[0], 1000) != NULL);
+	CHECK(frame_share_client_recv(&a, &ma[1], 1000) != NULL);
+	CHECK(frame_share_client_recv(&b, &mb, 1000) != NULL);
+	CHECK_EQ(frame_share_client_release(&b, &mb), 0);
+	usleep(20000);
+	CHECK_EQ(Busy(), 2);
+
+	// a dies holding both: the first goes back, the second still waits for b
+	frame_share_client_close(&a);
+	CHECK(WaitClients(&share, 1));
+	CHECK(Wait([] { return g_src.busy[0] + g_src.busy[1] == 1; }));
+	CHECK_EQ(Released(), 1);
+	CHECK(frame_share_client_recv(&b, &mb, 1000) != NULL);
+	CHECK_EQ(frame_share_client_release(&b, &mb), 0);
+	CHECK(Wait([] { return g_src.busy[0] + g_src.busy[1] == 0; }));
+
+	// shutting down releases what is still out
+	CHECK_EQ(Publish(), 1);
+	CHECK(frame_share_client_recv(&b, &mb, 1000) != NULL);
+	CHECK_EQ(Busy(), 1);
+	frame_share_stop(&share);
+	CHECK_EQ(Busy(), 0);
+	CHECK(frame_share_client_recv(&b, &mb, 100) == NULL);
+	frame_share_client_close(&b);
+	for (int i = 0; i < BUFFERS; i++)
+		CHECK(g_src.released[i] <= 2);
+	CHECK_EQ(Released(), 3);
+	CHECK_EQ(share.lease_expired, 0);
+	SourceDeinit();
+}
+
+int main() {
+	rt_sched_profile_t profile;
+
+	rt_sched_profile_default(&profile);
+	rt_sched_init(&profile);
+	snprintf(g_path, sizeof(g_path), "/tmp/test_frame_share_%d.sock", (int)getpid());
+	TestRelease();
+	TestLeaseExpiry();
+	TestClientDrop();
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,284 @@
+/*****************************************************************************
+* | Function    :   Host test: heatmap accumulation, decay to zero and
+*                   the false colour export
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "heatmap.h"
+#include "host_test.h"
+
+#include "opencv2/highgui/highgui.hpp"
+
+// 90x60 cells of 8 px, as on the device
+#define W 720
+#define H 480
+#define SEC 1000000ULL
+
+static std::string g_png_path;
+static std::vector<uint8_t> g_png;
+static int g_png_cols;
+
+namespace cv {
+bool imwrite(const std::string &filename, const Mat &img, const std::vector<int> &params) {
+	(void)params;
+	g_png_path = filename;
+	g_png.assign(img.data, img.data + img.rows * img.step);
+	g_png_cols = img.cols;
+	return true;
+}
+}
+
+static RECT_S Rect(RK_S32 x, RK_S32 y, RK_U32 w, RK_U32 h) {
+	RECT_S r;
+	r.s32X = x;
+	r.s32Y = y;
+	r.u32Width = w;
+	r.u32Height = h;
+	return r;
+}
+
+static void Init(heatmap_t *hm) {
+	heatmap_cfg_t cfg;
+	heatmap_cfg_default(&cfg, W, H);
+	CHECK_EQ(heatmap_init(hm, &cfg), 0);
+	CHECK_EQ(hm->gw, 90);
+	CHECK_EQ(hm->gh, 60);
+}
+
+static void Fill(heatmap_t *hm, uint16_t v) {
+	for (RK_U32 i = 0; i < hm->gw * hm->gh; i++)
+		hm->grid[i] = v;
+}
+
+// decay intervals with no track in the picture
+static void Decay(heatmap_t *hm, tracker_t *tracker, RK_U64 *now, int intervals) {
+	*now += intervals * SEC;
+	heatmap_update(hm, tracker, *now);
+}
+
+// one splat fades all the way out; v -= v >> 5 used to stop at 31 for good
+static void TestDecayReachesZero() {
+	heatmap_t hm;
+	tracker_t tracker;
+	tracker_cfg_t tcfg;
+	RECT_S box = Rect(100, 100, 80, 80);
+	RK_U64 now = SEC;
+
+	tracker_cfg_default(&tcfg);
+	tracker_init(&tracker, &tcfg);
+	Init(&hm);
+	heatmap_update(&hm, &tracker, now);
+	heatmap_splat(&hm, &box, hm.cfg.weight);
+	CHECK_EQ(heatmap_max(&hm), 64);
+
+	Decay(&hm, &tracker, &now, 30);
+	CHECK(heatmap_max(&hm) > 0);
+	CHECK(heatmap_max(&hm) < 31);
+	Decay(&hm, &tracker, &now, 30);
+	CHECK_EQ(heatmap_max(&hm), 0);
+	CHECK_EQ(hm.decays, 60);
+	heatmap_deinit(&hm);
+}
+
+// every non-zero cell loses at least 1 and at most a 32nd rounded up, whole rows and the row tails alike
+static void TestDecayStep() {
+	heatmap_t hm;
+	tracker_t tracker;
+	tracker_cfg_t tcfg;
+	RK_U64 now = SEC;
+	static const uint16_t values[] = {0, 1, 2, 31, 32, 33, 63, 64, 1000, 32767, 65504, 65535};
+	const int count = sizeof(values) / sizeof(values[0]);
+
+	tracker_cfg_default(&tcfg);
+	tracker_init(&tracker, &tcfg);
+	Init(&hm);
+	heatmap_update(&hm, &tracker, now);
+	for (RK_U32 i = 0; i < hm.gw * hm.gh; i++)
+		hm.grid[i] = values[i % count];
+	Decay(&hm, &tracker, &now, 1);
+	for (RK_U32 i = 0; i < hm.gw * hm.gh; i++) {
+		RK_U32 v = values[i % count];
+		CHECK_EQ(hm.grid[i], v - (v + 31) / 32);
+	}
+	CHECK_EQ(hm.grid[count - 1], 65535 - 2048);
+	CHECK_EQ(hm.grid[1], 0);
+	heatmap_deinit(&hm);
+}
+
+// the half-life of the default shift is about 22 intervals
+static void TestHalfLife() {
+	heatmap_t hm;
+	tracker_t tracker;
+	tracker_cfg_t tcfg;
+	RK_U64 now = SEC;
+
+	tracker_cfg_default(&tcfg);
+	tracker_init(&tracker, &tcfg);
+	Init(&hm);
+	heatmap_update(&hm, &tracker, now);
+	Fill(&hm, 60000);
+	Decay(&hm, &tracker, &now, 22);
+	CHECK_NEAR(heatmap_max(&hm) / 60000.0, 0.5, 0.02);
+	heatmap_deinit(&hm);
+}
+
+// k intervals at once come out within a few counts of k single decays, in one pass
+static void TestCatchUpMatchesSteps() {
+	static heatmap_t one, many;
+	tracker_t tracker;
+	tracker_cfg_t tcfg;
+	static const int ks[] = {2, 5, 22, 100, 200};
+
+	tracker_cfg_default(&tcfg);
+	tracker_init(&tracker, &tcfg);
+	for (size_t n = 0; n < sizeof(ks) / sizeof(ks[0]); n++) {
+		RK_U64 t_one = SEC, t_many = SEC;
+		Init(&one);
+		Init(&many);
+		heatmap_update(&one, &tracker, t_one);
+		heatmap_update(&many, &tracker, t_many);
+		for (RK_U32 i = 0; i < one.gw * one.gh; i++)
+			one.grid[i] = many.grid[i] = (uint16_t)(i * 12 + 1);
+		Decay(&many, &tracker, &t_many, ks[n]);
+		for (int k = 0; k < ks[n]; k++)
+			Decay(&one, &tracker, &t_one, 1);
+		CHECK_EQ(many.decays, ks[n]);
+		int worst = 0;
+		for (RK_U32 i = 0; i < one.gw * one.gh; i++) {
+			int d = abs((int)one.grid[i] - (int)many.grid[i]);
+			worst = d > worst ? d : worst;
+		}
+		CHECK(worst <= 20);
+		heatmap_deinit(&one);
+		heatmap_deinit(&many);
+	}
+}
+
+// hours without a pass: a clear, not a loop of decays on the detection thread
+static void TestLongGapIsBounded() {
+	heatmap_t hm;
+	tracker_t tracker;
+	tracker_cfg_t tcfg;
+	RK_U64 now = SEC;
+
+	tracker_cfg_default(&tcfg);
+	tracker_init(&tracker, &tcfg);
+	Init(&hm);
+	CHECK(hm.zero_steps > 200 && hm.zero_steps < 400);
+	heatmap_update(&hm, &tracker, now);
+	Fill(&hm, 65535);
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	now += 100000 * SEC + SEC / 2;
+	heatmap_update(&hm, &tracker, now);
+	CHECK(TEST_COMM_GetNowUs() - begin < 10000);
+	CHECK_EQ(heatmap_max(&hm), 0);
+	CHECK_EQ(hm.decays, 100000);
+	// the interval phase is kept
+	CHECK_EQ(hm.last_decay_us, SEC + 100000 * SEC);
+	heatmap_deinit(&hm);
+}
+
+// confirmed tracks matched in the pass splat, clipped to the grid and saturating; coasting ones do not
+static void TestUpdateSplats() {
+	heatmap_t hm;
+	tracker_t tracker;
+	tracker_cfg_t tcfg;
+	tracker_det_t dets[2];
+
+	tracker_cfg_default(&tcfg);
+	tcfg.min_hits = 1;
+	tracker_init(&tracker, &tcfg);
+	Init(&hm);
+	dets[0].box = Rect(100, 100, 80, 80);
+	dets[1].box = Rect(700, 450, 80, 80);
+	for (int i = 0; i < 2; i++) {
+		dets[i].score = 0.9f;
+		dets[i].cls = 0;
+		dets[i].index = i;
+	}
+	tracker_update(&tracker, dets, 2, 0);
+	heatmap_update(&hm, &tracker, 1000);
+	CHECK_EQ(hm.grid[12 * hm.gw + 12], 64);
+	CHECK_EQ(hm.grid[22 * hm.gw + 22], 64);
+	CHECK_EQ(hm.grid[23 * hm.gw + 23], 0);
+	CHECK_EQ(hm.grid[59 * hm.gw + 89], 64);
+
+	tracker_update(&tracker, dets, 1, 100000);
+	heatmap_update(&hm, &tracker, 101000);
+	CHECK_EQ(hm.grid[12 * hm.gw + 12], 128);
+	CHECK_EQ(hm.grid[59 * hm.gw + 89], 64);
+
+	RECT_S big = Rect(-100, -100, 200, 200);
+	for (int i = 0; i < 1100; i++)
+		heatmap_splat(&hm, &big, 64);
+	CHECK_EQ(hm.grid[0], 0xffff);
+	heatmap_deinit(&hm);
+}
+
+// the peak maps to the top of the colour table, empty cells to the bottom
+static void TestExportPng() {
+	heatmap_t hm;
+	RECT_S hot = Rect(0, 0, 8, 8);
+	RECT_S warm = Rect(16, 0, 8, 8);
+
+	Init(&hm);
+	heatmap_splat(&hm, &hot, 1000);
+	heatmap_splat(&hm, &warm, 500);
+	CHECK_EQ(heatmap_export_png(&hm, "/tmp/heatmap.png"), 0);
+	CHECK(g_png_path == "/tmp/heatmap.png");
+	CHECK_EQ(g_png_cols, hm.gw * hm.cfg.osd_scale);
+
+	const uint8_t *px = g_png.data();
+	uint32_t top = hm.lut[255], bottom = hm.lut[0];
+	// BGR, each cell osd_scale pixels wide
+	CHECK_EQ(px[0], top & 0xff);
+	CHECK_EQ(px[2], (top >> 16) & 0xff);
+	CHECK_EQ(px[3 * 2 * 1], bottom & 0xff);
+	CHECK_EQ(px[3 * 2 * 1 + 2], (bottom >> 16) & 0xff);
+	uint32_t half = hm.lut[(500 * ((255u << 16) / 1000)) >> 16];
+	CHECK_EQ(px[3 * 2 * 2 + 1], (half >> 8) & 0xff);
+	heatmap_deinit(&hm);
+}
+
+// the detection thread only copies; the export writes that copy, once, from another thread
+static void TestSnapshotExport() {
+	heatmap_t hm;
+	RECT_S hot = Rect(0, 0, 8, 8);
+
+	Init(&hm);
+	CHECK_EQ(heatmap_export_snapshot(&hm, "/tmp"), 0);
+	heatmap_splat(&hm, &hot, 1000);
+	heatmap_snapshot(&hm);
+	// later changes and snapshots do not touch the pending copy
+	Fill(&hm, 0);
+	heatmap_snapshot(&hm);
+	g_png_path.clear();
+	CHECK_EQ(heatmap_export_snapshot(&hm, "/tmp"), 1);
+	CHECK(g_png_path == "/tmp/heatmap.png");
+	CHECK_EQ(g_png[0], hm.lut[255] & 0xff);
+	CHECK_EQ(heatmap_export_snapshot(&hm, "/tmp"), 0);
+
+	FILE *fp = fopen("/tmp/heatmap_90x60.raw", "rb");
+	CHECK(fp != NULL);
+	if (fp) {
+		uint16_t first = 0;
+		CHECK_EQ(fread(&first, sizeof(first), 1, fp), 1);
+		CHECK_EQ(first, 1000);
+		fclose(fp);
+	}
+	unlink("/tmp/heatmap_90x60.raw");
+	heatmap_deinit(&hm);
+}
+
+int main() {
+	TestDecayReachesZero();
+	TestDecayStep();
+	TestHalfLife();
+	TestCatchUpMatchesSteps();
+	TestLongGapIsBounded();
+	TestUpdateSplats();
+	TestExportPng();
+	TestSnapshotExport();
+	return HOST_TEST_RESULT();
+}
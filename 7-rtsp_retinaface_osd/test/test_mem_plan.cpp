@@ -0,0 +1,149 @@
+/*****************************************************************************
+* | Function    :   Host test: mem_plan buffer sizing (wrap, ref sharing,
+*                   stream buffers) and the budget check
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "mem_plan.h"
+#include "host_test.h"
+
+static RK_U64 EntryBytes(const mem_plan_t *plan, const char *name) {
+	for (int i = 0; i < plan->entry_count; i++) {
+		if (!strcmp(plan->entries[i].name, name))
+			return plan->entries[i].bytes;
+	}
+	return 0;
+}
+
+// without -m every channel keeps what vi_chn_init()/venc_init() always used
+static void TestDefaultPlan() {
+	mem_plan_cfg_t cfg;
+	mem_plan_t plan;
+	RK_U64 frame = 1920 * 1088 * 3 / 2;
+
+	mem_plan_cfg_default(&cfg, 1920, 1080);
+	plan.cma_free_start_kb = -1;
+	mem_plan_compute(&cfg, &plan);
+	for (int i = 0; i < 2; i++) {
+		CHECK_EQ(plan.vi[i].buf_cnt, 4);
+		CHECK_EQ(plan.vi[i].depth, 2);
+		CHECK_EQ(plan.vi[i].wrap_line, 0);
+	}
+	CHECK_EQ(EntryBytes(&plan, "vi chn0"), frame * 4);
+	CHECK(!plan.venc.ref_share);
+	CHECK_EQ(plan.venc.wrap_line, 0);
+	CHECK_EQ(plan.venc.buf_size, 1920 * 1080 * 3 / 2);
+	CHECK_EQ(EntryBytes(&plan, "venc ref"), frame * 2);
+	CHECK_EQ(plan.total_bytes, frame * 4 * 2 + frame * 2 + 2 * (RK_U64)plan.venc.buf_size);
+}
+
+// -m: the encoder channel gets a quarter-height wrap shared with VENC, the reader one held frame, VENC one ref
+static void TestSavePlan() {
+	mem_plan_cfg_t cfg;
+	mem_plan_t plan;
+	RK_U64 frame = 1920 * 1088 * 3 / 2;
+
+	mem_plan_cfg_default(&cfg, 1920, 1080);
+	cfg.save = true;
+	cfg.vi_chn_count = 3;
+	cfg.vi_role[2] = MEM_PLAN_VI_BIND;
+	plan.cma_free_start_kb = 12345;
+	mem_plan_compute(&cfg, &plan);
+	CHECK_EQ(plan.cma_free_start_kb, 12345);
+
+	CHECK_EQ(plan.vi[0].wrap_line, 272);
+	CHECK_EQ(plan.venc.wrap_line, 272);
+	CHECK_EQ(EntryBytes(&plan, "vi chn0"), 272 * 1920 * 3 / 2);
+	CHECK_EQ(plan.vi[1].buf_cnt, 2);
+	CHECK_EQ(plan.vi[1].depth, 1);
+	CHECK_EQ(plan.vi[1].wrap_line, 0);
+	CHECK_EQ(EntryBytes(&plan, "vi chn1"), frame * 2);
+	// a bound channel cannot wrap, the consumer reads whole frames
+	CHECK_EQ(plan.vi[2].wrap_line, 0);
+	CHECK_EQ(plan.vi[2].depth, 0);
+	CHECK_EQ(EntryBytes(&plan, "vi chn2"), frame * 2);
+
+	CHECK(plan.venc.ref_share);
+	CHECK_EQ(EntryBytes(&plan, "venc ref"), frame + 1920 * 64 * 3 / 2);
+	CHECK(EntryBytes(&plan, "venc ref") < frame * 2);
+	CHECK_EQ(plan.venc.buf_size, mem_plan_venc_buf_size(1920, 1080, 30, 10 * 1024));
+	CHECK_EQ(EntryBytes(&plan, "venc stream"), 2 * (RK_U64)plan.venc.buf_size);
+}
+
+// the wrap never drops below what VI/VENC accept, and tiny frames do not wrap at all
+static void TestWrapBounds() {
+	mem_plan_cfg_t cfg;
+	mem_plan_t plan;
+
+	mem_plan_cfg_default(&cfg, 640, 400);
+	cfg.save = true;
+	mem_plan_compute(&cfg, &plan);
+	CHECK_EQ(plan.vi[0].wrap_line, 128);
+
+	mem_plan_cfg_default(&cfg, 160, 120);
+	cfg.save = true;
+	mem_plan_compute(&cfg, &plan);
+	CHECK_EQ(plan.vi[0].wrap_line, 0);
+	CHECK_EQ(EntryBytes(&plan, "vi chn0"), mem_plan_frame_bytes(160, 120, 16) * 2);
+}
+
+static void TestSizes() {
+	CHECK_EQ(mem_plan_frame_bytes(1920, 1080, 16), 1920 * 1088 * 3 / 2);
+	// H.265 aligns to 64x64 CTUs
+	CHECK_EQ(mem_plan_venc_ref_bytes(1280, 720, RK_VIDEO_ID_HEVC, false), 2 * 1280 * 768 * 3 / 2);
+	CHECK_EQ(mem_plan_venc_ref_bytes(1280, 720, RK_VIDEO_ID_HEVC, true), 1280 * 768 * 3 / 2 + 1280 * 64 * 3 / 2);
+	CHECK_EQ(mem_plan_venc_ref_bytes(1280, 720, RK_VIDEO_ID_AVC, false), 2 * 1280 * 720 * 3 / 2);
+
+	// 10 Mbps at 30 fps: 8 average frames are below the floor of a quarter frame
+	CHECK_EQ(mem_plan_venc_buf_size(1920, 1080, 30, 10 * 1024), 520192);
+	// 4 Mbps at 5 fps: 8 average frames
+	CHECK_EQ(mem_plan_venc_buf_size(1920, 1080, 5, 4 * 1024), 839680);
+	// never more than a raw frame
+	CHECK_EQ(mem_plan_venc_buf_size(1920, 1080, 1, 100 * 1024), 3112960);
+	CHECK_EQ(mem_plan_venc_buf_size(1920, 1080, 0, 1024), 3112960);
+	for (RK_U32 kbps = 256; kbps <= 64 * 1024; kbps *= 2)
+		CHECK_EQ(mem_plan_venc_buf_size(1280, 720, 15, kbps) % 4096, 0);
+}
+
+static void TestAddIsBounded() {
+	mem_plan_t plan;
+
+	memset(&plan, 0, sizeof(plan));
+	for (int i = 0; i < MEM_PLAN_MAX_ENTRIES + 3; i++)
+		mem_plan_add(&plan, "pool", 1024);
+	CHECK_EQ(plan.entry_count, MEM_PLAN_MAX_ENTRIES);
+	CHECK_EQ(plan.total_bytes, MEM_PLAN_MAX_ENTRIES * 1024);
+}
+
+// the planned total and the CMA actually taken are both held against the budget
+static void TestBudgetCheck() {
+	mem_plan_t plan;
+
+	memset(&plan, 0, sizeof(plan));
+	mem_plan_add(&plan, "vpss pools", 8000 * 1024);
+	plan.cma_free_start_kb = 50000;
+
+	CHECK_EQ(mem_plan_check(&plan, 41000), 0);			// no budget
+	plan.cfg.budget_kb = 10000;
+	CHECK_EQ(mem_plan_check(&plan, 41000), 0);			// 9000 taken
+	CHECK_EQ(mem_plan_check(&plan, 39000), -1);		// 11000 taken
+	CHECK_EQ(mem_plan_check(&plan, -1), 0);			// not reported: the plan alone
+	plan.cma_free_start_kb = -1;
+	CHECK_EQ(mem_plan_check(&plan, 1000), 0);
+
+	plan.cfg.budget_kb = 7000;
+	CHECK_EQ(mem_plan_check(&plan, -1), -1);			// planned over budget
+	plan.cma_free_start_kb = 50000;
+	CHECK_EQ(mem_plan_check(&plan, 49000), -1);		// even if little is taken yet
+}
+
+int main() {
+	TestDefaultPlan();
+	TestSavePlan();
+	TestWrapBounds();
+	TestSizes();
+	TestAddIsBounded();
+	TestBudgetCheck();
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,223 @@
+/*****************************************************************************
+* | Function    :   Host test: motion gate decisions from IVS results and from
+*                   the software SAD fallback, occlusion and motion regions
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "motion_gate.h"
+#include "fake_mpi.h"
+#include "host_test.h"
+
+#define W 320
+#define H 240
+
+// NV12 in a fake media block; luma is textured unless flat, with a changed square if size > 0
+static void Frame(VIDEO_FRAME_INFO_S *frame, bool flat, int x0, int y0, int size) {
+	MB_BLK blk = fake_mb_alloc(W * H * 3 / 2);
+	uint8_t *y = (uint8_t *)RK_MPI_MB_Handle2VirAddr(blk);
+	for (int r = 0; r < H; r++) {
+		for (int c = 0; c < W; c++) {
+			uint8_t v = flat ? 30 + ((r + c) & 1) : (uint8_t)((c * 7 + r * 13) ^ (c * r));
+			if (size > 0 && c >= x0 && c < x0 + size && r >= y0 && r < y0 + size)
+				v = (uint8_t)(v + 128);
+			y[r * W + c] = v;
+		}
+	}
+	memset(y + W * H, 128, W * H / 2);
+	memset(frame, 0, sizeof(*frame));
+	frame->stVFrame.pMbBlk = blk;
+	frame->stVFrame.u32Width = W;
+	frame->stVFrame.u32Height = H;
+	frame->stVFrame.u32VirWidth = W;
+	frame->stVFrame.u32VirHeight = H;
+	frame->stVFrame.enPixelFormat = RK_FMT_YUV420SP;
+}
+
+static int Process(motion_gate_t *gate, bool flat, int x0, int y0, int size, motion_gate_result_t *res) {
+	VIDEO_FRAME_INFO_S frame;
+	Frame(&frame, flat, x0, y0, size);
+	int ret = motion_gate_process(gate, &frame, res);
+	RK_MPI_MB_ReleaseMB(frame.stVFrame.pMbBlk);
+	return ret;
+}
+
+static int Ivs(motion_gate_t *gate, const fake_ivs_result_t *result, motion_gate_result_t *res) {
+	if (result)
+		fake_ivs_queue(0, result);
+	return Process(gate, false, 0, 0, 0, res);
+}
+
+static void CheckRect(const RECT_S *r, RK_S32 x, RK_S32 y, RK_U32 w, RK_U32 h) {
+	CHECK_EQ(r->s32X, x);
+	CHECK_EQ(r->s32Y, y);
+	CHECK_EQ(r->u32Width, w);
+	CHECK_EQ(r->u32Height, h);
+}
+
+// MD rectangles count as moving cells, overlapping ones merge; OD stops the detector; no answer runs it
+static void TestIvsResults() {
+	motion_gate_t gate;
+	motion_gate_cfg_t cfg;
+	motion_gate_result_t res;
+	fake_ivs_result_t moving, quiet, covered;
+
+	memset(&moving, 0, sizeof(moving));
+	moving.rect_count = 3;
+	moving.rects[0] = {16, 16, 16, 16};
+	moving.rects[1] = {32, 16, 16, 16};
+	moving.rects[2] = {200, 100, 8, 8};
+	memset(&quiet, 0, sizeof(quiet));
+	memset(&covered, 0, sizeof(covered));
+	covered.occluded = true;
+
+	motion_gate_cfg_default(&cfg, W, H);
+	cfg.hold_frames = 1;
+	cfg.force_interval = 0;
+	cfg.rois = true;
+	CHECK_EQ(motion_gate_init(&gate, &cfg), 0);
+	CHECK_EQ(gate.backend, MOTION_GATE_IVS);
+	CHECK(fake_ivs_created(0));
+
+	CHECK_EQ(Ivs(&gate, &moving, &res), 0);
+	CHECK(res.run_detector);
+	CHECK(!res.occluded);
+	CHECK_EQ(res.motion_cells, 3);
+	CHECK_EQ(res.roi_count, 2);
+	CheckRect(&res.rois[0], 16, 16, 32, 16);
+	CheckRect(&res.rois[1], 200, 100, 8, 8);
+	CHECK_EQ(gate.triggered, 1);
+
+	// held for one quiet frame, then skipped
+	CHECK_EQ(Ivs(&gate, &quiet, &res), 0);
+	CHECK(res.run_detector);
+	CHECK_EQ(Ivs(&gate, &quiet, &res), 0);
+	CHECK(!res.run_detector);
+
+	// covered: no detection even with motion
+	covered.rect_count = 2;
+	covered.rects[0] = moving.rects[0];
+	covered.rects[1] = moving.rects[2];
+	CHECK_EQ(Ivs(&gate, &covered, &res), 0);
+	CHECK(res.occluded);
+	CHECK(!res.run_detector);
+
+	// no result from the block, or a failed send: the detector is not starved
+	CHECK_EQ(Ivs(&gate, NULL, &res), -1);
+	CHECK(res.run_detector);
+	fake_mpi_fail("RK_MPI_IVS_SendFrame", 1);
+	CHECK_EQ(Ivs(&gate, NULL, &res), -1);
+	CHECK(res.run_detector);
+	CHECK_EQ(fake_ivs_sent(0), 5);
+	CHECK_EQ(fake_ivs_outstanding(0), 0);
+
+	// without -G nothing is collected, the decision is the same
+	gate.cfg.rois = false;
+	CHECK_EQ(Ivs(&gate, &moving, &res), 0);
+	CHECK(res.run_detector);
+	CHECK_EQ(res.motion_cells, 3);
+	CHECK_EQ(res.roi_count, 0);
+
+	motion_gate_deinit(&gate);
+	CHECK(!fake_ivs_created(0));
+	CHECK_EQ(fake_mb_live(), 0);
+	fake_mpi_reset();
+}
+
+// no IVS channel: SAD on 1/2 luma, moving 8x8 cells at gate scale become one region, force_interval still runs
+static void TestSoftFallback() {
+	motion_gate_t gate;
+	motion_gate_cfg_t cfg;
+	motion_gate_result_t res;
+
+	motion_gate_cfg_default(&cfg, W, H);
+	cfg.hold_frames = 0;
+	cfg.force_interval = 4;
+	cfg.rois = true;
+	fake_mpi_fail("RK_MPI_IVS_CreateChn", 1);
+	CHECK_EQ(motion_gate_init(&gate, &cfg), 0);
+	CHECK_EQ(gate.backend, MOTION_GATE_SOFT);
+	CHECK(!fake_ivs_created(0));
+	CHECK_EQ(gate.step, 2);
+	CHECK_EQ(gate.dw, 160);
+	CHECK_EQ(gate.dh, 120);
+
+	// the first frame has nothing to compare with
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK_EQ(res.motion_cells, 0);
+	CHECK(!res.run_detector);
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK(!res.run_detector);
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK(!res.run_detector);
+	// frame 4: forced
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK_EQ(res.motion_cells, 0);
+	CHECK(res.run_detector);
+	gate.cfg.force_interval = 0;
+
+	// 32x32 at (64, 48): 2x2 cells of the 160x120 luma, back in frame pixels as one region
+	CHECK_EQ(Process(&gate, false, 64, 48, 32, &res), 0);
+	CHECK_EQ(res.motion_cells, 4);
+	CHECK(res.run_detector);
+	CHECK(!res.occluded);
+	CHECK_EQ(res.roi_count, 1);
+	CheckRect(&res.rois[0], 64, 48, 32, 32);
+	// and when it goes away
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK_EQ(res.motion_cells, 4);
+	CHECK(res.run_detector);
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK(!res.run_detector);
+
+	// a single cell is below min_cells
+	CHECK_EQ(Process(&gate, false, 160, 160, 16, &res), 0);
+	CHECK_EQ(res.motion_cells, 1);
+	CHECK(!res.run_detector);
+
+	gate.cfg.rois = false;
+	CHECK_EQ(Process(&gate, false, 64, 48, 32, &res), 0);
+	CHECK_EQ(res.motion_cells, 5);
+	CHECK(res.run_detector);
+	CHECK_EQ(res.roi_count, 0);
+	motion_gate_deinit(&gate);
+	CHECK_EQ(fake_mb_live(), 0);
+	fake_mpi_reset();
+}
+
+// a flat frame is a covered lens: no detection even though everything moved, nor while it stays flat
+static void TestSoftOcclusion() {
+	motion_gate_t gate;
+	motion_gate_cfg_t cfg;
+	motion_gate_result_t res;
+
+	motion_gate_cfg_default(&cfg, W, H);
+	cfg.try_ivs = false;
+	CHECK_EQ(motion_gate_init(&gate, &cfg), 0);
+	CHECK_EQ(gate.backend, MOTION_GATE_SOFT);
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK(!res.occluded);
+	CHECK(res.run_detector);
+
+	CHECK_EQ(Process(&gate, true, 0, 0, 0, &res), 0);
+	CHECK(res.occluded);
+	CHECK(res.motion_cells >= cfg.min_cells);
+	CHECK(!res.run_detector);
+	CHECK_EQ(Process(&gate, true, 0, 0, 0, &res), 0);
+	CHECK(res.occluded);
+	CHECK(!res.run_detector);
+
+	// uncovered: the change back is motion again
+	CHECK_EQ(Process(&gate, false, 0, 0, 0, &res), 0);
+	CHECK(!res.occluded);
+	CHECK(res.run_detector);
+	motion_gate_deinit(&gate);
+	fake_mpi_reset();
+}
+
+int main() {
+	TestIvsResults();
+	TestSoftFallback();
+	TestSoftOcclusion();
+	return HOST_TEST_RESULT();
+}
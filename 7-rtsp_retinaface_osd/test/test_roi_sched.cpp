@@ -0,0 +1,212 @@
+/*****************************************************************************
+* | Function    :   Host test: roi_sched windows, motion hints and the
+*                   full-pass decisions they lead to
+*
+******************************************************************************/
+
+#include "luckfox_mpi.h"
+#include "roi_sched.h"
+#include "fake_mpi.h"
+#include "host_test.h"
+
+static RECT_S Rect(RK_S32 x, RK_S32 y, RK_U32 w, RK_U32 h) {
+	RECT_S r;
+	r.s32X = x;
+	r.s32Y = y;
+	r.u32Width = w;
+	r.u32Height = h;
+	return r;
+}
+
+// one tracked face at (400, 300) 60x60, after a full pass at pts 0
+static void Setup(roi_sched_t *sched, tracker_t *tracker) {
+	roi_sched_cfg_t cfg;
+	tracker_cfg_t tcfg;
+	tracker_det_t det;
+
+	roi_sched_cfg_default(&cfg);
+	roi_sched_init(sched, &cfg);
+	tracker_cfg_default(&tcfg);
+	tracker_init(tracker, &tcfg);
+	det.box = Rect(400, 300, 60, 60);
+	det.score = 0.9f;
+	det.cls = 0;
+	det.index = 0;
+	tracker_update(tracker, &det, 1, 0);
+	roi_sched_done(sched, ROI_SCHED_FULL, 0, NULL, NULL, 0, 1000);
+	roi_sched_observe(sched, tracker);
+}
+
+static crop_mosaic_det_t Det(RK_S32 left, RK_S32 top, RK_S32 size) {
+	crop_mosaic_det_t det;
+	memset(&det, 0, sizeof(det));
+	det.det.prop = 0.9f;
+	det.det.box.left = left;
+	det.det.box.top = top;
+	det.det.box.right = left + size;
+	det.det.box.bottom = top + size;
+	return det;
+}
+
+// the plan's windows as the mosaic would hand them back, all placed
+static void Mosaic(crop_mosaic_t *mosaic, const RECT_S *rois, const int *tags, int count) {
+	memset(mosaic, 0, sizeof(*mosaic));
+	mosaic->count = count;
+	for (int i = 0; i < count; i++) {
+		mosaic->tiles[i].roi = rois[i];
+		mosaic->tiles[i].tag = tags[i];
+		mosaic->tiles[i].placed = true;
+	}
+}
+
+// motion away from the track becomes an untagged window in the plan's scale, motion on the track does not
+static void TestHintsBecomeWindows() {
+	roi_sched_t sched;
+	tracker_t tracker;
+	RECT_S rois[ROI_SCHED_MAX_ROIS];
+	int tags[ROI_SCHED_MAX_ROIS];
+	int count;
+	// gate frame a quarter of the plan's size; the second region lands on the tracked face
+	RECT_S hints[2] = {Rect(300, 100, 20, 40), Rect(105, 80, 10, 10)};
+
+	Setup(&sched, &tracker);
+	roi_sched_hint(&sched, hints, 2, 4.0f, 4.0f);
+	CHECK_EQ(roi_sched_plan(&sched, &tracker, 100000, 1920, 1080, rois, tags, &count), ROI_SCHED_ROI);
+	CHECK_EQ(count, 2);
+	CHECK_EQ(tags[0], tracker.tracks[0].id);
+	CHECK_EQ(tags[1], 0);
+	// centre kept, grown to min_window where the motion was smaller
+	CHECK_EQ(rois[1].s32X + rois[1].u32Width / 2, 1200 + 40);
+	CHECK_EQ(rois[1].s32Y + rois[1].u32Height / 2, 400 + 80);
+	CHECK_EQ(rois[1].u32Width, 80);
+	CHECK_EQ(rois[1].u32Height, 160);
+
+	// used once: the next plan has the track window only
+	CHECK_EQ(roi_sched_plan(&sched, &tracker, 200000, 1920, 1080, rois, tags, &count), ROI_SCHED_ROI);
+	CHECK_EQ(count, 1);
+}
+
+// a motion window with nothing in it forces no full pass, a face in it is counted; a lost track window forces one
+static void TestHintWindowsForceNothing() {
+	roi_sched_t sched;
+	tracker_t tracker;
+	crop_mosaic_t mosaic;
+	RECT_S rois[ROI_SCHED_MAX_ROIS];
+	int tags[ROI_SCHED_MAX_ROIS];
+	int count;
+	RECT_S hint = Rect(1000, 600, 100, 100);
+	crop_mosaic_det_t dets[2] = {Det(410, 310, 40), Det(1020, 620, 40)};
+
+	Setup(&sched, &tracker);
+	roi_sched_hint(&sched, &hint, 1, 1.0f, 1.0f);
+	roi_sched_plan(&sched, &tracker, 100000, 1920, 1080, rois, tags, &count);
+	CHECK_EQ(count, 2);
+	Mosaic(&mosaic, rois, tags, count);
+	roi_sched_done(&sched, ROI_SCHED_ROI, 100000, &mosaic, dets, 1, 1000);
+	CHECK(!sched.force_full);
+	CHECK_EQ(sched.refound, 1);
+	CHECK_EQ(sched.lost, 0);
+	CHECK_EQ(sched.hinted, 1);
+	CHECK_EQ(sched.hint_found, 0);
+
+	roi_sched_hint(&sched, &hint, 1, 1.0f, 1.0f);
+	roi_sched_plan(&sched, &tracker, 200000, 1920, 1080, rois, tags, &count);
+	Mosaic(&mosaic, rois, tags, count);
+	roi_sched_done(&sched, ROI_SCHED_ROI, 200000, &mosaic, dets, 2, 1000);
+	CHECK(!sched.force_full);
+	CHECK_EQ(sched.hinted, 2);
+	CHECK_EQ(sched.hint_found, 1);
+
+	// a motion window left out of the mosaic is no spill either
+	roi_sched_hint(&sched, &hint, 1, 1.0f, 1.0f);
+	roi_sched_plan(&sched, &tracker, 300000, 1920, 1080, rois, tags, &count);
+	Mosaic(&mosaic, rois, tags, count);
+	mosaic.tiles[1].placed = false;
+	roi_sched_done(&sched, ROI_SCHED_ROI, 300000, &mosaic, dets, 1, 1000);
+	CHECK(!sched.force_full);
+	CHECK_EQ(sched.spilled, 0);
+
+	// the track's own window empty: the full frame has to look
+	roi_sched_plan(&sched, &tracker, 350000, 1920, 1080, rois, tags, &count);
+	Mosaic(&mosaic, rois, tags, count);
+	roi_sched_done(&sched, ROI_SCHED_ROI, 350000, &mosaic, dets + 1, 1, 1000);
+	CHECK(sched.force_full);
+	CHECK_EQ(sched.lost, 1);
+}
+
+// motion alone, with no track to re-check, is left to a full pass
+static void TestNoTracksIsFull() {
+	roi_sched_t sched;
+	tracker_t tracker;
+	RECT_S rois[ROI_SCHED_MAX_ROIS];
+	int tags[ROI_SCHED_MAX_ROIS];
+	int count;
+	RECT_S hint = Rect(100, 100, 50, 50);
+
+	Setup(&sched, &tracker);
+	tracker_flush(&tracker);
+	roi_sched_hint(&sched, &hint, 1, 1.0f, 1.0f);
+	CHECK_EQ(roi_sched_plan(&sched, &tracker, 100000, 1920, 1080, rois, tags, &count), ROI_SCHED_FULL);
+	CHECK_EQ(count, 0);
+	CHECK_EQ(sched.hint_count, 0);
+}
+
+// passes at the infer interval, the track refound each time: full_every sets the
+// schedule at the default 500 ms, full_max_ms takes over only at longer intervals
+static int FullPasses(RK_U64 interval_us, int passes) {
+	roi_sched_t sched;
+	tracker_t tracker;
+	crop_mosaic_t mosaic;
+	RECT_S rois[ROI_SCHED_MAX_ROIS];
+	int tags[ROI_SCHED_MAX_ROIS];
+	int count;
+	crop_mosaic_det_t det = Det(410, 310, 40);
+	int full = 0;
+
+	Setup(&sched, &tracker);
+	for (int p = 1; p <= passes; p++) {
+		RK_U64 pts = p * interval_us;
+		if (roi_sched_plan(&sched, &tracker, pts, 1920, 1080, rois, tags, &count) == ROI_SCHED_FULL) {
+			roi_sched_done(&sched, ROI_SCHED_FULL, pts, NULL, NULL, 0, 1000);
+			full++;
+			continue;
+		}
+		CHECK_EQ(count, 1);
+		Mosaic(&mosaic, rois, tags, count);
+		roi_sched_done(&sched, ROI_SCHED_ROI, pts, &mosaic, &det, 1, 1000);
+		CHECK(!sched.force_full);
+	}
+	return full;
+}
+
+static void TestScheduleAtPassRate() {
+	CHECK_EQ(FullPasses(500000, 20), 4);
+	CHECK_EQ(FullPasses(1000000, 21), 7);
+}
+
+// one replay pass per interval of pts, whatever the file's frame rate; a loop starts over
+static void TestReplayDue() {
+	roi_sched_replay_t replay;
+	int due = 0;
+
+	roi_sched_replay_init(&replay);
+	replay.interval_ms = 500;
+	for (RK_U64 pts = 0; pts < 10000000; pts += 40000)
+		due += roi_sched_replay_due(&replay, pts);
+	CHECK_EQ(due, 20);
+	CHECK(roi_sched_replay_due(&replay, 0));
+	CHECK(!roi_sched_replay_due(&replay, 40000));
+
+	replay.interval_ms = 0;
+	CHECK(roi_sched_replay_due(&replay, 40000));
+	CHECK(roi_sched_replay_due(&replay, 40000));
+}
+
+int main() {
+	TestHintsBecomeWindows();
+	TestHintWindowsForceNothing();
+	TestNoTracksIsFull();
+	TestScheduleAtPassRate();
+	TestReplayDue();
+	return HOST_TEST_RESULT();
+}
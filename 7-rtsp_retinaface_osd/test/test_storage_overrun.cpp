@@ -0,0 +1,140 @@
+/*****************************************************************************
+* | Function    :   Host test: a 1 MB storage_writer ring overrun while the
+*                   card is held, drops counted and nothing accepted lost
+*
+******************************************************************************/
+
+#include <sys/stat.h>
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "rt_sched.h"
+#include "storage_writer.h"
+#include "slow_card.h"
+#include "host_test.h"
+
+#define CHUNK (16 * 1024)
+#define CHUNKS 256				// 4 MB into a 1 MB ring
+
+static char g_dir[64];
+
+static std::vector<uint8_t> Chunk(RK_U32 n) {
+	std::vector<uint8_t> data(CHUNK);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (uint8_t)(n * 13 + i);
+	memcpy(data.data(), &n, sizeof(n));
+	return data;
+}
+
+static std::vector<uint8_t> Contents(const char *path) {
+	std::vector<uint8_t> data;
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return data;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(fp);
+	return data;
+}
+
+static bool WaitBlocked(void) {
+	slow_card_stats_t stats;
+	for (int i = 0; i < 200; i++) {
+		slow_card_stats(&stats);
+		if (stats.blocked)
+			return true;
+		usleep(5000);
+	}
+	return false;
+}
+
+// the writer sits in a held pwrite while 4 MB are pushed at full speed
+static void TestOverrun() {
+	storage_writer_t writer;
+	storage_writer_cfg_t cfg;
+	slow_card_cfg_t card;
+	std::vector<uint8_t> accepted;
+	RK_U32 accepted_chunks = 0;
+	RK_U64 worst_us = 0;
+
+	memset(&card, 0, sizeof(card));
+	slow_card_set(&card);
+	storage_writer_cfg_default(&cfg);
+	cfg.dir = g_dir;
+	cfg.queue_bytes = 1 << 20;
+	cfg.block_bytes = 64 * 1024;
+	CHECK_EQ(storage_writer_start(&writer, &cfg), 0);
+	CHECK_EQ(writer.cfg.queue_bytes, 1 << 20);
+
+	// one block through to the card, where it stays
+	slow_card_hold(true);
+	for (RK_U32 n = 0; n < 4; n++) {
+		std::vector<uint8_t> chunk = Chunk(n);
+		CHECK_EQ(storage_writer_push(&writer, chunk.data(), CHUNK, 0), 0);
+		accepted.insert(accepted.end(), chunk.begin(), chunk.end());
+	}
+	CHECK(WaitBlocked());
+
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	for (RK_U32 n = 4; n < CHUNKS; n++) {
+		std::vector<uint8_t> chunk = Chunk(n);
+		RK_U64 t = TEST_COMM_GetNowUs();
+		int ret = storage_writer_push(&writer, chunk.data(), CHUNK, 0);
+		t = TEST_COMM_GetNowUs() - t;
+		if (t > worst_us)
+			worst_us = t;
+		if (ret == 0) {
+			accepted.insert(accepted.end(), chunk.begin(), chunk.end());
+			accepted_chunks++;
+		}
+	}
+	RK_U64 took = TEST_COMM_GetNowUs() - begin;
+	printf("overrun: %u of %u chunks accepted in %llu us, worst push %llu us\n", accepted_chunks, CHUNKS - 4,
+	       (unsigned long long)took, (unsigned long long)worst_us);
+
+	// the ring filled and stayed full, the rest dropped and counted, no push waited
+	CHECK(worst_us < 20000);
+	CHECK(took < 500000);
+	// a megabyte of 16 KB + 8 byte items, less one lost to the skip at the end of the ring
+	CHECK(accepted_chunks >= (1u << 20) / (CHUNK + 8) - 1);
+	CHECK(accepted_chunks <= (1u << 20) / (CHUNK + 8));
+	CHECK_EQ(writer.dropped.load(), CHUNKS - 4 - accepted_chunks);
+	CHECK_EQ(writer.dropped_bytes.load(), (RK_U64)writer.dropped.load() * CHUNK);
+	CHECK(writer.queue_max.load() <= cfg.queue_bytes);
+	CHECK(storage_writer_queue_depth(&writer) > cfg.queue_bytes - CHUNK - 8);
+
+	// the card comes back, the ring drains and pushes are accepted again
+	slow_card_hold(false);
+	for (int i = 0; i < 200 && storage_writer_queue_depth(&writer); i++)
+		usleep(5000);
+	CHECK_EQ(storage_writer_queue_depth(&writer), 0);
+	for (RK_U32 n = CHUNKS; n < CHUNKS + 8; n++) {
+		std::vector<uint8_t> chunk = Chunk(n);
+		CHECK_EQ(storage_writer_push(&writer, chunk.data(), CHUNK, 0), 0);
+		accepted.insert(accepted.end(), chunk.begin(), chunk.end());
+	}
+	storage_writer_dump_stats(&writer);
+	storage_writer_stop(&writer);
+	CHECK_EQ(writer.errors, 0);
+
+	// what was accepted is on the card in order, nothing else
+	CHECK_EQ(writer.seg_index, 1);
+	std::vector<uint8_t> file = Contents(writer.seg_names[0]);
+	CHECK_EQ(file.size(), accepted.size());
+	CHECK(file == accepted);
+	unlink(writer.seg_names[0]);
+}
+
+int main() {
+	rt_sched_profile_t profile;
+
+	rt_sched_profile_default(&profile);
+	rt_sched_init(&profile);
+	snprintf(g_dir, sizeof(g_dir), "/tmp/test_storage_overrun_%d", (int)getpid());
+	mkdir(g_dir, 0755);
+	TestOverrun();
+	rmdir(g_dir);
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,154 @@
+/*****************************************************************************
+* | Function    :   Host test: storage_writer against a throttled card, the
+*                   producer never waits for it and the segments add up
+*
+******************************************************************************/
+
+#include <sys/stat.h>
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "rt_sched.h"
+#include "storage_writer.h"
+#include "slow_card.h"
+#include "host_test.h"
+
+// 25 fps for 8 s of 2.6 Mbps: a 40 KB IDR and 24 8 KB P frames per second
+#define FRAMES 200
+#define GOP 25
+#define FRAME_US 40000
+#define IDR_BYTES (40 * 1024)
+#define P_BYTES (8 * 1024)
+
+static char g_dir[64];
+static int g_idle;
+
+static void Idle(void *arg) {
+	(void)arg;
+	g_idle++;
+}
+
+// frame number up front, then a pattern of it
+static std::vector<uint8_t> Frame(RK_U32 n) {
+	std::vector<uint8_t> data(n % GOP ? P_BYTES : IDR_BYTES);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = (uint8_t)(n * 7 + i);
+	memcpy(data.data(), &n, sizeof(n));
+	return data;
+}
+
+static std::vector<uint8_t> Contents(const char *path) {
+	std::vector<uint8_t> data;
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return data;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		data.insert(data.end(), buf, buf + n);
+	fclose(fp);
+	return data;
+}
+
+/*
+ * The card writes 4 MB/s but every third fdatasync stalls for a second,
+ * like an SD card collecting garbage. The stream keeps its 40 ms frame
+ * clock through every stall; the ring absorbs the backlog.
+ */
+static void TestThrottledCard() {
+	storage_writer_t writer;
+	storage_writer_cfg_t cfg;
+	slow_card_cfg_t card;
+	slow_card_stats_t card_stats;
+	std::vector<uint8_t> stream;
+	RK_U64 worst_us = 0;
+
+	memset(&card, 0, sizeof(card));
+	card.write_us = 2000;
+	card.bytes_per_ms = 4096;
+	card.sync_us = 5000;
+	card.stall_every = 3;
+	card.stall_us = 1000000;
+	slow_card_set(&card);
+
+	storage_writer_cfg_default(&cfg);
+	cfg.dir = g_dir;
+	cfg.segment_bytes = 1 << 20;		// a quarter holds a whole GOP, so every segment starts at an IDR
+	cfg.block_bytes = 64 * 1024;
+	cfg.sync_blocks = 2;
+	cfg.sync_ms = 1000;
+	cfg.idle = Idle;
+	cfg.idle_ms = 100;
+	CHECK_EQ(storage_writer_start(&writer, &cfg), 0);
+
+	RK_U64 begin = TEST_COMM_GetNowUs();
+	for (RK_U32 n = 0; n < FRAMES; n++) {
+		std::vector<uint8_t> frame = Frame(n);
+		struct iovec iov[2];
+		iov[0].iov_base = frame.data();
+		iov[0].iov_len = 100;
+		iov[1].iov_base = frame.data() + 100;
+		iov[1].iov_len = frame.size() - 100;
+		RK_U64 t = TEST_COMM_GetNowUs();
+		CHECK_EQ(storage_writer_pushv(&writer, iov, 2, n % GOP ? 0 : STORAGE_WRITER_SYNC_POINT), 0);
+		t = TEST_COMM_GetNowUs() - t;
+		if (t > worst_us)
+			worst_us = t;
+		stream.insert(stream.end(), frame.begin(), frame.end());
+		RK_U64 next = begin + (n + 1) * (RK_U64)FRAME_US;
+		RK_U64 now = TEST_COMM_GetNowUs();
+		if (next > now)
+			usleep(next - now);
+	}
+	RK_U64 took = TEST_COMM_GetNowUs() - begin;
+	RK_U32 queue_max = writer.queue_max.load();
+	slow_card_stats(&card_stats);
+	storage_writer_dump_stats(&writer);
+	storage_writer_stop(&writer);
+	printf("throttled card: worst push %llu us, queue max %u KB, %u stalls\n", (unsigned long long)worst_us,
+	       queue_max / 1024, card_stats.stalls);
+
+	// the card stalled for seconds in all, the producer kept its clock and never dropped
+	CHECK(card_stats.stalls >= 2);
+	CHECK(worst_us < 20000);
+	CHECK(took < FRAMES * (RK_U64)FRAME_US + 200000);
+	CHECK(queue_max > 4 * IDR_BYTES);
+	CHECK_EQ(writer.dropped.load(), 0);
+	CHECK_EQ(writer.errors, 0);
+	CHECK(g_idle > 0);
+	// syncs come in batches of blocks, plus one at each segment close
+	slow_card_stats(&card_stats);
+	CHECK(card_stats.syncs * 2 <= card_stats.writes + 2 * writer.segments);
+
+	// byte for byte the stream, each file starting at an IDR and cut back to its real length
+	std::vector<uint8_t> files;
+	CHECK(writer.seg_index >= 2);
+	for (RK_U32 i = 0; i < writer.seg_index; i++) {
+		const char *path = writer.seg_names[i % STORAGE_WRITER_MAX_SEGMENTS];
+		std::vector<uint8_t> seg = Contents(path);
+		RK_U32 first = 0;
+		CHECK(seg.size() >= sizeof(first));
+		if (seg.size() >= sizeof(first))
+			memcpy(&first, seg.data(), sizeof(first));
+		CHECK_EQ(first % GOP, 0);
+		CHECK(seg.size() <= cfg.segment_bytes);
+		files.insert(files.end(), seg.begin(), seg.end());
+		unlink(path);
+	}
+	CHECK_EQ(files.size(), stream.size());
+	CHECK(files == stream);
+}
+
+int main() {
+	rt_sched_profile_t profile;
+
+	rt_sched_profile_default(&profile);
+	rt_sched_init(&profile);
+	// STORAGE_TEST_DIR: a real card or a loop mounted image instead of /tmp
+	const char *dir = getenv("STORAGE_TEST_DIR");
+	snprintf(g_dir, sizeof(g_dir), "%s/test_storage_writer_%d", dir ? dir : "/tmp", (int)getpid());
+	mkdir(g_dir, 0755);
+	TestThrottledCard();
+	rmdir(g_dir);
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,175 @@
+/*****************************************************************************
+* | Function    :   Host test: slice-split (-L) and multi-pack VENC streams
+*                   through venc_stream_read() against the fake encoder
+*
+******************************************************************************/
+
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "venc_stream.h"
+#include "fake_mpi.h"
+#include "host_test.h"
+
+typedef struct {
+	RK_U32 pack_count;
+	RK_U32 total_len;
+	RK_U64 pts;
+	bool frame_end;
+	bool after_drop;
+	bool data_ok;
+} seen_au_t;
+
+static std::vector<seen_au_t> g_seen;
+
+static void RecordSink(const venc_au_t *au, void *arg) {
+	seen_au_t seen;
+	uint8_t fill = *(uint8_t *)arg;
+
+	seen.pack_count = au->pack_count;
+	seen.total_len = au->total_len;
+	seen.pts = au->pts;
+	seen.frame_end = au->frame_end;
+	seen.after_drop = au->after_drop;
+	seen.data_ok = true;
+	// every pack starts at its offset with (fill + i) for pack i
+	for (RK_U32 i = 0; i < au->pack_count; i++) {
+		for (RK_U32 b = 0; b < au->packs[i].len; b++) {
+			if (au->packs[i].data[b] != (uint8_t)(fill + i * 16 + b))
+				seen.data_ok = false;
+		}
+	}
+	g_seen.push_back(seen);
+}
+
+static fake_venc_pack_t Pack(RK_U32 len, RK_U64 pts, bool frame_end, uint8_t fill) {
+	fake_venc_pack_t pack;
+	pack.len = len;
+	pack.offset = 64;
+	pack.pts = pts;
+	pack.frame_end = frame_end;
+	pack.fill = fill;
+	return pack;
+}
+
+// -L 4: each slice is its own stream, the sinks must see it before the next one exists
+static void TestSlicesGoOutOneByOne() {
+	venc_stream_reader_t reader;
+	uint8_t fill = 0;
+	const RK_U64 pts = 1000000;
+
+	g_seen.clear();
+	venc_stream_reader_init(&reader, 0);
+	venc_stream_add_sink(&reader, RecordSink, &fill);
+	for (int s = 0; s < 4; s++) {
+		fake_venc_pack_t slice = Pack(1000 + s, pts, s == 3, 0);
+		fake_venc_queue(0, &slice, 1);
+		CHECK_EQ(venc_stream_read(&reader, 0), RK_SUCCESS);
+		CHECK_EQ(g_seen.size(), s + 1);
+		CHECK_EQ(g_seen[s].pack_count, 1);
+		CHECK_EQ(g_seen[s].total_len, 1000 + s);
+		// one pts per frame: RtspVideoSink times the first slice by the pts change
+		CHECK_EQ(g_seen[s].pts, pts);
+		CHECK_EQ(g_seen[s].frame_end, s == 3);
+		CHECK(g_seen[s].data_ok);
+		CHECK_EQ(fake_venc_outstanding(0), 0);
+	}
+	CHECK_EQ(reader.frames, 4);
+	CHECK_EQ(reader.multi_pack_frames, 0);
+	CHECK(venc_stream_read(&reader, 0) != RK_SUCCESS);
+	CHECK_EQ(g_seen.size(), 4);
+}
+
+// without -L an IDR comes as SPS, PPS and slice in one GetStream, fanned out as one access unit
+static void TestPacksOfAFrameAreOneAccessUnit() {
+	venc_stream_reader_t reader;
+	uint8_t fill = 0;
+	fake_venc_pack_t packs[3] = {Pack(12, 5000, false, 0), Pack(6, 5000, false, 16), Pack(30000, 5000, true, 32)};
+
+	g_seen.clear();
+	venc_stream_reader_init(&reader, 1);
+	venc_stream_add_sink(&reader, RecordSink, &fill);
+	venc_stream_add_sink(&reader, RecordSink, &fill);
+	fake_venc_queue(1, packs, 3);
+	CHECK_EQ(venc_stream_read(&reader, 0), RK_SUCCESS);
+	CHECK_EQ(g_seen.size(), 2);
+	for (const seen_au_t &seen : g_seen) {
+		CHECK_EQ(seen.pack_count, 3);
+		CHECK_EQ(seen.total_len, 12 + 6 + 30000);
+		CHECK(seen.frame_end);
+		CHECK(seen.data_ok);
+	}
+	CHECK_EQ(reader.multi_pack_frames, 1);
+	CHECK_EQ(fake_venc_outstanding(1), 0);
+}
+
+// more packs in one fetch than the reader holds: no sink sees a truncated frame, the stream is
+// released, its further slices dropped too and an IDR requested; the next frame is marked
+static void TestOverflowDropsTheFrame() {
+	venc_stream_reader_t reader;
+	uint8_t fill = 0;
+	fake_venc_pack_t packs[VENC_STREAM_MAX_PACKS + 2];
+
+	for (int i = 0; i < VENC_STREAM_MAX_PACKS + 2; i++)
+		packs[i] = Pack(100, 7000, false, (uint8_t)(i * 16));
+	g_seen.clear();
+	venc_stream_reader_init(&reader, 2);
+	venc_stream_add_sink(&reader, RecordSink, &fill);
+	fake_venc_queue(2, packs, VENC_STREAM_MAX_PACKS + 2);
+	CHECK_EQ(venc_stream_read(&reader, 0), RK_SUCCESS);
+	CHECK_EQ(reader.overflow_frames, 1);
+	CHECK_EQ(g_seen.size(), 0);
+	CHECK_EQ(fake_venc_outstanding(2), 0);
+	CHECK_EQ(fake_venc_idr_requests(2), 1);
+
+	// the last slice of the same frame
+	fake_venc_pack_t tail = Pack(100, 7000, true, 0);
+	fake_venc_queue(2, &tail, 1);
+	CHECK_EQ(venc_stream_read(&reader, 0), RK_SUCCESS);
+	CHECK_EQ(g_seen.size(), 0);
+	CHECK_EQ(reader.dropped_streams, 2);
+
+	fake_venc_pack_t next = Pack(100, 7040, true, 0);
+	for (int f = 0; f < 2; f++) {
+		fake_venc_queue(2, &next, 1);
+		CHECK_EQ(venc_stream_read(&reader, 0), RK_SUCCESS);
+	}
+	CHECK_EQ(g_seen.size(), 2);
+	CHECK(g_seen[0].after_drop);
+	CHECK(!g_seen[1].after_drop);
+	CHECK(g_seen[0].data_ok);
+	CHECK_EQ(fake_venc_outstanding(2), 0);
+	CHECK_EQ(fake_venc_idr_requests(2), 1);
+}
+
+// an empty pack is skipped, a stream with nothing in it reaches no sink but is still released
+static void TestEmptyPacksAreSkipped() {
+	venc_stream_reader_t reader;
+	uint8_t fill = 0;
+	fake_venc_pack_t packs[2] = {Pack(0, 9000, false, 0), Pack(50, 9000, true, 0)};
+
+	g_seen.clear();
+	venc_stream_reader_init(&reader, 3);
+	venc_stream_add_sink(&reader, RecordSink, &fill);
+	fake_venc_queue(3, packs, 2);
+	CHECK_EQ(venc_stream_read(&reader, 0), RK_SUCCESS);
+	CHECK_EQ(g_seen.size(), 1);
+	CHECK_EQ(g_seen[0].pack_count, 1);
+	CHECK_EQ(g_seen[0].total_len, 50);
+	CHECK(g_seen[0].data_ok);
+
+	fake_venc_queue(3, packs, 1);
+	CHECK_EQ(venc_stream_read(&reader, 0), RK_SUCCESS);
+	CHECK_EQ(g_seen.size(), 1);
+	CHECK_EQ(fake_venc_outstanding(3), 0);
+}
+
+int main() {
+	TestSlicesGoOutOneByOne();
+	TestPacksOfAFrameAreOneAccessUnit();
+	TestOverflowDropsTheFrame();
+	TestEmptyPacksAreSkipped();
+	fake_mpi_reset();
+	CHECK_EQ(fake_mb_live(), 0);
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,244 @@
+/*****************************************************************************
+* | Function    :   Host test: vpss_node configuration, frame flow and
+*                   cleanup against the fake VPSS
+*
+******************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "luckfox_mpi.h"
+#include "event_loop.h"
+#include "vpss_node.h"
+#include "fake_mpi.h"
+#include "host_test.h"
+
+static vpss_output_cfg_t Output(const char *name, RK_U32 width, RK_U32 height, PIXEL_FORMAT_E format,
+                                RK_U32 depth, RK_U32 pool_blk_cnt) {
+	vpss_output_cfg_t out;
+	memset(&out, 0, sizeof(out));
+	out.name = name;
+	out.width = width;
+	out.height = height;
+	out.format = format;
+	out.rotation = ROTATION_0;
+	out.depth = depth;
+	out.pool_blk_cnt = pool_blk_cnt;
+	return out;
+}
+
+static VIDEO_FRAME_INFO_S InputFrame(RK_U64 pts) {
+	VIDEO_FRAME_INFO_S frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.stVFrame.u32Width = 1920;
+	frame.stVFrame.u32Height = 1080;
+	frame.stVFrame.enPixelFormat = RK_FMT_YUV420SP;
+	frame.stVFrame.u64PTS = pts;
+	return frame;
+}
+
+static RK_U64 FramePts(const VIDEO_FRAME_INFO_S *frame) {
+	RK_U64 pts;
+	memcpy(&pts, RK_MPI_MB_Handle2VirAddr(frame->stVFrame.pMbBlk), sizeof(pts));
+	return pts;
+}
+
+// the layout main.cpp uses: encoder size bind-only, model input with a pool, cropped and rotated thumbnail
+static void TestOutputsAreConfigured() {
+	vpss_node_t node;
+	vpss_output_cfg_t outs[3] = {
+		Output("venc", 1920, 1080, RK_FMT_YUV420SP, 0, 0),
+		Output("model", 640, 640, RK_FMT_RGB888, 1, 3),
+		Output("thumb", 320, 180, RK_FMT_YUV420SP, 2, 0),
+	};
+	outs[2].crop.s32X = 100;
+	outs[2].crop.u32Width = 960;
+	outs[2].crop.u32Height = 540;
+	outs[2].rotation = ROTATION_90;
+
+	CHECK_EQ(vpss_node_create(&node, 1, 1920, 1080, outs, 3), 0);
+	const fake_vpss_grp_t *grp = fake_vpss_grp(1);
+	CHECK(grp->created);
+	CHECK(grp->started);
+	CHECK_EQ(grp->attr.u32MaxW, 1920);
+	CHECK_EQ(grp->attr.u32MaxH, 1080);
+	for (int i = 0; i < 3; i++) {
+		CHECK(grp->enabled[i]);
+		CHECK_EQ(grp->chn[i].u32Width, outs[i].width);
+		CHECK_EQ(grp->chn[i].u32Height, outs[i].height);
+		CHECK_EQ(grp->chn[i].enPixelFormat, outs[i].format);
+		CHECK_EQ(grp->chn[i].u32Depth, outs[i].depth);
+	}
+	CHECK(!grp->crop[0].bEnable);
+	CHECK(grp->crop[2].bEnable);
+	CHECK_EQ(grp->crop[2].stCropRect.s32X, 100);
+	CHECK_EQ(grp->crop[2].stCropRect.u32Width, 960);
+	CHECK_EQ(grp->rotation[2], ROTATION_90);
+	CHECK_EQ(grp->pool[0], MB_INVALID_POOLID);
+	CHECK(grp->pool[1] != MB_INVALID_POOLID);
+	CHECK_EQ(grp->pool[1], node.pools[1]);
+	CHECK_EQ(fake_mb_pool_free(node.pools[1]), 3);
+	CHECK_EQ(vpss_node_pool_bytes(&node), 640 * 640 * 3 * 3);
+
+	CHECK_EQ(vpss_node_bind_vi(&node, 0, 2), 0);
+	CHECK(grp->bound);
+	CHECK_EQ(grp->bind_src.enModId, RK_ID_VI);
+	CHECK_EQ(grp->bind_src.s32ChnId, 2);
+
+	vpss_node_destroy(&node);
+	CHECK(!grp->created);
+	CHECK(!grp->bound);
+	CHECK_EQ(fake_mb_pools(), 0);
+	CHECK_EQ(fake_mb_live(), 0);
+}
+
+// frames come from the pool, carry the input pts, go back to the pool on release; a rotated output swaps its size
+static void TestFramesComeFromThePool() {
+	vpss_node_t node;
+	vpss_output_cfg_t outs[2] = {
+		Output("model", 64, 48, RK_FMT_RGB888, 2, 2),
+		Output("thumb", 32, 16, RK_FMT_YUV420SP, 1, 0),
+	};
+	outs[1].rotation = ROTATION_270;
+	VIDEO_FRAME_INFO_S in = InputFrame(1234), frame, thumb;
+
+	CHECK_EQ(vpss_node_create(&node, 2, 1920, 1080, outs, 2), 0);
+	CHECK(vpss_node_get_frame(&node, 0, &frame, 0) != RK_SUCCESS);
+	CHECK_EQ(vpss_node_send_frame(&node, &in, 0), RK_SUCCESS);
+
+	CHECK_EQ(vpss_node_get_frame(&node, 0, &frame, 0), RK_SUCCESS);
+	CHECK_EQ(frame.stVFrame.u32Width, 64);
+	CHECK_EQ(frame.stVFrame.u32Height, 48);
+	CHECK_EQ(FramePts(&frame), 1234);
+	CHECK_EQ(RK_MPI_MB_GetSize(frame.stVFrame.pMbBlk), vpss_node_frame_size(64, 48, RK_FMT_RGB888));
+	CHECK_EQ(fake_mb_pool_free(node.pools[0]), 1);
+
+	CHECK_EQ(vpss_node_get_frame(&node, 1, &thumb, 0), RK_SUCCESS);
+	CHECK_EQ(thumb.stVFrame.u32Width, 16);
+	CHECK_EQ(thumb.stVFrame.u32Height, 32);
+	CHECK_EQ(vpss_node_release_frame(&node, 1, &thumb), RK_SUCCESS);
+
+	CHECK_EQ(vpss_node_release_frame(&node, 0, &frame), RK_SUCCESS);
+	CHECK_EQ(fake_mb_pool_free(node.pools[0]), 2);
+	CHECK_EQ(fake_vpss_grp(2)->outstanding[0], 0);
+	vpss_node_destroy(&node);
+	CHECK_EQ(fake_mb_live(), 0);
+}
+
+// a slow consumer loses the oldest frames to the depth, a held frame keeps its pool block
+static void TestDepthDropsTheOldest() {
+	vpss_node_t node;
+	vpss_output_cfg_t outs[1] = {Output("model", 16, 16, RK_FMT_RGB888, 2, 4)};
+	VIDEO_FRAME_INFO_S in, held, frame;
+
+	CHECK_EQ(vpss_node_create(&node, 3, 1920, 1080, outs, 1), 0);
+	in = InputFrame(1);
+	vpss_node_send_frame(&node, &in, 0);
+	CHECK_EQ(vpss_node_get_frame(&node, 0, &held, 0), RK_SUCCESS);
+	for (RK_U64 pts = 2; pts <= 5; pts++) {
+		in = InputFrame(pts);
+		vpss_node_send_frame(&node, &in, 0);
+	}
+	const fake_vpss_grp_t *grp = fake_vpss_grp(3);
+	CHECK_EQ(grp->queued[0], 2);
+	CHECK_EQ(grp->dropped[0], 2);
+	CHECK_EQ(vpss_node_get_frame(&node, 0, &frame, 0), RK_SUCCESS);
+	CHECK_EQ(FramePts(&frame), 4);
+	vpss_node_release_frame(&node, 0, &frame);
+	CHECK_EQ(vpss_node_get_frame(&node, 0, &frame, 0), RK_SUCCESS);
+	CHECK_EQ(FramePts(&frame), 5);
+	vpss_node_release_frame(&node, 0, &frame);
+	CHECK_EQ(FramePts(&held), 1);
+	vpss_node_release_frame(&node, 0, &held);
+	CHECK_EQ(fake_mb_pool_free(node.pools[0]), 4);
+	vpss_node_destroy(&node);
+	CHECK_EQ(fake_mb_live(), 0);
+}
+
+typedef struct {
+	vpss_node_t *node;
+	event_loop_t *loop;
+	int seen;
+} fd_reader_t;
+
+static void OnVpssReady(int fd, RK_U32 events, void *arg) {
+	fd_reader_t *reader = (fd_reader_t *)arg;
+	VIDEO_FRAME_INFO_S frame;
+	(void)fd;
+	(void)events;
+	while (vpss_node_get_frame(reader->node, 0, &frame, 0) == RK_SUCCESS) {
+		reader->seen++;
+		vpss_node_release_frame(reader->node, 0, &frame);
+	}
+	event_loop_stop(reader->loop);
+}
+
+// the output fd wakes the stream loop once frames are queued
+static void TestFdWakesTheEventLoop() {
+	vpss_node_t node;
+	event_loop_t loop;
+	vpss_output_cfg_t outs[1] = {Output("share", 16, 16, RK_FMT_YUV420SP, 4, 0)};
+	VIDEO_FRAME_INFO_S in;
+	fd_reader_t reader = {&node, &loop, 0};
+
+	CHECK_EQ(vpss_node_create(&node, 4, 1920, 1080, outs, 1), 0);
+	int fd = vpss_node_get_fd(&node, 0);
+	CHECK(fd >= 0);
+	CHECK_EQ(vpss_node_get_fd(&node, 0), fd);
+	CHECK_EQ(event_loop_init(&loop, 1000, NULL, NULL), 0);
+	CHECK_EQ(event_loop_add(&loop, fd, OnVpssReady, &reader), 0);
+	for (RK_U64 pts = 0; pts < 3; pts++) {
+		in = InputFrame(pts);
+		vpss_node_send_frame(&node, &in, 0);
+	}
+	event_loop_run(&loop);
+	CHECK_EQ(reader.seen, 3);
+	event_loop_del(&loop, fd);
+	event_loop_deinit(&loop);
+	vpss_node_destroy(&node);
+	CHECK_EQ(fake_vpss_open_fds(), 0);
+	CHECK_EQ(fake_mb_live(), 0);
+}
+
+// a failure half way through the outputs leaves no group, pool or block behind
+static void TestFailedCreateLeavesNothing() {
+	const char *calls[] = {"RK_MPI_VPSS_SetChnAttr", "RK_MPI_MB_CreatePool", "RK_MPI_VPSS_AttachMbPool",
+	                       "RK_MPI_VPSS_EnableChn", "RK_MPI_VPSS_StartGrp"};
+	vpss_output_cfg_t outs[2] = {
+		Output("model", 64, 64, RK_FMT_RGB888, 1, 2),
+		Output("gate", 32, 32, RK_FMT_YUV420SP, 1, 2),
+	};
+
+	for (const char *call : calls) {
+		for (int nth = 1; nth <= 2; nth++) {
+			vpss_node_t node;
+			fake_mpi_fail(call, nth);
+			int ret = vpss_node_create(&node, 5, 1920, 1080, outs, 2);
+			fake_mpi_fail(NULL, 0);
+			if (ret == 0) {
+				// StartGrp is called once, its second failure never comes
+				CHECK(nth == 2 && !strcmp(call, "RK_MPI_VPSS_StartGrp"));
+				vpss_node_destroy(&node);
+			}
+			CHECK_EQ(fake_vpss_live(), 0);
+			CHECK_EQ(fake_mb_pools(), 0);
+			CHECK_EQ(fake_mb_live(), 0);
+		}
+	}
+	vpss_node_t node;
+	fake_mpi_fail("RK_MPI_VPSS_CreateGrp", 1);
+	CHECK_EQ(vpss_node_create(&node, 5, 1920, 1080, outs, 2), -1);
+	CHECK_EQ(vpss_node_create(&node, 5, 1920, 1080, outs, 0), -1);
+	CHECK_EQ(fake_vpss_live(), 0);
+}
+
+int main() {
+	TestOutputsAreConfigured();
+	TestFramesComeFromThePool();
+	TestDepthDropsTheOldest();
+	TestFdWakesTheEventLoop();
+	TestFailedCreateLeavesNothing();
+	fake_mpi_reset();
+	CHECK_EQ(fake_mb_live(), 0);
+	return HOST_TEST_RESULT();
+}
@@ -0,0 +1,181 @@
+/*****************************************************************************
+* | Function    :   Host test: zone enter/exit, tripwire crossings and
+*                   track end on a synthetic trace through the tracker
+*
+******************************************************************************/
+
+#include <vector>
+
+#include "luckfox_mpi.h"
+#include "zone_analytics.h"
+#include "host_test.h"
+
+#define W 720
+#define H 480
+#define SEC 1000000ULL
+#define CLS 1
+
+// one frame a second; "room" is 100 <= x, y < 300, "line" the vertical x = 500
+typedef struct {
+	tracker_t tracker;
+	zone_analytics_t zones;
+	std::vector<zone_event_t> events;
+	RK_U64 pts;
+} trace_t;
+
+static void OnEvent(const zone_event_t *event, void *arg) {
+	((trace_t *)arg)->events.push_back(*event);
+}
+
+static void Init(trace_t *t) {
+	static const POINT_S room[4] = {{100, 100}, {300, 100}, {300, 300}, {100, 300}};
+	tracker_cfg_t tcfg;
+	zone_cfg_t zcfg;
+
+	tracker_cfg_default(&tcfg);
+	tracker_init(&t->tracker, &tcfg);
+	zone_cfg_default(&zcfg, W, H);
+	zcfg.cb = OnEvent;
+	zcfg.cb_arg = t;
+	CHECK_EQ(zone_init(&t->zones, &zcfg), 0);
+	CHECK_EQ(zone_add_polygon(&t->zones, "room", room, 4), 0);
+	POINT_S a = {500, 0}, b = {500, H};
+	CHECK_EQ(zone_add_tripwire(&t->zones, "line", a, b), 0);
+	t->events.clear();
+	t->pts = 0;
+}
+
+// one frame with an 80x80 face centred at (x, 200), none if x < 0, then the next second
+static void Frame(trace_t *t, int x) {
+	tracker_det_t det;
+	int count = 0;
+
+	if (x >= 0) {
+		det.box.s32X = x - 40;
+		det.box.s32Y = 160;
+		det.box.u32Width = 80;
+		det.box.u32Height = 80;
+		det.score = 0.9f;
+		det.cls = CLS;
+		det.index = 0;
+		count = 1;
+	}
+	tracker_update(&t->tracker, &det, count, t->pts);
+	zone_process(&t->zones, &t->tracker);
+	t->pts += SEC;
+}
+
+static void CheckEvent(const zone_event_t *ev, zone_event_e type, const char *name, RK_U64 pts) {
+	CHECK_EQ(ev->type, type);
+	CHECK(strcmp(ev->name, name) == 0);
+	CHECK_EQ(ev->rule, 0);
+	CHECK_EQ(ev->cls, CLS);
+	CHECK_EQ(ev->pts, pts);
+}
+
+/*
+ * Left to right at 20 px/s from x = 50: in the room from 3 s (x = 110) to
+ * 12 s (x = 290), out from 13 s, over the line between 22 s (x = 490) and
+ * 23 s (x = 510). Events carry the frame of the change, not of the confirmation.
+ */
+static void TestWalkThrough() {
+	trace_t t;
+
+	Init(&t);
+	for (int i = 0; i < 4; i++)
+		Frame(&t, 50 + 20 * i);
+	CHECK_EQ(t.events.size(), 0);
+	Frame(&t, 130);
+	CHECK_EQ(t.events.size(), 1);
+	CheckEvent(&t.events[0], ZONE_EVENT_ENTER, "room", 3 * SEC);
+	RK_U32 id = t.events[0].track_id;
+	CHECK(id != 0);
+
+	for (int i = 5; i < 26; i++)
+		Frame(&t, 50 + 20 * i);
+	CHECK_EQ(t.events.size(), 3);
+	CheckEvent(&t.events[1], ZONE_EVENT_EXIT, "room", 13 * SEC);
+	CheckEvent(&t.events[2], ZONE_EVENT_CROSS, "line", 23 * SEC);
+	// from the +1 side of a->b (x < 500 for a wire pointing down) to the -1 side
+	CHECK_EQ(t.events[2].direction, -1);
+	for (size_t e = 0; e < t.events.size(); e++)
+		CHECK_EQ(t.events[e].track_id, id);
+	CHECK_EQ(t.zones.events[ZONE_EVENT_ENTER], 1);
+	CHECK_EQ(t.zones.events[ZONE_EVENT_EXIT], 1);
+	CHECK_EQ(t.zones.events[ZONE_EVENT_CROSS], 1);
+	zone_deinit(&t.zones);
+}
+
+// a border touched for one frame, or a wire stepped over and back, is no event
+static void TestJitterIsQuiet() {
+	trace_t t;
+	static const int xs[] = {60, 70, 80, 110, 90, 80, 470, 480, 490, 510, 490, 480, 470};
+
+	Init(&t);
+	for (size_t i = 0; i < sizeof(xs) / sizeof(xs[0]); i++)
+		Frame(&t, xs[i]);
+	CHECK_EQ(t.events.size(), 0);
+	zone_deinit(&t.zones);
+}
+
+// lost inside the room: the exit comes when the tracker ends it, stamped with the last pass it was seen
+static void TestTrackEndsInside() {
+	trace_t t;
+
+	Init(&t);
+	for (int i = 0; i < 10; i++)
+		Frame(&t, 150 + 5 * i);
+	CHECK_EQ(t.events.size(), 1);
+	CheckEvent(&t.events[0], ZONE_EVENT_ENTER, "room", 1 * SEC);
+
+	// coasting is still inside
+	for (int i = 0; i < 5; i++)
+		Frame(&t, -1);
+	CHECK_EQ(t.events.size(), 1);
+	Frame(&t, -1);
+	CHECK_EQ(t.events.size(), 2);
+	CheckEvent(&t.events[1], ZONE_EVENT_EXIT, "room", 9 * SEC);
+	CHECK_EQ(t.events[1].track_id, t.events[0].track_id);
+
+	// a new track in the freed slot starts from nothing
+	Frame(&t, 600);
+	Frame(&t, 600);
+	Frame(&t, 600);
+	CHECK_EQ(t.events.size(), 2);
+	zone_deinit(&t.zones);
+}
+
+// rules from a file, bad lines skipped; the grid answers per point
+static void TestLoadFile() {
+	zone_analytics_t za;
+	zone_cfg_t cfg;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/tmp/test_zone_analytics_%d.txt", (int)getpid());
+	FILE *fp = fopen(path, "w");
+	fprintf(fp, "# comment\nzone a 0,0 200,0 200,200 0,200\nzone b 100,100 400,100 400,400\n"
+	            "wire w 10,10 20,20\nwire bad 10,10\nzone short 1,1 2,2\n");
+	fclose(fp);
+	zone_cfg_default(&cfg, W, H);
+	CHECK_EQ(zone_init(&za, &cfg), 0);
+	CHECK_EQ(zone_load_file(&za, path), 3);
+	CHECK_EQ(za.zone_count, 2);
+	CHECK_EQ(za.wire_count, 1);
+	CHECK_EQ(zone_mask_at(&za, 50, 50), 0x1);
+	CHECK_EQ(zone_mask_at(&za, 180, 150), 0x3);
+	CHECK_EQ(zone_mask_at(&za, 380, 300), 0x2);
+	CHECK_EQ(zone_mask_at(&za, 600, 50), 0);
+	CHECK_EQ(zone_mask_at(&za, -1, 50), 0);
+	CHECK_EQ(zone_mask_at(&za, W, 50), 0);
+	CHECK_EQ(zone_load_file(&za, "/nonexistent/zones.txt"), -1);
+	zone_deinit(&za);
+	unlink(path);
+}
+
+int main() {
+	TestWalkThrough();
+	TestJitterIsQuiet();
+	TestTrackEndsInside();
+	TestLoadFile();
+	return HOST_TEST_RESULT();
+}